@@ -0,0 +1,213 @@
+#include "audio_backend.hpp"
+
+#if SYNTH_ALSA
+#include "denormals.hpp"
+#include "thread_scheduling.hpp"
+#include <alsa/asoundlib.h>
+#include <algorithm>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+// Plays through an ALSA PCM with read/write access, so "hw:" devices are
+// driven directly at the period and buffer asked for, or the nearest the
+// hardware allows. The render thread blocks in snd_pcm_writei(), which
+// paces it to the device.
+class AlsaBackend : public AudioBackend
+{
+public:
+    ~AlsaBackend() override
+    {
+        Stop();
+        if (m_Pcm)
+            snd_pcm_close(m_Pcm);
+    }
+
+    bool Open(const AudioBackendSettings& settings) override
+    {
+        m_Info.device = settings.device.empty() ? "default" : settings.device;
+        int error = snd_pcm_open(&m_Pcm, m_Info.device.c_str(), SND_PCM_STREAM_PLAYBACK, 0);
+        if (error < 0)
+            return Fail("snd_pcm_open", error);
+
+        snd_pcm_hw_params_t* hw;
+        snd_pcm_hw_params_alloca(&hw);
+        snd_pcm_hw_params_any(m_Pcm, hw);
+        if ((error = snd_pcm_hw_params_set_access(m_Pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0)
+            return Fail("interleaved access", error);
+
+        // hw: devices take only their native formats; prefer float, then
+        // the widest integer
+        const snd_pcm_format_t formats[] = { SND_PCM_FORMAT_FLOAT_LE, SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_S16_LE };
+        m_Format = SND_PCM_FORMAT_UNKNOWN;
+        for (snd_pcm_format_t format : formats)
+        {
+            if (snd_pcm_hw_params_test_format(m_Pcm, hw, format) == 0)
+            {
+                m_Format = format;
+                break;
+            }
+        }
+        if (m_Format == SND_PCM_FORMAT_UNKNOWN)
+            return Fail("no float, S32 or S16 format", -EINVAL);
+        snd_pcm_hw_params_set_format(m_Pcm, hw, m_Format);
+        if ((error = snd_pcm_hw_params_set_channels(m_Pcm, hw, 2)) < 0)
+            return Fail("stereo", error);
+
+        unsigned int rate = settings.sampleRate > 0 ? settings.sampleRate : 48000;
+        if ((error = snd_pcm_hw_params_set_rate_near(m_Pcm, hw, &rate, nullptr)) < 0)
+            return Fail("sample rate", error);
+        snd_pcm_uframes_t period = settings.periodFrames > 0 ? settings.periodFrames : 256;
+        if ((error = snd_pcm_hw_params_set_period_size_near(m_Pcm, hw, &period, nullptr)) < 0)
+            return Fail("period size", error);
+        unsigned int periods = settings.periods > 0 ? settings.periods : 2;
+        if ((error = snd_pcm_hw_params_set_periods_near(m_Pcm, hw, &periods, nullptr)) < 0)
+            return Fail("period count", error);
+        if ((error = snd_pcm_hw_params(m_Pcm, hw)) < 0)
+            return Fail("snd_pcm_hw_params", error);
+
+        snd_pcm_uframes_t buffer;
+        snd_pcm_hw_params_get_buffer_size(hw, &buffer);
+
+        // Start once the buffer is full and wake a period at a time
+        snd_pcm_sw_params_t* sw;
+        snd_pcm_sw_params_alloca(&sw);
+        snd_pcm_sw_params_current(m_Pcm, sw);
+        snd_pcm_sw_params_set_start_threshold(m_Pcm, sw, buffer);
+        snd_pcm_sw_params_set_avail_min(m_Pcm, sw, period);
+        if ((error = snd_pcm_sw_params(m_Pcm, sw)) < 0)
+            return Fail("snd_pcm_sw_params", error);
+
+        m_Info.sampleRate = (int)rate;
+        m_Info.periodFrames = (int)period;
+        m_Info.periods = (int)(buffer / period);
+        m_Info.latency = (double)buffer / rate;
+        m_Left.assign(period, 0.0f);
+        m_Right.assign(period, 0.0f);
+        m_Interleaved.assign(2 * period * 4, 0);
+        return true;
+    }
+
+    bool Start(AudioRenderFn render, void* user) override
+    {
+        if (!m_Pcm || m_Thread.joinable() || !render)
+            return false;
+        m_Render = render;
+        m_User = user;
+        snd_pcm_prepare(m_Pcm);     // Stop() dropped the stream
+        m_Quit.store(false);
+        m_Running.store(true);
+        m_Thread = std::thread(&AlsaBackend::ThreadLoop, this);
+        return true;
+    }
+
+    void Stop() override
+    {
+        if (!m_Thread.joinable())
+            return;
+        m_Quit.store(true);
+        m_Thread.join();
+        snd_pcm_drop(m_Pcm);
+        m_Running.store(false);
+    }
+
+    bool IsRunning() const override { return m_Running.load(); }
+
+private:
+    bool Fail(const char* what, int error)
+    {
+        m_Error = std::string(what) + ": " + snd_strerror(error);
+        if (m_Pcm)
+        {
+            snd_pcm_close(m_Pcm);
+            m_Pcm = nullptr;
+        }
+        return false;
+    }
+
+    void Convert(int frames)
+    {
+        const int count = 2 * frames;
+        if (m_Format == SND_PCM_FORMAT_FLOAT_LE)
+        {
+            float* out = (float*)m_Interleaved.data();
+            for (int i = 0; i < frames; ++i)
+            {
+                out[2 * i] = std::min(1.0f, std::max(-1.0f, m_Left[i]));
+                out[2 * i + 1] = std::min(1.0f, std::max(-1.0f, m_Right[i]));
+            }
+        }
+        else if (m_Format == SND_PCM_FORMAT_S32_LE)
+        {
+            int32_t* out = (int32_t*)m_Interleaved.data();
+            for (int i = 0; i < count; ++i)
+            {
+                float x = std::min(1.0f, std::max(-1.0f, (i & 1 ? m_Right : m_Left)[i >> 1]));
+                out[i] = (int32_t)(x * 2147483520.0f);     // Largest float below 2^31
+            }
+        }
+        else
+        {
+            int16_t* out = (int16_t*)m_Interleaved.data();
+            for (int i = 0; i < count; ++i)
+            {
+                float x = std::min(1.0f, std::max(-1.0f, (i & 1 ? m_Right : m_Left)[i >> 1]));
+                out[i] = (int16_t)(x * 32767.0f);
+            }
+        }
+    }
+
+    void ThreadLoop()
+    {
+        PromoteCurrentThread(ThreadRole::Audio, "audio (alsa)");
+        ScopedFlushDenormals flush;
+        const int frames = m_Info.periodFrames;
+        const int frameBytes = snd_pcm_format_physical_width(m_Format) / 8 * 2;
+        while (!m_Quit.load(std::memory_order_relaxed))
+        {
+            m_Render(m_User, m_Left.data(), m_Right.data(), frames);
+            Convert(frames);
+
+            const unsigned char* data = m_Interleaved.data();
+            int remaining = frames;
+            while (remaining > 0 && !m_Quit.load(std::memory_order_relaxed))
+            {
+                snd_pcm_sframes_t written = snd_pcm_writei(m_Pcm, data, remaining);
+                if (written >= 0)
+                {
+                    data += written * frameBytes;
+                    remaining -= (int)written;
+                    continue;
+                }
+
+                // Underrun or suspend: count it, recover and refill
+                if (written == -EPIPE)
+                    m_Xruns.fetch_add(1, std::memory_order_relaxed);
+                if (snd_pcm_recover(m_Pcm, (int)written, 1) < 0)
+                {
+                    m_Error = std::string("snd_pcm_writei: ") + snd_strerror((int)written);
+                    m_Running.store(false);
+                    return;
+                }
+            }
+        }
+    }
+
+    snd_pcm_t* m_Pcm = nullptr;
+    snd_pcm_format_t m_Format = SND_PCM_FORMAT_UNKNOWN;
+    std::vector<float> m_Left;
+    std::vector<float> m_Right;
+    std::vector<unsigned char> m_Interleaved;      // Device format, up to 4 bytes per sample
+
+    AudioRenderFn m_Render = nullptr;
+    void* m_User = nullptr;
+    std::thread m_Thread;
+    std::atomic<bool> m_Quit{ false };
+    std::atomic<bool> m_Running{ false };
+};
+
+std::unique_ptr<AudioBackend> CreateAlsaBackend()
+{
+    return std::unique_ptr<AudioBackend>(new AlsaBackend());
+}
+#endif
@@ -0,0 +1,324 @@
+#include "audio_backend.hpp"
+#include "denormals.hpp"
+#include "thread_scheduling.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+static const int DEFAULT_SAMPLE_RATE = 48000;
+static const int DEFAULT_PERIOD_FRAMES = 256;
+
+const char* GetAudioBackendName(AudioBackendType type)
+{
+    switch (type)
+    {
+    case AudioBackendType::IrrKlang: return "irrklang";
+    case AudioBackendType::Alsa: return "alsa";
+    case AudioBackendType::Jack: return "jack";
+    case AudioBackendType::Null: return "null";
+    case AudioBackendType::File: return "file";
+    default: return "?";
+    }
+}
+
+bool ParseAudioBackendType(const char* name, AudioBackendType& type)
+{
+    for (int t = 0; t < (int)AudioBackendType::Count; ++t)
+    {
+        if (strcmp(name, GetAudioBackendName((AudioBackendType)t)) == 0)
+        {
+            type = (AudioBackendType)t;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* GetOptionValue(const char* argument, const char* name)
+{
+    size_t length = strlen(name);
+    if (strncmp(argument, name, length) != 0 || argument[length] != '=')
+        return nullptr;
+    return argument + length + 1;
+}
+
+bool ParseCount(const char* text, int low, int high, int& value)
+{
+    char* end;
+    long parsed = strtol(text, &end, 10);
+    if (*end != 0 || parsed < low || parsed > high)
+        return false;
+    value = (int)parsed;
+    return true;
+}
+
+bool ParseAudioArguments(int argc, char** argv, AudioBackendSettings& settings)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* value;
+        bool valid = true;
+        if ((value = GetOptionValue(argv[i], "--audio")))
+            valid = ParseAudioBackendType(value, settings.type);
+        else if ((value = GetOptionValue(argv[i], "--device")))
+            settings.device = value;
+        else if ((value = GetOptionValue(argv[i], "--rate")))
+            valid = ParseCount(value, 8000, 384000, settings.sampleRate);
+        else if ((value = GetOptionValue(argv[i], "--period")))
+            valid = ParseCount(value, 16, 8192, settings.periodFrames);
+        else if ((value = GetOptionValue(argv[i], "--periods")))
+            valid = ParseCount(value, 2, 16, settings.periods);
+        else if ((value = GetOptionValue(argv[i], "--seconds")))
+        {
+            settings.seconds = atof(value);
+            valid = settings.seconds > 0.0;
+        }
+        if (!valid)
+        {
+            fprintf(stderr, "Bad audio option %s\n", argv[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Null and file sinks
+
+// Both run the render callback on a thread of their own, one period at a
+// time; they differ in what happens to the period and when the next starts.
+// Each sink calls Stop() in its own destructor: the thread calls Consume(),
+// which is gone by the time this destructor runs, and a thread still
+// joinable here terminates the program rather than calling it.
+class ThreadedSink : public AudioBackend
+{
+public:
+    bool Start(AudioRenderFn render, void* user) override
+    {
+        if (m_Thread.joinable() || !render)
+            return false;
+        m_Render = render;
+        m_User = user;
+        m_Quit.store(false);
+        m_Running.store(true);
+        m_Thread = std::thread(&ThreadedSink::ThreadLoop, this);
+        return true;
+    }
+
+    void Stop() override
+    {
+        if (!m_Thread.joinable())
+            return;
+        m_Quit.store(true);
+        m_Thread.join();
+        m_Running.store(false);
+        Finish();
+    }
+
+    bool IsRunning() const override { return m_Running.load(); }
+
+protected:
+    void OpenCommon(const AudioBackendSettings& settings)
+    {
+        m_Info.sampleRate = settings.sampleRate > 0 ? settings.sampleRate : DEFAULT_SAMPLE_RATE;
+        m_Info.periodFrames = settings.periodFrames > 0 ? settings.periodFrames : DEFAULT_PERIOD_FRAMES;
+        m_Left.assign(m_Info.periodFrames, 0.0f);
+        m_Right.assign(m_Info.periodFrames, 0.0f);
+    }
+
+    // Called after each rendered period; false ends the render
+    virtual bool Consume(const float* left, const float* right, int frames) = 0;
+    virtual void Finish() {}
+
+    // Sinks that render as fast as they can must not starve the machine
+    // at real-time priority
+    virtual bool IsPaced() const { return true; }
+
+    void ThreadLoop()
+    {
+        if (IsPaced())
+            PromoteCurrentThread(ThreadRole::Audio, ("audio (" + m_Info.device + ")").c_str());
+        ScopedFlushDenormals flush;
+        while (!m_Quit.load(std::memory_order_relaxed))
+        {
+            m_Render(m_User, m_Left.data(), m_Right.data(), m_Info.periodFrames);
+            if (!Consume(m_Left.data(), m_Right.data(), m_Info.periodFrames))
+                break;
+        }
+        m_Running.store(false);
+    }
+
+    std::vector<float> m_Left;
+    std::vector<float> m_Right;
+
+private:
+    AudioRenderFn m_Render = nullptr;
+    void* m_User = nullptr;
+    std::thread m_Thread;
+    std::atomic<bool> m_Quit{ false };
+    std::atomic<bool> m_Running{ false };
+};
+
+// Paces the callbacks like a device with the requested buffer would: it
+// plays one period per period time, and a render that finishes after the
+// buffer ran dry counts as an xrun and restarts the clock rather than
+// rendering ahead to catch up.
+class NullSink : public ThreadedSink
+{
+public:
+    ~NullSink() override { Stop(); }
+
+    bool Open(const AudioBackendSettings& settings) override
+    {
+        OpenCommon(settings);
+        m_Info.periods = std::max(1, settings.periods);
+        m_Info.latency = (double)m_Info.periods * m_Info.periodFrames / m_Info.sampleRate;
+        m_Info.device = "null";
+        m_Period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>((double)m_Info.periodFrames / m_Info.sampleRate));
+        m_Dry = Clock::time_point();
+        return true;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    bool Consume(const float*, const float*, int) override
+    {
+        Clock::time_point now = Clock::now();
+        if (m_Dry == Clock::time_point())
+            m_Dry = now;
+        else if (now > m_Dry)
+        {
+            m_Xruns.fetch_add(1, std::memory_order_relaxed);
+            m_Dry = now;
+        }
+        m_Dry += m_Period;
+
+        // Wait until the buffer has room for the next period
+        std::this_thread::sleep_until(m_Dry - (m_Info.periods - 1) * m_Period);
+        return true;
+    }
+
+    Clock::duration m_Period{};
+    Clock::time_point m_Dry;        // When everything rendered so far has played
+};
+
+// 32-bit float stereo WAV. The sizes in the header are written at the end.
+class FileSink : public ThreadedSink
+{
+public:
+    bool Open(const AudioBackendSettings& settings) override
+    {
+        OpenCommon(settings);
+        m_Info.periods = 1;
+        m_Info.latency = 0.0;
+        m_Info.device = settings.device.empty() ? "output.wav" : settings.device;
+        m_Remaining = settings.seconds > 0.0 ? (long long)(settings.seconds * m_Info.sampleRate) : -1;
+        m_Frames = 0;
+        m_Interleaved.assign(2 * m_Info.periodFrames, 0.0f);
+
+        m_File = fopen(m_Info.device.c_str(), "wb");
+        if (!m_File)
+        {
+            m_Error = "Cannot create " + m_Info.device;
+            return false;
+        }
+        WriteHeader();
+        return true;
+    }
+
+    ~FileSink() override
+    {
+        Stop();
+        if (m_File)
+            fclose(m_File);
+    }
+
+protected:
+    bool IsPaced() const override { return false; }
+
+private:
+    static void Put32(unsigned char* p, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+            p[i] = (unsigned char)(value >> (8 * i));
+    }
+
+    void WriteHeader()
+    {
+        const uint32_t dataBytes = (uint32_t)std::min<long long>(m_Frames * 8, 0xFFFFFFF0ll);
+        unsigned char header[58] = {};
+        memcpy(header, "RIFF", 4);
+        Put32(header + 4, 50 + dataBytes);
+        memcpy(header + 8, "WAVEfmt ", 8);
+        Put32(header + 16, 18);
+        header[20] = 3;                                 // IEEE float
+        header[22] = 2;                                 // Channels
+        Put32(header + 24, (uint32_t)m_Info.sampleRate);
+        Put32(header + 28, (uint32_t)m_Info.sampleRate * 8);
+        header[32] = 8;                                 // Bytes per frame
+        header[34] = 32;                                // Bits per sample
+        memcpy(header + 38, "fact", 4);
+        Put32(header + 42, 4);
+        Put32(header + 46, (uint32_t)m_Frames);
+        memcpy(header + 50, "data", 4);
+        Put32(header + 54, dataBytes);
+        fseek(m_File, 0, SEEK_SET);
+        fwrite(header, 1, sizeof(header), m_File);
+        fseek(m_File, 0, SEEK_END);
+    }
+
+    bool Consume(const float* left, const float* right, int frames) override
+    {
+        if (m_Remaining >= 0)
+            frames = (int)std::min<long long>(frames, m_Remaining);
+        for (int i = 0; i < frames; ++i)
+        {
+            m_Interleaved[2 * i] = std::min(1.0f, std::max(-1.0f, left[i]));
+            m_Interleaved[2 * i + 1] = std::min(1.0f, std::max(-1.0f, right[i]));
+        }
+        if (fwrite(m_Interleaved.data(), 8, frames, m_File) != (size_t)frames)
+        {
+            m_Error = "Cannot write " + m_Info.device;
+            return false;
+        }
+        m_Frames += frames;
+        if (m_Remaining >= 0)
+            m_Remaining -= frames;
+        return m_Remaining != 0;
+    }
+
+    void Finish() override
+    {
+        if (!m_File)
+            return;
+        WriteHeader();
+        fflush(m_File);
+    }
+
+    FILE* m_File = nullptr;
+    long long m_Remaining = -1;     // Frames still to render, -1 = until stopped
+    long long m_Frames = 0;
+    std::vector<float> m_Interleaved;
+};
+
+std::unique_ptr<AudioBackend> CreateAudioBackend(AudioBackendType type)
+{
+    switch (type)
+    {
+#if SYNTH_ALSA
+    case AudioBackendType::Alsa: return CreateAlsaBackend();
+#endif
+#if SYNTH_JACK
+    case AudioBackendType::Jack: return CreateJackBackend();
+#endif
+    case AudioBackendType::Null: return std::unique_ptr<AudioBackend>(new NullSink());
+    case AudioBackendType::File: return std::unique_ptr<AudioBackend>(new FileSink());
+    default: return nullptr;
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+// Backends compiled in besides irrKlang, null and file. The build defines
+// these where the libraries exist (asound, jack).
+#ifndef SYNTH_ALSA
+#define SYNTH_ALSA 0
+#endif
+#ifndef SYNTH_JACK
+#define SYNTH_JACK 0
+#endif
+
+enum class AudioBackendType
+{
+    IrrKlang,       // Driver picked by irrKlang, buffering up to it
+    Alsa,           // Direct hw:/plughw: device
+    Jack,
+    Null,           // Discards the output, clocked in real time
+    File,           // WAV file, rendered as fast as possible
+    Count
+};
+
+// What to ask the device for. Zero means the device's default.
+struct AudioBackendSettings
+{
+    AudioBackendType type = AudioBackendType::IrrKlang;
+    int sampleRate = 0;
+    int periodFrames = 0;       // Frames per render callback
+    int periods = 2;            // Periods in the device buffer
+    std::string device;         // ALSA PCM, JACK client name or output file
+    double seconds = 0.0;       // File sink: length to render, 0 = until stopped
+};
+
+// What the device actually runs at, valid after Open()
+struct AudioBackendInfo
+{
+    int sampleRate = 0;
+    int periodFrames = 0;       // 0 = chosen by the driver and not reported
+    int periods = 0;
+    double latency = 0.0;       // Seconds from render to the speaker, 0 = unknown
+    std::string device;
+};
+
+// Renders frames of stereo float output on the backend's audio thread. The
+// backend converts and clamps; frames is at most the period size.
+typedef void (*AudioRenderFn)(void* user, float* left, float* right, int frames);
+
+// An output device driving a render callback from its own thread. Open()
+// negotiates the format so the caller can prepare for the rate it got,
+// Start() begins calling back, Stop() returns once the callbacks have ended.
+class AudioBackend
+{
+public:
+    virtual ~AudioBackend() {}
+
+    virtual bool Open(const AudioBackendSettings& settings) = 0;
+    virtual bool Start(AudioRenderFn render, void* user) = 0;
+    virtual void Stop() = 0;
+
+    // False once a finite render (file sink) is done or the device failed
+    virtual bool IsRunning() const = 0;
+
+    const AudioBackendInfo& GetInfo() const { return m_Info; }
+    const std::string& GetError() const { return m_Error; }
+
+    // Any thread: periods the device ran dry or the render came late
+    unsigned long long GetXruns() const { return m_Xruns.load(std::memory_order_relaxed); }
+
+protected:
+    AudioBackendInfo m_Info;
+    std::string m_Error;
+    std::atomic<unsigned long long> m_Xruns{ 0 };
+};
+
+// Returns nullptr for backends not compiled in. irrKlang is created by
+// CreateIrrKlangBackend() in audio_output.hpp since it needs the engine.
+std::unique_ptr<AudioBackend> CreateAudioBackend(AudioBackendType type);
+
+const char* GetAudioBackendName(AudioBackendType type);
+bool ParseAudioBackendType(const char* name, AudioBackendType& type);
+
+// Reads --audio=, --device=, --rate=, --period=, --periods= and --seconds=
+// from the command line; other arguments are left alone. False on a bad
+// value.
+bool ParseAudioArguments(int argc, char** argv, AudioBackendSettings& settings);
+
+// Helpers for the other option parsers. GetOptionValue() returns the value
+// of "--name=value", or nullptr for any other argument.
+const char* GetOptionValue(const char* argument, const char* name);
+bool ParseCount(const char* text, int low, int high, int& value);
+
+#if SYNTH_ALSA
+std::unique_ptr<AudioBackend> CreateAlsaBackend();
+#endif
+#if SYNTH_JACK
+std::unique_ptr<AudioBackend> CreateJackBackend();
+#endif
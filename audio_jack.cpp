@@ -0,0 +1,127 @@
+#include "audio_backend.hpp"
+
+#if SYNTH_JACK
+#include "denormals.hpp"
+#include <jack/jack.h>
+#include <algorithm>
+
+// A JACK client with two output ports, connected to the first two physical
+// playback ports. The server owns the period and the rate; only a period
+// size given explicitly is requested from the server, and what it settles
+// on is reported. Runs against jackd -d dummy for tests.
+class JackBackend : public AudioBackend
+{
+public:
+    ~JackBackend() override
+    {
+        Stop();
+        if (m_Client)
+            jack_client_close(m_Client);
+    }
+
+    bool Open(const AudioBackendSettings& settings) override
+    {
+        const char* name = settings.device.empty() ? "syntezator" : settings.device.c_str();
+        jack_status_t status;
+        m_Client = jack_client_open(name, JackNoStartServer, &status);
+        if (!m_Client)
+        {
+            m_Error = "jack_client_open failed, is the server running?";
+            return false;
+        }
+
+        if (settings.periodFrames > 0 && (jack_nframes_t)settings.periodFrames != jack_get_buffer_size(m_Client))
+            jack_set_buffer_size(m_Client, (jack_nframes_t)settings.periodFrames);
+
+        m_Ports[0] = jack_port_register(m_Client, "out_l", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        m_Ports[1] = jack_port_register(m_Client, "out_r", JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        if (!m_Ports[0] || !m_Ports[1])
+        {
+            m_Error = "jack_port_register failed";
+            return false;
+        }
+        jack_set_process_callback(m_Client, &JackBackend::Process, this);
+        jack_set_xrun_callback(m_Client, &JackBackend::Xrun, this);
+
+        m_Info.device = jack_get_client_name(m_Client);
+        m_Info.sampleRate = (int)jack_get_sample_rate(m_Client);
+        m_Info.periodFrames = (int)jack_get_buffer_size(m_Client);
+        m_Info.periods = 0;     // Not exposed by JACK; the latency covers it
+        return true;
+    }
+
+    bool Start(AudioRenderFn render, void* user) override
+    {
+        if (!m_Client || m_Active || !render)
+            return false;
+        m_Render = render;
+        m_User = user;
+        if (jack_activate(m_Client) != 0)
+        {
+            m_Error = "jack_activate failed";
+            return false;
+        }
+        m_Active = true;
+
+        const char** playback = jack_get_ports(m_Client, nullptr, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical | JackPortIsInput);
+        if (playback)
+        {
+            for (int c = 0; c < 2 && playback[c]; ++c)
+                jack_connect(m_Client, jack_port_name(m_Ports[c]), playback[c]);
+            jack_free(playback);
+        }
+
+        // Latency from our port to the speaker, valid once connected
+        jack_latency_range_t range;
+        jack_port_get_latency_range(m_Ports[0], JackPlaybackLatency, &range);
+        m_Info.latency = (double)range.max / m_Info.sampleRate;
+        return true;
+    }
+
+    void Stop() override
+    {
+        if (!m_Active)
+            return;
+        jack_deactivate(m_Client);
+        m_Active = false;
+    }
+
+    bool IsRunning() const override { return m_Active; }
+
+private:
+    static int Process(jack_nframes_t frames, void* arg)
+    {
+        JackBackend* self = (JackBackend*)arg;
+
+        // The process thread belongs to the JACK library
+        ScopedFlushDenormals flush;
+
+        float* left = (float*)jack_port_get_buffer(self->m_Ports[0], frames);
+        float* right = (float*)jack_port_get_buffer(self->m_Ports[1], frames);
+        self->m_Render(self->m_User, left, right, (int)frames);
+        for (jack_nframes_t i = 0; i < frames; ++i)
+        {
+            left[i] = std::min(1.0f, std::max(-1.0f, left[i]));
+            right[i] = std::min(1.0f, std::max(-1.0f, right[i]));
+        }
+        return 0;
+    }
+
+    static int Xrun(void* arg)
+    {
+        ((JackBackend*)arg)->m_Xruns.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    jack_client_t* m_Client = nullptr;
+    jack_port_t* m_Ports[2] = {};
+    bool m_Active = false;
+    AudioRenderFn m_Render = nullptr;
+    void* m_User = nullptr;
+};
+
+std::unique_ptr<AudioBackend> CreateJackBackend()
+{
+    return std::unique_ptr<AudioBackend>(new JackBackend());
+}
+#endif
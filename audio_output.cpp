@@ -0,0 +1,203 @@
+#include "audio_output.hpp"
+#include "thread_scheduling.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+using namespace irrklang;
+
+class RateProbe : public ISoundMixedOutputReceiver
+{
+public:
+    std::atomic<int> rate{ 0 };
+
+    void OnAudioDataReady(const void*, int, int playbackrate) override
+    {
+        rate.store(playbackrate);
+    }
+};
+
+int DetectOutputSampleRate(ISoundEngine* engine, int fallbackRate)
+{
+    RateProbe probe;
+    if (!engine->setMixedDataOutputReceiver(&probe))
+        return fallbackRate;
+
+    // The driver only mixes while something is playing, so play a short
+    // silent buffer and wait for the first mixed chunk
+    static short silence[4410 * 2] = {};
+    SAudioStreamFormat format;
+    format.ChannelCount = 2;
+    format.FrameCount = 4410;
+    format.SampleRate = 44100;
+    format.SampleFormat = ESF_S16;
+
+    ISoundSource* source = engine->addSoundSourceFromPCMData(silence, sizeof(silence), "__rate_probe", format, false);
+    ISound* sound = source ? engine->play2D(source, false, false, true) : nullptr;
+
+    for (int i = 0; i < 50 && probe.rate.load() == 0; ++i)
+    {
+        if (!engine->isMultiThreaded())
+            engine->update();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    engine->setMixedDataOutputReceiver(nullptr);
+    if (sound)
+    {
+        sound->stop();
+        sound->drop();
+    }
+    if (source)
+        engine->removeSoundSource(source);
+
+    int rate = probe.rate.load();
+    return rate > 0 ? rate : fallbackRate;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Engine output stream
+
+static const char* ENGINE_STREAM_NAME = "engine.synth";
+static const int STREAM_CHUNK_FRAMES = 256;
+
+class EngineStream : public IAudioStream
+{
+public:
+    EngineStream(AudioRenderFn render, void* user, int sampleRate) : m_Render(render), m_User(user), m_SampleRate(sampleRate) {}
+
+    SAudioStreamFormat getFormat() override
+    {
+        SAudioStreamFormat format;
+        format.ChannelCount = 2;
+        format.FrameCount = -1;     // Endless
+        format.SampleRate = m_SampleRate;
+        format.SampleFormat = ESF_S16;
+        return format;
+    }
+
+    bool setPosition(ik_s32) override { return true; }
+    bool getIsSeekingSupported() override { return false; }
+
+    ik_s32 readFrames(void* target, ik_s32 frameCountToRead) override
+    {
+        // irrKlang owns its mixing thread; raise it on the first callback
+        if (!m_Promoted)
+        {
+            m_Promoted = true;
+            PromoteCurrentThread(ThreadRole::Audio, "audio (irrklang)");
+        }
+
+        short* out = (short*)target;
+        for (int offset = 0; offset < frameCountToRead; offset += STREAM_CHUNK_FRAMES)
+        {
+            int frames = std::min(STREAM_CHUNK_FRAMES, frameCountToRead - offset);
+            m_Render(m_User, m_Left, m_Right, frames);
+            for (int i = 0; i < frames; ++i)
+            {
+                float l = std::min(1.0f, std::max(-1.0f, m_Left[i]));
+                float r = std::min(1.0f, std::max(-1.0f, m_Right[i]));
+                *out++ = (short)(l * 32767.0f);
+                *out++ = (short)(r * 32767.0f);
+            }
+        }
+        return frameCountToRead;
+    }
+
+private:
+    AudioRenderFn m_Render;
+    void* m_User;
+    int m_SampleRate;
+    bool m_Promoted = false;
+    float m_Left[STREAM_CHUNK_FRAMES];
+    float m_Right[STREAM_CHUNK_FRAMES];
+};
+
+// Creates the engine stream for the virtual file ENGINE_STREAM_NAME
+class EngineStreamLoader : public IAudioStreamLoader
+{
+public:
+    EngineStreamLoader(AudioRenderFn render, void* user, int sampleRate) : m_Render(render), m_User(user), m_SampleRate(sampleRate) {}
+
+    bool isALoadableFileExtension(const ik_c8* fileName) override
+    {
+        size_t length = strlen(fileName);
+        return length >= 6 && strcmp(fileName + length - 6, ".synth") == 0;
+    }
+
+    IAudioStream* createAudioStream(IFileReader*) override
+    {
+        return new EngineStream(m_Render, m_User, m_SampleRate);
+    }
+
+private:
+    AudioRenderFn m_Render;
+    void* m_User;
+    int m_SampleRate;
+};
+
+// irrKlang decides the buffering and calls readFrames() from its mixing
+// thread, so only the rate is known
+class IrrKlangBackend : public AudioBackend
+{
+public:
+    explicit IrrKlangBackend(ISoundEngine* engine) : m_Engine(engine) {}
+    ~IrrKlangBackend() override { Stop(); }
+
+    bool Open(const AudioBackendSettings& settings) override
+    {
+        m_Info.sampleRate = settings.sampleRate > 0 ? settings.sampleRate : DetectOutputSampleRate(m_Engine);
+        m_Info.periodFrames = 0;
+        m_Info.periods = 0;
+        m_Info.latency = 0.0;
+        m_Info.device = m_Engine->getDriverName();
+        return true;
+    }
+
+    bool Start(AudioRenderFn render, void* user) override
+    {
+        if (m_Sound || !render)
+            return false;
+        EngineStreamLoader* loader = new EngineStreamLoader(render, user, m_Info.sampleRate);
+        m_Engine->registerAudioStreamLoader(loader);
+        loader->drop();
+
+        // The loader ignores the file contents, it only needs a name to match
+        static char placeholder[4] = { 'S', 'Y', 'N', 'T' };
+        ISoundSource* source = m_Engine->addSoundSourceFromMemory(placeholder, sizeof(placeholder), ENGINE_STREAM_NAME, false);
+        if (!source)
+        {
+            m_Error = "Cannot create the engine stream";
+            return false;
+        }
+        source->setStreamMode(ESM_STREAMING);
+
+        m_Sound = m_Engine->play2D(source, false, false, true);
+        if (!m_Sound)
+            m_Error = "Cannot play the engine stream";
+        return m_Sound != nullptr;
+    }
+
+    void Stop() override
+    {
+        if (!m_Sound)
+            return;
+        m_Sound->stop();
+        m_Sound->drop();
+        m_Sound = nullptr;
+        m_Engine->removeSoundSource(ENGINE_STREAM_NAME);
+    }
+
+    bool IsRunning() const override { return m_Sound != nullptr; }
+
+private:
+    ISoundEngine* m_Engine;
+    ISound* m_Sound = nullptr;
+};
+
+std::unique_ptr<AudioBackend> CreateIrrKlangBackend(ISoundEngine* engine)
+{
+    return std::unique_ptr<AudioBackend>(new IrrKlangBackend(engine));
+}
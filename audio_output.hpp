@@ -0,0 +1,18 @@
+#pragma once
+
+#include "audio_backend.hpp"
+#include <irrKlang.h>
+
+// Sample rate used when the driver cannot report its mixing rate
+const int DEFAULT_OUTPUT_RATE = 44100;
+
+// Returns the rate the irrKlang driver mixes at, by briefly listening to the
+// mixed output. Falls back to fallbackRate for drivers without mixed output
+// access (DirectSound).
+int DetectOutputSampleRate(irrklang::ISoundEngine* engine, int fallbackRate = DEFAULT_OUTPUT_RATE);
+
+// Plays a render callback through irrKlang as one endless 16-bit stereo
+// stream; irrKlang's mixing thread becomes the audio thread and the driver
+// picks the buffer sizes. Open() uses the detected mixing rate unless a
+// rate is asked for.
+std::unique_ptr<AudioBackend> CreateIrrKlangBackend(irrklang::ISoundEngine* engine);
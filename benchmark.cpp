@@ -0,0 +1,1376 @@
+#include "benchmark.hpp"
+#include "audio_backend.hpp"
+#include "cpu_features.hpp"
+#include "denormals.hpp"
+#include "effects.hpp"
+#include "fast_sine.hpp"
+#include "fm_synth.hpp"
+#include "interpolation.hpp"
+#include "key_input.hpp"
+#include "limiter.hpp"
+#include "midi_file.hpp"
+#include "mixer.hpp"
+#include "physical_piano.hpp"
+#include "rt_check.hpp"
+#include "synth_engine.hpp"
+#include "voice_kernels.hpp"
+#include "wavetable.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <linux/input.h>
+#include <string>
+#include <unistd.h>
+#endif
+
+static const double PI = 3.14159265358979323846;
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double SecondsSince(BenchClock::time_point start)
+{
+    return std::chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// Keeps the optimiser from discarding results
+static volatile float g_Sink = 0.0f;
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Interpolation
+
+// Resamples a sine and compares against the exact value at each fractional
+// position. Everything that is not the original tone (aliases, images,
+// passband ripple) ends up in the error, reported in dB below the signal.
+static double MeasureInterpolationError(ResampleFn resample, double frequency, double step)
+{
+    const int length = 16384;
+    std::vector<float> source(length + 2 * INTERPOLATION_PADDING, 0.0f);
+    float* src = &source[INTERPOLATION_PADDING];
+    for (int i = 0; i < length; ++i)
+        src[i] = (float)std::sin(2.0 * PI * frequency * i);
+
+    const int frames = 4096;
+    std::vector<float> out(frames);
+    double position = 1000.0;   // Stay clear of the zero padding
+    ResampleArgs args = { src, length, &position, step, out.data(), frames, nullptr };
+    int written = resample(args);
+
+    double signal = 0.0, error = 0.0;
+    for (int i = 0; i < written; ++i)
+    {
+        double expected = std::sin(2.0 * PI * frequency * (1000.0 + i * step));
+        signal += expected * expected;
+        error += (out[i] - expected) * (out[i] - expected);
+    }
+    return 10.0 * std::log10(error / signal + 1e-30);
+}
+
+static void BenchmarkInterpolation()
+{
+    printf("Interpolation kernels (ns/sample, pitch step 1.0595)\n");
+
+    const int length = 1 << 20;
+    std::vector<float> source(length + 2 * INTERPOLATION_PADDING, 0.0f);
+    float* src = &source[INTERPOLATION_PADDING];
+    for (int i = 0; i < length; ++i)
+        src[i] = (float)std::sin(i * 0.01) * 0.5f;
+
+    const int block = 256;
+    std::vector<float> out(block);
+    const SimdLevel best = DetectSimdLevel();
+
+    for (int k = 0; k < (int)InterpolationKind::Count; ++k)
+    {
+        InterpolationKind kind = (InterpolationKind)k;
+        printf("  %-8s", GetInterpolationName(kind));
+        for (int l = 0; l <= (int)best; ++l)
+        {
+            ResampleFn resample = GetResampleFunction(kind, (SimdLevel)l);
+            BenchClock::time_point start = BenchClock::now();
+            long long produced = 0;
+            for (int pass = 0; pass < 4; ++pass)
+            {
+                double position = 0.0;
+                for (;;)
+                {
+                    ResampleArgs args = { src, length, &position, 1.0595, out.data(), block, nullptr };
+                    int written = resample(args);
+                    produced += written;
+                    g_Sink = g_Sink + out[0];
+                    if (written < block)
+                        break;
+                }
+            }
+            double ns = SecondsSince(start) * 1e9 / (double)produced;
+            printf("  %s %6.2f", GetSimdLevelName((SimdLevel)l), ns);
+        }
+        printf("\n");
+    }
+
+    printf("Interpolation error (dB below signal; tone at 0.1 and 0.2 of the source rate)\n");
+    const double steps[] = { 44100.0 / 48000.0, 1.0595, 0.5 };
+    for (int k = 0; k < (int)InterpolationKind::Count; ++k)
+    {
+        InterpolationKind kind = (InterpolationKind)k;
+        ResampleFn resample = GetResampleFunction(kind);
+        printf("  %-8s", GetInterpolationName(kind));
+        for (double step : steps)
+        {
+            printf("  step %.3f: %7.1f / %7.1f", step,
+                MeasureInterpolationError(resample, 0.1, step),
+                MeasureInterpolationError(resample, 0.2, step));
+        }
+        printf("\n");
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Mixing
+
+static void BenchmarkMixer()
+{
+    const int block = 128;
+    const int voice_counts[] = { 16, 64, 256 };
+    const char* layout_names[] = { "mono", "planar", "interleaved" };
+
+    printf("Voice mixer (voices mixed per microsecond, %d-frame blocks)\n", block);
+
+    std::vector<float> source(block * 2);
+    for (int i = 0; i < block * 2; ++i)
+        source[i] = (float)std::sin(i * 0.05);
+    std::vector<float> outL(block), outR(block);
+    const SimdLevel best = DetectSimdLevel();
+
+    for (int layout = 0; layout < 3; ++layout)
+    {
+        for (int count : voice_counts)
+        {
+            std::vector<MixVoice> voices(count);
+            for (int v = 0; v < count; ++v)
+            {
+                voices[v].left = source.data();
+                voices[v].right = source.data() + block;
+                voices[v].layout = (VoiceLayout)layout;
+                voices[v].gainStart = 0.5f;
+                voices[v].gainEnd = 0.45f;
+                voices[v].panStart = -0.5f + v * (1.0f / count);
+                voices[v].panEnd = voices[v].panStart;
+            }
+
+            printf("  %-11s %4d voices", layout_names[layout], count);
+            for (int l = 0; l <= (int)best; ++l)
+            {
+                MixFn mix = GetMixFunction((SimdLevel)l);
+                const int blocks = 200000 / count;
+                BenchClock::time_point start = BenchClock::now();
+                for (int b = 0; b < blocks; ++b)
+                {
+                    mix(voices.data(), count, outL.data(), outR.data(), block);
+                    g_Sink = g_Sink + outL[0];
+                }
+                double us = SecondsSince(start) * 1e6;
+                printf("  %s %7.1f", GetSimdLevelName((SimdLevel)l), (double)blocks * count / us);
+            }
+            printf("\n");
+        }
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Oscillators
+
+// Renders a saw at a given frequency through the scalar kernel and measures
+// the energy that is not part of the band-limited waveform, in dB
+static double MeasureOscillatorAliasing(const WavetableSet& tables, double frequency, int sampleRate)
+{
+    const int frames = 8192;
+    double increment = frequency / sampleRate;
+    uint32_t phase = 0, step = (uint32_t)(increment * 4294967296.0);
+    int32_t offset = tables.GetOffset((int)Waveform::Saw, increment);
+    float gain = 1.0f, gainStep = 0.0f, pan = 1.0f;
+    OscillatorLanes lanes = { &phase, &step, &offset, &gain, &gainStep, &pan, &pan, 1, tables.GetData(), FilterMode::Off, {} };
+    std::vector<float> outL(frames, 0.0f), outR(frames, 0.0f);
+    GetOscillatorFunction(SimdLevel::Scalar, FilterMode::Off)(lanes, outL.data(), outR.data(), frames);
+
+    // Ideal saw with the harmonics of the mip level that was picked; what
+    // remains is aliasing and interpolation error
+    double signal = 0.0, error = 0.0;
+    int level = (offset / WAVETABLE_STRIDE) % WAVETABLE_LEVELS;
+    int harmonics = std::min((WAVETABLE_SIZE / 2) >> level, WAVETABLE_SIZE / 2 - 1);
+    for (int i = 0; i < frames; ++i)
+    {
+        double expected = 0.0;
+        for (int k = 1; k <= harmonics; ++k)
+            expected += (k & 1 ? 1.0 : -1.0) / k * std::sin(2.0 * PI * k * increment * i);
+        signal += expected * expected;
+        outR[i] = (float)expected;
+    }
+
+    // The tables are normalised, so fit the level before comparing
+    double dot = 0.0;
+    for (int i = 0; i < frames; ++i)
+        dot += outL[i] * outR[i];
+    double scale = dot / signal;
+    for (int i = 0; i < frames; ++i)
+        error += (outL[i] - scale * outR[i]) * (outL[i] - scale * outR[i]);
+    return 10.0 * std::log10(error / (signal * scale * scale) + 1e-30);
+}
+
+static void BenchmarkOscillators()
+{
+    const int block = 128;
+    const int sample_rate = 48000;
+    const int voice_counts[] = { 64, 256 };
+    const FilterMode modes[] = { FilterMode::Off, FilterMode::LowPass };
+
+    WavetableSet tables;
+    tables.Build();
+
+    printf("Wavetable oscillators (real-time voices per core at %d Hz, %d-frame blocks)\n", sample_rate, block);
+
+    const SimdLevel best = DetectSimdLevel();
+    for (FilterMode mode : modes)
+    {
+        for (int count : voice_counts)
+        {
+            // Spread over the keyboard and all waveforms so lanes hit different tables
+            std::vector<uint32_t> phase(count), increment(count);
+            std::vector<int32_t> offset(count);
+            std::vector<float> gain(count), gainStep(count, 0.0f), panLeft(count, 0.7f), panRight(count, 0.7f);
+            std::vector<float> ic1(count), ic2(count), g(count), k(count), gTarget(count), kTarget(count);
+            std::vector<float> outL(block), outR(block);
+
+            printf("  %-9s %4d voices", GetFilterModeName(mode), count);
+            for (int l = 0; l <= (int)best; ++l)
+            {
+                for (int v = 0; v < count; ++v)
+                {
+                    double frequency = 55.0 * std::pow(2.0, (v % 60) / 12.0);
+                    phase[v] = 0;
+                    increment[v] = (uint32_t)(frequency / sample_rate * 4294967296.0);
+                    offset[v] = tables.GetOffset(v % (int)Waveform::Count, frequency / sample_rate);
+                    gain[v] = 0.01f;
+                    ic1[v] = ic2[v] = 0.0f;
+                    g[v] = SvfCutoffCoefficient(500.0f, sample_rate);
+                    gTarget[v] = SvfCutoffCoefficient(4000.0f, sample_rate);
+                    k[v] = kTarget[v] = SvfDampingCoefficient(0.5f);
+                }
+                OscillatorLanes lanes = { phase.data(), increment.data(), offset.data(), gain.data(), gainStep.data(),
+                                          panLeft.data(), panRight.data(), count, tables.GetData(), mode,
+                                          { ic1.data(), ic2.data(), g.data(), k.data(), gTarget.data(), kTarget.data(), SvfSmoothing(sample_rate) } };
+
+                OscillatorFn render = GetOscillatorFunction((SimdLevel)l, mode);
+                const int blocks = 400000 / count;
+                BenchClock::time_point start = BenchClock::now();
+                for (int b = 0; b < blocks; ++b)
+                {
+                    render(lanes, outL.data(), outR.data(), block);
+                    g_Sink = g_Sink + outL[0];
+                }
+                double seconds = SecondsSince(start);
+                double realtime = (double)blocks * block / sample_rate;
+                printf("  %s %6.0f", GetSimdLevelName((SimdLevel)l), count * realtime / seconds);
+            }
+            printf("\n");
+        }
+    }
+
+    printf("  Saw aliasing (dB):");
+    const double frequencies[] = { 110.0, 1760.0, 7040.0 };
+    for (double frequency : frequencies)
+        printf("  %.0f Hz %.1f", frequency, MeasureOscillatorAliasing(tables, frequency, sample_rate));
+    printf("\n");
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Physical piano strings
+
+static void BenchmarkPhysicalPiano()
+{
+    const int sample_rate = 48000;
+    const int count = MAX_PHYSICAL_VOICES;
+    const int blocks = 4000;
+
+    printf("Physical piano strings (real-time voices per core at %d Hz, %d voices)\n", sample_rate, count);
+
+    // Loops spread over the keyboard, each filled with noise so nothing decays
+    // to denormals during the run
+    std::vector<float> delay((size_t)count * STRING_DELAY_SIZE);
+    std::vector<int32_t> length(count);
+    std::vector<float> tuning(count, 0.2f), tuningState(count), dispersion(count), dispersionState(MAX_DISPERSION_STAGES * count);
+    std::vector<float> loss(count), lossState(count), loopGain(count, 0.9995f), pan(count, 0.5f), peak(count);
+    std::vector<float> fade(count, 1.0f), fadeStep(count);
+    std::vector<float> outL(STRING_CHUNK_FRAMES), outR(STRING_CHUNK_FRAMES), board(STRING_CHUNK_FRAMES);
+
+    const SimdLevel best = DetectSimdLevel();
+    for (int q = 0; q < (int)PhysicalQuality::Count; ++q)
+    {
+        printf("  %-7s %d stages", GetPhysicalQualityName((PhysicalQuality)q), GetDispersionStages((PhysicalQuality)q));
+        for (int l = 0; l <= (int)best; ++l)
+        {
+            uint32_t noise = 1;
+            for (float& x : delay)
+            {
+                noise = noise * 1664525u + 1013904223u;
+                x = (int32_t)noise * (0.1f / 2147483648.0f);
+            }
+            for (int v = 0; v < count; ++v)
+            {
+                length[v] = (int32_t)(sample_rate / (27.5 * std::pow(2.0, (v * 87 / count) / 12.0)));
+                dispersion[v] = -0.5f + 0.3f * v / count;
+                loss[v] = 0.3f + 0.65f * v / count;
+            }
+            StringLanes lanes = { delay.data(), 0, length.data(), tuning.data(), tuningState.data(), dispersion.data(),
+                                  dispersionState.data(), loss.data(), lossState.data(), loopGain.data(), pan.data(), pan.data(),
+                                  fade.data(), fadeStep.data(), peak.data(), count };
+
+            StringFn render = GetStringFunction((SimdLevel)l, (PhysicalQuality)q);
+            BenchClock::time_point start = BenchClock::now();
+            for (int b = 0; b < blocks; ++b)
+            {
+                render(lanes, outL.data(), outR.data(), board.data(), STRING_CHUNK_FRAMES);
+                lanes.writePos += STRING_CHUNK_FRAMES;
+                g_Sink = g_Sink + outL[0];
+            }
+            double seconds = SecondsSince(start);
+            double realtime = (double)blocks * STRING_CHUNK_FRAMES / sample_rate;
+            printf("  %s %6.0f", GetSimdLevelName((SimdLevel)l), count * realtime / seconds);
+        }
+        printf("\n");
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// FM operators
+
+#if SYNTH_X86
+SYNTH_TARGET_SSE2 static void MeasureSineSSE2(const float* turns, float* result)
+{
+    _mm_storeu_ps(result, FastSineSSE2(_mm_loadu_ps(turns)));
+    _mm_storeu_ps(result + 4, FastSineSSE2(_mm_loadu_ps(turns + 4)));
+}
+
+SYNTH_TARGET_AVX2 static void MeasureSineAVX2(const float* turns, float* result)
+{
+    _mm256_storeu_ps(result, FastSineAVX2(_mm256_loadu_ps(turns)));
+    _mm256_zeroupper();
+}
+#endif
+
+// Largest difference from std::sin over a dense grid, including the
+// phase-modulated arguments several turns away from zero
+static double MeasureFastSineError(SimdLevel level)
+{
+    const int count = 1 << 20;
+    std::vector<float> turns(count), result(count);
+    for (int i = 0; i < count; ++i)
+        turns[i] = -8.0f + 16.0f * i / count;
+
+    for (int i = 0; i < count; i += 8)
+    {
+#if SYNTH_X86
+        if (level == SimdLevel::AVX2)
+        {
+            MeasureSineAVX2(&turns[i], &result[i]);
+            continue;
+        }
+        if (level == SimdLevel::SSE2)
+        {
+            MeasureSineSSE2(&turns[i], &result[i]);
+            continue;
+        }
+#endif
+        for (int k = 0; k < 8; ++k)
+            result[i + k] = FastSine(turns[i + k]);
+    }
+
+    double error = 0.0;
+    for (int i = 0; i < count; ++i)
+        error = std::max(error, std::fabs(result[i] - std::sin(2.0 * PI * (double)turns[i])));
+    return error;
+}
+
+static void BenchmarkFm()
+{
+    const int block = 128;
+    const int sample_rate = 48000;
+    const int count = MAX_FM_VOICES;
+    const int blocks = 2000;
+
+    printf("FM voices, %d operators (real-time voices per core at %d Hz, %d voices)\n", FM_OPERATORS, sample_rate, count);
+
+    const SimdLevel best = DetectSimdLevel();
+    printf("  Fast sine max error:");
+    for (int l = 0; l <= (int)best; ++l)
+        printf("  %s %.2g", GetSimdLevelName((SimdLevel)l), MeasureFastSineError((SimdLevel)l));
+    printf("\n");
+
+    std::vector<uint32_t> phase(FM_OPERATORS * MAX_FM_VOICES), increment(FM_OPERATORS * MAX_FM_VOICES);
+    std::vector<float> level(FM_OPERATORS * MAX_FM_VOICES), levelStep(FM_OPERATORS * MAX_FM_VOICES, 0.0f);
+    std::vector<float> feedback1(count), feedback2(count), pan(count, 0.7f);
+    std::vector<float> outL(block), outR(block);
+
+    for (int a = 0; a < (int)FmAlgorithm::Count; ++a)
+    {
+        printf("  %-10s", GetFmAlgorithmName((FmAlgorithm)a));
+        for (int l = 0; l <= (int)best; ++l)
+        {
+            for (int v = 0; v < count; ++v)
+            {
+                double frequency = 55.0 * std::pow(2.0, (v % 60) / 12.0);
+                for (int op = 0; op < FM_OPERATORS; ++op)
+                {
+                    phase[op * MAX_FM_VOICES + v] = 0;
+                    increment[op * MAX_FM_VOICES + v] = (uint32_t)(frequency * (op + 1) / sample_rate * 4294967296.0);
+                    level[op * MAX_FM_VOICES + v] = 0.2f;
+                }
+                feedback1[v] = feedback2[v] = 0.0f;
+            }
+            FmLanes lanes = { phase.data(), increment.data(), level.data(), levelStep.data(), feedback1.data(), feedback2.data(),
+                              0.1f, pan.data(), pan.data(), count };
+
+            FmFn render = GetFmFunction((SimdLevel)l, (FmAlgorithm)a);
+            BenchClock::time_point start = BenchClock::now();
+            for (int b = 0; b < blocks; ++b)
+            {
+                render(lanes, outL.data(), outR.data(), block);
+                g_Sink = g_Sink + outL[0];
+            }
+            double seconds = SecondsSince(start);
+            double realtime = (double)blocks * block / sample_rate;
+            printf("  %s %6.0f", GetSimdLevelName((SimdLevel)l), count * realtime / seconds);
+        }
+        printf("\n");
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Effects
+
+static void BenchmarkEffects()
+{
+    const int block = 256;
+    const int sample_rate = 48000;
+    const int blocks = 4000;
+
+    printf("Master effects (ns per stereo frame, %% of one core at %d Hz)\n", sample_rate);
+
+    std::vector<float> inL(block), inR(block), outL(block), outR(block);
+    for (int i = 0; i < block; ++i)
+    {
+        inL[i] = 0.5f * (float)std::sin(i * 0.05);
+        inR[i] = 0.5f * (float)std::sin(i * 0.07);
+    }
+
+    // Each effect alone, then the whole chain
+    for (int e = 0; e <= (int)EffectType::Count; ++e)
+    {
+        EffectSettings settings;
+        settings.eq.enabled = e == (int)EffectType::Eq || e == (int)EffectType::Count;
+        settings.compressor.enabled = e == (int)EffectType::Compressor || e == (int)EffectType::Count;
+        settings.chorus.enabled = e == (int)EffectType::Chorus || e == (int)EffectType::Count;
+        settings.delay.enabled = e == (int)EffectType::Delay || e == (int)EffectType::Count;
+        settings.reverb.enabled = e == (int)EffectType::Reverb || e == (int)EffectType::Count;
+        settings.convolution.enabled = e == (int)EffectType::Convolution || e == (int)EffectType::Count;
+
+        EffectsChain chain;
+        chain.SetSettings(settings);
+        chain.Prepare(sample_rate);
+        BenchClock::time_point start = BenchClock::now();
+        for (int b = 0; b < blocks; ++b)
+        {
+            std::copy(inL.begin(), inL.end(), outL.begin());
+            std::copy(inR.begin(), inR.end(), outR.begin());
+            chain.Process(outL.data(), outR.data(), block, true);
+            g_Sink = g_Sink + outL[0];
+        }
+        double seconds = SecondsSince(start);
+        double frames = (double)blocks * block;
+        printf("  %-12s %6.2f ns  %5.2f%%\n", e < (int)EffectType::Count ? GetEffectName((EffectType)e) : "All",
+               seconds * 1e9 / frames, 100.0 * seconds * sample_rate / frames);
+    }
+
+    // The reverbs are the costliest; their kernels at each SIMD level
+    printf("  FDN reverb  ");
+    const SimdLevel best = DetectSimdLevel();
+    for (int l = 0; l <= (int)best; ++l)
+    {
+        SetSimdLevelLimit((SimdLevel)l);
+        FdnReverb reverb;
+        reverb.Prepare(sample_rate);
+        BenchClock::time_point start = BenchClock::now();
+        for (int b = 0; b < blocks; ++b)
+        {
+            reverb.Process(inL.data(), inR.data(), outL.data(), outR.data(), block);
+            g_Sink = g_Sink + outL[0];
+        }
+        double seconds = SecondsSince(start);
+        double frames = (double)blocks * block;
+        printf("  %s %5.2f ns %5.3f%%", GetSimdLevelName((SimdLevel)l), seconds * 1e9 / frames, 100.0 * seconds * sample_rate / frames);
+    }
+    printf("\n");
+
+    // Convolution with a long response in 64-frame blocks: the audio thread
+    // part is the head alone, the workers are timed by the reverb itself
+    const float seconds = 3.0f;
+    const int small = HEAD_BLOCK_FRAMES;
+    std::vector<float> impulseL, impulseR;
+    GenerateRoomImpulse(seconds, sample_rate, impulseL, impulseR);
+    printf("  Convolution, %.0f s response, %d-frame blocks (audio thread ns per frame, workers %% of one core)\n  ", seconds, small);
+    for (int l = 0; l <= (int)best; ++l)
+    {
+        SetSimdLevelLimit((SimdLevel)l);
+        ConvolutionReverb head, full;
+        head.SetImpulse(impulseL.data(), impulseR.data(), 2 * STAGE_BLOCK_FRAMES[0]);
+        head.Prepare(sample_rate);
+        full.SetImpulse(impulseL.data(), impulseR.data(), (int)impulseL.size());
+        full.Prepare(sample_rate);
+
+        const int runs = blocks * block / small;
+        BenchClock::time_point start = BenchClock::now();
+        for (int b = 0; b < runs; ++b)
+        {
+            head.Process(inL.data(), inR.data(), outL.data(), outR.data(), small);
+            g_Sink = g_Sink + outL[0];
+        }
+        double audio = SecondsSince(start) * 1e9 / ((double)runs * small);
+        for (int b = 0; b < runs; ++b)
+        {
+            full.Process(inL.data(), inR.data(), outL.data(), outR.data(), small);
+            g_Sink = g_Sink + outL[0];
+        }
+        printf("  %s %5.2f ns %5.2f%%", GetSimdLevelName((SimdLevel)l), audio, 100.0f * full.GetBackgroundLoad());
+    }
+    SetSimdLevelLimit(SimdLevel::AVX2);
+    printf("\n");
+
+    // The limiter's window maximum is a monotonic deque, so a longer
+    // lookahead should cost nothing extra. Driven 12 dB into the ceiling.
+    printf("  Limiter     ");
+    const float lookaheads[] = { 0.001f, 0.005f, 0.02f };
+    for (float lookahead : lookaheads)
+    {
+        LimiterSettings settings;
+        settings.gain = 12.0f;
+        settings.lookahead = lookahead;
+        Limiter limiter;
+        limiter.Prepare(sample_rate);
+        limiter.Update(settings);
+        BenchClock::time_point start = BenchClock::now();
+        for (int b = 0; b < blocks; ++b)
+        {
+            std::copy(inL.begin(), inL.end(), outL.begin());
+            std::copy(inR.begin(), inR.end(), outR.begin());
+            limiter.Process(outL.data(), outR.data(), block);
+            g_Sink = g_Sink + outL[0];
+        }
+        double elapsed = SecondsSince(start);
+        double frames = (double)blocks * block;
+        printf("  %2.0f ms %5.2f ns %5.2f%%", lookahead * 1000.0f, elapsed * 1e9 / frames, 100.0 * elapsed * sample_rate / frames);
+    }
+    printf("\n");
+
+    // Reverb and delay tails fed silence decay into denormals; the audio
+    // thread flushes them, this thread does not unless asked
+    printf("  Silent tail ");
+    for (int flush = 0; flush < 2; ++flush)
+    {
+        ScopedFlushDenormals scope(flush != 0);
+        EffectSettings settings;
+        settings.delay.enabled = true;
+        settings.reverb.enabled = true;
+        EffectsChain chain;
+        chain.SetSettings(settings);
+        chain.Prepare(sample_rate);
+        for (int b = 0; b < 20; ++b)
+        {
+            std::copy(inL.begin(), inL.end(), outL.begin());
+            std::copy(inR.begin(), inR.end(), outR.begin());
+            chain.Process(outL.data(), outR.data(), block, true);
+        }
+
+        // Skip the seconds in which the tail is still audible
+        const int tail = 10 * blocks;
+        double elapsed = 0.0;
+        for (int b = 0; b < tail; ++b)
+        {
+            std::fill(outL.begin(), outL.end(), 0.0f);
+            std::fill(outR.begin(), outR.end(), 0.0f);
+            BenchClock::time_point start = BenchClock::now();
+            chain.Process(outL.data(), outR.data(), block, true);
+            if (b >= tail / 2)
+                elapsed += SecondsSince(start);
+            g_Sink = g_Sink + outL[0];
+        }
+        double frames = (double)(tail - tail / 2) * block;
+        printf("  %s %6.2f ns %5.2f%%", flush ? "flushed" : "denormal", elapsed * 1e9 / frames, 100.0 * elapsed * sample_rate / frames);
+    }
+    printf("\n");
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Voice render dispatch
+
+static void BenchmarkVoiceKernels()
+{
+    const int block = 128;
+    const int voices = 64;
+    const int blocks = 2000;
+    const InterpolationKind kinds[] = { InterpolationKind::Linear, InterpolationKind::Cubic, InterpolationKind::Sinc16 };
+
+    printf("Sample voice render, generic per-sample dispatch vs kernels picked at note-on (ns per voice frame)\n");
+
+    // Long enough that no voice reaches the end during the run
+    SampleData sample;
+    sample.channels = 2;
+    sample.frames = (int)(blocks * block * 1.1) + 1;
+    sample.data.assign((size_t)sample.Stride() * 2, 0.0f);
+    for (int c = 0; c < 2; ++c)
+    {
+        for (int i = 0; i < sample.frames; ++i)
+            sample.data[(size_t)c * sample.Stride() + INTERPOLATION_PADDING + i] = (float)std::sin(i * (0.01 + 0.002 * c));
+    }
+    std::vector<float> outL(block), outR(block);
+    const SimdLevel best = DetectSimdLevel();
+
+    for (int channels = 1; channels <= 2; ++channels)
+    {
+        sample.channels = channels;
+        for (int k = -1; k < (int)(sizeof(kinds) / sizeof(kinds[0])); ++k)
+        {
+            // k = -1 is the unity-rate copy path
+            InterpolationKind kind = k < 0 ? InterpolationKind::Linear : kinds[k];
+            double step = k < 0 ? 1.0 : 1.0595;
+            printf("  %s %-8s", channels == 1 ? "mono  " : "stereo", k < 0 ? "copy" : GetInterpolationName(kind));
+
+            for (int l = -1; l <= (int)best; ++l)
+            {
+                // l = -1 is the generic path
+                VoiceKernel kernel = SelectVoiceKernel(kind, channels, k < 0, l < 0 ? SimdLevel::Scalar : (SimdLevel)l);
+                std::vector<double> positions(voices, 0.0);
+                BenchClock::time_point start = BenchClock::now();
+                for (int b = 0; b < blocks; ++b)
+                {
+                    for (int v = 0; v < voices; ++v)
+                    {
+                        VoiceBlock args = { &sample, &positions[v], step, 0.5f, 0.5f, -0.5f + v / (float)voices,
+                                            outL.data(), outR.data(), block };
+                        if (l < 0)
+                            RenderVoiceGeneric(args, kind);
+                        else
+                            RenderVoiceBlock(kernel, args);
+                    }
+                }
+                g_Sink = g_Sink + outL[0];
+                double ns = SecondsSince(start) * 1e9 / ((double)blocks * block * voices);
+                printf("  %s %5.2f", l < 0 ? "generic" : GetSimdLevelName((SimdLevel)l), ns);
+            }
+            printf("\n");
+        }
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Parallel voices
+
+// Stereo sines of slightly different pitch
+static void AddSineSamples(SampleBank& bank, int samples, int frames, int sampleRate)
+{
+    for (int s = 0; s < samples; ++s)
+    {
+        SampleData sample;
+        sample.channels = 2;
+        sample.frames = frames;
+        sample.data.assign((size_t)sample.Stride() * 2, 0.0f);
+        for (int c = 0; c < 2; ++c)
+        {
+            for (int i = 0; i < sample.frames; ++i)
+                sample.data[(size_t)c * sample.Stride() + INTERPOLATION_PADDING + i] = 0.1f * (float)std::sin(i * (0.01 + 0.003 * s + 0.001 * c));
+        }
+        bank.Add(std::move(sample), sampleRate);
+    }
+}
+
+static void BenchmarkParallelVoices()
+{
+    const int bank_rate = 48000;
+    const int sample_rate = 44100;      // Every voice resamples
+    const int block = 128;
+    const int blocks = 400;
+    const int samples = 8;
+
+    // More helpers than the other cores would not be started
+    const int most = std::min(3, JobPool::GetHelperLimit());
+    printf("Sample voices, %d voices with sinc16 in %d-frame blocks, serial vs jobs on 0..%d helpers (ns per voice frame)\n", MAX_VOICES, block, most);
+
+    SampleBank bank;
+    AddSineSamples(bank, samples, (int)(blocks * block * 1.2) + 1, bank_rate);
+
+    const InterpolationKind previous = GetGlobalInterpolation();
+    SetGlobalInterpolation(InterpolationKind::Sinc16);
+    std::vector<float> outL(block), outR(block), reference;
+    printf(" ");
+    for (int helpers = -1; helpers <= most; ++helpers)
+    {
+        // helpers = -1 is the serial loop
+        std::unique_ptr<SynthEngine> engine(new SynthEngine());
+        engine->GetGovernor().SetEnabled(false);
+        engine->SetVoiceThreads(std::max(0, helpers));
+        engine->SetParallelVoices(helpers >= 0);
+        engine->Prepare(&bank, sample_rate);
+        LimiterSettings limiter;
+        limiter.enabled = false;
+        engine->SetLimiter(limiter);
+        for (int v = 0; v < MAX_VOICES; ++v)
+            engine->NoteOn(v, v % samples, 60.0f, 0.5f + 0.5f * v / MAX_VOICES);
+
+        std::vector<float> output;
+        output.reserve((size_t)blocks * block);
+        BenchClock::time_point start = BenchClock::now();
+        for (int b = 0; b < blocks; ++b)
+        {
+            engine->Render(outL.data(), outR.data(), block);
+            output.insert(output.end(), outL.begin(), outL.end());
+        }
+        double ns = SecondsSince(start) * 1e9 / ((double)blocks * block * MAX_VOICES);
+
+        if (helpers < 0)
+            printf("  serial %5.2f", ns);
+        else
+        {
+            if (helpers == 0)
+                reference = output;
+            bool identical = output == reference;
+            printf("  %d: %5.2f%s", helpers, ns, identical ? "" : " (differs)");
+        }
+    }
+    printf("\n");
+    SetGlobalInterpolation(previous);
+}
+
+// Every source sounding at once; parallel mode runs the layers, the
+// independent branches of the source graph, on their own helpers
+static void BenchmarkLayers()
+{
+    const int sample_rate = 48000;
+    const int block = 128;
+    const int blocks = 400;
+    const int notes = 16;
+
+    SampleBank bank;
+    AddSineSamples(bank, 4, blocks * block + block * (int)SoundSource::Count + 1, sample_rate);
+
+    std::vector<float> outL(block), outR(block), reference;
+    const int most = std::min(3, JobPool::GetHelperLimit());
+    for (int helpers = -1; helpers <= most; ++helpers)
+    {
+        // helpers = -1 is the serial loop
+        std::unique_ptr<SynthEngine> engine(new SynthEngine());
+        engine->GetGovernor().SetEnabled(false);
+        engine->SetVoiceThreads(std::max(0, helpers));
+        engine->SetParallelVoices(helpers >= 0);
+        engine->Prepare(&bank, sample_rate);
+        LimiterSettings limiter;
+        limiter.enabled = false;
+        engine->SetLimiter(limiter);
+        if (helpers < 0)
+        {
+            const GraphShape& shape = engine->GetGraphShape();
+            printf("Layers, %d notes on each source in %d-frame blocks, %d nodes in %d levels, %d ports sharing %d buffers,\n"
+                   "serial vs layers on 0..%d helpers (us per block)\n ",
+                   notes, block, shape.nodes, shape.levels, shape.ports, shape.buffers, most);
+        }
+
+        // A source is picked when its note-on is applied, so one block each
+        std::vector<float> output;
+        output.reserve((size_t)(blocks + (int)SoundSource::Count) * block);
+        for (int layer = 0; layer < (int)SoundSource::Count; ++layer)
+        {
+            engine->SetSoundSource((SoundSource)layer);
+            for (int n = 0; n < notes; ++n)
+                engine->NoteOn(layer * notes + n, n % bank.GetCount(), 48.0f + n * 2, 0.5f);
+            engine->Render(outL.data(), outR.data(), block);
+            output.insert(output.end(), outL.begin(), outL.end());
+        }
+
+        BenchClock::time_point start = BenchClock::now();
+        for (int b = 0; b < blocks; ++b)
+        {
+            engine->Render(outL.data(), outR.data(), block);
+            output.insert(output.end(), outL.begin(), outL.end());
+        }
+        double us = SecondsSince(start) * 1e6 / blocks;
+
+        if (helpers < 0)
+            printf("  serial %6.1f", us);
+        else
+        {
+            if (helpers == 0)
+                reference = output;
+            bool identical = output == reference;
+            printf("  %d: %6.1f%s", helpers, us, identical ? "" : " (differs)");
+        }
+    }
+    printf("\n");
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Key to sound latency
+
+static void RenderSynth(void* user, float* left, float* right, int frames)
+{
+    ((SynthEngine*)user)->Render(left, right, frames);
+}
+
+// Synthetic players on the null sink, which paces the render calls like a
+// device; the injecting thread stands in for the UI
+static void BenchmarkLatency()
+{
+    const int sample_rate = 48000;
+    const double seconds = 3.0;
+    const int periods[] = { 64, 128, 256 };
+
+    printf("Key to sound latency, null sink at %d Hz, %.0f s of random note-ons per period size\n", sample_rate, seconds);
+
+    SampleBank bank;
+    for (int period : periods)
+    {
+        AudioBackendSettings settings;
+        settings.type = AudioBackendType::Null;
+        settings.sampleRate = sample_rate;
+        settings.periodFrames = period;
+        settings.periods = 2;
+        std::unique_ptr<AudioBackend> backend = CreateAudioBackend(settings.type);
+        backend->Open(settings);
+
+        SynthEngine engine;
+        engine.SetSoundSource(SoundSource::Fm);
+        engine.GetGovernor().SetEnabled(false);
+        engine.Prepare(&bank, backend->GetInfo().sampleRate);
+        engine.GetLatencyMonitor().SetOutputLatency(backend->GetInfo().latency);
+        engine.GetTelemetry().SetXrunSource(backend.get());
+        backend->Start(RenderSynth, &engine);
+
+        // Notes at random moments, so they land anywhere in the period
+        std::mt19937 random(period);
+        std::uniform_int_distribution<int> gap(3000, 25000);
+        BenchClock::time_point start = BenchClock::now();
+        int key = 0;
+        while (SecondsSince(start) < seconds)
+        {
+            engine.NoteOff(key);
+            key = (key + 1) % 24;
+            engine.NoteOn(key, 0, 48.0f + key);
+            std::this_thread::sleep_for(std::chrono::microseconds(gap(random)));
+        }
+        backend->Stop();
+
+        // Well under the queue's capacity of blocks, so one drain sees them all
+        engine.GetTelemetry().Update();
+        const TelemetrySummary& health = engine.GetTelemetry().GetSummary();
+        printf("  %d x %d frames, load avg %.1f%% max %.1f%%, %llu xruns. ", backend->GetInfo().periods, period,
+               health.avgLoad * 100.0f, health.maxLoad * 100.0f, health.xruns);
+        engine.GetLatencyMonitor().PrintReport(stdout);
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Real-time safety
+
+// Render calls covering the given time; every call is checked
+static void RenderFor(SynthEngine& engine, std::vector<float>& left, std::vector<float>& right, int period, double seconds)
+{
+    int blocks = std::max(1, (int)(seconds * engine.GetSampleRate() / period));
+    for (int b = 0; b < blocks; ++b)
+        engine.Render(left.data(), right.data(), period);
+}
+
+// Chord of the given size, held and released
+static void PlayChord(SynthEngine& engine, const SampleBank* bank, std::vector<float>& left, std::vector<float>& right, int period,
+                      int first, int notes)
+{
+    for (int n = 0; n < notes; ++n)
+    {
+        int key = first + n;
+        int sample = bank->GetCount() > 0 ? key % bank->GetCount() : -1;
+        engine.NoteOn(key, sample, 48.0f + key % 36, 0.5f + 0.5f * (n & 1));
+    }
+    RenderFor(engine, left, right, period, 0.2);
+    for (int n = 0; n < notes; ++n)
+        engine.NoteOff(first + n);
+    RenderFor(engine, left, right, period, 0.1);
+}
+
+static void PlaySession(SynthEngine& engine, const SampleBank* bank, int period)
+{
+    std::vector<float> left(period), right(period);
+    const SoundSource sources[] = { SoundSource::Samples, SoundSource::Oscillators, SoundSource::Physical, SoundSource::Fm };
+
+    for (SoundSource source : sources)
+    {
+        engine.SetSoundSource(source);
+        PlayChord(engine, bank, left, right, period, 0, 6);
+
+        // Sustain pedal, retriggers under it, and events timed inside blocks
+        engine.SetSustainPedal(true);
+        PlayChord(engine, bank, left, right, period, 10, 4);
+        PlayChord(engine, bank, left, right, period, 10, 4);
+        for (int n = 0; n < 8; ++n)
+        {
+            engine.NoteOn(20 + n, 0, 60.0f, 1.0f, engine.GetFrameTime() + n * 37);
+            engine.NoteOff(20 + n, engine.GetFrameTime() + 500 + n * 37);
+        }
+        RenderFor(engine, left, right, period, 0.1);
+        engine.SetSustainPedal(false);
+        RenderFor(engine, left, right, period, 0.1);
+
+        // More notes than voices steals some
+        PlayChord(engine, bank, left, right, period, 30, MAX_VOICES + 16);
+        engine.NoteOn(1, 0, 60.0f);
+        engine.AllNotesOff();
+        RenderFor(engine, left, right, period, 0.1);
+    }
+
+    // Every setting the UI can change while notes play
+    engine.SetSoundSource(SoundSource::Oscillators);
+    AdsrSettings envelope;
+    envelope.attack = 0.05f;
+    envelope.sustain = 0.5f;
+    envelope.release = 0.05f;
+    engine.SetEnvelope(envelope);
+    for (int mode = 0; mode < (int)FilterMode::Count; ++mode)
+    {
+        FilterSettings filter;
+        filter.mode = (FilterMode)mode;
+        filter.resonance = 0.9f;
+        engine.SetFilter(filter);
+        PlayChord(engine, bank, left, right, period, 0, 4);
+    }
+    for (int table = 0; table < engine.GetWavetables().GetCount(); ++table)
+    {
+        engine.SetWaveform(table);
+        PlayChord(engine, bank, left, right, period, 0, 4);
+    }
+
+    engine.SetSoundSource(SoundSource::Fm);
+    for (int preset = 0; preset < GetFmPresetCount(); ++preset)
+    {
+        engine.SetFmPreset(preset);
+        PlayChord(engine, bank, left, right, period, 0, 4);
+    }
+
+    engine.SetSoundSource(SoundSource::Physical);
+    for (int quality = 0; quality < (int)PhysicalQuality::Count; ++quality)
+    {
+        engine.SetPhysicalQuality((PhysicalQuality)quality);
+        PlayChord(engine, bank, left, right, period, 0, 4);
+    }
+
+    EffectSettings effects;
+    effects.eq.enabled = effects.compressor.enabled = effects.chorus.enabled = true;
+    effects.delay.enabled = effects.reverb.enabled = effects.convolution.enabled = true;
+    engine.GetEffects().SetSettings(effects);
+    PlayChord(engine, bank, left, right, period, 0, 8);
+    LimiterSettings limiter;
+    limiter.lookahead = MAX_LIMITER_LOOKAHEAD;
+    engine.SetLimiter(limiter);
+    PlayChord(engine, bank, left, right, period, 0, 8);
+    limiter.enabled = false;
+    engine.SetLimiter(limiter);
+    engine.GetEffects().SetSettings(EffectSettings());
+    PlayChord(engine, bank, left, right, period, 0, 8);
+
+    // Debug counting and the silent tails it watches
+    engine.GetDenormals().SetCountingEnabled(true);
+    engine.GetDenormals().SetFlushEnabled(false);
+    PlayChord(engine, bank, left, right, period, 0, 8);
+    RenderFor(engine, left, right, period, 1.0);
+    engine.GetDenormals().SetFlushEnabled(true);
+    engine.GetDenormals().SetCountingEnabled(false);
+
+    // Any load degrades, then recover
+    engine.SetSoundSource(SoundSource::Samples);
+    engine.GetGovernor().SetThresholds(0.0f, 0.0f);
+    PlayChord(engine, bank, left, right, period, 0, MAX_VOICES);
+    engine.GetGovernor().SetThresholds(100.0f, 99.0f);
+    PlayChord(engine, bank, left, right, period, 0, MAX_VOICES);
+
+    // Voice groups shared with the helper threads, which are checked too
+    engine.SetParallelVoices(true);
+    PlayChord(engine, bank, left, right, period, 0, MAX_VOICES);
+
+    // Every layer sounding on the layer helpers while layers are switched
+    // off and on, each edit swapping in a new schedule
+    for (int layer = 0; layer < (int)SoundSource::Count; ++layer)
+    {
+        engine.SetSoundSource((SoundSource)layer);
+        for (int n = 0; n < 4; ++n)
+            engine.NoteOn(40 + layer * 4 + n, bank->GetCount() > 0 ? n % bank->GetCount() : -1, 60.0f + n, 0.8f);
+        engine.Render(left.data(), right.data(), period);
+    }
+    for (int layer = 0; layer < (int)SoundSource::Count; ++layer)
+    {
+        engine.SetLayerEnabled((SoundSource)layer, false);
+        RenderFor(engine, left, right, period, 0.05);
+        engine.SetLayerEnabled((SoundSource)layer, true);
+        RenderFor(engine, left, right, period, 0.05);
+    }
+    engine.AllNotesOff();
+    RenderFor(engine, left, right, period, 0.1);
+    engine.SetParallelVoices(false);
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// MIDI files
+
+static void PutBigEndian(std::vector<unsigned char>& data, unsigned value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; --i)
+        data.push_back((unsigned char)(value >> (8 * i)));
+}
+
+static void PutChunk(std::vector<unsigned char>& data, const char* id, const std::vector<unsigned char>& body)
+{
+    data.insert(data.end(), id, id + 4);
+    PutBigEndian(data, (unsigned)body.size(), 4);
+    data.insert(data.end(), body.begin(), body.end());
+}
+
+static std::vector<unsigned char> MakeMidiFile(unsigned format, unsigned division, const std::vector<std::vector<unsigned char>>& tracks)
+{
+    std::vector<unsigned char> data, header;
+    PutBigEndian(header, format, 2);
+    PutBigEndian(header, (unsigned)tracks.size(), 2);
+    PutBigEndian(header, division, 2);
+    PutChunk(data, "MThd", header);
+    for (size_t t = 0; t < tracks.size(); ++t)
+    {
+        PutChunk(data, "MTrk", tracks[t]);
+        if (t == 0)
+            PutChunk(data, "XXun", { 1, 2, 3 });    // Unknown chunks are skipped
+    }
+    return data;
+}
+
+// A tempo track that halves the tempo at half a second, and a track of
+// notes in running status with a velocity-0 note-off, the pedal, a system
+// exclusive, a text event and all notes off. 96 ticks per quarter note, so
+// a tick is 1/192 s, then 1/96 s.
+static std::vector<unsigned char> MakeTestMidiFile()
+{
+    std::vector<unsigned char> tempo = { 0x00, 0xFF, 0x51, 3, 0x07, 0xA1, 0x20,     // 500000 us per quarter
+                                         0x60, 0xFF, 0x51, 3, 0x0F, 0x42, 0x40,     // 1000000 at tick 96
+                                         0x00, 0xFF, 0x2F, 0 };
+    std::vector<unsigned char> notes = { 0x00, 0xF0, 3, 0x7E, 0x7F, 0xF7,
+                                         0x00, 0x90, 60, 100, 0x00, 64, 90, 0x00, 67, 80,
+                                         0x18, 0xB0, 64, 127,
+                                         0x00, 0xFF, 0x01, 2, 'h', 'i',
+                                         0x18, 0x90, 60, 0,
+                                         0x30, 72, 100,
+                                         0x30, 0xB0, 64, 0, 0x00, 0x80, 64, 0, 0x00, 0x80, 67, 0,
+                                         0x18, 0xB0, 123, 0,
+                                         0x00, 0xFF, 0x2F, 0 };
+    return MakeMidiFile(1, 96, { tempo, notes });
+}
+
+struct ExpectedMidiEvent
+{
+    double seconds;
+    unsigned char status, data1, data2;
+};
+
+static const ExpectedMidiEvent TEST_MIDI_EVENTS[] = {
+    { 0.0, 0x90, 60, 100 }, { 0.0, 0x90, 64, 90 }, { 0.0, 0x90, 67, 80 }, { 0.125, 0xB0, 64, 127 },
+    { 0.25, 0x90, 60, 0 }, { 0.5, 0x90, 72, 100 }, { 1.0, 0xB0, 64, 0 }, { 1.0, 0x80, 64, 0 },
+    { 1.0, 0x80, 67, 0 }, { 1.25, 0xB0, 123, 0 },
+};
+static const int TEST_MIDI_EVENT_COUNT = sizeof(TEST_MIDI_EVENTS) / sizeof(TEST_MIDI_EVENTS[0]);
+
+// The test file read back exactly; every truncation of it and each kind of
+// damage refused. Returns the number of failed cases.
+static int CheckMidiFileParser()
+{
+    int failures = 0;
+    std::vector<unsigned char> data = MakeTestMidiFile();
+    MidiFile file;
+    bool parsed = file.Parse(data.data(), data.size());
+    bool read = parsed && (int)file.GetEvents().size() == TEST_MIDI_EVENT_COUNT;
+    for (int i = 0; read && i < TEST_MIDI_EVENT_COUNT; ++i)
+    {
+        const MidiFileEvent& event = file.GetEvents()[i];
+        const ExpectedMidiEvent& expected = TEST_MIDI_EVENTS[i];
+        read = std::fabs(event.seconds - expected.seconds) < 1e-9 && event.message.status == expected.status
+            && event.message.data1 == expected.data1 && event.message.data2 == expected.data2;
+    }
+    if (!read)
+    {
+        printf("  MIDI file: test file %s\n", parsed ? "read wrongly" : file.GetError().c_str());
+        ++failures;
+    }
+
+    int accepted = 0;
+    for (size_t size = 0; size < data.size(); ++size)
+        accepted += file.Parse(data.data(), size) ? 1 : 0;
+    if (accepted > 0)
+    {
+        printf("  MIDI file: %d truncated copies accepted\n", accepted);
+        ++failures;
+    }
+
+    std::vector<unsigned char> end = { 0x00, 0xFF, 0x2F, 0 };
+    struct Damaged
+    {
+        const char* name;
+        std::vector<unsigned char> data;
+    };
+    const Damaged damaged[] = {
+        { "format 2", MakeMidiFile(2, 96, { end }) },
+        { "zero division", MakeMidiFile(0, 0, { end }) },
+        { "data byte without a status", MakeMidiFile(0, 96, { { 0x00, 60, 100, 0x00, 0xFF, 0x2F, 0 } }) },
+        { "five-byte delta", MakeMidiFile(0, 96, { { 0x81, 0x81, 0x81, 0x81, 0x01, 0x90, 60, 100 } }) },
+        { "meta longer than its track", MakeMidiFile(0, 96, { { 0x00, 0xFF, 0x01, 0x40, 'x' } }) },
+        { "system message in a track", MakeMidiFile(0, 96, { { 0x00, 0xF8, 0x00, 0xFF, 0x2F, 0 } }) },
+        { "missing track", std::vector<unsigned char>(data.begin(), data.begin() + 14) },
+    };
+    for (const Damaged& bad : damaged)
+    {
+        if (file.Parse(bad.data.data(), bad.data.size()))
+        {
+            printf("  MIDI file: %s accepted\n", bad.name);
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+// Replays the test file through the player while rendering in real time,
+// as an output device would pace it, and checks every event took effect on
+// the frame the file puts it at. Returns the number of events that did not.
+static int ReplayMidiFile(SynthEngine& engine, const SampleBank* bank, int period)
+{
+    std::vector<unsigned char> data = MakeTestMidiFile();
+    MidiFile file;
+    file.Parse(data.data(), data.size());
+    MidiNoteMap notes;
+    for (int note = 0; note < MIDI_NOTES; ++note)
+        notes.samples[note] = bank->GetCount() > 0 ? note % bank->GetCount() : -1;
+
+    std::vector<float> left(period), right(period);
+    std::vector<NoteEvent> played;
+    played.reserve(4 * TEST_MIDI_EVENT_COUNT);
+    NoteEvent event;
+    while (engine.PopPlayedEvent(event))
+        ;
+    engine.SetPlayedEventsEnabled(true);
+    MidiFilePlayer player;
+    player.Start(file, engine, notes, false);
+    BenchClock::time_point next = BenchClock::now();
+    const auto periodTime = std::chrono::duration_cast<BenchClock::duration>(std::chrono::duration<double>((double)period / engine.GetSampleRate()));
+    while (player.IsPlaying())
+    {
+        engine.Render(left.data(), right.data(), period);
+        while (engine.PopPlayedEvent(event))
+            played.push_back(event);
+        next += periodTime;
+        std::this_thread::sleep_until(next);
+    }
+    player.Stop();
+    RenderFor(engine, left, right, period, 0.05);
+    while (engine.PopPlayedEvent(event))
+        played.push_back(event);
+    engine.SetPlayedEventsEnabled(false);
+
+    static const NoteEventType TYPES[] = { NoteEventType::NoteOn, NoteEventType::NoteOn, NoteEventType::NoteOn,
+        NoteEventType::SustainOn, NoteEventType::NoteOff, NoteEventType::NoteOn, NoteEventType::SustainOff,
+        NoteEventType::NoteOff, NoteEventType::NoteOff, NoteEventType::AllNotesOff };
+    int misplaced = std::abs((int)played.size() - TEST_MIDI_EVENT_COUNT);
+    for (int i = 0; i < std::min((int)played.size(), TEST_MIDI_EVENT_COUNT); ++i)
+    {
+        long long frames = std::llround(TEST_MIDI_EVENTS[i].seconds * engine.GetSampleRate());
+        if (played[i].type != TYPES[i] || played[i].time - played[0].time != frames)
+            ++misplaced;
+    }
+    return misplaced;
+}
+
+#ifndef _WIN32
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Key capture
+
+struct KeyCapture
+{
+    static const int CAPACITY = 512;
+    KeyEvent events[CAPACITY];
+    int count = 0;
+};
+
+static void CaptureKey(void* user, const KeyEvent& event)
+{
+    KeyCapture& capture = *(KeyCapture*)user;
+    if (capture.count < KeyCapture::CAPACITY)
+        capture.events[capture.count] = event;
+    ++capture.count;
+}
+
+// Feeds recorded evdev events to KeyInput through a pipe, /dev/fd/N
+// standing in for the device: each round holds one key over another with
+// auto-repeats, a release of a key never pressed, an unbound key and
+// synchronisation reports between. The end of the stream leaves two keys
+// down. Checks only the transitions arrive, in order, and the two are
+// released as the capture ends. Returns the number of failed checks.
+static int CheckKeyInput()
+{
+    const int ROUNDS = 100;
+    int stream[2];
+    if (pipe(stream) != 0)
+    {
+        printf("  Key input: no pipe\n");
+        return 1;
+    }
+    auto emit = [&](int type, int code, int value)
+    {
+        input_event event = {};
+        event.type = (unsigned short)type;
+        event.code = (unsigned short)code;
+        event.value = value;
+        ssize_t written = write(stream[1], &event, sizeof(event));
+        (void)written;
+    };
+    // Well under a pipe's buffer, so it is written whole before reading
+    for (int round = 0; round < ROUNDS; ++round)
+    {
+        emit(EV_KEY, KEY_Q, 1);
+        emit(EV_KEY, KEY_Q, 2);
+        emit(EV_KEY, KEY_E, 0);
+        emit(EV_SYN, SYN_REPORT, 0);
+        emit(EV_MSC, MSC_SCAN, 0x70014);
+        emit(EV_KEY, KEY_W, 1);
+        emit(EV_KEY, KEY_Q, 2);
+        emit(EV_KEY, KEY_F1, 1);
+        emit(EV_KEY, KEY_Q, 0);
+        emit(EV_SYN, SYN_REPORT, 0);
+        emit(EV_KEY, KEY_W, 2);
+        emit(EV_KEY, KEY_W, 0);
+        emit(EV_KEY, KEY_F1, 0);
+        emit(EV_SYN, SYN_REPORT, 0);
+    }
+    emit(EV_KEY, KEY_LEFTSHIFT, 1);
+    emit(EV_KEY, KEY_1, 1);
+    emit(EV_KEY, KEY_1, 2);
+    emit(EV_SYN, SYN_REPORT, 0);
+    close(stream[1]);
+
+    KeyCapture capture;
+    KeyInput input;
+    KeyInputSettings settings;
+    settings.device = "/dev/fd/" + std::to_string(stream[0]);
+    bool started = input.Start(settings, CaptureKey, &capture);
+    close(stream[0]);
+    if (!started)
+    {
+        printf("  Key input: %s\n", input.GetError().c_str());
+        return 1;
+    }
+    // The end of the stream ends the capture
+    BenchClock::time_point start = BenchClock::now();
+    while (input.IsRunning() && SecondsSince(start) < 5.0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    input.Stop();
+
+    KeyEvent expected[4 * ROUNDS + 4];
+    int expectedCount = 0;
+    for (int round = 0; round < ROUNDS; ++round)
+    {
+        expected[expectedCount++] = { 'Q', true, 0 };
+        expected[expectedCount++] = { 'W', true, 0 };
+        expected[expectedCount++] = { 'Q', false, 0 };
+        expected[expectedCount++] = { 'W', false, 0 };
+    }
+    expected[expectedCount++] = { KEY_CODE_SHIFT, true, 0 };
+    expected[expectedCount++] = { '1', true, 0 };
+    expected[expectedCount++] = { KEY_CODE_SHIFT, false, 0 };
+    expected[expectedCount++] = { '1', false, 0 };
+
+    int failures = 0;
+    if (capture.count != expectedCount)
+    {
+        printf("  Key input: %d transitions, expected %d\n", capture.count, expectedCount);
+        ++failures;
+    }
+    int wrong = 0;
+    for (int i = 0; i < std::min(capture.count, expectedCount); ++i)
+    {
+        const KeyEvent& event = capture.events[i];
+        bool ordered = i == 0 || event.stamp >= capture.events[i - 1].stamp;
+        if (event.key != expected[i].key || event.down != expected[i].down || !ordered)
+            ++wrong;
+    }
+    if (wrong > 0)
+    {
+        printf("  Key input: %d transitions out of order or wrong\n", wrong);
+        ++failures;
+    }
+    return failures;
+}
+
+#endif
+
+int RunRealtimeCheck(const SampleBank* bank)
+{
+    const int periods[] = { 64, 256, 1000 };
+    SampleBank empty;
+    if (!bank)
+        bank = &empty;
+    const int sample_rate = bank->GetCount() > 0 ? bank->GetSampleRate() : 48000;
+
+    printf("Real-time safety check, %d samples at %d Hz\n", bank->GetCount(), sample_rate);
+    bool failed = false;
+    for (int period : periods)
+    {
+        // Preparing allocates, so the check starts after it
+        SynthEngine engine;
+        engine.SetVoiceThreads(2);
+        engine.Prepare(bank, sample_rate);
+        EnableRealtimeCheck(true);
+        PlaySession(engine, bank, period);
+        int misplaced = ReplayMidiFile(engine, bank, period);
+        EnableRealtimeCheck(false);
+
+        unsigned long long violations = GetRealtimeViolationCount();
+        printf("  %4d frames: %llu violations, %d MIDI file events off their frames\n", period, violations, misplaced);
+        if (violations > 0)
+            PrintRealtimeViolations(stdout);
+        failed = failed || violations > 0 || misplaced > 0;
+    }
+    failed = CheckMidiFileParser() > 0 || failed;
+#ifndef _WIN32
+    failed = CheckKeyInput() > 0 || failed;
+#endif
+    printf(failed ? "FAILED\n" : "PASSED\n");
+    return failed ? 1 : 0;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+
+int RunBenchmarks()
+{
+    printf("Syntezator benchmarks, SIMD level %s\n\n", GetSimdLevelName(DetectSimdLevel()));
+    BenchmarkInterpolation();
+    BenchmarkMixer();
+    BenchmarkOscillators();
+    BenchmarkPhysicalPiano();
+    BenchmarkFm();
+    BenchmarkEffects();
+    BenchmarkVoiceKernels();
+    BenchmarkParallelVoices();
+    BenchmarkLayers();
+    BenchmarkLatency();
+    return 0;
+}
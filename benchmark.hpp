@@ -0,0 +1,15 @@
+#pragma once
+
+// Headless benchmarks and quality measurements of the DSP code, started with
+// "Syntezator --bench". Results are printed to the console.
+int RunBenchmarks();
+
+class SampleBank;
+
+// Plays a scripted session through every sound source and setting, then
+// replays a MIDI file in real time, with the real-time checker on; returns
+// 0 if the render calls never allocated, locked, touched files or slept,
+// every file event landed on its frame, damaged files were refused and,
+// on Linux, recorded key events were captured in order.
+// "Syntezator --rt-check"
+int RunRealtimeCheck(const SampleBank* bank);
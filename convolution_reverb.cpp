@@ -0,0 +1,347 @@
+#include "convolution_reverb.hpp"
+#include "denormals.hpp"
+#include "thread_scheduling.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+
+// Energy of each response channel; a mono sum of uncorrelated channels
+// loses 3 dB, so this lands the wet level about 7 dB under the dry one
+static const double IMPULSE_ENERGY = 0.4;
+
+//---------------------------------------------------------------------------
+// Uniform partitions
+
+void PartitionedConvolver::Prepare(const float* left, const float* right, int frames, int block)
+{
+    const int size = 2 * block;
+    m_Block = block;
+    m_Partitions = std::max(1, (frames + block - 1) / block);
+    m_Fft.Prepare(size);
+    m_Mac = GetSpectrumMacFunction(GetSimdLevel());
+
+    m_ImpulseRe.assign((size_t)m_Partitions * size, 0.0f);
+    m_ImpulseIm.assign((size_t)m_Partitions * size, 0.0f);
+    m_InputRe.assign((size_t)m_Partitions * size, 0.0f);
+    m_InputIm.assign((size_t)m_Partitions * size, 0.0f);
+    m_Window.assign(size, 0.0f);
+    m_SumRe.assign(size, 0.0f);
+    m_SumIm.assign(size, 0.0f);
+
+    // Zero-padded partitions; the 1 / size of the inverse transform is
+    // folded in here
+    const float scale = 1.0f / size;
+    for (int p = 0; p < m_Partitions; ++p)
+    {
+        float* re = &m_ImpulseRe[(size_t)p * size];
+        float* im = &m_ImpulseIm[(size_t)p * size];
+        for (int i = 0; i < block && p * block + i < frames; ++i)
+        {
+            re[i] = left[p * block + i] * scale;
+            im[i] = right[p * block + i] * scale;
+        }
+        m_Fft.Forward(re, im);
+    }
+    Reset();
+}
+
+void PartitionedConvolver::Reset()
+{
+    std::fill(m_InputRe.begin(), m_InputRe.end(), 0.0f);
+    std::fill(m_InputIm.begin(), m_InputIm.end(), 0.0f);
+    std::fill(m_Window.begin(), m_Window.end(), 0.0f);
+    m_Position = 0;
+}
+
+void PartitionedConvolver::Process(const float* input, float* outL, float* outR)
+{
+    const int size = 2 * m_Block;
+
+    // Overlap-save: transform the last two input blocks
+    memmove(m_Window.data(), m_Window.data() + m_Block, m_Block * sizeof(float));
+    memcpy(m_Window.data() + m_Block, input, m_Block * sizeof(float));
+    float* re = &m_InputRe[(size_t)m_Position * size];
+    float* im = &m_InputIm[(size_t)m_Position * size];
+    memcpy(re, m_Window.data(), size * sizeof(float));
+    memset(im, 0, size * sizeof(float));
+    m_Fft.Forward(re, im);
+
+    // Newest input with the first partition, older inputs with later ones
+    std::fill(m_SumRe.begin(), m_SumRe.end(), 0.0f);
+    std::fill(m_SumIm.begin(), m_SumIm.end(), 0.0f);
+    int slot = m_Position;
+    for (int p = 0; p < m_Partitions; ++p)
+    {
+        m_Mac(&m_InputRe[(size_t)slot * size], &m_InputIm[(size_t)slot * size],
+              &m_ImpulseRe[(size_t)p * size], &m_ImpulseIm[(size_t)p * size], m_SumRe.data(), m_SumIm.data(), size);
+        slot = slot == 0 ? m_Partitions - 1 : slot - 1;
+    }
+    m_Position = m_Position + 1 == m_Partitions ? 0 : m_Position + 1;
+
+    // The first half wrapped around; the second half is this block's output
+    m_Fft.Inverse(m_SumRe.data(), m_SumIm.data());
+    memcpy(outL, m_SumRe.data() + m_Block, m_Block * sizeof(float));
+    memcpy(outR, m_SumIm.data() + m_Block, m_Block * sizeof(float));
+}
+
+//---------------------------------------------------------------------------
+// Generated room
+
+void GenerateRoomImpulse(float seconds, int sampleRate, std::vector<float>& left, std::vector<float>& right)
+{
+    const int frames = std::max(1, (int)(seconds * sampleRate));
+    const double decay = 6.9078 / (seconds * sampleRate);     // 60 dB over the length
+    uint32_t seed = 12345;
+    auto random = [&seed]() {
+        seed = seed * 1664525u + 1013904223u;
+        return (float)(seed >> 8) * (2.0f / 16777216.0f) - 1.0f;
+    };
+
+    std::vector<float>* channels[2] = { &left, &right };
+    for (int c = 0; c < 2; ++c)
+    {
+        std::vector<float>& out = *channels[c];
+        out.assign(frames, 0.0f);
+
+        // Diffuse tail fading in behind the first reflections, losing
+        // high frequencies as it decays
+        const int onset = (int)(0.005f * sampleRate);
+        const int fade = (int)(0.02f * sampleRate);
+        float lowPass = 0.0f;
+        for (int i = onset; i < frames; ++i)
+        {
+            float damping = 0.15f + 0.7f * i / frames;
+            float noise = random();
+            lowPass = noise + (lowPass - noise) * damping;
+            float envelope = (float)std::exp(-decay * i) * std::min(1.0f, (float)(i - onset) / fade);
+            out[i] = lowPass * envelope;
+        }
+
+        // Sparse early reflections over the first 70 ms
+        for (int r = 0; r < 14; ++r)
+        {
+            float time = 0.004f + 0.066f * (0.5f + 0.5f * random());
+            int frame = std::min(frames - 1, (int)(time * sampleRate));
+            out[frame] += (random() < 0.0f ? -1.0f : 1.0f) * 2.5f * (1.0f - time / 0.08f);
+        }
+
+        double energy = 0.0;
+        for (float x : out)
+            energy += (double)x * x;
+        float gain = energy > 0.0 ? (float)std::sqrt(IMPULSE_ENERGY / energy) : 0.0f;
+        for (float& x : out)
+            x *= gain;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Background stages
+
+void BackgroundConvolver::Prepare(const float* left, const float* right, int frames, int block, int sampleRate)
+{
+    Stop();
+    m_Block = block;
+    m_Period = (double)block / sampleRate;
+    m_Convolver.Prepare(left, right, frames, block);
+    m_Input.assign(block, 0.0f);
+    m_JobInput.assign(block, 0.0f);
+    for (int s = 0; s < 2; ++s)
+    {
+        m_OutL[s].assign(block, 0.0f);
+        m_OutR[s].assign(block, 0.0f);
+    }
+    Reset();
+    m_Quit.store(false);
+    m_Worker = std::thread(&BackgroundConvolver::WorkerLoop, this);
+}
+
+void BackgroundConvolver::Stop()
+{
+    if (!m_Worker.joinable())
+        return;
+    m_Quit.store(true);
+    m_Wake.notify_one();
+    m_Worker.join();
+    m_Completed.store(m_Submitted.load());      // A job still queued is dropped
+}
+
+void BackgroundConvolver::Reset()
+{
+    // The worker may still be on a job that uses the convolver
+    Wait();
+    m_Convolver.Reset();
+    std::fill(m_Input.begin(), m_Input.end(), 0.0f);
+    m_Playing = -1;
+    m_Submitted.store(0);
+    m_Completed.store(0);
+}
+
+void BackgroundConvolver::Process(const float* input, long long position, float* outL, float* outR)
+{
+    const int offset = (int)(position % m_Block);
+
+    // At each block boundary collect the result for the coming block
+    // period, which is the input block before last convolved with this
+    // stage's part of the response, and hand the block that just completed
+    // to the worker
+    if (offset == 0 && position > 0)
+    {
+        long long block = position / m_Block;
+        Wait();
+        m_Playing = block >= 2 ? (int)((block - 2) & 1) : -1;
+        m_JobInput.swap(m_Input);
+        m_Submitted.store(block, std::memory_order_release);
+        m_Wake.notify_one();
+    }
+
+    if (m_Playing >= 0)
+    {
+        const float* resultL = m_OutL[m_Playing].data() + offset;
+        const float* resultR = m_OutR[m_Playing].data() + offset;
+        for (int i = 0; i < HEAD_BLOCK_FRAMES; ++i)
+        {
+            outL[i] += resultL[i];
+            outR[i] += resultR[i];
+        }
+    }
+    memcpy(m_Input.data() + offset, input, HEAD_BLOCK_FRAMES * sizeof(float));
+}
+
+// Only spins when the worker is behind, which in real time means the
+// machine cannot keep up; offline renders wait here regularly
+void BackgroundConvolver::Wait()
+{
+    if (m_Completed.load(std::memory_order_acquire) == m_Submitted.load(std::memory_order_relaxed))
+        return;
+    m_Waits.fetch_add(1, std::memory_order_relaxed);
+    while (m_Completed.load(std::memory_order_acquire) != m_Submitted.load(std::memory_order_relaxed))
+        std::this_thread::yield();
+}
+
+void BackgroundConvolver::WorkerLoop()
+{
+    typedef std::chrono::steady_clock Clock;
+    PromoteCurrentThread(ThreadRole::Worker, ("convolution " + std::to_string(m_Block)).c_str());
+    ScopedFlushDenormals flush;
+    float load = 0.0f;
+
+    for (;;)
+    {
+        {
+            // The audio thread notifies without the lock, so a wakeup can
+            // be missed; the timeout bounds the delay
+            std::unique_lock<std::mutex> lock(m_Mutex);
+            while (!m_Quit.load() && m_Completed.load() == m_Submitted.load(std::memory_order_acquire))
+                m_Wake.wait_for(lock, std::chrono::milliseconds(1));
+        }
+        if (m_Quit.load())
+            break;
+
+        long long job = m_Completed.load();
+        Clock::time_point start = Clock::now();
+        int slot = (int)(job & 1);
+        m_Convolver.Process(m_JobInput.data(), m_OutL[slot].data(), m_OutR[slot].data());
+        float used = (float)(std::chrono::duration<double>(Clock::now() - start).count() / m_Period);
+        load += (used - load) * 0.1f;
+        m_Load.store(load, std::memory_order_relaxed);
+        m_Completed.store(job + 1, std::memory_order_release);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Reverb
+
+void ConvolutionReverb::SetImpulse(const float* left, const float* right, int frames)
+{
+    m_ImpulseL.assign(left, left + frames);
+    m_ImpulseR.assign(right, right + frames);
+}
+
+void ConvolutionReverb::Prepare(int sampleRate)
+{
+    for (auto& stage : m_Stages)
+        stage.Stop();
+    if (m_ImpulseL.empty())
+        GenerateRoomImpulse(2.4f, sampleRate, m_ImpulseL, m_ImpulseR);
+
+    // Stage s covers [2 * block[s], 2 * block[s + 1]), the head everything
+    // before the first stage
+    const int frames = (int)m_ImpulseL.size();
+    const float* left = m_ImpulseL.data();
+    const float* right = m_ImpulseR.data();
+    m_Head.Prepare(left, right, std::min(frames, 2 * STAGE_BLOCK_FRAMES[0]), HEAD_BLOCK_FRAMES);
+    m_StageCount = 0;
+    for (int s = 0; s < BACKGROUND_STAGES; ++s)
+    {
+        int start = 2 * STAGE_BLOCK_FRAMES[s];
+        int end = s + 1 < BACKGROUND_STAGES ? 2 * STAGE_BLOCK_FRAMES[s + 1] : frames;
+        if (frames <= start)
+            break;
+        end = std::min(end, frames);
+        m_Stages[s].Prepare(left + start, right + start, end - start, STAGE_BLOCK_FRAMES[s], sampleRate);
+        m_StageCount = s + 1;
+    }
+    Reset();
+}
+
+void ConvolutionReverb::Reset()
+{
+    m_Head.Reset();
+    for (int s = 0; s < m_StageCount; ++s)
+        m_Stages[s].Reset();
+    memset(m_Input, 0, sizeof(m_Input));
+    memset(m_OutL, 0, sizeof(m_OutL));
+    memset(m_OutR, 0, sizeof(m_OutR));
+    m_Fill = 0;
+    m_Position = 0;
+}
+
+// Output lags the input by one head block
+void ConvolutionReverb::Process(const float* left, const float* right, float* wetL, float* wetR, int frames)
+{
+    int done = 0;
+    while (done < frames)
+    {
+        int count = std::min(HEAD_BLOCK_FRAMES - m_Fill, frames - done);
+        for (int i = 0; i < count; ++i)
+        {
+            m_Input[m_Fill + i] = 0.5f * (left[done + i] + right[done + i]);
+            wetL[done + i] = m_OutL[m_Fill + i];
+            wetR[done + i] = m_OutR[m_Fill + i];
+        }
+        m_Fill += count;
+        done += count;
+        if (m_Fill == HEAD_BLOCK_FRAMES)
+        {
+            ProcessBlock();
+            m_Fill = 0;
+        }
+    }
+}
+
+void ConvolutionReverb::ProcessBlock()
+{
+    m_Head.Process(m_Input, m_OutL, m_OutR);
+    for (int s = 0; s < m_StageCount; ++s)
+        m_Stages[s].Process(m_Input, m_Position, m_OutL, m_OutR);
+    m_Position += HEAD_BLOCK_FRAMES;
+}
+
+float ConvolutionReverb::GetBackgroundLoad() const
+{
+    float load = 0.0f;
+    for (int s = 0; s < m_StageCount; ++s)
+        load += m_Stages[s].GetLoad();
+    return load;
+}
+
+unsigned long long ConvolutionReverb::GetBackgroundWaits() const
+{
+    unsigned long long waits = 0;
+    for (int s = 0; s < m_StageCount; ++s)
+        waits += m_Stages[s].GetWaits();
+    return waits;
+}
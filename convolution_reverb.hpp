@@ -0,0 +1,134 @@
+#pragma once
+
+#include "fft.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The head of the impulse response is convolved in the audio thread in
+// blocks of HEAD_BLOCK_FRAMES, which is also the latency. The rest goes to
+// background stages with larger blocks, each on its own worker thread; a
+// stage with blocks of B frames starts 2 * B into the response, so every
+// block has one block period to finish. Larger blocks further out keep the
+// spectra streamed per output frame small.
+const int HEAD_BLOCK_FRAMES = 64;
+const int BACKGROUND_STAGES = 2;
+const int STAGE_BLOCK_FRAMES[BACKGROUND_STAGES] = { 1024, 8192 };
+
+// Uniformly partitioned overlap-save convolution of a mono input with a
+// stereo impulse response. The two response channels are packed as the
+// real and imaginary parts of one complex signal, so a single complex FFT
+// per block gives both output channels.
+class PartitionedConvolver
+{
+public:
+    // Allocates everything; the impulse may be shorter than one block
+    void Prepare(const float* left, const float* right, int frames, int block);
+    void Reset();
+
+    // Consumes one block of input and writes one block of each output
+    // channel, the convolution up to the end of this input block
+    void Process(const float* input, float* outL, float* outR);
+
+    int GetPartitions() const { return m_Partitions; }
+
+private:
+    Fft m_Fft;
+    SpectrumMacFn m_Mac = nullptr;
+    int m_Block = 0;
+    int m_Partitions = 0;
+    int m_Position = 0;                     // Newest slot of the input spectra
+    std::vector<float> m_ImpulseRe;         // [partition * 2 * block + bin]
+    std::vector<float> m_ImpulseIm;
+    std::vector<float> m_InputRe;           // Spectra of the recent input blocks, same layout
+    std::vector<float> m_InputIm;
+    std::vector<float> m_Window;            // Previous and current input block
+    std::vector<float> m_SumRe;
+    std::vector<float> m_SumIm;
+};
+
+// Decaying stereo noise with early reflections and air absorption, a
+// stand-in room when no measured response is loaded
+void GenerateRoomImpulse(float seconds, int sampleRate, std::vector<float>& left, std::vector<float>& right);
+
+// One background stage: the audio thread collects its input and plays its
+// results, the worker runs the convolution
+class BackgroundConvolver
+{
+public:
+    ~BackgroundConvolver() { Stop(); }
+
+    // Part of the response this stage covers; starts the worker
+    void Prepare(const float* left, const float* right, int frames, int block, int sampleRate);
+    void Stop();
+
+    // Audio thread. Called for each head block in order with the block's
+    // input; adds the stage's output for the same frames.
+    void Reset();
+    void Process(const float* input, long long position, float* outL, float* outR);
+
+    float GetLoad() const { return m_Load.load(std::memory_order_relaxed); }
+    unsigned long long GetWaits() const { return m_Waits.load(std::memory_order_relaxed); }
+
+private:
+    void Wait();
+    void WorkerLoop();
+
+    int m_Block = 0;
+    double m_Period = 0.0;                  // Seconds per block
+    PartitionedConvolver m_Convolver;
+    std::vector<float> m_Input;             // Filled by the audio thread
+    std::vector<float> m_JobInput;          // Read by the worker
+    std::vector<float> m_OutL[2];           // Results, alternating by job
+    std::vector<float> m_OutR[2];
+    int m_Playing = -1;                     // Result being played, -1 = none yet
+
+    std::thread m_Worker;
+    std::mutex m_Mutex;
+    std::condition_variable m_Wake;
+    std::atomic<bool> m_Quit{ false };
+    std::atomic<long long> m_Submitted{ 0 };
+    std::atomic<long long> m_Completed{ 0 };
+    std::atomic<float> m_Load{ 0.0f };
+    std::atomic<unsigned long long> m_Waits{ 0 };
+};
+
+// Impulse-response reverb for multi-second stereo responses. The input is
+// summed to mono.
+class ConvolutionReverb
+{
+public:
+    // Not while rendering: takes effect at the next Prepare()
+    void SetImpulse(const float* left, const float* right, int frames);
+
+    // Builds the spectra and starts the workers. Uses a generated room if
+    // no impulse was set.
+    void Prepare(int sampleRate);
+
+    // Audio thread
+    void Reset();
+    void Process(const float* left, const float* right, float* wetL, float* wetR, int frames);
+
+    // Any thread: worker time as a fraction of real time, summed over the
+    // stages, and how often the audio thread had to wait for a worker
+    float GetBackgroundLoad() const;
+    unsigned long long GetBackgroundWaits() const;
+
+private:
+    void ProcessBlock();
+
+    std::vector<float> m_ImpulseL;
+    std::vector<float> m_ImpulseR;
+
+    PartitionedConvolver m_Head;
+    float m_Input[HEAD_BLOCK_FRAMES] = {};
+    float m_OutL[HEAD_BLOCK_FRAMES] = {};
+    float m_OutR[HEAD_BLOCK_FRAMES] = {};
+    int m_Fill = 0;
+    long long m_Position = 0;               // Input frames in completed head blocks
+
+    int m_StageCount = 0;                   // Stages the response reaches
+    BackgroundConvolver m_Stages[BACKGROUND_STAGES];
+};
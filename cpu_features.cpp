@@ -0,0 +1,70 @@
+#include "cpu_features.hpp"
+
+#if SYNTH_X86 && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static SimdLevel g_SimdLimit = SimdLevel::AVX2;
+
+SimdLevel DetectSimdLevel()
+{
+#if SYNTH_X86 && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+
+    bool avx2 = false;
+    if (max_leaf >= 7 && osxsave && avx)
+    {
+        // The OS must save the YMM registers on context switches
+        unsigned long long xcr0 = _xgetbv(0);
+        if ((xcr0 & 0x6) == 0x6)
+        {
+            __cpuidex(info, 7, 0);
+            avx2 = (info[1] & (1 << 5)) != 0;
+        }
+    }
+
+    if (avx2)
+        return SimdLevel::AVX2;
+    if (sse2)
+        return SimdLevel::SSE2;
+    return SimdLevel::Scalar;
+#elif SYNTH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return SimdLevel::SSE2;
+    return SimdLevel::Scalar;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel GetSimdLevel()
+{
+    static const SimdLevel detected = DetectSimdLevel();
+    return detected < g_SimdLimit ? detected : g_SimdLimit;
+}
+
+void SetSimdLevelLimit(SimdLevel limit)
+{
+    g_SimdLimit = limit;
+}
+
+const char* GetSimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::Scalar: return "scalar";
+    case SimdLevel::SSE2: return "SSE2";
+    case SimdLevel::AVX2: return "AVX2";
+    default: return "?";
+    }
+}
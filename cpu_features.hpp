@@ -0,0 +1,68 @@
+#pragma once
+
+// Runtime detection of the SIMD instruction sets used by the DSP kernels.
+// Kernels are compiled for every level and the best one supported by the
+// CPU is picked once, so a single binary runs on old and new machines.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SYNTH_X86 1
+#include <immintrin.h>
+#else
+#define SYNTH_X86 0
+#endif
+
+// GCC and Clang only allow SIMD intrinsics inside functions marked for that
+// target; MSVC accepts them anywhere.
+#if SYNTH_X86 && (defined(__GNUC__) || defined(__clang__))
+#define SYNTH_TARGET_SSE2 __attribute__((target("sse2")))
+#define SYNTH_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define SYNTH_TARGET_SSE2
+#define SYNTH_TARGET_AVX2
+#endif
+
+enum class SimdLevel
+{
+    Scalar,
+    SSE2,
+    AVX2,
+    Count
+};
+
+SimdLevel DetectSimdLevel();                    // What the CPU and OS support
+SimdLevel GetSimdLevel();                       // What the kernels currently use
+void SetSimdLevelLimit(SimdLevel limit);        // Cap the level (benchmarks, debugging)
+const char* GetSimdLevelName(SimdLevel level);
+
+#if SYNTH_X86
+// Kernels that run one voice per lane accumulate 4 lane values per frame;
+// this adds the horizontal sum of each frame's 4 values to out
+SYNTH_TARGET_SSE2 inline void FoldLanes(const float* acc, float* out, int frames)
+{
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 r0 = _mm_load_ps(acc + 4 * i);
+        __m128 r1 = _mm_load_ps(acc + 4 * i + 4);
+        __m128 r2 = _mm_load_ps(acc + 4 * i + 8);
+        __m128 r3 = _mm_load_ps(acc + 4 * i + 12);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        __m128 sum = _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3));
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), sum));
+    }
+    for (; i < frames; ++i)
+        out[i] += acc[4 * i] + acc[4 * i + 1] + acc[4 * i + 2] + acc[4 * i + 3];
+}
+
+// Same for 8 lane values per frame, halved to 4 in scratch (4 floats per frame)
+SYNTH_TARGET_AVX2 inline void FoldLanes8(const float* acc, float* scratch, float* out, int frames)
+{
+    for (int i = 0; i < frames; ++i)
+    {
+        __m256 v = _mm256_load_ps(acc + 8 * i);
+        _mm_store_ps(scratch + 4 * i, _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+    }
+    _mm256_zeroupper();
+    FoldLanes(scratch, out, frames);
+}
+#endif
@@ -0,0 +1,144 @@
+#include "denormals.hpp"
+#include "cpu_features.hpp"
+
+#if SYNTH_X86
+// MXCSR control and sticky flag bits
+static const unsigned int FLUSH_TO_ZERO = 0x8000;
+static const unsigned int DENORMALS_ARE_ZERO = 0x0040;
+static const unsigned int UNDERFLOW_FLAG = 0x0010;
+static const unsigned int DENORMAL_FLAG = 0x0002;
+
+// MXCSR only governs SSE math; a scalar build on an x87-only CPU has
+// nothing to set or read
+static bool HasMxcsr()
+{
+    static const bool sse = DetectSimdLevel() >= SimdLevel::SSE2;
+    return sse;
+}
+
+SYNTH_TARGET_SSE2 static unsigned int GetCsr()
+{
+    return _mm_getcsr();
+}
+
+SYNTH_TARGET_SSE2 static void SetCsr(unsigned int value)
+{
+    _mm_setcsr(value);
+}
+#elif defined(__aarch64__)
+// FPCR flush-to-zero, which also covers denormal inputs
+static const unsigned long long FLUSH_TO_ZERO = 1ull << 24;
+
+static unsigned long long ReadFpcr()
+{
+    unsigned long long value;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(value));
+    return value;
+}
+
+static void WriteFpcr(unsigned long long value)
+{
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(value));
+}
+#endif
+
+ScopedFlushDenormals::ScopedFlushDenormals(bool enabled)
+{
+    if (!enabled)
+        return;
+#if SYNTH_X86
+    if (!HasMxcsr())
+        return;
+    m_Saved = GetCsr();
+    SetCsr(m_Saved | FLUSH_TO_ZERO | DENORMALS_ARE_ZERO);
+    m_Changed = true;
+#elif defined(__aarch64__)
+    unsigned long long fpcr = ReadFpcr();
+    m_Saved = (unsigned int)fpcr;
+    WriteFpcr(fpcr | FLUSH_TO_ZERO);
+    m_Changed = true;
+#endif
+}
+
+ScopedFlushDenormals::~ScopedFlushDenormals()
+{
+    if (!m_Changed)
+        return;
+#if SYNTH_X86
+    // Keep the exception flags raised meanwhile, only the mode goes back
+    unsigned int mode = FLUSH_TO_ZERO | DENORMALS_ARE_ZERO;
+    SetCsr((GetCsr() & ~mode) | (m_Saved & mode));
+#elif defined(__aarch64__)
+    WriteFpcr((ReadFpcr() & ~FLUSH_TO_ZERO) | (m_Saved & FLUSH_TO_ZERO));
+#endif
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+
+void DenormalMonitor::SetCountingEnabled(bool enabled)
+{
+    if (enabled && !IsCountingEnabled())
+    {
+        m_Blocks.store(0, std::memory_order_relaxed);
+        for (auto& count : m_Counts)
+            count.store(0, std::memory_order_relaxed);
+    }
+    m_CountingEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+void DenormalMonitor::BeginBlock()
+{
+#if SYNTH_X86
+    m_Counting = m_CountingEnabled.load(std::memory_order_relaxed) && HasMxcsr();
+#endif
+    m_BlockMask.store(0, std::memory_order_relaxed);
+}
+
+void DenormalMonitor::Begin()
+{
+#if SYNTH_X86
+    if (m_Counting)
+        SetCsr(GetCsr() & ~(UNDERFLOW_FLAG | DENORMAL_FLAG));
+#endif
+}
+
+void DenormalMonitor::End(DspNode node)
+{
+#if SYNTH_X86
+    if (m_Counting && (GetCsr() & (UNDERFLOW_FLAG | DENORMAL_FLAG)))
+        m_BlockMask.fetch_or(1u << (int)node, std::memory_order_relaxed);
+#else
+    (void)node;
+#endif
+}
+
+void DenormalMonitor::EndBlock()
+{
+    if (!m_Counting)
+        return;
+    m_Blocks.fetch_add(1, std::memory_order_relaxed);
+    for (int n = 0; n < (int)DspNode::Count; ++n)
+    {
+        if (m_BlockMask.load(std::memory_order_relaxed) & (1u << n))
+            m_Counts[n].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+const char* DenormalMonitor::GetNodeName(DspNode node)
+{
+    switch (node)
+    {
+    case DspNode::SampleVoices: return "Sample voices";
+    case DspNode::Oscillators: return "Oscillators";
+    case DspNode::PhysicalPiano: return "Physical piano";
+    case DspNode::Fm: return "FM";
+    case DspNode::Eq: return "EQ";
+    case DspNode::Compressor: return "Compressor";
+    case DspNode::Chorus: return "Chorus";
+    case DspNode::Delay: return "Delay";
+    case DspNode::Reverb: return "Reverb";
+    case DspNode::Convolution: return "Convolution";
+    case DspNode::Limiter: return "Limiter";
+    default: return "?";
+    }
+}
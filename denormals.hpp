@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+
+// Decaying filter, reverb and string states end in denormals, which x86
+// handles in microcode at 10-100x the cost of normal floats. Every thread
+// that renders audio runs with flush-to-zero and denormals-are-zero set, so
+// they cannot occur; the previous mode is restored when it leaves.
+class ScopedFlushDenormals
+{
+public:
+    explicit ScopedFlushDenormals(bool enabled = true);
+    ~ScopedFlushDenormals();
+
+    ScopedFlushDenormals(const ScopedFlushDenormals&) = delete;
+    ScopedFlushDenormals& operator=(const ScopedFlushDenormals&) = delete;
+
+private:
+    unsigned int m_Saved = 0;
+    bool m_Changed = false;
+};
+
+// DSP stages the denormal monitor reports on; the effects keep the order of
+// EffectType
+enum class DspNode
+{
+    SampleVoices,
+    Oscillators,
+    PhysicalPiano,
+    Fm,
+    Eq,
+    Compressor,
+    Chorus,
+    Delay,
+    Reverb,
+    Convolution,
+    Limiter,
+    Count
+};
+
+// Debug instrumentation: counts, for each DSP node, the render calls in
+// which its float math underflowed or read a denormal. Uses the sticky
+// exception flags of the SSE unit, which are raised whether or not the
+// results are flushed, so it sees the nodes that would produce denormals
+// with flushing on. x86 only; elsewhere nothing is counted.
+class DenormalMonitor
+{
+public:
+    // UI thread. Flushing can be switched off to hear and measure what the
+    // denormals cost; turning counting on clears the counts.
+    void SetFlushEnabled(bool enabled) { m_Flush.store(enabled, std::memory_order_relaxed); }
+    bool IsFlushEnabled() const { return m_Flush.load(std::memory_order_relaxed); }
+    void SetCountingEnabled(bool enabled);
+    bool IsCountingEnabled() const { return m_CountingEnabled.load(std::memory_order_relaxed); }
+
+    // Audio thread, except Begin() and End(), which bracket each node's work
+    // on whichever thread does it and may be repeated within a render call;
+    // a node counts once per call.
+    void BeginBlock();
+    void Begin();
+    void End(DspNode node);
+    void EndBlock();
+
+    unsigned long long GetBlocks() const { return m_Blocks.load(std::memory_order_relaxed); }
+    unsigned long long GetCount(DspNode node) const { return m_Counts[(int)node].load(std::memory_order_relaxed); }
+    static const char* GetNodeName(DspNode node);
+
+private:
+    std::atomic<bool> m_Flush{ true };
+    std::atomic<bool> m_CountingEnabled{ false };
+    bool m_Counting = false;            // Sampled once per render call
+    std::atomic<unsigned int> m_BlockMask{ 0 };     // Nodes flagged in this render call
+    std::atomic<unsigned long long> m_Blocks{ 0 };
+    std::atomic<unsigned long long> m_Counts[(int)DspNode::Count] = {};
+};
@@ -0,0 +1,321 @@
+#include "dsp_graph.hpp"
+#include "job_pool.hpp"
+#include <algorithm>
+#include <cstring>
+
+int GetPortChannels(PortType type)
+{
+    return type == PortType::Stereo ? 2 : 1;
+}
+
+GraphNode::GraphNode(const char* name, std::vector<PortType> inputs, std::vector<PortType> outputs)
+    : m_Name(name), m_Inputs(std::move(inputs)), m_Outputs(std::move(outputs))
+{
+}
+
+MixNode::MixNode(const char* name, PortType type, int inputs)
+    : GraphNode(name, std::vector<PortType>(inputs, type), { type }), m_Channels(GetPortChannels(type))
+{
+}
+
+void MixNode::Process(const GraphBuffers& buffers)
+{
+    const int inputs = (int)GetInputs().size();
+    for (int c = 0; c < m_Channels; ++c)
+    {
+        float* out = buffers.outputs[0] + c * MAX_GRAPH_FRAMES;
+        if (inputs == 0)
+        {
+            memset(out, 0, buffers.frames * sizeof(float));
+            continue;
+        }
+        memcpy(out, buffers.inputs[0] + c * MAX_GRAPH_FRAMES, buffers.frames * sizeof(float));
+        for (int p = 1; p < inputs; ++p)
+        {
+            const float* in = buffers.inputs[p] + c * MAX_GRAPH_FRAMES;
+            for (int i = 0; i < buffers.frames; ++i)
+                out[i] += in[i];
+        }
+    }
+}
+
+SourceNode::SourceNode(const char* name, SourceFn fn, void* user)
+    : GraphNode(name, {}, { PortType::Stereo }), m_Fn(fn), m_User(user)
+{
+}
+
+void SourceNode::Process(const GraphBuffers& buffers)
+{
+    float* left = buffers.outputs[0];
+    float* right = left + MAX_GRAPH_FRAMES;
+    memset(left, 0, buffers.frames * sizeof(float));
+    memset(right, 0, buffers.frames * sizeof(float));
+    m_Fn(m_User, left, right, buffers.frames);
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+
+void CompiledGraph::RunStep(void* user, int job)
+{
+    CompiledGraph* graph = (CompiledGraph*)user;
+    const Step& step = graph->m_Steps[graph->m_LevelStart[graph->m_Level] + job];
+    GraphBuffers buffers = { graph->m_InputPointers.data() + step.firstInput, graph->m_OutputPointers.data() + step.firstOutput, graph->m_Frames };
+    step.node->Process(buffers);
+}
+
+void CompiledGraph::Process(float* left, float* right, int frames, JobPool* pool, bool flushDenormals)
+{
+    m_Frames = std::min(frames, MAX_GRAPH_FRAMES);
+    for (m_Level = 0; m_Level < m_Shape.levels; ++m_Level)
+    {
+        int nodes = m_LevelStart[m_Level + 1] - m_LevelStart[m_Level];
+        if (pool && pool->GetHelperCount() > 0 && nodes > 1)
+            pool->Run(nodes, RunStep, this, flushDenormals);
+        else
+        {
+            for (int job = 0; job < nodes; ++job)
+                RunStep(this, job);
+        }
+    }
+
+    for (int i = 0; i < m_Frames; ++i)
+    {
+        left[i] += m_Result[i];
+        right[i] += m_Result[MAX_GRAPH_FRAMES + i];
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// UI thread
+
+bool DspGraph::Fail(const std::string& error)
+{
+    m_Error = error;
+    return false;
+}
+
+int DspGraph::AddNode(GraphNode* node)
+{
+    m_Nodes.push_back(node);
+    return (int)m_Nodes.size() - 1;
+}
+
+bool DspGraph::Connect(int from, int output, int to, int input)
+{
+    const int count = (int)m_Nodes.size();
+    if (from < 0 || from >= count || to < 0 || to >= count)
+        return Fail("No such node");
+    const std::vector<PortType>& outputs = m_Nodes[from]->GetOutputs();
+    const std::vector<PortType>& inputs = m_Nodes[to]->GetInputs();
+    if (output < 0 || output >= (int)outputs.size())
+        return Fail(m_Nodes[from]->GetName() + " has no output " + std::to_string(output));
+    if (input < 0 || input >= (int)inputs.size())
+        return Fail(m_Nodes[to]->GetName() + " has no input " + std::to_string(input));
+    if (outputs[output] != inputs[input])
+        return Fail("Port types differ from " + m_Nodes[from]->GetName() + " to " + m_Nodes[to]->GetName());
+    for (const Edge& edge : m_Edges)
+    {
+        if (edge.to == to && edge.input == input)
+            return Fail(m_Nodes[to]->GetName() + " input " + std::to_string(input) + " is already connected");
+    }
+    m_Edges.push_back({ from, output, to, input });
+    return true;
+}
+
+bool DspGraph::SetOutput(int node, int output)
+{
+    if (node < 0 || node >= (int)m_Nodes.size())
+        return Fail("No such node");
+    const std::vector<PortType>& outputs = m_Nodes[node]->GetOutputs();
+    if (output < 0 || output >= (int)outputs.size() || outputs[output] != PortType::Stereo)
+        return Fail("The graph output must be a stereo port");
+    m_OutputNode = node;
+    m_OutputPort = output;
+    return true;
+}
+
+std::unique_ptr<CompiledGraph> DspGraph::Compile()
+{
+    if (m_OutputNode < 0)
+    {
+        Fail("The graph has no output");
+        return nullptr;
+    }
+    const int count = (int)m_Nodes.size();
+
+    // Nodes the output depends on
+    std::vector<bool> needed(count, false);
+    std::vector<int> stack = { m_OutputNode };
+    needed[m_OutputNode] = true;
+    while (!stack.empty())
+    {
+        int node = stack.back();
+        stack.pop_back();
+        for (const Edge& edge : m_Edges)
+        {
+            if (edge.to == node && !needed[edge.from])
+            {
+                needed[edge.from] = true;
+                stack.push_back(edge.from);
+            }
+        }
+    }
+
+    // Kahn's algorithm; a node's level is one past that of its deepest input
+    std::vector<int> waiting(count, 0), level(count, 0), order;
+    for (const Edge& edge : m_Edges)
+        waiting[edge.to] += needed[edge.to] ? 1 : 0;
+    for (int node = 0; node < count; ++node)
+    {
+        if (needed[node] && waiting[node] == 0)
+            order.push_back(node);
+    }
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        for (const Edge& edge : m_Edges)
+        {
+            if (edge.from != order[i] || !needed[edge.to])
+                continue;
+            level[edge.to] = std::max(level[edge.to], level[order[i]] + 1);
+            if (--waiting[edge.to] == 0)
+                order.push_back(edge.to);
+        }
+    }
+    for (int node = 0; node < count; ++node)
+    {
+        if (needed[node] && waiting[node] > 0)
+        {
+            Fail("The graph has a cycle through " + m_Nodes[node]->GetName());
+            return nullptr;
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return level[a] < level[b]; });
+    const int levels = level[order.back()] + 1;
+
+    // One value per output port, live from its node's level to that of its
+    // last reader; the graph output lives to the end
+    std::vector<int> firstValue(count + 1, 0);
+    for (int node = 0; node < count; ++node)
+        firstValue[node + 1] = firstValue[node] + (needed[node] ? (int)m_Nodes[node]->GetOutputs().size() : 0);
+    std::vector<int> lastUse(firstValue[count], 0);
+    for (int node : order)
+    {
+        for (int v = firstValue[node]; v < firstValue[node + 1]; ++v)
+            lastUse[v] = level[node];
+    }
+    for (const Edge& edge : m_Edges)
+    {
+        if (needed[edge.to])
+            lastUse[firstValue[edge.from] + edge.output] = std::max(lastUse[firstValue[edge.from] + edge.output], level[edge.to]);
+    }
+    const int result = firstValue[m_OutputNode] + m_OutputPort;
+    lastUse[result] = levels;
+
+    // Interval colouring, a level at a time: a buffer is free again once
+    // the level of its value's last reader is over, never sooner, so the
+    // nodes of one level never share one
+    std::unique_ptr<CompiledGraph> graph(new CompiledGraph());
+    std::vector<int> bufferOf(lastUse.size(), -1), bufferChannels;
+    std::vector<int> freeBuffers[2];
+    std::vector<bool> released(lastUse.size(), false);
+    size_t step = 0;
+    for (int l = 0; l < levels; ++l)
+    {
+        for (size_t v = 0; v < lastUse.size(); ++v)
+        {
+            if (bufferOf[v] >= 0 && !released[v] && lastUse[v] < l)
+            {
+                released[v] = true;
+                freeBuffers[bufferChannels[bufferOf[v]] - 1].push_back(bufferOf[v]);
+            }
+        }
+
+        graph->m_LevelStart.push_back((int)step);
+        for (; step < order.size() && level[order[step]] == l; ++step)
+        {
+            int node = order[step];
+            const std::vector<PortType>& outputs = m_Nodes[node]->GetOutputs();
+            for (int p = 0; p < (int)outputs.size(); ++p)
+            {
+                int channels = GetPortChannels(outputs[p]);
+                std::vector<int>& spare = freeBuffers[channels - 1];
+                if (!spare.empty())
+                {
+                    bufferOf[firstValue[node] + p] = spare.back();
+                    spare.pop_back();
+                }
+                else
+                {
+                    bufferOf[firstValue[node] + p] = (int)bufferChannels.size();
+                    bufferChannels.push_back(channels);
+                }
+            }
+        }
+    }
+    graph->m_LevelStart.push_back((int)step);
+
+    std::vector<size_t> bufferOffset(bufferChannels.size(), 0);
+    size_t floats = 0;
+    for (size_t b = 0; b < bufferChannels.size(); ++b)
+    {
+        bufferOffset[b] = floats;
+        floats += (size_t)bufferChannels[b] * MAX_GRAPH_FRAMES;
+    }
+    graph->m_Memory.assign(floats, 0.0f);
+    graph->m_Silence.assign(2 * MAX_GRAPH_FRAMES, 0.0f);
+    graph->m_Shape = { (int)order.size(), levels, (int)lastUse.size(), (int)bufferChannels.size() };
+
+    auto valuePointer = [&](int value) { return graph->m_Memory.data() + bufferOffset[bufferOf[value]]; };
+    for (int node : order)
+    {
+        CompiledGraph::Step entry = { m_Nodes[node], (int)graph->m_InputPointers.size(), (int)graph->m_OutputPointers.size() };
+        for (int input = 0; input < (int)m_Nodes[node]->GetInputs().size(); ++input)
+        {
+            const float* pointer = graph->m_Silence.data();
+            for (const Edge& edge : m_Edges)
+            {
+                if (edge.to == node && edge.input == input)
+                    pointer = valuePointer(firstValue[edge.from] + edge.output);
+            }
+            graph->m_InputPointers.push_back(pointer);
+        }
+        for (int v = firstValue[node]; v < firstValue[node + 1]; ++v)
+            graph->m_OutputPointers.push_back(valuePointer(v));
+        graph->m_Steps.push_back(entry);
+    }
+    graph->m_Result = valuePointer(result);
+    m_Error.clear();
+    return graph;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+
+GraphSchedule::~GraphSchedule()
+{
+    CollectRetired();
+    delete m_Pending.load();
+    delete m_Active;
+}
+
+void GraphSchedule::Publish(std::unique_ptr<CompiledGraph> schedule)
+{
+    // The audio thread only ever swaps the slot for nullptr, so whatever
+    // comes back here was never seen by it
+    delete m_Pending.exchange(schedule.release(), std::memory_order_acq_rel);
+}
+
+void GraphSchedule::CollectRetired()
+{
+    CompiledGraph* schedule;
+    while (m_Retired.Pop(schedule))
+        delete schedule;
+}
+
+CompiledGraph* GraphSchedule::Acquire()
+{
+    // The replaced schedule is let go of only once it has a way back to be
+    // freed; while the UI thread is not collecting, the current one stays
+    if (m_Pending.load(std::memory_order_relaxed) && (!m_Active || m_Retired.Push(m_Active)))
+        m_Active = m_Pending.exchange(nullptr, std::memory_order_acquire);
+    return m_Active;
+}
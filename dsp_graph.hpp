@@ -0,0 +1,178 @@
+#pragma once
+
+#include "event_queue.hpp"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+class JobPool;
+
+const int MAX_GRAPH_FRAMES = 256;
+
+enum class PortType
+{
+    Mono,
+    Stereo
+};
+
+int GetPortChannels(PortType type);
+
+// The buffers of one Process() call, one pointer per port. Channel c of a
+// port starts c * MAX_GRAPH_FRAMES floats after its pointer. Unconnected
+// inputs read silence.
+struct GraphBuffers
+{
+    const float* const* inputs;
+    float* const* outputs;
+    int frames;
+};
+
+// A processing stage with typed input and output ports
+class GraphNode
+{
+public:
+    GraphNode(const char* name, std::vector<PortType> inputs, std::vector<PortType> outputs);
+    virtual ~GraphNode() {}
+
+    const std::string& GetName() const { return m_Name; }
+    const std::vector<PortType>& GetInputs() const { return m_Inputs; }
+    const std::vector<PortType>& GetOutputs() const { return m_Outputs; }
+
+    // Audio thread or a helper. Overwrites every output; nodes of the same
+    // schedule level run at the same time, so it may touch no state shared
+    // with another node.
+    virtual void Process(const GraphBuffers& buffers) = 0;
+
+private:
+    std::string m_Name;
+    std::vector<PortType> m_Inputs;
+    std::vector<PortType> m_Outputs;
+};
+
+// Sums its inputs in port order
+class MixNode : public GraphNode
+{
+public:
+    MixNode(const char* name, PortType type, int inputs);
+    void Process(const GraphBuffers& buffers) override;
+
+private:
+    int m_Channels;
+};
+
+// A renderer that adds into a stereo buffer, as a source with one output
+typedef void (*SourceFn)(void* user, float* left, float* right, int frames);
+
+class SourceNode : public GraphNode
+{
+public:
+    SourceNode(const char* name, SourceFn fn, void* user);
+    void Process(const GraphBuffers& buffers) override;
+
+private:
+    SourceFn m_Fn;
+    void* m_User;
+};
+
+struct GraphShape
+{
+    int nodes = 0;
+    int levels = 0;
+    int ports = 0;          // Output ports scheduled
+    int buffers = 0;        // Buffers they share
+};
+
+// A flat schedule: the nodes in dependency levels, every port bound to a
+// buffer from a shared pool. Buffers are reused once their last reader has
+// run, and never within a level, so the nodes of one level can run in
+// parallel on any threads.
+class CompiledGraph
+{
+public:
+    // Audio thread. Adds the graph's output to left and right. With a pool,
+    // levels of more than one node are spread over its threads; the result
+    // is the same either way.
+    void Process(float* left, float* right, int frames, JobPool* pool, bool flushDenormals);
+
+    const GraphShape& GetShape() const { return m_Shape; }
+
+private:
+    friend class DspGraph;
+
+    struct Step
+    {
+        GraphNode* node;
+        int firstInput;             // Into m_InputPointers
+        int firstOutput;            // Into m_OutputPointers
+    };
+
+    static void RunStep(void* user, int job);
+
+    std::vector<Step> m_Steps;                  // Level by level
+    std::vector<int> m_LevelStart;              // First step of each level, then the step count
+    std::vector<const float*> m_InputPointers;
+    std::vector<float*> m_OutputPointers;
+    std::vector<float> m_Memory;                // Every pooled buffer
+    std::vector<float> m_Silence;               // Read by unconnected inputs
+    const float* m_Result = nullptr;            // Stereo
+    GraphShape m_Shape;
+    int m_Frames = 0;                           // Of the call in progress
+    int m_Level = 0;
+};
+
+// Nodes and connections, edited and compiled on the UI thread. The nodes
+// are not owned and must outlive every schedule compiled from them.
+class DspGraph
+{
+public:
+    int AddNode(GraphNode* node);
+
+    // False, with the reason in GetError(), if a port does not exist, the
+    // types differ or the input is already connected
+    bool Connect(int from, int output, int to, int input);
+    // The stereo output the schedule adds to the caller's buffers
+    bool SetOutput(int node, int output);
+
+    // Only the nodes the output depends on are scheduled. nullptr, with the
+    // reason in GetError(), if there is no output or they form a cycle.
+    std::unique_ptr<CompiledGraph> Compile();
+    const std::string& GetError() const { return m_Error; }
+
+private:
+    struct Edge
+    {
+        int from, output, to, input;
+    };
+
+    bool Fail(const std::string& error);
+
+    std::vector<GraphNode*> m_Nodes;
+    std::vector<Edge> m_Edges;
+    int m_OutputNode = -1;
+    int m_OutputPort = 0;
+    std::string m_Error;
+};
+
+// Hands compiled schedules from the UI thread to the audio thread. Neither
+// side waits: the audio thread takes the newest schedule at the start of a
+// block and passes the one it replaced back to be freed.
+class GraphSchedule
+{
+public:
+    ~GraphSchedule();
+
+    // UI thread. A schedule published before and not yet taken is freed.
+    void Publish(std::unique_ptr<CompiledGraph> schedule);
+    // UI thread. Frees the schedules the audio thread has let go of.
+    void CollectRetired();
+
+    // Audio thread. The schedule for this block, nullptr if none was
+    // published yet.
+    CompiledGraph* Acquire();
+
+private:
+    std::atomic<CompiledGraph*> m_Pending{ nullptr };
+    CompiledGraph* m_Active = nullptr;          // Audio thread
+    SpscQueue<CompiledGraph*, 16> m_Retired;    // Audio thread to UI thread
+};
@@ -0,0 +1,139 @@
+#include "dsp_telemetry.hpp"
+#include "audio_backend.hpp"
+#include "latency_monitor.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+static const int WINDOW_CAPACITY = 16384;       // 5 s of 15-frame calls at 48 kHz
+
+DspTelemetry::DspTelemetry()
+    : m_Window(WINDOW_CAPACITY)
+{
+}
+
+void DspTelemetry::RecordBlock(double renderSeconds, int frames, int sampleRate)
+{
+    if (frames <= 0 || sampleRate <= 0)
+        return;
+
+    BlockStats block;
+    block.time = LatencyMonitor::Now();
+    block.render = (float)renderSeconds;
+    block.deadline = (float)frames / sampleRate;
+    const AudioBackend* backend = m_Backend.load(std::memory_order_relaxed);
+    block.xruns = backend ? backend->GetXruns() : 0;
+    if (!m_Queue.Push(block))
+        m_Dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void DspTelemetry::Update()
+{
+    TelemetrySummary& summary = m_Summary;
+    BlockStats block;
+    for (int i = 0; i < QUEUE_CAPACITY && m_Queue.Pop(block); ++i)
+    {
+        if (m_WindowCount == WINDOW_CAPACITY)
+        {
+            m_WindowStart = (m_WindowStart + 1) % WINDOW_CAPACITY;
+            --m_WindowCount;
+        }
+        m_Window[(m_WindowStart + m_WindowCount++) % WINDOW_CAPACITY] = block;
+
+        ++summary.blocks;
+        if (block.render > block.deadline)
+            ++summary.overruns;
+        if (block.Load() >= summary.worst.Load())
+            summary.worst = block;
+        summary.xruns = block.xruns - std::min(block.xruns, m_BaseXruns);
+    }
+    summary.dropped = m_Dropped.load(std::memory_order_relaxed) - m_DroppedBase;
+
+    // Aged by the clock, so the window empties when rendering stops
+    const long long now = LatencyMonitor::Now();
+    const long long span = (long long)(TELEMETRY_WINDOW_SECONDS * 1e9);
+    while (m_WindowCount > 0 && now - m_Window[m_WindowStart].time > span)
+    {
+        m_WindowStart = (m_WindowStart + 1) % WINDOW_CAPACITY;
+        --m_WindowCount;
+    }
+
+    summary.windowBlocks = m_WindowCount;
+    summary.window = 0.0;
+    summary.minLoad = summary.avgLoad = summary.maxLoad = 0.0f;
+    summary.windowXruns = 0;
+    if (m_WindowCount == 0)
+        return;
+
+    double render = 0.0, audio = 0.0;
+    float minLoad = 1e30f, maxLoad = 0.0f;
+    for (int i = 0; i < m_WindowCount; ++i)
+    {
+        const BlockStats& b = m_Window[(m_WindowStart + i) % WINDOW_CAPACITY];
+        render += b.render;
+        audio += b.deadline;
+        minLoad = std::min(minLoad, b.Load());
+        maxLoad = std::max(maxLoad, b.Load());
+    }
+    const BlockStats& oldest = m_Window[m_WindowStart];
+    const BlockStats& newest = m_Window[(m_WindowStart + m_WindowCount - 1) % WINDOW_CAPACITY];
+    summary.window = (newest.time - oldest.time) * 1e-9 + oldest.deadline;
+    summary.minLoad = minLoad;
+    summary.avgLoad = audio > 0.0 ? (float)(render / audio) : 0.0f;
+    summary.maxLoad = maxLoad;
+    // The oldest block's own count includes the xruns before it
+    summary.windowXruns = newest.xruns - oldest.xruns;
+}
+
+void DspTelemetry::Reset()
+{
+    BlockStats block;
+    while (m_Queue.Pop(block))
+        ;
+    m_WindowStart = 0;
+    m_WindowCount = 0;
+    const AudioBackend* backend = m_Backend.load(std::memory_order_relaxed);
+    m_BaseXruns = backend ? backend->GetXruns() : 0;
+    m_DroppedBase = m_Dropped.load(std::memory_order_relaxed);
+    m_Summary = TelemetrySummary();
+}
+
+bool DspTelemetry::WriteStatsFile(const char* path) const
+{
+    const TelemetrySummary& s = m_Summary;
+    const std::string temp = std::string(path) + ".tmp";
+    FILE* file = fopen(temp.c_str(), "w");
+    if (!file)
+        return false;
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"window_seconds\": %.3f,\n", s.window);
+    fprintf(file, "  \"window_blocks\": %d,\n", s.windowBlocks);
+    fprintf(file, "  \"load_min\": %.4f,\n", s.minLoad);
+    fprintf(file, "  \"load_avg\": %.4f,\n", s.avgLoad);
+    fprintf(file, "  \"load_max\": %.4f,\n", s.maxLoad);
+    fprintf(file, "  \"window_xruns\": %llu,\n", s.windowXruns);
+    fprintf(file, "  \"blocks\": %llu,\n", s.blocks);
+    fprintf(file, "  \"overruns\": %llu,\n", s.overruns);
+    fprintf(file, "  \"xruns\": %llu,\n", s.xruns);
+    fprintf(file, "  \"dropped_records\": %llu,\n", s.dropped);
+    fprintf(file, "  \"worst_block\": { \"load\": %.4f, \"render_ms\": %.3f, \"deadline_ms\": %.3f, \"age_seconds\": %.1f }\n",
+            s.worst.Load(), s.worst.render * 1000.0, s.worst.deadline * 1000.0,
+            s.blocks ? (LatencyMonitor::Now() - s.worst.time) * 1e-9 : 0.0);
+    fprintf(file, "}\n");
+    bool written = ferror(file) == 0;
+    written = fclose(file) == 0 && written;
+
+    if (!written)
+        return false;
+#ifdef _WIN32
+    // rename() does not replace an existing file there
+    return MoveFileExA(temp.c_str(), path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(temp.c_str(), path) == 0;
+#endif
+}
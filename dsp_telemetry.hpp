@@ -0,0 +1,76 @@
+#pragma once
+
+#include "event_queue.hpp"
+#include <atomic>
+#include <vector>
+
+class AudioBackend;
+
+// One render call as the audio thread saw it
+struct BlockStats
+{
+    long long time = 0;                 // Steady clock ns at the end of the call
+    float render = 0.0f;                // Seconds spent rendering
+    float deadline = 0.0f;              // Seconds of audio rendered
+    unsigned long long xruns = 0;       // Backend's count when the call ended
+
+    float Load() const { return deadline > 0.0f ? render / deadline : 0.0f; }
+};
+
+// Rolling view over the last TELEMETRY_WINDOW_SECONDS, plus totals since
+// the last reset
+struct TelemetrySummary
+{
+    double window = 0.0;                // Seconds of wall time the window covers
+    int windowBlocks = 0;
+    float minLoad = 0.0f;
+    float avgLoad = 0.0f;               // Render time over audio time, not a mean of ratios
+    float maxLoad = 0.0f;
+    unsigned long long windowXruns = 0;
+
+    unsigned long long blocks = 0;
+    unsigned long long overruns = 0;    // Calls that took longer than the audio they rendered
+    unsigned long long xruns = 0;
+    unsigned long long dropped = 0;     // Records lost because nobody drained the queue
+    BlockStats worst;                   // Highest load seen
+};
+
+const double TELEMETRY_WINDOW_SECONDS = 5.0;
+
+// Per-block health of the render loop. The audio thread records every call
+// into a lock-free queue; one consumer thread drains it into the rolling
+// window and the summary.
+class DspTelemetry
+{
+public:
+    DspTelemetry();
+
+    // Not while rendering. The backend's xrun count goes into every record.
+    void SetXrunSource(const AudioBackend* backend) { m_Backend.store(backend, std::memory_order_relaxed); }
+
+    // Audio thread, after each render call
+    void RecordBlock(double renderSeconds, int frames, int sampleRate);
+
+    // Consumer thread
+    void Update();
+    void Reset();
+    const TelemetrySummary& GetSummary() const { return m_Summary; }
+
+    // Summary as JSON, replaced atomically so readers never see half a file
+    bool WriteStatsFile(const char* path) const;
+
+private:
+    static const int QUEUE_CAPACITY = 4096;     // Over 5 s of 64-frame calls at 48 kHz
+
+    SpscQueue<BlockStats, QUEUE_CAPACITY> m_Queue;
+    std::atomic<const AudioBackend*> m_Backend{ nullptr };
+    std::atomic<unsigned long long> m_Dropped{ 0 };
+
+    std::vector<BlockStats> m_Window;           // Ring, oldest at m_WindowStart
+    int m_WindowStart = 0;
+    int m_WindowCount = 0;
+    unsigned long long m_BaseXruns = 0;         // Backend's count at the last reset
+    bool m_HaveBase = false;
+    unsigned long long m_DroppedBase = 0;
+    TelemetrySummary m_Summary;
+};
@@ -0,0 +1,578 @@
+#include "effects.hpp"
+#include "fast_sine.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+static const double PI = 3.14159265358979323846;
+
+// Effects work through the block in chunks this size so the dry copies
+// and wet buffers stay on the stack
+static const int EFFECT_CHUNK_FRAMES = 64;
+
+// Switching an effect on or off takes this long
+static const float CROSSFADE_SECONDS = 0.02f;
+
+// A changed setting glides to its new value over this long
+static const float GLIDE_SECONDS = 0.02f;
+
+// While the EQ glides, its filters are redesigned this often
+static const int EQ_DESIGN_FRAMES = 32;
+
+const char* GetEffectName(EffectType type)
+{
+    switch (type)
+    {
+    case EffectType::Eq: return "EQ";
+    case EffectType::Compressor: return "Compressor";
+    case EffectType::Chorus: return "Chorus";
+    case EffectType::Delay: return "Delay";
+    case EffectType::Reverb: return "Reverb";
+    case EffectType::Convolution: return "Convolution";
+    default: return "?";
+    }
+}
+
+static float DecibelsToGain(float db)
+{
+    return std::exp2(db * (1.0f / 6.0206f));
+}
+
+//---------------------------------------------------------------------------
+// EQ
+
+void Biquad::Process(float* left, float* right, int frames)
+{
+    float* channels[2] = { left, right };
+    for (int c = 0; c < 2; ++c)
+    {
+        float* x = channels[c];
+        float s1 = z1[c], s2 = z2[c];
+        for (int i = 0; i < frames; ++i)
+        {
+            float in = x[i];
+            float out = b0 * in + s1;
+            s1 = b1 * in - a1 * out + s2;
+            s2 = b2 * in - a2 * out;
+            x[i] = out;
+        }
+        z1[c] = s1;
+        z2[c] = s2;
+    }
+}
+
+enum class BiquadShape { LowShelf, Peak, HighShelf };
+
+// Coefficients from the Audio EQ Cookbook; shelves use slope 1
+static void DesignBiquad(Biquad& filter, BiquadShape shape, double frequency, double gainDb, double q, int sampleRate)
+{
+    frequency = std::min(frequency, 0.45 * sampleRate);
+    double a = std::pow(10.0, gainDb / 40.0);
+    double w = 2.0 * PI * frequency / sampleRate;
+    double cosw = std::cos(w);
+    double b0, b1, b2, a0, a1, a2;
+    if (shape == BiquadShape::Peak)
+    {
+        double alpha = std::sin(w) / (2.0 * q);
+        b0 = 1.0 + alpha * a;
+        b1 = -2.0 * cosw;
+        b2 = 1.0 - alpha * a;
+        a0 = 1.0 + alpha / a;
+        a1 = -2.0 * cosw;
+        a2 = 1.0 - alpha / a;
+    }
+    else
+    {
+        double alpha = std::sin(w) / 2.0 * std::sqrt(2.0);
+        double root = 2.0 * std::sqrt(a) * alpha;
+        double sign = shape == BiquadShape::LowShelf ? 1.0 : -1.0;
+        b0 = a * ((a + 1.0) - sign * (a - 1.0) * cosw + root);
+        b1 = sign * 2.0 * a * ((a - 1.0) - sign * (a + 1.0) * cosw);
+        b2 = a * ((a + 1.0) - sign * (a - 1.0) * cosw - root);
+        a0 = (a + 1.0) + sign * (a - 1.0) * cosw + root;
+        a1 = -sign * 2.0 * ((a - 1.0) + sign * (a + 1.0) * cosw);
+        a2 = (a + 1.0) + sign * (a - 1.0) * cosw - root;
+    }
+    filter.b0 = (float)(b0 / a0);
+    filter.b1 = (float)(b1 / a0);
+    filter.b2 = (float)(b2 / a0);
+    filter.a1 = (float)(a1 / a0);
+    filter.a2 = (float)(a2 / a0);
+}
+
+void Equalizer::Prepare(int sampleRate)
+{
+    m_SampleRate = sampleRate;
+    for (LinearSmoother& setting : m_Settings)
+        setting.Prepare(GLIDE_SECONDS, sampleRate);
+    m_Silent = true;
+}
+
+void Equalizer::Update(const EqSettings& settings)
+{
+    // Frequencies glide in octaves, so a sweep moves evenly across the range
+    const float targets[(int)Setting::Count] = {
+        settings.lowGain, std::log2(std::max(1.0f, settings.lowFrequency)),
+        settings.midGain, std::log2(std::max(1.0f, settings.midFrequency)), std::max(0.1f, settings.midQ),
+        settings.highGain, std::log2(std::max(1.0f, settings.highFrequency))
+    };
+    for (int s = 0; s < (int)Setting::Count; ++s)
+    {
+        if (m_Silent)
+            m_Settings[s].Reset(targets[s]);
+        else
+            m_Settings[s].SetTarget(targets[s]);
+    }
+    Design();
+}
+
+void Equalizer::Design()
+{
+    DesignBiquad(m_Low, BiquadShape::LowShelf, std::exp2(Get(Setting::LowFrequency)), Get(Setting::LowGain), 0.7, m_SampleRate);
+    DesignBiquad(m_Mid, BiquadShape::Peak, std::exp2(Get(Setting::MidFrequency)), Get(Setting::MidGain), Get(Setting::MidQ), m_SampleRate);
+    DesignBiquad(m_High, BiquadShape::HighShelf, std::exp2(Get(Setting::HighFrequency)), Get(Setting::HighGain), 0.7, m_SampleRate);
+}
+
+void Equalizer::Reset()
+{
+    m_Low.Reset();
+    m_Mid.Reset();
+    m_High.Reset();
+
+    // Nothing is sounding, so nothing needs to glide
+    for (LinearSmoother& setting : m_Settings)
+        setting.Reset(setting.GetTarget());
+    Design();
+    m_Silent = true;
+}
+
+void Equalizer::Process(float* left, float* right, int frames)
+{
+    m_Silent = false;
+    for (int start = 0; start < frames; start += EQ_DESIGN_FRAMES)
+    {
+        int chunk = std::min(EQ_DESIGN_FRAMES, frames - start);
+        bool gliding = false;
+        for (LinearSmoother& setting : m_Settings)
+        {
+            gliding |= setting.IsSmoothing();
+            setting.Advance(chunk);
+        }
+        if (gliding)
+            Design();
+        m_Low.Process(left + start, right + start, chunk);
+        m_Mid.Process(left + start, right + start, chunk);
+        m_High.Process(left + start, right + start, chunk);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Compressor
+
+static float SmoothingCoefficient(float seconds, int sampleRate)
+{
+    return seconds > 0.0f ? 1.0f - std::exp(-1.0f / (seconds * sampleRate)) : 1.0f;
+}
+
+void Compressor::Prepare(int sampleRate)
+{
+    m_SampleRate = sampleRate;
+    m_Threshold.Prepare(GLIDE_SECONDS, sampleRate);
+    m_Makeup.Prepare(GLIDE_SECONDS, sampleRate);
+    m_Silent = true;
+}
+
+void Compressor::Update(const CompressorSettings& settings)
+{
+    m_Settings = settings;
+    m_Settings.ratio = std::max(1.0f, settings.ratio);
+    m_Settings.knee = std::max(0.0f, settings.knee);
+    m_AttackCoef = SmoothingCoefficient(settings.attack, m_SampleRate);
+    m_ReleaseCoef = SmoothingCoefficient(settings.release, m_SampleRate);
+    if (m_Silent)
+    {
+        m_Threshold.Reset(settings.threshold);
+        m_Makeup.Reset(settings.makeup);
+    }
+    else
+    {
+        m_Threshold.SetTarget(settings.threshold);
+        m_Makeup.SetTarget(settings.makeup);
+    }
+}
+
+void Compressor::Reset()
+{
+    m_Reduction = 0.0f;
+    m_Threshold.Reset(m_Threshold.GetTarget());
+    m_Makeup.Reset(m_Makeup.GetTarget());
+    m_Silent = true;
+}
+
+// Stereo-linked peak detector feeding a soft-knee gain computer; the gain
+// reduction in dB is smoothed with separate attack and release times
+void Compressor::Process(float* left, float* right, int frames)
+{
+    const float slope = 1.0f - 1.0f / m_Settings.ratio;
+    const float knee = m_Settings.knee;
+    float reduction = m_Reduction;
+    m_Silent = false;
+    for (int i = 0; i < frames; ++i)
+    {
+        float peak = std::max(std::fabs(left[i]), std::fabs(right[i]));
+        float level = 6.0206f * std::log2(peak + 1e-9f);
+        float over = level - m_Threshold.Next();
+        float target = 0.0f;
+        if (2.0f * over > knee)
+            target = over * slope;
+        else if (2.0f * over > -knee)
+            target = slope * (over + 0.5f * knee) * (over + 0.5f * knee) / (2.0f * knee);
+
+        reduction += (target - reduction) * (target > reduction ? m_AttackCoef : m_ReleaseCoef);
+        float gain = DecibelsToGain(m_Makeup.Next() - reduction);
+        left[i] *= gain;
+        right[i] *= gain;
+    }
+    m_Reduction = reduction;
+}
+
+//---------------------------------------------------------------------------
+// Chorus
+
+// Delay the modulation sweeps around, in seconds
+static const float CHORUS_BASE_DELAY = 0.012f;
+static const int CHORUS_LINE_FRAMES = 4096;   // Power of two, room for base delay + depth at 96 kHz
+
+void Chorus::Prepare(int sampleRate)
+{
+    m_SampleRate = sampleRate;
+    m_Depth.Prepare(GLIDE_SECONDS, sampleRate);
+    for (auto& line : m_Line)
+        line.assign(CHORUS_LINE_FRAMES, 0.0f);
+    Reset();
+}
+
+void Chorus::Update(const ChorusSettings& settings)
+{
+    m_Increment = settings.rate / m_SampleRate;
+    float depth = std::min(settings.depth * 0.001f, CHORUS_BASE_DELAY) * m_SampleRate;
+    if (m_Silent)
+        m_Depth.Reset(depth);
+    else
+        m_Depth.SetTarget(depth);
+}
+
+void Chorus::Reset()
+{
+    for (auto& line : m_Line)
+        std::fill(line.begin(), line.end(), 0.0f);
+    m_Phase = 0.0f;
+    m_WritePos = 0;
+    m_Depth.Reset(m_Depth.GetTarget());
+    m_Silent = true;
+}
+
+// One modulated tap per channel, the right LFO a quarter turn behind; a
+// new depth ramps in across the block
+void Chorus::Process(const float* left, const float* right, float* wetL, float* wetR, int frames)
+{
+    const int mask = CHORUS_LINE_FRAMES - 1;
+    const float base = CHORUS_BASE_DELAY * m_SampleRate;
+    const float depthStart = m_Depth.GetValue();
+    const float depthStep = (m_Depth.Advance(frames) - depthStart) / frames;
+    m_Silent = false;
+    const float* in[2] = { left, right };
+    float* out[2] = { wetL, wetR };
+    for (int c = 0; c < 2; ++c)
+    {
+        float* line = m_Line[c].data();
+        float phase = m_Phase + 0.25f * c;
+        float depth = depthStart;
+        int pos = m_WritePos;
+        for (int i = 0; i < frames; ++i)
+        {
+            line[pos] = in[c][i];
+            float delay = base + depth * FastSine(phase);
+            float read = (float)pos - delay;
+            int index = (int)std::floor(read);
+            float frac = read - (float)index;
+            float a = line[index & mask];
+            float b = line[(index + 1) & mask];
+            out[c][i] = a + (b - a) * frac;
+            pos = (pos + 1) & mask;
+            phase += m_Increment;
+            depth += depthStep;
+        }
+    }
+    m_Phase += m_Increment * frames;
+    m_Phase -= std::floor(m_Phase);
+    m_WritePos = (m_WritePos + frames) & mask;
+}
+
+//---------------------------------------------------------------------------
+// Delay
+
+void StereoDelay::Prepare(int sampleRate)
+{
+    m_SampleRate = sampleRate;
+    m_Feedback.Prepare(GLIDE_SECONDS, sampleRate);
+    m_Damping.Prepare(GLIDE_SECONDS, sampleRate);
+    int frames = 1;
+    while (frames < (int)(MAX_DELAY_SECONDS * sampleRate) + 2)
+        frames <<= 1;
+    for (auto& line : m_Line)
+        line.assign(frames, 0.0f);
+    Reset();
+}
+
+void StereoDelay::Update(const DelaySettings& settings)
+{
+    m_TargetTime = std::max(1.0f, std::min(settings.time, MAX_DELAY_SECONDS) * m_SampleRate);
+    if (m_Time < 0.0f)
+        m_Time = m_TargetTime;
+    float feedback = std::max(0.0f, std::min(settings.feedback, 0.95f));
+    float damping = std::max(0.0f, std::min(settings.damping, 0.95f));
+    if (m_Silent)
+    {
+        m_Feedback.Reset(feedback);
+        m_Damping.Reset(damping);
+    }
+    else
+    {
+        m_Feedback.SetTarget(feedback);
+        m_Damping.SetTarget(damping);
+    }
+}
+
+void StereoDelay::Reset()
+{
+    for (auto& line : m_Line)
+        std::fill(line.begin(), line.end(), 0.0f);
+    m_LowPass[0] = m_LowPass[1] = 0.0f;
+    m_WritePos = 0;
+    m_Time = m_TargetTime;
+    m_Feedback.Reset(m_Feedback.GetTarget());
+    m_Damping.Reset(m_Damping.GetTarget());
+    m_Silent = true;
+}
+
+// Feedback goes through a one-pole lowpass so repeats darken; the delay
+// time glides to new settings instead of jumping, like a tape delay, and
+// feedback and damping ramp across the block
+void StereoDelay::Process(const float* left, const float* right, float* wetL, float* wetR, int frames)
+{
+    const int mask = (int)m_Line[0].size() - 1;
+    const float glide = (m_TargetTime - m_Time) * std::min(1.0f, frames / (0.1f * m_SampleRate)) / frames;
+    const float feedbackStart = m_Feedback.GetValue();
+    const float feedbackStep = (m_Feedback.Advance(frames) - feedbackStart) / frames;
+    const float dampingStart = m_Damping.GetValue();
+    const float dampingStep = (m_Damping.Advance(frames) - dampingStart) / frames;
+    m_Silent = false;
+    const float* in[2] = { left, right };
+    float* out[2] = { wetL, wetR };
+    for (int c = 0; c < 2; ++c)
+    {
+        float* line = m_Line[c].data();
+        float lowPass = m_LowPass[c];
+        float time = m_Time;
+        float feedback = feedbackStart;
+        float damping = dampingStart;
+        int pos = m_WritePos;
+        for (int i = 0; i < frames; ++i)
+        {
+            float read = (float)pos - time;
+            int index = (int)std::floor(read);
+            float frac = read - (float)index;
+            float a = line[index & mask];
+            float b = line[(index + 1) & mask];
+            float delayed = a + (b - a) * frac;
+            lowPass += (delayed - lowPass) * (1.0f - damping);
+            line[pos] = in[c][i] + lowPass * feedback;
+            out[c][i] = delayed;
+            pos = (pos + 1) & mask;
+            time += glide;
+            feedback += feedbackStep;
+            damping += dampingStep;
+        }
+        m_LowPass[c] = lowPass;
+    }
+    m_Time += glide * frames;
+    m_WritePos = (m_WritePos + frames) & mask;
+}
+
+//---------------------------------------------------------------------------
+// Chain
+
+// Wet level of a send effect; inserts have none
+static float GetSendLevel(const EffectSettings& settings, EffectType type)
+{
+    switch (type)
+    {
+    case EffectType::Chorus: return settings.chorus.mix;
+    case EffectType::Delay: return settings.delay.mix;
+    case EffectType::Reverb: return settings.reverb.mix;
+    case EffectType::Convolution: return settings.convolution.mix;
+    default: return 1.0f;
+    }
+}
+
+void EffectsChain::Prepare(int sampleRate)
+{
+    m_SampleRate = sampleRate;
+    m_Eq.Prepare(sampleRate);
+    m_Compressor.Prepare(sampleRate);
+    m_Chorus.Prepare(sampleRate);
+    m_Delay.Prepare(sampleRate);
+    m_Reverb.Prepare(sampleRate);
+    m_Convolution.Prepare(sampleRate);
+    for (int e = 0; e < (int)EffectType::Count; ++e)
+    {
+        m_Mix[e] = 0.0f;
+        m_Idle[e] = true;
+        m_Load[e] = 0.0f;
+        m_Level[e].Prepare(CROSSFADE_SECONDS, sampleRate);
+        m_Level[e].Reset(GetSendLevel(m_UiSettings, (EffectType)e));
+    }
+    Apply(m_UiSettings);
+}
+
+void EffectsChain::SetSettings(const EffectSettings& settings)
+{
+    m_UiSettings = settings;
+    m_Updates.Write(settings);
+}
+
+void EffectsChain::Apply(const EffectSettings& settings)
+{
+    m_Settings = settings;
+    m_Eq.Update(settings.eq);
+    m_Compressor.Update(settings.compressor);
+    m_Chorus.Update(settings.chorus);
+    m_Delay.Update(settings.delay);
+    m_Reverb.Update(settings.reverb.size, settings.reverb.damping);
+    for (int e = 0; e < (int)EffectType::Count; ++e)
+        m_Level[e].SetTarget(GetSendLevel(settings, (EffectType)e));
+}
+
+// Insert effects (EQ, compressor) crossfade between the dry and processed
+// signal; send effects add their wet output scaled by their mix setting
+void EffectsChain::ProcessEffect(EffectType type, float* left, float* right, int frames, float mixStart, float mixEnd)
+{
+    alignas(16) float bufL[EFFECT_CHUNK_FRAMES];
+    alignas(16) float bufR[EFFECT_CHUNK_FRAMES];
+    bool insert = !IsOptionalEffect(type);
+    LinearSmoother& level = m_Level[(int)type];
+
+    for (int start = 0; start < frames; start += EFFECT_CHUNK_FRAMES)
+    {
+        int chunk = std::min(EFFECT_CHUNK_FRAMES, frames - start);
+        float* l = left + start;
+        float* r = right + start;
+        float mix = mixStart + (mixEnd - mixStart) * start / frames;
+        float step = (mixEnd - mixStart) / frames;
+
+        if (insert)
+        {
+            // Fully on: process in place, no dry copy needed
+            if (mixStart == 1.0f && mixEnd == 1.0f)
+            {
+                if (type == EffectType::Eq)
+                    m_Eq.Process(l, r, chunk);
+                else
+                    m_Compressor.Process(l, r, chunk);
+                continue;
+            }
+            memcpy(bufL, l, chunk * sizeof(float));
+            memcpy(bufR, r, chunk * sizeof(float));
+            if (type == EffectType::Eq)
+                m_Eq.Process(bufL, bufR, chunk);
+            else
+                m_Compressor.Process(bufL, bufR, chunk);
+            for (int i = 0; i < chunk; ++i, mix += step)
+            {
+                l[i] += (bufL[i] - l[i]) * mix;
+                r[i] += (bufR[i] - r[i]) * mix;
+            }
+            continue;
+        }
+
+        switch (type)
+        {
+        case EffectType::Chorus: m_Chorus.Process(l, r, bufL, bufR, chunk); break;
+        case EffectType::Delay: m_Delay.Process(l, r, bufL, bufR, chunk); break;
+        case EffectType::Reverb: m_Reverb.Process(l, r, bufL, bufR, chunk); break;
+        default: m_Convolution.Process(l, r, bufL, bufR, chunk); break;
+        }
+        for (int i = 0; i < chunk; ++i, mix += step)
+        {
+            float wet = level.Next();
+            l[i] += bufL[i] * mix * wet;
+            r[i] += bufR[i] * mix * wet;
+        }
+    }
+}
+
+void EffectsChain::Process(float* left, float* right, int frames, bool optionalEnabled, DenormalMonitor* denormals)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    // Latest settings only; intermediate slider positions are skipped
+    if (m_Updates.Update())
+        Apply(m_Updates.Read());
+
+    if (frames <= 0)
+        return;
+
+    const bool enabled[(int)EffectType::Count] = {
+        m_Settings.eq.enabled, m_Settings.compressor.enabled, m_Settings.chorus.enabled,
+        m_Settings.delay.enabled, m_Settings.reverb.enabled, m_Settings.convolution.enabled
+    };
+    const float maxStep = frames / (CROSSFADE_SECONDS * m_SampleRate);
+    const double duration = (double)frames / m_SampleRate;
+
+    for (int e = 0; e < (int)EffectType::Count; ++e)
+    {
+        EffectType type = (EffectType)e;
+        float target = enabled[e] && (optionalEnabled || !IsOptionalEffect(type)) ? 1.0f : 0.0f;
+        float start = m_Mix[e];
+        float end = start + std::max(-maxStep, std::min(maxStep, target - start));
+
+        // Faded out: clear the state once so switching back on starts clean
+        if (start == 0.0f && end == 0.0f)
+        {
+            if (!m_Idle[e])
+            {
+                switch (type)
+                {
+                case EffectType::Eq: m_Eq.Reset(); break;
+                case EffectType::Compressor: m_Compressor.Reset(); break;
+                case EffectType::Chorus: m_Chorus.Reset(); break;
+                case EffectType::Delay: m_Delay.Reset(); break;
+                case EffectType::Reverb: m_Reverb.Reset(); break;
+                default: m_Convolution.Reset(); break;
+                }
+                m_Idle[e] = true;
+            }
+            m_Level[e].Reset(m_Level[e].GetTarget());      // Nothing to glide while silent
+            m_Load[e] = 0.0f;
+            m_Timings.load[e].store(0.0f, std::memory_order_relaxed);
+            continue;
+        }
+
+        Clock::time_point begin = Clock::now();
+        m_Idle[e] = false;
+        if (denormals)
+            denormals->Begin();
+        ProcessEffect(type, left, right, frames, start, end);
+        if (denormals)
+            denormals->End((DspNode)((int)DspNode::Eq + e));
+        m_Mix[e] = end;
+
+        float load = (float)(std::chrono::duration<double>(Clock::now() - begin).count() / duration);
+        m_Load[e] += (load - m_Load[e]) * 0.05f;
+        m_Timings.load[e].store(m_Load[e], std::memory_order_relaxed);
+    }
+    m_Timings.gainReduction.store(m_Mix[(int)EffectType::Compressor] > 0.0f ? m_Compressor.GetGainReduction() : 0.0f,
+                                  std::memory_order_relaxed);
+}
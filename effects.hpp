@@ -0,0 +1,242 @@
+#pragma once
+
+#include "convolution_reverb.hpp"
+#include "denormals.hpp"
+#include "fdn_reverb.hpp"
+#include "parameter_store.hpp"
+#include <atomic>
+#include <vector>
+
+// Master effects run on the engine's float output in the render thread, so
+// realtime playback and offline renders go through the same code. All
+// memory is allocated by Prepare().
+
+enum class EffectType
+{
+    Eq,
+    Compressor,
+    Chorus,
+    Delay,
+    Reverb,
+    Convolution,
+    Count
+};
+
+const char* GetEffectName(EffectType type);
+
+// Chorus, delay and the reverbs are optional: the CPU governor may bypass them
+inline bool IsOptionalEffect(EffectType type)
+{
+    return type >= EffectType::Chorus;
+}
+
+struct EqSettings
+{
+    bool enabled = false;
+    float lowGain = 0.0f;       // dB, low shelf
+    float lowFrequency = 200.0f;
+    float midGain = 0.0f;       // dB, peaking
+    float midFrequency = 1000.0f;
+    float midQ = 0.7f;
+    float highGain = 0.0f;      // dB, high shelf
+    float highFrequency = 5000.0f;
+};
+
+struct CompressorSettings
+{
+    bool enabled = false;
+    float threshold = -18.0f;   // dB
+    float ratio = 3.0f;
+    float knee = 6.0f;          // dB
+    float attack = 0.005f;      // Seconds
+    float release = 0.15f;
+    float makeup = 3.0f;        // dB
+};
+
+struct ChorusSettings
+{
+    bool enabled = false;
+    float rate = 0.6f;          // Hz
+    float depth = 3.0f;         // Milliseconds of delay modulation
+    float mix = 0.5f;
+};
+
+struct DelaySettings
+{
+    bool enabled = false;
+    float time = 0.35f;         // Seconds, up to MAX_DELAY_SECONDS
+    float feedback = 0.35f;
+    float damping = 0.3f;       // High-frequency loss per repeat
+    float mix = 0.25f;
+};
+
+struct ReverbSettings
+{
+    bool enabled = false;
+    float size = 0.6f;          // 0..1, room size and decay time
+    float damping = 0.5f;
+    float mix = 0.2f;
+};
+
+struct ConvolutionSettings
+{
+    bool enabled = false;
+    float mix = 0.3f;           // Response set with EffectsChain::GetConvolution()
+};
+
+struct EffectSettings
+{
+    EqSettings eq;
+    CompressorSettings compressor;
+    ChorusSettings chorus;
+    DelaySettings delay;
+    ReverbSettings reverb;
+    ConvolutionSettings convolution;
+};
+
+const float MAX_DELAY_SECONDS = 2.0f;
+
+// Per-effect render time as a fraction of the block duration, smoothed,
+// readable from any thread
+struct EffectTimings
+{
+    std::atomic<float> load[(int)EffectType::Count] = {};
+    std::atomic<float> gainReduction{ 0.0f };      // Compressor, dB
+};
+
+//---------------------------------------------------------------------------
+// Effect units, audio thread only
+
+struct Biquad
+{
+    float b0 = 1.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+    float z1[2] = {}, z2[2] = {};
+
+    void Reset() { z1[0] = z1[1] = z2[0] = z2[1] = 0.0f; }
+    void Process(float* left, float* right, int frames);
+};
+
+// Gains, frequencies and Q glide to new settings; while they do, the
+// filters are redesigned every few frames
+class Equalizer
+{
+public:
+    void Prepare(int sampleRate);
+    void Update(const EqSettings& settings);
+    void Reset();
+    void Process(float* left, float* right, int frames);
+
+private:
+    enum class Setting { LowGain, LowFrequency, MidGain, MidFrequency, MidQ, HighGain, HighFrequency, Count };
+
+    float Get(Setting setting) const { return m_Settings[(int)setting].GetValue(); }
+    void Design();
+
+    int m_SampleRate = 44100;
+    bool m_Silent = true;           // Reset and not run since: settings apply at once
+    LinearSmoother m_Settings[(int)Setting::Count];     // Gains in dB, frequencies in log2 Hz
+    Biquad m_Low, m_Mid, m_High;
+};
+
+class Compressor
+{
+public:
+    void Prepare(int sampleRate);
+    void Update(const CompressorSettings& settings);
+    void Reset();
+    void Process(float* left, float* right, int frames);
+    float GetGainReduction() const { return m_Reduction; }
+
+private:
+    int m_SampleRate = 44100;
+    bool m_Silent = true;
+    CompressorSettings m_Settings;
+    LinearSmoother m_Threshold;     // dB
+    LinearSmoother m_Makeup;
+    float m_AttackCoef = 0.0f;
+    float m_ReleaseCoef = 0.0f;
+    float m_Reduction = 0.0f;       // dB, smoothed
+};
+
+// Send effects write only their wet signal; the chain mixes it in
+class Chorus
+{
+public:
+    void Prepare(int sampleRate);
+    void Update(const ChorusSettings& settings);
+    void Reset();
+    void Process(const float* left, const float* right, float* wetL, float* wetR, int frames);
+
+private:
+    int m_SampleRate = 44100;
+    bool m_Silent = true;
+    float m_Increment = 0.0f;       // LFO turns per frame
+    LinearSmoother m_Depth;         // Frames
+    float m_Phase = 0.0f;
+    int m_WritePos = 0;
+    std::vector<float> m_Line[2];
+};
+
+class StereoDelay
+{
+public:
+    void Prepare(int sampleRate);
+    void Update(const DelaySettings& settings);
+    void Reset();
+    void Process(const float* left, const float* right, float* wetL, float* wetR, int frames);
+
+private:
+    int m_SampleRate = 44100;
+    float m_Time = -1.0f;           // Frames, glides towards m_TargetTime
+    float m_TargetTime = 0.0f;
+    bool m_Silent = true;
+    LinearSmoother m_Feedback;
+    LinearSmoother m_Damping;
+    float m_LowPass[2] = {};
+    int m_WritePos = 0;
+    std::vector<float> m_Line[2];
+};
+
+//---------------------------------------------------------------------------
+
+// EQ -> compressor -> chorus -> delay -> reverb -> convolution. Settings
+// come from the UI thread as a snapshot taken once per block; send levels
+// and the effects' own settings glide to a new value, and switching an
+// effect on or off, or the governor bypassing it, crossfades over a few
+// milliseconds.
+class EffectsChain
+{
+public:
+    void Prepare(int sampleRate);
+
+    // UI thread
+    void SetSettings(const EffectSettings& settings);
+    const EffectSettings& GetSettings() const { return m_UiSettings; }
+    const EffectTimings& GetTimings() const { return m_Timings; }
+    ConvolutionReverb& GetConvolution() { return m_Convolution; }
+
+    // Audio thread. optionalEnabled = false fades out the optional effects.
+    void Process(float* left, float* right, int frames, bool optionalEnabled, DenormalMonitor* denormals = nullptr);
+
+private:
+    void Apply(const EffectSettings& settings);
+    void ProcessEffect(EffectType type, float* left, float* right, int frames, float mixStart, float mixEnd);
+
+    int m_SampleRate = 44100;
+    EffectSettings m_UiSettings;
+    EffectSettings m_Settings;
+    SnapshotBuffer<EffectSettings> m_Updates;
+    EffectTimings m_Timings;
+
+    float m_Mix[(int)EffectType::Count] = {};      // Crossfade position of each effect
+    LinearSmoother m_Level[(int)EffectType::Count];     // Send effects' wet level
+    bool m_Idle[(int)EffectType::Count] = {};      // Faded out and state cleared
+    float m_Load[(int)EffectType::Count] = {};
+
+    Equalizer m_Eq;
+    Compressor m_Compressor;
+    Chorus m_Chorus;
+    StereoDelay m_Delay;
+    FdnReverb m_Reverb;
+    ConvolutionReverb m_Convolution;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cmath>
+
+// Level below which a releasing voice is inaudible and gets reclaimed (-80 dB)
+const float ENVELOPE_SILENCE = 0.0001f;
+
+struct AdsrSettings
+{
+    float attack = 0.002f;      // Seconds from the current level to full level
+    float decay = 1.0f;         // Seconds to fall 60 dB towards the sustain level
+    float sustain = 1.0f;       // Level while the key is held
+    float release = 0.3f;       // Seconds to fall 60 dB after note-off
+};
+
+// ADSR envelope evaluated at block rate; the mixer interpolates linearly
+// between the levels at consecutive block boundaries.
+class AdsrEnvelope
+{
+public:
+    enum class Stage { Idle, Attack, Decay, Sustain, Release };
+
+    // Starts (or restarts) the attack from the current level, so retriggering
+    // a sounding voice does not jump
+    void Start(const AdsrSettings& settings, int sampleRate)
+    {
+        m_AttackStep = settings.attack > 0.0f ? 1.0f / (settings.attack * sampleRate) : 1.0f;
+        m_DecayCoef = FallCoefficient(settings.decay, sampleRate);
+        m_ReleaseCoef = FallCoefficient(settings.release, sampleRate);
+        m_Sustain = settings.sustain;
+        m_Stage = Stage::Attack;
+    }
+
+    void Release()
+    {
+        if (m_Stage != Stage::Idle)
+            m_Stage = Stage::Release;
+    }
+
+    // Short release for voices that must stop without clicking
+    void FastRelease(int sampleRate)
+    {
+        if (m_Stage == Stage::Idle)
+            return;
+        m_ReleaseCoef = FallCoefficient(0.005f, sampleRate);
+        m_Stage = Stage::Release;
+    }
+
+    void Reset()
+    {
+        m_Stage = Stage::Idle;
+        m_Level = 0.0f;
+    }
+
+    // Advances by frames and returns the level at the end
+    float Advance(int frames)
+    {
+        while (frames > 0)
+        {
+            switch (m_Stage)
+            {
+            case Stage::Attack:
+            {
+                int n = (int)std::ceil((1.0f - m_Level) / m_AttackStep);
+                if (n > frames)
+                    n = frames;
+                m_Level += n * m_AttackStep;
+                if (m_Level >= 1.0f)
+                {
+                    m_Level = 1.0f;
+                    m_Stage = Stage::Decay;
+                }
+                frames -= n;
+                break;
+            }
+            case Stage::Decay:
+                m_Level = m_Sustain + (m_Level - m_Sustain) * std::pow(m_DecayCoef, (float)frames);
+                if (std::fabs(m_Level - m_Sustain) < ENVELOPE_SILENCE)
+                {
+                    m_Level = m_Sustain;
+                    m_Stage = Stage::Sustain;
+                }
+                frames = 0;
+                break;
+            case Stage::Release:
+                m_Level *= std::pow(m_ReleaseCoef, (float)frames);
+                if (m_Level < ENVELOPE_SILENCE)
+                    Reset();
+                frames = 0;
+                break;
+            default:
+                frames = 0;
+                break;
+            }
+        }
+        return m_Level;
+    }
+
+    float GetLevel() const { return m_Level; }
+    Stage GetStage() const { return m_Stage; }
+    bool IsIdle() const { return m_Stage == Stage::Idle; }
+
+private:
+    // Per-frame multiplier that falls by 60 dB in 'seconds'
+    static float FallCoefficient(float seconds, int sampleRate)
+    {
+        if (seconds <= 0.0f)
+            return 0.0f;
+        return std::exp(-6.9077553f / (seconds * sampleRate));
+    }
+
+    Stage m_Stage = Stage::Idle;
+    float m_Level = 0.0f;
+    float m_AttackStep = 1.0f;
+    float m_DecayCoef = 0.0f;
+    float m_ReleaseCoef = 0.0f;
+    float m_Sustain = 1.0f;
+};
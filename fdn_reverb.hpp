@@ -0,0 +1,75 @@
+#pragma once
+
+#include "cpu_features.hpp"
+#include "parameter_store.hpp"
+#include <vector>
+
+const int FDN_LINES = 8;
+const int FDN_CHUNK_FRAMES = 64;
+
+// State of the eight delay lines, one line per lane. The lines are
+// interleaved frame by frame ([frame * FDN_LINES + line]) so a frame of
+// the feedback vector is written with one store.
+struct FdnLanes
+{
+    float* lines;
+    int mask;                   // Frames per line - 1, a power of two
+    int writePos;
+    const float* delay;         // Read delay in frames at the first frame, > 1
+    const float* delayStep;     // Change per frame, for the modulation
+    float* lowPass;             // Damping filter state
+    const float* gain;          // Loss per pass, sets the decay time
+    float damping;              // Lowpass coefficient, 0 = no damping
+    const float* inputLeft;     // Input gain of each line
+    const float* inputRight;
+    const float* outputLeft;    // Output gain of each line
+    const float* outputRight;
+};
+
+// Runs the network for at most FDN_CHUNK_FRAMES and adds its output to
+// outL/outR. Each frame reads the lines, damps them, mixes them with a
+// scaled 8x8 Hadamard matrix and writes the result plus the input back.
+typedef void (*FdnFn)(const FdnLanes& lanes, const float* inL, const float* inR, float* outL, float* outR, int frames);
+
+FdnFn GetFdnFunction(SimdLevel level);
+
+// Feedback delay network reverb. The matrix is orthogonal, so the decay
+// time is set by the per-line gains alone; the damping filters make high
+// frequencies die away sooner and slow modulation of the read positions
+// keeps long tails from ringing metallically. Memory is allocated by
+// Prepare(); audio thread only.
+class FdnReverb
+{
+public:
+    void Prepare(int sampleRate);
+    void Update(float size, float damping);     // Both 0..1
+    void Reset();
+
+    // Writes the wet signal only
+    void Process(const float* left, const float* right, float* wetL, float* wetR, int frames);
+
+private:
+    void UpdateGains();
+
+    int m_SampleRate = 44100;
+    FdnFn m_Render = nullptr;
+    std::vector<float> m_Lines;
+    int m_Mask = 0;
+    int m_WritePos = 0;
+    bool m_Silent = true;                       // Reset and not run since
+    LinearSmoother m_Decay;                     // T60, seconds
+    LinearSmoother m_Damping;
+    float m_ModDepth = 0.0f;                    // Frames
+    float m_Base[FDN_LINES] = {};               // Unmodulated delay, glides towards m_TargetBase
+    float m_TargetBase[FDN_LINES] = {};
+    float m_ModPhase[FDN_LINES] = {};           // Turns
+    float m_ModIncrement[FDN_LINES] = {};       // Turns per frame
+    alignas(32) float m_Delay[FDN_LINES] = {};
+    alignas(32) float m_DelayStep[FDN_LINES] = {};
+    alignas(32) float m_LowPass[FDN_LINES] = {};
+    alignas(32) float m_Gain[FDN_LINES] = {};
+    alignas(32) float m_InputLeft[FDN_LINES] = {};
+    alignas(32) float m_InputRight[FDN_LINES] = {};
+    alignas(32) float m_OutputLeft[FDN_LINES] = {};
+    alignas(32) float m_OutputRight[FDN_LINES] = {};
+};
@@ -0,0 +1,318 @@
+#include "fft.hpp"
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+
+//---------------------------------------------------------------------------
+// Radix-2 stages
+//
+// The forward transform is decimation in frequency, stages from half-size
+// size/2 down to 1; the inverse is decimation in time with the conjugate
+// twiddles, stages from 1 up. The two smallest stages only multiply by 1
+// and -i, so they are done together without multiplications.
+
+static void ForwardStageScalar(float* re, float* im, int size, int half, const float* twiddleRe, const float* twiddleIm)
+{
+    for (int g = 0; g < size; g += 2 * half)
+    {
+        for (int j = 0; j < half; ++j)
+        {
+            float ar = re[g + j], ai = im[g + j];
+            float br = re[g + j + half], bi = im[g + j + half];
+            float wr = twiddleRe[half + j], wi = twiddleIm[half + j];
+            float dr = ar - br, di = ai - bi;
+            re[g + j] = ar + br;
+            im[g + j] = ai + bi;
+            re[g + j + half] = dr * wr - di * wi;
+            im[g + j + half] = dr * wi + di * wr;
+        }
+    }
+}
+
+static void InverseStageScalar(float* re, float* im, int size, int half, const float* twiddleRe, const float* twiddleIm)
+{
+    for (int g = 0; g < size; g += 2 * half)
+    {
+        for (int j = 0; j < half; ++j)
+        {
+            float ar = re[g + j], ai = im[g + j];
+            float br = re[g + j + half], bi = im[g + j + half];
+            float wr = twiddleRe[half + j], wi = twiddleIm[half + j];
+            float tr = br * wr + bi * wi, ti = bi * wr - br * wi;
+            re[g + j] = ar + tr;
+            im[g + j] = ai + ti;
+            re[g + j + half] = ar - tr;
+            im[g + j + half] = ai - ti;
+        }
+    }
+}
+
+// Stages of half-size 2 and 1
+static void ForwardLastStages(float* re, float* im, int size)
+{
+    for (int g = 0; g < size; g += 4)
+    {
+        float* r = re + g;
+        float* i = im + g;
+        float r0 = r[0] + r[2], i0 = i[0] + i[2];
+        float r2 = r[0] - r[2], i2 = i[0] - i[2];
+        float r1 = r[1] + r[3], i1 = i[1] + i[3];
+        float r3 = i[1] - i[3], i3 = r[3] - r[1];      // (x1 - x3) * -i
+        r[0] = r0 + r1; i[0] = i0 + i1;
+        r[1] = r0 - r1; i[1] = i0 - i1;
+        r[2] = r2 + r3; i[2] = i2 + i3;
+        r[3] = r2 - r3; i[3] = i2 - i3;
+    }
+}
+
+static void InverseFirstStages(float* re, float* im, int size)
+{
+    for (int g = 0; g < size; g += 4)
+    {
+        float* r = re + g;
+        float* i = im + g;
+        float r0 = r[0] + r[1], i0 = i[0] + i[1];
+        float r1 = r[0] - r[1], i1 = i[0] - i[1];
+        float r2 = r[2] + r[3], i2 = i[2] + i[3];
+        float r3 = i[3] - i[2], i3 = r[2] - r[3];      // (x2 - x3) * i
+        r[0] = r0 + r2; i[0] = i0 + i2;
+        r[2] = r0 - r2; i[2] = i0 - i2;
+        r[1] = r1 + r3; i[1] = i1 + i3;
+        r[3] = r1 - r3; i[3] = i1 - i3;
+    }
+}
+
+static void ForwardScalar(float* re, float* im, int size, const float* twiddleRe, const float* twiddleIm)
+{
+    for (int half = size / 2; half >= 4; half /= 2)
+        ForwardStageScalar(re, im, size, half, twiddleRe, twiddleIm);
+    ForwardLastStages(re, im, size);
+}
+
+static void InverseScalar(float* re, float* im, int size, const float* twiddleRe, const float* twiddleIm)
+{
+    InverseFirstStages(re, im, size);
+    for (int half = 4; half < size; half *= 2)
+        InverseStageScalar(re, im, size, half, twiddleRe, twiddleIm);
+}
+
+static void SpectrumMacScalar(const float* xRe, const float* xIm, const float* hRe, const float* hIm,
+                              float* yRe, float* yIm, int bins)
+{
+    for (int i = 0; i < bins; ++i)
+    {
+        yRe[i] += xRe[i] * hRe[i] - xIm[i] * hIm[i];
+        yIm[i] += xRe[i] * hIm[i] + xIm[i] * hRe[i];
+    }
+}
+
+#if SYNTH_X86
+
+// Half-size 4 and up: four butterflies per instruction
+SYNTH_TARGET_SSE2 static void ForwardStageSSE2(float* re, float* im, int size, int half, const float* twiddleRe, const float* twiddleIm)
+{
+    for (int g = 0; g < size; g += 2 * half)
+    {
+        for (int j = 0; j < half; j += 4)
+        {
+            float* ar = re + g + j;
+            float* ai = im + g + j;
+            __m128 xr = _mm_loadu_ps(ar), xi = _mm_loadu_ps(ai);
+            __m128 yr = _mm_loadu_ps(ar + half), yi = _mm_loadu_ps(ai + half);
+            __m128 wr = _mm_loadu_ps(twiddleRe + half + j), wi = _mm_loadu_ps(twiddleIm + half + j);
+            __m128 dr = _mm_sub_ps(xr, yr), di = _mm_sub_ps(xi, yi);
+            _mm_storeu_ps(ar, _mm_add_ps(xr, yr));
+            _mm_storeu_ps(ai, _mm_add_ps(xi, yi));
+            _mm_storeu_ps(ar + half, _mm_sub_ps(_mm_mul_ps(dr, wr), _mm_mul_ps(di, wi)));
+            _mm_storeu_ps(ai + half, _mm_add_ps(_mm_mul_ps(dr, wi), _mm_mul_ps(di, wr)));
+        }
+    }
+}
+
+SYNTH_TARGET_SSE2 static void InverseStageSSE2(float* re, float* im, int size, int half, const float* twiddleRe, const float* twiddleIm)
+{
+    for (int g = 0; g < size; g += 2 * half)
+    {
+        for (int j = 0; j < half; j += 4)
+        {
+            float* ar = re + g + j;
+            float* ai = im + g + j;
+            __m128 xr = _mm_loadu_ps(ar), xi = _mm_loadu_ps(ai);
+            __m128 yr = _mm_loadu_ps(ar + half), yi = _mm_loadu_ps(ai + half);
+            __m128 wr = _mm_loadu_ps(twiddleRe + half + j), wi = _mm_loadu_ps(twiddleIm + half + j);
+            __m128 tr = _mm_add_ps(_mm_mul_ps(yr, wr), _mm_mul_ps(yi, wi));
+            __m128 ti = _mm_sub_ps(_mm_mul_ps(yi, wr), _mm_mul_ps(yr, wi));
+            _mm_storeu_ps(ar, _mm_add_ps(xr, tr));
+            _mm_storeu_ps(ai, _mm_add_ps(xi, ti));
+            _mm_storeu_ps(ar + half, _mm_sub_ps(xr, tr));
+            _mm_storeu_ps(ai + half, _mm_sub_ps(xi, ti));
+        }
+    }
+}
+
+SYNTH_TARGET_SSE2 static void ForwardSSE2(float* re, float* im, int size, const float* twiddleRe, const float* twiddleIm)
+{
+    for (int half = size / 2; half >= 4; half /= 2)
+        ForwardStageSSE2(re, im, size, half, twiddleRe, twiddleIm);
+    ForwardLastStages(re, im, size);
+}
+
+SYNTH_TARGET_SSE2 static void InverseSSE2(float* re, float* im, int size, const float* twiddleRe, const float* twiddleIm)
+{
+    InverseFirstStages(re, im, size);
+    for (int half = 4; half < size; half *= 2)
+        InverseStageSSE2(re, im, size, half, twiddleRe, twiddleIm);
+}
+
+SYNTH_TARGET_SSE2 static void SpectrumMacSSE2(const float* xRe, const float* xIm, const float* hRe, const float* hIm,
+                                              float* yRe, float* yIm, int bins)
+{
+    int i = 0;
+    for (; i + 4 <= bins; i += 4)
+    {
+        __m128 xr = _mm_loadu_ps(xRe + i), xi = _mm_loadu_ps(xIm + i);
+        __m128 hr = _mm_loadu_ps(hRe + i), hi = _mm_loadu_ps(hIm + i);
+        __m128 pr = _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi));
+        __m128 pi = _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr));
+        _mm_storeu_ps(yRe + i, _mm_add_ps(_mm_loadu_ps(yRe + i), pr));
+        _mm_storeu_ps(yIm + i, _mm_add_ps(_mm_loadu_ps(yIm + i), pi));
+    }
+    SpectrumMacScalar(xRe + i, xIm + i, hRe + i, hIm + i, yRe + i, yIm + i, bins - i);
+}
+
+SYNTH_TARGET_AVX2 static void ForwardStageAVX2(float* re, float* im, int size, int half, const float* twiddleRe, const float* twiddleIm)
+{
+    for (int g = 0; g < size; g += 2 * half)
+    {
+        for (int j = 0; j < half; j += 8)
+        {
+            float* ar = re + g + j;
+            float* ai = im + g + j;
+            __m256 xr = _mm256_loadu_ps(ar), xi = _mm256_loadu_ps(ai);
+            __m256 yr = _mm256_loadu_ps(ar + half), yi = _mm256_loadu_ps(ai + half);
+            __m256 wr = _mm256_loadu_ps(twiddleRe + half + j), wi = _mm256_loadu_ps(twiddleIm + half + j);
+            __m256 dr = _mm256_sub_ps(xr, yr), di = _mm256_sub_ps(xi, yi);
+            _mm256_storeu_ps(ar, _mm256_add_ps(xr, yr));
+            _mm256_storeu_ps(ai, _mm256_add_ps(xi, yi));
+            _mm256_storeu_ps(ar + half, _mm256_sub_ps(_mm256_mul_ps(dr, wr), _mm256_mul_ps(di, wi)));
+            _mm256_storeu_ps(ai + half, _mm256_add_ps(_mm256_mul_ps(dr, wi), _mm256_mul_ps(di, wr)));
+        }
+    }
+}
+
+SYNTH_TARGET_AVX2 static void InverseStageAVX2(float* re, float* im, int size, int half, const float* twiddleRe, const float* twiddleIm)
+{
+    for (int g = 0; g < size; g += 2 * half)
+    {
+        for (int j = 0; j < half; j += 8)
+        {
+            float* ar = re + g + j;
+            float* ai = im + g + j;
+            __m256 xr = _mm256_loadu_ps(ar), xi = _mm256_loadu_ps(ai);
+            __m256 yr = _mm256_loadu_ps(ar + half), yi = _mm256_loadu_ps(ai + half);
+            __m256 wr = _mm256_loadu_ps(twiddleRe + half + j), wi = _mm256_loadu_ps(twiddleIm + half + j);
+            __m256 tr = _mm256_add_ps(_mm256_mul_ps(yr, wr), _mm256_mul_ps(yi, wi));
+            __m256 ti = _mm256_sub_ps(_mm256_mul_ps(yi, wr), _mm256_mul_ps(yr, wi));
+            _mm256_storeu_ps(ar, _mm256_add_ps(xr, tr));
+            _mm256_storeu_ps(ai, _mm256_add_ps(xi, ti));
+            _mm256_storeu_ps(ar + half, _mm256_sub_ps(xr, tr));
+            _mm256_storeu_ps(ai + half, _mm256_sub_ps(xi, ti));
+        }
+    }
+}
+
+SYNTH_TARGET_AVX2 static void ForwardAVX2(float* re, float* im, int size, const float* twiddleRe, const float* twiddleIm)
+{
+    int half = size / 2;
+    for (; half >= 8; half /= 2)
+        ForwardStageAVX2(re, im, size, half, twiddleRe, twiddleIm);
+    _mm256_zeroupper();
+    if (half == 4)
+        ForwardStageSSE2(re, im, size, half, twiddleRe, twiddleIm);
+    ForwardLastStages(re, im, size);
+}
+
+SYNTH_TARGET_AVX2 static void InverseAVX2(float* re, float* im, int size, const float* twiddleRe, const float* twiddleIm)
+{
+    InverseFirstStages(re, im, size);
+    if (size > 4)
+        InverseStageSSE2(re, im, size, 4, twiddleRe, twiddleIm);
+    for (int half = 8; half < size; half *= 2)
+        InverseStageAVX2(re, im, size, half, twiddleRe, twiddleIm);
+    _mm256_zeroupper();
+}
+
+SYNTH_TARGET_AVX2 static void SpectrumMacAVX2(const float* xRe, const float* xIm, const float* hRe, const float* hIm,
+                                              float* yRe, float* yIm, int bins)
+{
+    int i = 0;
+    for (; i + 8 <= bins; i += 8)
+    {
+        __m256 xr = _mm256_loadu_ps(xRe + i), xi = _mm256_loadu_ps(xIm + i);
+        __m256 hr = _mm256_loadu_ps(hRe + i), hi = _mm256_loadu_ps(hIm + i);
+        __m256 pr = _mm256_sub_ps(_mm256_mul_ps(xr, hr), _mm256_mul_ps(xi, hi));
+        __m256 pi = _mm256_add_ps(_mm256_mul_ps(xr, hi), _mm256_mul_ps(xi, hr));
+        _mm256_storeu_ps(yRe + i, _mm256_add_ps(_mm256_loadu_ps(yRe + i), pr));
+        _mm256_storeu_ps(yIm + i, _mm256_add_ps(_mm256_loadu_ps(yIm + i), pi));
+    }
+    _mm256_zeroupper();
+    SpectrumMacScalar(xRe + i, xIm + i, hRe + i, hIm + i, yRe + i, yIm + i, bins - i);
+}
+
+#endif
+
+SpectrumMacFn GetSpectrumMacFunction(SimdLevel level)
+{
+#if SYNTH_X86
+    if (level == SimdLevel::AVX2)
+        return &SpectrumMacAVX2;
+    if (level == SimdLevel::SSE2)
+        return &SpectrumMacSSE2;
+#endif
+    (void)level;
+    return &SpectrumMacScalar;
+}
+
+//---------------------------------------------------------------------------
+
+void Fft::Prepare(int size)
+{
+    m_Size = size;
+    m_TwiddleRe.assign(size, 0.0f);
+    m_TwiddleIm.assign(size, 0.0f);
+    for (int half = 1; half < size; half *= 2)
+    {
+        for (int j = 0; j < half; ++j)
+        {
+            double angle = -PI * j / half;
+            m_TwiddleRe[half + j] = (float)std::cos(angle);
+            m_TwiddleIm[half + j] = (float)std::sin(angle);
+        }
+    }
+
+    m_Forward = &ForwardScalar;
+    m_Inverse = &InverseScalar;
+#if SYNTH_X86
+    SimdLevel level = GetSimdLevel();
+    if (level == SimdLevel::AVX2)
+    {
+        m_Forward = &ForwardAVX2;
+        m_Inverse = &InverseAVX2;
+    }
+    else if (level == SimdLevel::SSE2)
+    {
+        m_Forward = &ForwardSSE2;
+        m_Inverse = &InverseSSE2;
+    }
+#endif
+}
+
+void Fft::Forward(float* re, float* im) const
+{
+    m_Forward(re, im, m_Size, m_TwiddleRe.data(), m_TwiddleIm.data());
+}
+
+void Fft::Inverse(float* re, float* im) const
+{
+    m_Inverse(re, im, m_Size, m_TwiddleRe.data(), m_TwiddleIm.data());
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "cpu_features.hpp"
+#include <vector>
+
+// Complex FFT on split real/imaginary arrays. The forward transform takes
+// natural order and leaves the spectrum in bit-reversed order; the inverse
+// takes bit-reversed order back to natural order. Convolution only
+// multiplies spectra bin by bin, so the permutation is never needed.
+class Fft
+{
+public:
+    // size is a power of two, at least 4. Allocates the twiddle tables.
+    void Prepare(int size);
+    int GetSize() const { return m_Size; }
+
+    void Forward(float* re, float* im) const;
+    void Inverse(float* re, float* im) const;       // Unscaled: the result is size times the input
+
+private:
+    typedef void (*TransformFn)(float* re, float* im, int size, const float* twiddleRe, const float* twiddleIm);
+
+    int m_Size = 0;
+    TransformFn m_Forward = nullptr;
+    TransformFn m_Inverse = nullptr;
+    std::vector<float> m_TwiddleRe;     // [h + j] = exp(-2 pi i j / 2h) for the stage of half-size h
+    std::vector<float> m_TwiddleIm;
+};
+
+// y += x * h for complex spectra of bins entries
+typedef void (*SpectrumMacFn)(const float* xRe, const float* xIm, const float* hRe, const float* hIm,
+                              float* yRe, float* yIm, int bins);
+
+SpectrumMacFn GetSpectrumMacFunction(SimdLevel level);
@@ -0,0 +1,646 @@
+#include "fm_synth.hpp"
+#include "fast_sine.hpp"
+#include "mixer.hpp"
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+static const float PHASE_TO_TURNS = 1.0f / 4294967296.0f;
+
+// Carriers are full scale; keep a chord near the level of the piano samples
+static const float FM_LEVEL = 0.25f;
+
+// Slots kept free for stolen voices to fade out in
+static const int STEAL_RESERVE = 16;
+
+const char* GetFmAlgorithmName(FmAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case FmAlgorithm::Stack: return "Stack";
+    case FmAlgorithm::TwoStacks: return "Two stacks";
+    case FmAlgorithm::Fan: return "Fan";
+    case FmAlgorithm::Additive: return "Additive";
+    default: return "?";
+    }
+}
+
+// Envelope fields: attack, decay, sustain, release
+static const FmPatch g_Presets[] = {
+    { "FM electric piano", FmAlgorithm::TwoStacks, 0.0f, {
+        { 1.0f, 0.0f, 1.0f, 0.7f, { 0.001f, 2.5f, 0.0f, 0.4f } },
+        { 1.0f, 3.0f, 1.6f, 0.8f, { 0.001f, 1.2f, 0.0f, 0.4f } },
+        { 1.0f, -4.0f, 0.35f, 0.8f, { 0.001f, 0.8f, 0.0f, 0.3f } },
+        { 14.0f, 0.0f, 1.2f, 0.9f, { 0.001f, 0.25f, 0.0f, 0.2f } } } },
+    { "FM bell", FmAlgorithm::TwoStacks, 0.0f, {
+        { 1.0f, 0.0f, 1.0f, 0.5f, { 0.001f, 6.0f, 0.0f, 2.0f } },
+        { 3.5f, 0.0f, 2.5f, 0.6f, { 0.001f, 4.0f, 0.0f, 2.0f } },
+        { 2.0f, 7.0f, 0.5f, 0.5f, { 0.001f, 3.0f, 0.0f, 1.5f } },
+        { 5.19f, 0.0f, 1.8f, 0.6f, { 0.001f, 2.0f, 0.0f, 1.0f } } } },
+    { "FM bass", FmAlgorithm::Stack, 1.2f, {
+        { 1.0f, 0.0f, 1.0f, 0.4f, { 0.002f, 3.0f, 0.6f, 0.15f } },
+        { 1.0f, 0.0f, 2.2f, 0.8f, { 0.001f, 0.6f, 0.2f, 0.15f } },
+        { 2.0f, 0.0f, 1.0f, 0.8f, { 0.001f, 0.3f, 0.0f, 0.1f } },
+        { 1.0f, 0.0f, 0.8f, 0.5f, { 0.001f, 0.4f, 0.3f, 0.1f } } } },
+    { "FM organ", FmAlgorithm::Additive, 0.6f, {
+        { 0.5f, 0.0f, 0.6f, 0.0f, { 0.005f, 1.0f, 1.0f, 0.08f } },
+        { 1.0f, 0.0f, 0.8f, 0.0f, { 0.005f, 1.0f, 1.0f, 0.08f } },
+        { 2.0f, 1.5f, 0.5f, 0.0f, { 0.005f, 1.0f, 1.0f, 0.08f } },
+        { 3.0f, 0.0f, 0.35f, 0.0f, { 0.005f, 1.0f, 1.0f, 0.08f } } } },
+    { "FM brass", FmAlgorithm::Fan, 0.9f, {
+        { 1.0f, 0.0f, 0.6f, 0.5f, { 0.06f, 2.0f, 0.8f, 0.2f } },
+        { 1.0f, 6.0f, 0.5f, 0.5f, { 0.07f, 2.0f, 0.8f, 0.2f } },
+        { 2.0f, -6.0f, 0.25f, 0.5f, { 0.08f, 2.0f, 0.7f, 0.2f } },
+        { 1.0f, 0.0f, 2.0f, 0.7f, { 0.08f, 1.5f, 0.6f, 0.25f } } } },
+};
+
+int GetFmPresetCount()
+{
+    return (int)(sizeof(g_Presets) / sizeof(g_Presets[0]));
+}
+
+const FmPatch& GetFmPreset(int preset)
+{
+    return g_Presets[preset >= 0 && preset < GetFmPresetCount() ? preset : 0];
+}
+
+static bool IsCarrier(FmAlgorithm algorithm, int op)
+{
+    switch (algorithm)
+    {
+    case FmAlgorithm::Stack: return op == 0;
+    case FmAlgorithm::TwoStacks: return op == 0 || op == 2;
+    case FmAlgorithm::Fan: return op != 3;
+    default: return true;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Operator kernels
+//
+// Operator 3 runs first with its feedback, then 2, 1 and 0, each phase
+// modulated by the operators feeding it. Modulator levels are in turns, so
+// their output is added to the carrier phase directly.
+
+template<FmAlgorithm Algorithm>
+static void FmScalar(const FmLanes& lanes, float* outL, float* outR, int frames)
+{
+    const int stride = MAX_FM_VOICES;
+    for (int v = 0; v < lanes.count; ++v)
+    {
+        uint32_t phase[FM_OPERATORS], increment[FM_OPERATORS];
+        float level[FM_OPERATORS], step[FM_OPERATORS];
+        bool silent = true;
+        for (int op = 0; op < FM_OPERATORS; ++op)
+        {
+            phase[op] = lanes.phase[op * stride + v];
+            increment[op] = lanes.increment[op * stride + v];
+            level[op] = lanes.level[op * stride + v];
+            step[op] = lanes.levelStep[op * stride + v];
+            silent = silent && level[op] == 0.0f && step[op] == 0.0f;
+        }
+        if (silent)
+            continue;
+        float f1 = lanes.feedback1[v], f2 = lanes.feedback2[v];
+        float left = lanes.panLeft[v], right = lanes.panRight[v];
+
+        for (int i = 0; i < frames; ++i)
+        {
+            float t[FM_OPERATORS];
+            for (int op = 0; op < FM_OPERATORS; ++op)
+                t[op] = (float)(int32_t)phase[op] * PHASE_TO_TURNS;
+
+            float raw = FastSine(t[3] + lanes.feedback * 0.5f * (f1 + f2));
+            f2 = f1;
+            f1 = raw;
+            float y3 = raw * level[3];
+            float y2, y1, y0, out;
+            if (Algorithm == FmAlgorithm::Stack)
+            {
+                y2 = FastSine(t[2] + y3) * level[2];
+                y1 = FastSine(t[1] + y2) * level[1];
+                out = FastSine(t[0] + y1) * level[0];
+            }
+            else if (Algorithm == FmAlgorithm::TwoStacks)
+            {
+                y2 = FastSine(t[2] + y3) * level[2];
+                y1 = FastSine(t[1]) * level[1];
+                y0 = FastSine(t[0] + y1) * level[0];
+                out = y0 + y2;
+            }
+            else if (Algorithm == FmAlgorithm::Fan)
+            {
+                y2 = FastSine(t[2] + y3) * level[2];
+                y1 = FastSine(t[1] + y3) * level[1];
+                y0 = FastSine(t[0] + y3) * level[0];
+                out = y0 + y1 + y2;
+            }
+            else
+            {
+                y2 = FastSine(t[2]) * level[2];
+                y1 = FastSine(t[1]) * level[1];
+                y0 = FastSine(t[0]) * level[0];
+                out = y0 + y1 + y2 + y3;
+            }
+            outL[i] += out * left;
+            outR[i] += out * right;
+
+            for (int op = 0; op < FM_OPERATORS; ++op)
+            {
+                phase[op] += increment[op];
+                level[op] += step[op];
+            }
+        }
+
+        for (int op = 0; op < FM_OPERATORS; ++op)
+        {
+            lanes.phase[op * stride + v] = phase[op];
+            lanes.level[op * stride + v] = level[op];
+        }
+        lanes.feedback1[v] = f1;
+        lanes.feedback2[v] = f2;
+    }
+}
+
+#if SYNTH_X86
+
+// Lanes hold one voice each, so the kernels accumulate per-lane sums for a
+// chunk of frames and fold the lanes into the output at the end
+static const int CHUNK_FRAMES = 64;
+
+static bool LanesSilent(const FmLanes& lanes, int first, int width)
+{
+    for (int op = 0; op < FM_OPERATORS; ++op)
+    {
+        for (int v = first; v < first + width; ++v)
+        {
+            if (lanes.level[op * MAX_FM_VOICES + v] != 0.0f || lanes.levelStep[op * MAX_FM_VOICES + v] != 0.0f)
+                return false;
+        }
+    }
+    return true;
+}
+
+template<FmAlgorithm Algorithm>
+SYNTH_TARGET_SSE2 static void FmSSE2(const FmLanes& lanes, float* outL, float* outR, int frames)
+{
+    alignas(16) float accL[CHUNK_FRAMES * 4];
+    alignas(16) float accR[CHUNK_FRAMES * 4];
+    const int stride = MAX_FM_VOICES;
+    const __m128 toTurns = _mm_set1_ps(PHASE_TO_TURNS);
+    const __m128 feedback = _mm_set1_ps(lanes.feedback * 0.5f);
+
+    for (int start = 0; start < frames; start += CHUNK_FRAMES)
+    {
+        int chunk = frames - start < CHUNK_FRAMES ? frames - start : CHUNK_FRAMES;
+        for (int i = 0; i < chunk * 4; i += 4)
+        {
+            _mm_store_ps(accL + i, _mm_setzero_ps());
+            _mm_store_ps(accR + i, _mm_setzero_ps());
+        }
+
+        for (int v = 0; v < lanes.count; v += 4)
+        {
+            if (LanesSilent(lanes, v, 4))
+                continue;
+
+            __m128i phase[FM_OPERATORS], increment[FM_OPERATORS];
+            __m128 level[FM_OPERATORS], step[FM_OPERATORS];
+            for (int op = 0; op < FM_OPERATORS; ++op)
+            {
+                phase[op] = _mm_loadu_si128((const __m128i*)(lanes.phase + op * stride + v));
+                increment[op] = _mm_loadu_si128((const __m128i*)(lanes.increment + op * stride + v));
+                level[op] = _mm_loadu_ps(lanes.level + op * stride + v);
+                step[op] = _mm_loadu_ps(lanes.levelStep + op * stride + v);
+            }
+            __m128 f1 = _mm_loadu_ps(lanes.feedback1 + v);
+            __m128 f2 = _mm_loadu_ps(lanes.feedback2 + v);
+            __m128 left = _mm_loadu_ps(lanes.panLeft + v);
+            __m128 right = _mm_loadu_ps(lanes.panRight + v);
+
+            for (int i = 0; i < chunk; ++i)
+            {
+                __m128 t[FM_OPERATORS];
+                for (int op = 0; op < FM_OPERATORS; ++op)
+                    t[op] = _mm_mul_ps(_mm_cvtepi32_ps(phase[op]), toTurns);
+
+                __m128 raw = FastSineSSE2(_mm_add_ps(t[3], _mm_mul_ps(feedback, _mm_add_ps(f1, f2))));
+                f2 = f1;
+                f1 = raw;
+                __m128 y3 = _mm_mul_ps(raw, level[3]);
+                __m128 y2, y1, y0, out;
+                if (Algorithm == FmAlgorithm::Stack)
+                {
+                    y2 = _mm_mul_ps(FastSineSSE2(_mm_add_ps(t[2], y3)), level[2]);
+                    y1 = _mm_mul_ps(FastSineSSE2(_mm_add_ps(t[1], y2)), level[1]);
+                    out = _mm_mul_ps(FastSineSSE2(_mm_add_ps(t[0], y1)), level[0]);
+                }
+                else if (Algorithm == FmAlgorithm::TwoStacks)
+                {
+                    y2 = _mm_mul_ps(FastSineSSE2(_mm_add_ps(t[2], y3)), level[2]);
+                    y1 = _mm_mul_ps(FastSineSSE2(t[1]), level[1]);
+                    y0 = _mm_mul_ps(FastSineSSE2(_mm_add_ps(t[0], y1)), level[0]);
+                    out = _mm_add_ps(y0, y2);
+                }
+                else if (Algorithm == FmAlgorithm::Fan)
+                {
+                    y2 = _mm_mul_ps(FastSineSSE2(_mm_add_ps(t[2], y3)), level[2]);
+                    y1 = _mm_mul_ps(FastSineSSE2(_mm_add_ps(t[1], y3)), level[1]);
+                    y0 = _mm_mul_ps(FastSineSSE2(_mm_add_ps(t[0], y3)), level[0]);
+                    out = _mm_add_ps(_mm_add_ps(y0, y1), y2);
+                }
+                else
+                {
+                    y2 = _mm_mul_ps(FastSineSSE2(t[2]), level[2]);
+                    y1 = _mm_mul_ps(FastSineSSE2(t[1]), level[1]);
+                    y0 = _mm_mul_ps(FastSineSSE2(t[0]), level[0]);
+                    out = _mm_add_ps(_mm_add_ps(y0, y1), _mm_add_ps(y2, y3));
+                }
+                _mm_store_ps(accL + 4 * i, _mm_add_ps(_mm_load_ps(accL + 4 * i), _mm_mul_ps(out, left)));
+                _mm_store_ps(accR + 4 * i, _mm_add_ps(_mm_load_ps(accR + 4 * i), _mm_mul_ps(out, right)));
+
+                for (int op = 0; op < FM_OPERATORS; ++op)
+                {
+                    phase[op] = _mm_add_epi32(phase[op], increment[op]);
+                    level[op] = _mm_add_ps(level[op], step[op]);
+                }
+            }
+
+            for (int op = 0; op < FM_OPERATORS; ++op)
+            {
+                _mm_storeu_si128((__m128i*)(lanes.phase + op * stride + v), phase[op]);
+                _mm_storeu_ps(lanes.level + op * stride + v, level[op]);
+            }
+            _mm_storeu_ps(lanes.feedback1 + v, f1);
+            _mm_storeu_ps(lanes.feedback2 + v, f2);
+        }
+
+        FoldLanes(accL, outL + start, chunk);
+        FoldLanes(accR, outR + start, chunk);
+    }
+}
+
+template<FmAlgorithm Algorithm>
+SYNTH_TARGET_AVX2 static void FmAVX2(const FmLanes& lanes, float* outL, float* outR, int frames)
+{
+    alignas(32) float accL[CHUNK_FRAMES * 8];
+    alignas(32) float accR[CHUNK_FRAMES * 8];
+    alignas(16) float fold[CHUNK_FRAMES * 4];
+    const int stride = MAX_FM_VOICES;
+    const __m256 toTurns = _mm256_set1_ps(PHASE_TO_TURNS);
+    const __m256 feedback = _mm256_set1_ps(lanes.feedback * 0.5f);
+
+    for (int start = 0; start < frames; start += CHUNK_FRAMES)
+    {
+        int chunk = frames - start < CHUNK_FRAMES ? frames - start : CHUNK_FRAMES;
+        for (int i = 0; i < chunk * 8; i += 8)
+        {
+            _mm256_store_ps(accL + i, _mm256_setzero_ps());
+            _mm256_store_ps(accR + i, _mm256_setzero_ps());
+        }
+
+        for (int v = 0; v < lanes.count; v += 8)
+        {
+            if (LanesSilent(lanes, v, 8))
+                continue;
+
+            __m256i phase[FM_OPERATORS], increment[FM_OPERATORS];
+            __m256 level[FM_OPERATORS], step[FM_OPERATORS];
+            for (int op = 0; op < FM_OPERATORS; ++op)
+            {
+                phase[op] = _mm256_loadu_si256((const __m256i*)(lanes.phase + op * stride + v));
+                increment[op] = _mm256_loadu_si256((const __m256i*)(lanes.increment + op * stride + v));
+                level[op] = _mm256_loadu_ps(lanes.level + op * stride + v);
+                step[op] = _mm256_loadu_ps(lanes.levelStep + op * stride + v);
+            }
+            __m256 f1 = _mm256_loadu_ps(lanes.feedback1 + v);
+            __m256 f2 = _mm256_loadu_ps(lanes.feedback2 + v);
+            __m256 left = _mm256_loadu_ps(lanes.panLeft + v);
+            __m256 right = _mm256_loadu_ps(lanes.panRight + v);
+
+            for (int i = 0; i < chunk; ++i)
+            {
+                __m256 t[FM_OPERATORS];
+                for (int op = 0; op < FM_OPERATORS; ++op)
+                    t[op] = _mm256_mul_ps(_mm256_cvtepi32_ps(phase[op]), toTurns);
+
+                __m256 raw = FastSineAVX2(_mm256_add_ps(t[3], _mm256_mul_ps(feedback, _mm256_add_ps(f1, f2))));
+                f2 = f1;
+                f1 = raw;
+                __m256 y3 = _mm256_mul_ps(raw, level[3]);
+                __m256 y2, y1, y0, out;
+                if (Algorithm == FmAlgorithm::Stack)
+                {
+                    y2 = _mm256_mul_ps(FastSineAVX2(_mm256_add_ps(t[2], y3)), level[2]);
+                    y1 = _mm256_mul_ps(FastSineAVX2(_mm256_add_ps(t[1], y2)), level[1]);
+                    out = _mm256_mul_ps(FastSineAVX2(_mm256_add_ps(t[0], y1)), level[0]);
+                }
+                else if (Algorithm == FmAlgorithm::TwoStacks)
+                {
+                    y2 = _mm256_mul_ps(FastSineAVX2(_mm256_add_ps(t[2], y3)), level[2]);
+                    y1 = _mm256_mul_ps(FastSineAVX2(t[1]), level[1]);
+                    y0 = _mm256_mul_ps(FastSineAVX2(_mm256_add_ps(t[0], y1)), level[0]);
+                    out = _mm256_add_ps(y0, y2);
+                }
+                else if (Algorithm == FmAlgorithm::Fan)
+                {
+                    y2 = _mm256_mul_ps(FastSineAVX2(_mm256_add_ps(t[2], y3)), level[2]);
+                    y1 = _mm256_mul_ps(FastSineAVX2(_mm256_add_ps(t[1], y3)), level[1]);
+                    y0 = _mm256_mul_ps(FastSineAVX2(_mm256_add_ps(t[0], y3)), level[0]);
+                    out = _mm256_add_ps(_mm256_add_ps(y0, y1), y2);
+                }
+                else
+                {
+                    y2 = _mm256_mul_ps(FastSineAVX2(t[2]), level[2]);
+                    y1 = _mm256_mul_ps(FastSineAVX2(t[1]), level[1]);
+                    y0 = _mm256_mul_ps(FastSineAVX2(t[0]), level[0]);
+                    out = _mm256_add_ps(_mm256_add_ps(y0, y1), _mm256_add_ps(y2, y3));
+                }
+                _mm256_store_ps(accL + 8 * i, _mm256_add_ps(_mm256_load_ps(accL + 8 * i), _mm256_mul_ps(out, left)));
+                _mm256_store_ps(accR + 8 * i, _mm256_add_ps(_mm256_load_ps(accR + 8 * i), _mm256_mul_ps(out, right)));
+
+                for (int op = 0; op < FM_OPERATORS; ++op)
+                {
+                    phase[op] = _mm256_add_epi32(phase[op], increment[op]);
+                    level[op] = _mm256_add_ps(level[op], step[op]);
+                }
+            }
+
+            for (int op = 0; op < FM_OPERATORS; ++op)
+            {
+                _mm256_storeu_si256((__m256i*)(lanes.phase + op * stride + v), phase[op]);
+                _mm256_storeu_ps(lanes.level + op * stride + v, level[op]);
+            }
+            _mm256_storeu_ps(lanes.feedback1 + v, f1);
+            _mm256_storeu_ps(lanes.feedback2 + v, f2);
+        }
+
+        FoldLanes8(accL, fold, outL + start, chunk);
+        FoldLanes8(accR, fold, outR + start, chunk);
+    }
+}
+
+#endif
+
+template<FmAlgorithm Algorithm>
+static FmFn SelectFmFunction(SimdLevel level)
+{
+#if SYNTH_X86
+    if (level == SimdLevel::AVX2)
+        return &FmAVX2<Algorithm>;
+    if (level == SimdLevel::SSE2)
+        return &FmSSE2<Algorithm>;
+#endif
+    (void)level;
+    return &FmScalar<Algorithm>;
+}
+
+FmFn GetFmFunction(SimdLevel level, FmAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case FmAlgorithm::Stack: return SelectFmFunction<FmAlgorithm::Stack>(level);
+    case FmAlgorithm::TwoStacks: return SelectFmFunction<FmAlgorithm::TwoStacks>(level);
+    case FmAlgorithm::Fan: return SelectFmFunction<FmAlgorithm::Fan>(level);
+    default: return SelectFmFunction<FmAlgorithm::Additive>(level);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Engine
+
+void FmEngine::Prepare(int sampleRate)
+{
+    m_SampleRate = sampleRate;
+    m_ActiveCount = 0;
+    for (int a = 0; a < (int)FmAlgorithm::Count; ++a)
+        m_Render[a] = GetFmFunction(GetSimdLevel(), (FmAlgorithm)a);
+    for (int v = 0; v < MAX_FM_VOICES; ++v)
+    {
+        m_Voices[v] = FmVoice();
+        for (int op = 0; op < FM_OPERATORS; ++op)
+            m_Level[op * MAX_FM_VOICES + v] = m_LevelStep[op * MAX_FM_VOICES + v] = 0.0f;
+    }
+}
+
+int FmEngine::FindVoice(int key) const
+{
+    for (int v = 0; v < MAX_FM_VOICES; ++v)
+    {
+        if (m_Voices[v].active && m_Voices[v].key == key)
+            return v;
+    }
+    return -1;
+}
+
+// Loudest carrier envelope, used to pick a voice to steal
+float FmEngine::GetLoudness(int v) const
+{
+    const FmPatch& patch = GetFmPreset(m_Preset);
+    float loudness = 0.0f;
+    for (int op = 0; op < FM_OPERATORS; ++op)
+    {
+        if (IsCarrier(patch.algorithm, op))
+            loudness = std::fmax(loudness, m_Voices[v].envelope[op].GetLevel() * m_Scale[op * MAX_FM_VOICES + v]);
+    }
+    return loudness;
+}
+
+int FmEngine::FindQuietest(bool playingOnly) const
+{
+    int quietest = -1;
+    float quietestLoudness = 0.0f;
+    for (int v = 0; v < MAX_FM_VOICES; ++v)
+    {
+        const FmVoice& voice = m_Voices[v];
+        if (!voice.active || (playingOnly && voice.stolen))
+            continue;
+        float loudness = GetLoudness(v);
+        if (quietest < 0 || loudness < quietestLoudness)
+        {
+            quietest = v;
+            quietestLoudness = loudness;
+        }
+    }
+    return quietest;
+}
+
+int FmEngine::GetPlayingCount() const
+{
+    int playing = 0;
+    for (const auto& voice : m_Voices)
+        playing += (voice.active && !voice.stolen) ? 1 : 0;
+    return playing;
+}
+
+bool FmEngine::StealQuietest()
+{
+    int v = FindQuietest(true);
+    if (v < 0)
+        return false;
+    m_Voices[v].stolen = true;
+    for (auto& envelope : m_Voices[v].envelope)
+        envelope.FastRelease(m_SampleRate);
+    return true;
+}
+
+// Lowest free slot keeps the used lanes packed at the front. Once no more
+// than STEAL_RESERVE are free, the quietest playing voice fades out to make
+// room; a voice is only cut when a burst of notes has used every slot.
+int FmEngine::AllocateVoice()
+{
+    int idle = -1, idleCount = 0;
+    for (int v = 0; v < MAX_FM_VOICES; ++v)
+    {
+        if (!m_Voices[v].active)
+        {
+            idle = idle < 0 ? v : idle;
+            ++idleCount;
+        }
+    }
+    if (idleCount <= STEAL_RESERVE)
+        StealQuietest();
+    return idle >= 0 ? idle : FindQuietest(false);
+}
+
+void FmEngine::StartNote(int key, float pitch, float velocity, int preset)
+{
+    double frequency = 440.0 * std::pow(2.0, (pitch - 69.0) / 12.0);
+    if (frequency <= 0.0 || frequency >= 0.5 * m_SampleRate)
+        return;
+
+    // All voices share the patch's algorithm, so a patch change fades out
+    // the notes still ringing with the old one
+    if (preset != m_Preset)
+    {
+        for (auto& voice : m_Voices)
+        {
+            voice.stolen = voice.active;
+            for (auto& envelope : voice.envelope)
+                envelope.FastRelease(m_SampleRate);
+        }
+        m_Preset = preset;
+    }
+    const FmPatch& patch = GetFmPreset(preset);
+
+    // A retriggered key keeps its phases so the waveform does not jump
+    int v = FindVoice(key);
+    if (v < 0)
+    {
+        v = AllocateVoice();
+        for (int op = 0; op < FM_OPERATORS; ++op)
+        {
+            m_Voices[v].envelope[op].Reset();
+            m_Phase[op * MAX_FM_VOICES + v] = 0;
+        }
+        m_Feedback1[v] = m_Feedback2[v] = 0.0f;
+    }
+
+    FmVoice& voice = m_Voices[v];
+    voice.active = true;
+    voice.held = true;
+    voice.sustained = false;
+    voice.stolen = false;
+    voice.key = key;
+    voice.velocity = velocity;
+    for (int op = 0; op < FM_OPERATORS; ++op)
+    {
+        const FmOperator& settings = patch.op[op];
+        double increment = frequency * settings.ratio * std::pow(2.0, settings.detune / 1200.0) / m_SampleRate;
+        float sensitivity = 1.0f - settings.velocity + settings.velocity * velocity;
+        bool carrier = IsCarrier(patch.algorithm, op);
+
+        // Operators above Nyquist are muted rather than aliased
+        m_Increment[op * MAX_FM_VOICES + v] = increment < 0.5 ? (uint32_t)(increment * 4294967296.0) : 0;
+        m_Scale[op * MAX_FM_VOICES + v] = increment < 0.5 ? settings.level * sensitivity * (carrier ? FM_LEVEL : (float)(0.5 / PI)) : 0.0f;
+        voice.envelope[op].Start(settings.envelope, m_SampleRate);
+    }
+    float pan = std::fmax(-0.3f, std::fmin(0.3f, (pitch - 60.0f) / 80.0f));
+    PanGains(1.0f, pan, m_PanLeft[v], m_PanRight[v]);
+}
+
+void FmEngine::ReleaseNote(int key, bool sustainPedal)
+{
+    int v = FindVoice(key);
+    if (v < 0)
+        return;
+    m_Voices[v].held = false;
+    if (sustainPedal)
+        m_Voices[v].sustained = true;
+    else
+    {
+        for (auto& envelope : m_Voices[v].envelope)
+            envelope.Release();
+    }
+}
+
+void FmEngine::ReleaseSustained()
+{
+    for (auto& voice : m_Voices)
+    {
+        if (voice.active && voice.sustained && !voice.held)
+        {
+            voice.sustained = false;
+            for (auto& envelope : voice.envelope)
+                envelope.Release();
+        }
+    }
+}
+
+void FmEngine::ReleaseAll()
+{
+    for (auto& voice : m_Voices)
+    {
+        voice.held = voice.sustained = false;
+        for (auto& envelope : voice.envelope)
+            envelope.Release();
+    }
+}
+
+void FmEngine::Render(float* outL, float* outR, int frames)
+{
+    if (frames <= 0)
+        return;
+
+    // Operator envelopes run at block rate and become per-lane level ramps
+    const FmPatch& patch = GetFmPreset(m_Preset);
+    int lanes = 0;
+    for (int v = 0; v < MAX_FM_VOICES; ++v)
+    {
+        FmVoice& voice = m_Voices[v];
+        if (!voice.active)
+            continue;
+        for (int op = 0; op < FM_OPERATORS; ++op)
+        {
+            int i = op * MAX_FM_VOICES + v;
+            float start = voice.envelope[op].GetLevel();
+            float end = voice.envelope[op].Advance(frames);
+            m_Level[i] = start * m_Scale[i];
+            m_LevelStep[i] = (end - start) * m_Scale[i] / frames;
+        }
+        lanes = v + 1;
+    }
+    if (lanes == 0)
+        return;
+
+    FmLanes args = { m_Phase, m_Increment, m_Level, m_LevelStep, m_Feedback1, m_Feedback2,
+                     patch.feedback * (float)(0.5 / PI), m_PanLeft, m_PanRight, (lanes + 7) & ~7 };
+    m_Render[(int)patch.algorithm](args, outL, outR, frames);
+
+    // A voice ends when every carrier envelope is idle
+    m_ActiveCount = 0;
+    for (int v = 0; v < lanes; ++v)
+    {
+        FmVoice& voice = m_Voices[v];
+        bool idle = true;
+        for (int op = 0; op < FM_OPERATORS; ++op)
+            idle = idle && (!IsCarrier(patch.algorithm, op) || voice.envelope[op].IsIdle());
+        if (voice.active && idle)
+            voice.active = false;
+        if (!voice.active)
+        {
+            for (int op = 0; op < FM_OPERATORS; ++op)
+                m_Level[op * MAX_FM_VOICES + v] = m_LevelStep[op * MAX_FM_VOICES + v] = 0.0f;
+        }
+        m_ActiveCount += voice.active ? 1 : 0;
+    }
+}
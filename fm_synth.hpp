@@ -0,0 +1,119 @@
+#pragma once
+
+#include "cpu_features.hpp"
+#include "envelope.hpp"
+#include <stdint.h>
+
+const int FM_OPERATORS = 4;
+const int MAX_FM_VOICES = 256;
+
+// How the operators connect; operator 3 is always a modulator or carrier
+// with self-feedback
+enum class FmAlgorithm
+{
+    Stack,          // 3 -> 2 -> 1 -> 0
+    TwoStacks,      // 3 -> 2 and 1 -> 0, carriers 0 and 2
+    Fan,            // 3 -> 0, 1, 2, carriers 0, 1, 2
+    Additive,       // Every operator is a carrier
+    Count
+};
+
+const char* GetFmAlgorithmName(FmAlgorithm algorithm);
+
+struct FmOperator
+{
+    float ratio = 1.0f;         // Frequency relative to the note
+    float detune = 0.0f;        // Cents
+    float level = 1.0f;         // Output gain of a carrier, modulation index (radians) of a modulator
+    float velocity = 0.5f;      // How much of the level follows velocity
+    AdsrSettings envelope;
+};
+
+struct FmPatch
+{
+    const char* name;
+    FmAlgorithm algorithm;
+    float feedback;             // Modulation index of operator 3 on itself
+    FmOperator op[FM_OPERATORS];
+};
+
+int GetFmPresetCount();
+const FmPatch& GetFmPreset(int preset);
+
+// Operator state of many voices, one voice per lane. Every array holds
+// FM_OPERATORS rows of MAX_FM_VOICES, indexed [op * MAX_FM_VOICES + voice].
+struct FmLanes
+{
+    uint32_t* phase;
+    const uint32_t* increment;
+    float* level;               // Modulators in turns, advanced by levelStep every frame
+    const float* levelStep;
+    float* feedback1;           // Last two outputs of operator 3 before its level
+    float* feedback2;
+    float feedback;             // Turns per unit output
+    const float* panLeft;
+    const float* panRight;
+    int count;
+};
+
+typedef void (*FmFn)(const FmLanes& lanes, float* outL, float* outR, int frames);
+
+// Adds the lanes to outL/outR
+FmFn GetFmFunction(SimdLevel level, FmAlgorithm algorithm);
+
+struct FmVoice
+{
+    bool active = false;
+    bool held = false;
+    bool sustained = false;
+    bool stolen = false;        // Fading out to make room for other voices
+    int key = 0;
+    float velocity = 1.0f;
+    AdsrEnvelope envelope[FM_OPERATORS];
+};
+
+// FM synthesiser voices rendered by SIMD kernels that run one voice per
+// lane; a voice is a few hundred bytes of state. Audio thread only;
+// SynthEngine forwards its events here.
+class FmEngine
+{
+public:
+    void Prepare(int sampleRate);
+
+    // pitch in MIDI note numbers, may be fractional
+    void StartNote(int key, float pitch, float velocity, int preset);
+    void ReleaseNote(int key, bool sustainPedal);
+    void ReleaseSustained();
+    void ReleaseAll();
+
+    // Adds the voices to outL/outR
+    void Render(float* outL, float* outR, int frames);
+    int GetActiveCount() const { return m_ActiveCount; }
+    // For the governor's voice limit: voices playing, not counting those
+    // fading out after being stolen, and a fade-out of the quietest one;
+    // false if none is playing
+    int GetPlayingCount() const;
+    bool StealQuietest();
+
+private:
+    int FindVoice(int key) const;
+    int AllocateVoice();
+    int FindQuietest(bool playingOnly) const;
+    float GetLoudness(int v) const;
+
+    int m_SampleRate = 44100;
+    int m_ActiveCount = 0;
+    int m_Preset = 0;
+    FmFn m_Render[(int)FmAlgorithm::Count] = {};
+    FmVoice m_Voices[MAX_FM_VOICES];
+
+    alignas(32) uint32_t m_Phase[FM_OPERATORS * MAX_FM_VOICES] = {};
+    alignas(32) uint32_t m_Increment[FM_OPERATORS * MAX_FM_VOICES] = {};
+    alignas(32) float m_Level[FM_OPERATORS * MAX_FM_VOICES] = {};
+    alignas(32) float m_LevelStep[FM_OPERATORS * MAX_FM_VOICES] = {};
+    alignas(32) float m_Feedback1[MAX_FM_VOICES] = {};
+    alignas(32) float m_Feedback2[MAX_FM_VOICES] = {};
+    alignas(32) float m_PanLeft[MAX_FM_VOICES] = {};
+    alignas(32) float m_PanRight[MAX_FM_VOICES] = {};
+    float m_Scale[FM_OPERATORS * MAX_FM_VOICES] = {};     // Envelope to level
+};
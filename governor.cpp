@@ -0,0 +1,124 @@
+#include "governor.hpp"
+
+// A step up waits this long for the previous step to show in the load, a
+// step down waits longer so the governor does not oscillate
+static const double ESCALATE_HOLD = 0.05;
+static const double RECOVER_HOLD = 2.0;
+
+void CpuGovernor::Prepare(int sampleRate)
+{
+    m_SampleRate = sampleRate;
+    m_Load = 0.0f;
+    m_SecondsSinceChange = 0.0;
+    SetLevel(DegradeLevel::Normal);
+}
+
+void CpuGovernor::BeginBlock()
+{
+    m_BlockStart = Clock::now();
+}
+
+void CpuGovernor::EndBlock(int frames)
+{
+    if (frames <= 0)
+        return;
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - m_BlockStart).count();
+    m_LastRender = elapsed;
+    double duration = (double)frames / m_SampleRate;
+    float load = (float)(elapsed / duration);
+
+    // React to spikes at once, forget them slowly
+    m_Load = load > m_Load ? load : m_Load + (load - m_Load) * 0.05f;
+    m_SecondsSinceChange += duration;
+
+    m_Counters.blocks.fetch_add(1, std::memory_order_relaxed);
+    m_Counters.blocksAtLevel[(int)m_Level].fetch_add(1, std::memory_order_relaxed);
+    if (m_Level != DegradeLevel::Normal)
+        m_Counters.degradedBlocks.fetch_add(1, std::memory_order_relaxed);
+    if (load > 1.0f)
+        m_Counters.overruns.fetch_add(1, std::memory_order_relaxed);
+    m_Counters.load.store(m_Load, std::memory_order_relaxed);
+    if (load > m_Counters.peakLoad.load(std::memory_order_relaxed))
+        m_Counters.peakLoad.store(load, std::memory_order_relaxed);
+
+    if (!m_Enabled.load(std::memory_order_relaxed))
+    {
+        if (m_Level != DegradeLevel::Normal)
+            SetLevel(DegradeLevel::Normal);
+        return;
+    }
+
+    int level = (int)m_Level;
+    if (m_Load > m_HighLoad.load(std::memory_order_relaxed) && m_SecondsSinceChange >= ESCALATE_HOLD && level + 1 < (int)DegradeLevel::Count)
+    {
+        SetLevel((DegradeLevel)(level + 1));
+        m_Counters.levelUps.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if (m_Load < m_LowLoad.load(std::memory_order_relaxed) && m_SecondsSinceChange >= RECOVER_HOLD && level > 0)
+    {
+        SetLevel((DegradeLevel)(level - 1));
+        m_Counters.levelDowns.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void CpuGovernor::SetLevel(DegradeLevel level)
+{
+    m_Level = level;
+    m_SecondsSinceChange = 0.0;
+    m_Counters.level.store((int)level, std::memory_order_relaxed);
+}
+
+int CpuGovernor::GetVoiceLimit(int maxVoices) const
+{
+    int limit = maxVoices;
+    switch (m_Level)
+    {
+    case DegradeLevel::LinearInterpolation: limit = 48; break;
+    case DegradeLevel::Polyphony32: limit = 32; break;
+    case DegradeLevel::Polyphony16: limit = 16; break;
+    default: break;
+    }
+    return limit < maxVoices ? limit : maxVoices;
+}
+
+InterpolationKind CpuGovernor::LimitInterpolation(InterpolationKind kind) const
+{
+    InterpolationKind cap = InterpolationKind::Count;
+    if (m_Level >= DegradeLevel::LinearInterpolation)
+        cap = InterpolationKind::Linear;
+    else if (m_Level >= DegradeLevel::CheapInterpolation)
+        cap = InterpolationKind::Cubic;
+    return kind < cap ? kind : cap;
+}
+
+// The physical model follows the interpolation steps
+PhysicalQuality CpuGovernor::LimitPhysicalQuality(PhysicalQuality quality) const
+{
+    PhysicalQuality cap = PhysicalQuality::Count;
+    if (m_Level >= DegradeLevel::LinearInterpolation)
+        cap = PhysicalQuality::Draft;
+    else if (m_Level >= DegradeLevel::CheapInterpolation)
+        cap = PhysicalQuality::Low;
+    return quality < cap ? quality : cap;
+}
+
+void CpuGovernor::SetThresholds(float highLoad, float lowLoad)
+{
+    m_HighLoad.store(highLoad, std::memory_order_relaxed);
+    m_LowLoad.store(lowLoad, std::memory_order_relaxed);
+}
+
+const char* CpuGovernor::GetLevelName(DegradeLevel level)
+{
+    switch (level)
+    {
+    case DegradeLevel::Normal: return "Normal";
+    case DegradeLevel::NoOptionalEffects: return "No optional effects";
+    case DegradeLevel::CheapInterpolation: return "Cubic interpolation";
+    case DegradeLevel::LinearInterpolation: return "Linear interpolation, 48 voices";
+    case DegradeLevel::Polyphony32: return "32 voices";
+    case DegradeLevel::Polyphony16: return "16 voices";
+    default: return "?";
+    }
+}
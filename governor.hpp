@@ -0,0 +1,78 @@
+#pragma once
+
+#include "interpolation.hpp"
+#include "physical_piano.hpp"
+#include <atomic>
+#include <chrono>
+
+// Degradation steps, each one keeps everything the previous one did
+enum class DegradeLevel
+{
+    Normal,
+    NoOptionalEffects,      // Optional master effects bypassed
+    CheapInterpolation,     // Kernels limited to cubic
+    LinearInterpolation,    // Kernels limited to linear, polyphony 48
+    Polyphony32,
+    Polyphony16,
+    Count
+};
+
+// Counters describing the governor's decisions, readable from any thread
+struct GovernorCounters
+{
+    std::atomic<unsigned long long> blocks{ 0 };
+    std::atomic<unsigned long long> overruns{ 0 };         // Blocks that took longer than their duration
+    std::atomic<unsigned long long> degradedBlocks{ 0 };   // Blocks rendered above DegradeLevel::Normal
+    std::atomic<unsigned long long> blocksAtLevel[(int)DegradeLevel::Count] = {};
+    std::atomic<unsigned long long> levelUps{ 0 };
+    std::atomic<unsigned long long> levelDowns{ 0 };
+    std::atomic<unsigned long long> voicesStolen{ 0 };
+    std::atomic<int> level{ 0 };
+    std::atomic<float> load{ 0.0f };                       // Smoothed render time / block duration
+    std::atomic<float> peakLoad{ 0.0f };
+};
+
+// Measures the render time of every block against its real-time duration and
+// trades quality for CPU when the load approaches the deadline, recovering
+// step by step once it drops again.
+class CpuGovernor
+{
+public:
+    void Prepare(int sampleRate);
+
+    // Audio thread, around each render call
+    void BeginBlock();
+    void EndBlock(int frames);
+    double GetLastRenderSeconds() const { return m_LastRender; }     // Audio thread, measured by EndBlock()
+
+    DegradeLevel GetLevel() const { return m_Level; }
+    int GetVoiceLimit(int maxVoices) const;
+    InterpolationKind LimitInterpolation(InterpolationKind kind) const;
+    PhysicalQuality LimitPhysicalQuality(PhysicalQuality quality) const;
+    bool OptionalEffectsEnabled() const { return m_Level < DegradeLevel::NoOptionalEffects; }
+    void CountStolenVoice() { m_Counters.voicesStolen.fetch_add(1, std::memory_order_relaxed); }
+
+    // Degrade above highLoad, recover below lowLoad
+    void SetThresholds(float highLoad, float lowLoad);
+    void SetEnabled(bool enabled) { m_Enabled.store(enabled, std::memory_order_relaxed); }
+    bool IsEnabled() const { return m_Enabled.load(std::memory_order_relaxed); }
+
+    const GovernorCounters& GetCounters() const { return m_Counters; }
+    static const char* GetLevelName(DegradeLevel level);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    void SetLevel(DegradeLevel level);
+
+    Clock::time_point m_BlockStart;
+    double m_LastRender = 0.0;
+    int m_SampleRate = 44100;
+    DegradeLevel m_Level = DegradeLevel::Normal;
+    float m_Load = 0.0f;
+    double m_SecondsSinceChange = 0.0;      // Audio time since the last level change
+    std::atomic<float> m_HighLoad{ 0.75f };
+    std::atomic<float> m_LowLoad{ 0.45f };
+    std::atomic<bool> m_Enabled{ true };
+    GovernorCounters m_Counters;
+};
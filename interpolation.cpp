@@ -0,0 +1,440 @@
+#include "interpolation.hpp"
+#include <atomic>
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+static const int SINC_PHASES = 256;
+
+// Zeroth-order modified Bessel function, used by the Kaiser window
+static double BesselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 64; ++k)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12)
+            break;
+    }
+    return sum;
+}
+
+void SincTable::Build(int tapCount, int phaseCount, double cutoff, double kaiserBeta)
+{
+    taps = tapCount;
+    phases = phaseCount;
+    rows.assign((size_t)phases * taps * 2, 0.0f);
+
+    const double half = taps * 0.5;
+    const double window_norm = 1.0 / BesselI0(kaiserBeta);
+
+    // Coefficients for all phases plus the one at frac == 1, which is only
+    // needed to compute the deltas of the last row
+    std::vector<double> coeffs((size_t)(phases + 1) * taps);
+    for (int r = 0; r <= phases; ++r)
+    {
+        double frac = (double)r / phases;
+        double sum = 0.0;
+        for (int k = 0; k < taps; ++k)
+        {
+            double t = k - (half - 1.0) - frac;     // Distance from the read position
+            double x = t / half;
+            double window = (x <= -1.0 || x >= 1.0) ? 0.0 : BesselI0(kaiserBeta * std::sqrt(1.0 - x * x)) * window_norm;
+            double arg = PI * cutoff * t;
+            double sinc = (std::fabs(arg) < 1e-9) ? 1.0 : std::sin(arg) / arg;
+            double c = cutoff * sinc * window;
+            coeffs[(size_t)r * taps + k] = c;
+            sum += c;
+        }
+
+        // Unity gain at DC for every phase
+        for (int k = 0; k < taps; ++k)
+            coeffs[(size_t)r * taps + k] /= sum;
+    }
+
+    for (int r = 0; r < phases; ++r)
+    {
+        float* row = &rows[(size_t)r * taps * 2];
+        for (int k = 0; k < taps; ++k)
+        {
+            double c0 = coeffs[(size_t)r * taps + k];
+            double c1 = coeffs[(size_t)(r + 1) * taps + k];
+            row[k] = (float)c0;
+            row[taps + k] = (float)(c1 - c0);
+        }
+    }
+}
+
+static SincTable MakeDefaultSincTable(int taps, double cutoff, double beta)
+{
+    SincTable table;
+    table.Build(taps, SINC_PHASES, cutoff, beta);
+    return table;
+}
+
+// Shorter kernels trade passband width against stopband rejection
+static const SincTable g_Sinc8 = MakeDefaultSincTable(8, 0.80, 4.0);
+static const SincTable g_Sinc16 = MakeDefaultSincTable(16, 0.88, 6.0);
+static const SincTable g_Sinc32 = MakeDefaultSincTable(32, 0.92, 8.0);
+
+const SincTable& GetDefaultSincTable(int taps)
+{
+    if (taps <= 8)
+        return g_Sinc8;
+    if (taps <= 16)
+        return g_Sinc16;
+    return g_Sinc32;
+}
+
+// Clamp the request so the last output frame still reads inside the source
+static int AvailableFrames(const ResampleArgs& args)
+{
+    double remaining = (args.length - *args.position) / args.step;
+    if (remaining <= 0.0)
+        return 0;
+    double available = std::ceil(remaining);
+    return available < args.frames ? (int)available : args.frames;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Single-point interpolators, p points at the integer part of the position
+
+template<InterpolationKind Kind>
+struct Interpolator;
+
+template<>
+struct Interpolator<InterpolationKind::Linear>
+{
+    static float Read(const float* p, float f)
+    {
+        return p[0] + f * (p[1] - p[0]);
+    }
+};
+
+template<>
+struct Interpolator<InterpolationKind::Cubic>
+{
+    static float Read(const float* p, float f)
+    {
+        float xm1 = p[-1], x0 = p[0], x1 = p[1], x2 = p[2];
+        float c1 = 0.5f * (x1 - xm1);
+        float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+        float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+        return ((c3 * f + c2) * f + c1) * f + x0;
+    }
+};
+
+template<int Taps>
+static inline float ReadSinc(const float* p, const SincTable& table, double frac)
+{
+    double phase = frac * table.phases;
+    int r = (int)phase;
+    float pf = (float)(phase - r);
+    const float* row = table.Row(r);
+    const float* x = p - (Taps / 2 - 1);
+
+    float acc = 0.0f;
+    for (int k = 0; k < Taps; ++k)
+        acc += x[k] * (row[k] + pf * row[Taps + k]);
+    return acc;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Polynomial kernels
+
+template<InterpolationKind Kind, SimdLevel Level>
+struct PolyKernel
+{
+    static int Run(const ResampleArgs& args)
+    {
+        int frames = AvailableFrames(args);
+        double pos = *args.position;
+        for (int i = 0; i < frames; ++i)
+        {
+            int base = (int)pos;
+            args.dst[i] = Interpolator<Kind>::Read(args.src + base, (float)(pos - base));
+            pos += args.step;
+        }
+        *args.position = pos;
+        return frames;
+    }
+};
+
+#if SYNTH_X86
+template<InterpolationKind Kind>
+struct PolyKernel<Kind, SimdLevel::SSE2>
+{
+    SYNTH_TARGET_SSE2 static int Run(const ResampleArgs& args)
+    {
+        int frames = AvailableFrames(args);
+        double pos = *args.position;
+        const float step = (float)args.step;
+        const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+        int i = 0;
+        for (; i + 4 <= frames; i += 4)
+        {
+            // Re-base every group so float offsets keep full precision
+            int base = (int)pos;
+            __m128 off = _mm_add_ps(_mm_set1_ps((float)(pos - base)), _mm_mul_ps(lanes, _mm_set1_ps(step)));
+            __m128i idx = _mm_cvttps_epi32(off);
+            __m128 f = _mm_sub_ps(off, _mm_cvtepi32_ps(idx));
+
+            alignas(16) int index[4];
+            _mm_store_si128((__m128i*)index, idx);
+            const float* p = args.src + base;
+
+            __m128 out;
+            if (Kind == InterpolationKind::Linear)
+            {
+                __m128 x0 = _mm_setr_ps(p[index[0]], p[index[1]], p[index[2]], p[index[3]]);
+                __m128 x1 = _mm_setr_ps(p[index[0] + 1], p[index[1] + 1], p[index[2] + 1], p[index[3] + 1]);
+                out = _mm_add_ps(x0, _mm_mul_ps(f, _mm_sub_ps(x1, x0)));
+            }
+            else
+            {
+                __m128 xm1 = _mm_setr_ps(p[index[0] - 1], p[index[1] - 1], p[index[2] - 1], p[index[3] - 1]);
+                __m128 x0 = _mm_setr_ps(p[index[0]], p[index[1]], p[index[2]], p[index[3]]);
+                __m128 x1 = _mm_setr_ps(p[index[0] + 1], p[index[1] + 1], p[index[2] + 1], p[index[3] + 1]);
+                __m128 x2 = _mm_setr_ps(p[index[0] + 2], p[index[1] + 2], p[index[2] + 2], p[index[3] + 2]);
+                __m128 half = _mm_set1_ps(0.5f);
+                __m128 c1 = _mm_mul_ps(half, _mm_sub_ps(x1, xm1));
+                __m128 c2 = _mm_sub_ps(_mm_add_ps(xm1, _mm_add_ps(x1, x1)), _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.5f), x0), _mm_mul_ps(half, x2)));
+                __m128 c3 = _mm_add_ps(_mm_mul_ps(half, _mm_sub_ps(x2, xm1)), _mm_mul_ps(_mm_set1_ps(1.5f), _mm_sub_ps(x0, x1)));
+                out = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(c3, f), c2), f), c1), f), x0);
+            }
+            _mm_storeu_ps(args.dst + i, out);
+            pos += 4.0 * args.step;
+        }
+
+        for (; i < frames; ++i)
+        {
+            int base = (int)pos;
+            args.dst[i] = Interpolator<Kind>::Read(args.src + base, (float)(pos - base));
+            pos += args.step;
+        }
+        *args.position = pos;
+        return frames;
+    }
+};
+
+template<InterpolationKind Kind>
+struct PolyKernel<Kind, SimdLevel::AVX2>
+{
+    SYNTH_TARGET_AVX2 static int Run(const ResampleArgs& args)
+    {
+        int frames = AvailableFrames(args);
+        double pos = *args.position;
+        const __m256 step = _mm256_set1_ps((float)args.step);
+        const __m256 lanes = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+
+        int i = 0;
+        for (; i + 8 <= frames; i += 8)
+        {
+            int base = (int)pos;
+            __m256 off = _mm256_add_ps(_mm256_set1_ps((float)(pos - base)), _mm256_mul_ps(lanes, step));
+            __m256i idx = _mm256_cvttps_epi32(off);
+            __m256 f = _mm256_sub_ps(off, _mm256_cvtepi32_ps(idx));
+            const float* p = args.src + base;
+
+            __m256 out;
+            if (Kind == InterpolationKind::Linear)
+            {
+                __m256 x0 = _mm256_i32gather_ps(p, idx, 4);
+                __m256 x1 = _mm256_i32gather_ps(p + 1, idx, 4);
+                out = _mm256_add_ps(x0, _mm256_mul_ps(f, _mm256_sub_ps(x1, x0)));
+            }
+            else
+            {
+                __m256 xm1 = _mm256_i32gather_ps(p - 1, idx, 4);
+                __m256 x0 = _mm256_i32gather_ps(p, idx, 4);
+                __m256 x1 = _mm256_i32gather_ps(p + 1, idx, 4);
+                __m256 x2 = _mm256_i32gather_ps(p + 2, idx, 4);
+                __m256 half = _mm256_set1_ps(0.5f);
+                __m256 c1 = _mm256_mul_ps(half, _mm256_sub_ps(x1, xm1));
+                __m256 c2 = _mm256_sub_ps(_mm256_add_ps(xm1, _mm256_add_ps(x1, x1)), _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.5f), x0), _mm256_mul_ps(half, x2)));
+                __m256 c3 = _mm256_add_ps(_mm256_mul_ps(half, _mm256_sub_ps(x2, xm1)), _mm256_mul_ps(_mm256_set1_ps(1.5f), _mm256_sub_ps(x0, x1)));
+                out = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(c3, f), c2), f), c1), f), x0);
+            }
+            _mm256_storeu_ps(args.dst + i, out);
+            pos += 8.0 * args.step;
+        }
+        _mm256_zeroupper();     // The scalar tail and the caller use legacy SSE encoding
+
+        for (; i < frames; ++i)
+        {
+            int base = (int)pos;
+            args.dst[i] = Interpolator<Kind>::Read(args.src + base, (float)(pos - base));
+            pos += args.step;
+        }
+        *args.position = pos;
+        return frames;
+    }
+};
+#endif
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Windowed-sinc kernels, vectorised across taps
+
+template<int Taps, SimdLevel Level>
+struct SincKernel
+{
+    static int Run(const ResampleArgs& args)
+    {
+        const SincTable& table = args.table ? *args.table : GetDefaultSincTable(Taps);
+        int frames = AvailableFrames(args);
+        double pos = *args.position;
+        for (int i = 0; i < frames; ++i)
+        {
+            int base = (int)pos;
+            args.dst[i] = ReadSinc<Taps>(args.src + base, table, pos - base);
+            pos += args.step;
+        }
+        *args.position = pos;
+        return frames;
+    }
+};
+
+#if SYNTH_X86
+template<int Taps>
+struct SincKernel<Taps, SimdLevel::SSE2>
+{
+    SYNTH_TARGET_SSE2 static int Run(const ResampleArgs& args)
+    {
+        const SincTable& table = args.table ? *args.table : GetDefaultSincTable(Taps);
+        int frames = AvailableFrames(args);
+        double pos = *args.position;
+        for (int i = 0; i < frames; ++i)
+        {
+            int base = (int)pos;
+            double phase = (pos - base) * table.phases;
+            int r = (int)phase;
+            __m128 pf = _mm_set1_ps((float)(phase - r));
+            const float* row = table.Row(r);
+            const float* x = args.src + base - (Taps / 2 - 1);
+
+            __m128 acc = _mm_setzero_ps();
+            for (int k = 0; k < Taps; k += 4)
+            {
+                __m128 c = _mm_add_ps(_mm_loadu_ps(row + k), _mm_mul_ps(pf, _mm_loadu_ps(row + Taps + k)));
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + k), c));
+            }
+            acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+            acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+            args.dst[i] = _mm_cvtss_f32(acc);
+            pos += args.step;
+        }
+        *args.position = pos;
+        return frames;
+    }
+};
+
+template<int Taps>
+struct SincKernel<Taps, SimdLevel::AVX2>
+{
+    SYNTH_TARGET_AVX2 static int Run(const ResampleArgs& args)
+    {
+        const SincTable& table = args.table ? *args.table : GetDefaultSincTable(Taps);
+        int frames = AvailableFrames(args);
+        double pos = *args.position;
+        for (int i = 0; i < frames; ++i)
+        {
+            int base = (int)pos;
+            double phase = (pos - base) * table.phases;
+            int r = (int)phase;
+            __m256 pf = _mm256_set1_ps((float)(phase - r));
+            const float* row = table.Row(r);
+            const float* x = args.src + base - (Taps / 2 - 1);
+
+            __m256 acc = _mm256_setzero_ps();
+            for (int k = 0; k < Taps; k += 8)
+            {
+                __m256 c = _mm256_add_ps(_mm256_loadu_ps(row + k), _mm256_mul_ps(pf, _mm256_loadu_ps(row + Taps + k)));
+                acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(x + k), c));
+            }
+            __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+            args.dst[i] = _mm_cvtss_f32(sum);
+            pos += args.step;
+        }
+        _mm256_zeroupper();
+        *args.position = pos;
+        return frames;
+    }
+};
+#endif
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+
+#if SYNTH_X86
+#define KERNEL_ROW(Kernel) { &Kernel<SimdLevel::Scalar>::Run, &Kernel<SimdLevel::SSE2>::Run, &Kernel<SimdLevel::AVX2>::Run }
+#else
+#define KERNEL_ROW(Kernel) { &Kernel<SimdLevel::Scalar>::Run, &Kernel<SimdLevel::Scalar>::Run, &Kernel<SimdLevel::Scalar>::Run }
+#endif
+
+template<SimdLevel Level> using LinearKernel = PolyKernel<InterpolationKind::Linear, Level>;
+template<SimdLevel Level> using CubicKernel = PolyKernel<InterpolationKind::Cubic, Level>;
+template<SimdLevel Level> using Sinc8Kernel = SincKernel<8, Level>;
+template<SimdLevel Level> using Sinc16Kernel = SincKernel<16, Level>;
+template<SimdLevel Level> using Sinc32Kernel = SincKernel<32, Level>;
+
+static const ResampleFn g_Kernels[(int)InterpolationKind::Count][(int)SimdLevel::Count] =
+{
+    KERNEL_ROW(LinearKernel),
+    KERNEL_ROW(CubicKernel),
+    KERNEL_ROW(Sinc8Kernel),
+    KERNEL_ROW(Sinc16Kernel),
+    KERNEL_ROW(Sinc32Kernel),
+};
+
+#undef KERNEL_ROW
+
+static std::atomic<InterpolationKind> g_GlobalInterpolation(InterpolationKind::Cubic);
+
+ResampleFn GetResampleFunction(InterpolationKind kind, SimdLevel level)
+{
+    return g_Kernels[(int)kind][(int)level];
+}
+
+ResampleFn GetResampleFunction(InterpolationKind kind)
+{
+    return GetResampleFunction(kind, GetSimdLevel());
+}
+
+int GetInterpolationTaps(InterpolationKind kind)
+{
+    switch (kind)
+    {
+    case InterpolationKind::Linear: return 2;
+    case InterpolationKind::Cubic: return 4;
+    case InterpolationKind::Sinc8: return 8;
+    case InterpolationKind::Sinc16: return 16;
+    case InterpolationKind::Sinc32: return 32;
+    default: return 0;
+    }
+}
+
+const char* GetInterpolationName(InterpolationKind kind)
+{
+    switch (kind)
+    {
+    case InterpolationKind::Linear: return "Linear";
+    case InterpolationKind::Cubic: return "Cubic";
+    case InterpolationKind::Sinc8: return "Sinc 8";
+    case InterpolationKind::Sinc16: return "Sinc 16";
+    case InterpolationKind::Sinc32: return "Sinc 32";
+    default: return "?";
+    }
+}
+
+void SetGlobalInterpolation(InterpolationKind kind)
+{
+    g_GlobalInterpolation.store(kind, std::memory_order_relaxed);
+}
+
+InterpolationKind GetGlobalInterpolation()
+{
+    return g_GlobalInterpolation.load(std::memory_order_relaxed);
+}
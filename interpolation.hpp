@@ -0,0 +1,64 @@
+#pragma once
+
+#include "cpu_features.hpp"
+#include <vector>
+
+// Interpolation kernels used to read sample data at fractional positions
+// (pitch shifting and sample-rate conversion). Each kernel is a template
+// specialisation compiled for every SIMD level; the variant matching the CPU
+// is picked once, so the inner loops contain no per-sample dispatch.
+
+enum class InterpolationKind
+{
+    Linear,     // 2 points, cheapest
+    Cubic,      // 4-point Catmull-Rom
+    Sinc8,      // Windowed-sinc, 8 taps
+    Sinc16,     // Windowed-sinc, 16 taps
+    Sinc32,     // Windowed-sinc, 32 taps, offline quality
+    Count
+};
+
+// Source buffers must have this many readable zero frames before the first
+// and after the last frame, so kernels never have to check the edges.
+const int INTERPOLATION_PADDING = 16;
+
+// Polyphase windowed-sinc coefficients. Each row holds the taps for one
+// fractional phase, followed by the difference to the next row so kernels can
+// blend between phases with one multiply-add per tap.
+struct SincTable
+{
+    int taps = 0;
+    int phases = 0;
+    std::vector<float> rows;    // phases * taps * 2 floats
+
+    // cutoff is relative to the source Nyquist frequency (0..1]
+    void Build(int tapCount, int phaseCount, double cutoff, double kaiserBeta);
+    const float* Row(int phase) const { return &rows[(size_t)phase * taps * 2]; }
+};
+
+// Arguments of one resampling call. position is in source frames and is
+// advanced by step for every output frame.
+struct ResampleArgs
+{
+    const float* src;           // Padded source (see INTERPOLATION_PADDING)
+    int length;                 // Source length in frames
+    double* position;           // Read position, updated on return
+    double step;                // Source frames per output frame
+    float* dst;
+    int frames;                 // Output frames requested
+    const SincTable* table;     // Sinc kernels only, nullptr selects the default table
+};
+
+// Returns the number of frames written; less than requested when the end of
+// the source is reached.
+typedef int (*ResampleFn)(const ResampleArgs& args);
+
+ResampleFn GetResampleFunction(InterpolationKind kind);
+ResampleFn GetResampleFunction(InterpolationKind kind, SimdLevel level);
+int GetInterpolationTaps(InterpolationKind kind);
+const char* GetInterpolationName(InterpolationKind kind);
+const SincTable& GetDefaultSincTable(int taps);
+
+// Kernel used by voices that do not request a specific one
+void SetGlobalInterpolation(InterpolationKind kind);
+InterpolationKind GetGlobalInterpolation();
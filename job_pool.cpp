@@ -0,0 +1,192 @@
+#include "job_pool.hpp"
+#include "cpu_features.hpp"
+#include "denormals.hpp"
+#include "rt_check.hpp"
+#include "thread_scheduling.hpp"
+#include <algorithm>
+#include <chrono>
+
+// A helper whose last block came this soon after the one before polls
+// this long for the next before sleeping, so back-to-back blocks do not
+// pay for a wakeup. Blocks further apart find it asleep, not spinning.
+static const double HELPER_SPIN_SECONDS = 0.0002;
+
+// Pauses the audio thread spends waiting on the jobs helpers are in the
+// middle of before it yields: some microseconds, longer than a job usually
+// has left
+static const int WAIT_PAUSES = 512;
+
+// Spin-wait hint: frees the core's other hyperthread and saves power
+SYNTH_TARGET_SSE2 static inline void CpuRelax()
+{
+#if SYNTH_X86
+    _mm_pause();
+#endif
+}
+
+static unsigned long long PackRange(unsigned begin, unsigned end)
+{
+    return (unsigned long long)end << 32 | begin;
+}
+
+int JobPool::GetHelperLimit()
+{
+    // hardware_concurrency() is zero when the count is unknown
+    int cores = (int)std::thread::hardware_concurrency();
+    return cores > 0 ? std::min(MAX_POOL_HELPERS, cores - 1) : MAX_POOL_HELPERS;
+}
+
+void JobPool::Start(int helpers, const char* name)
+{
+    Stop();
+    helpers = std::min(GetHelperLimit(), std::max(0, helpers));
+    m_Name = name;
+    m_Participants = helpers + 1;
+    m_Quit.store(false);
+    for (int h = 0; h < helpers; ++h)
+        m_Threads.emplace_back(&JobPool::HelperLoop, this, h + 1);
+}
+
+void JobPool::Stop()
+{
+    if (m_Threads.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Quit.store(true);
+    }
+    m_Wake.notify_all();
+    for (std::thread& thread : m_Threads)
+        thread.join();
+    m_Threads.clear();
+    m_Participants = 1;
+}
+
+bool JobPool::PopFront(int owner, int& job)
+{
+    std::atomic<unsigned long long>& bounds = m_Ranges[owner].bounds;
+    unsigned long long range = bounds.load(std::memory_order_acquire);
+    for (;;)
+    {
+        unsigned begin = (unsigned)range, end = (unsigned)(range >> 32);
+        if (begin >= end)
+            return false;
+        if (bounds.compare_exchange_weak(range, PackRange(begin + 1, end), std::memory_order_acquire))
+        {
+            job = (int)begin;
+            return true;
+        }
+    }
+}
+
+bool JobPool::StealBack(int victim, int& job)
+{
+    std::atomic<unsigned long long>& bounds = m_Ranges[victim].bounds;
+    unsigned long long range = bounds.load(std::memory_order_acquire);
+    for (;;)
+    {
+        unsigned begin = (unsigned)range, end = (unsigned)(range >> 32);
+        if (begin >= end)
+            return false;
+        if (bounds.compare_exchange_weak(range, PackRange(begin, end - 1), std::memory_order_acquire))
+        {
+            job = (int)end - 1;
+            return true;
+        }
+    }
+}
+
+// A claim made on a range published for a later block is a claim on that
+// block's job, so m_Fn and m_User are read only after the claim
+bool JobPool::RunOne(int participant)
+{
+    int job;
+    for (int k = 0; k < m_Participants; ++k)
+    {
+        int victim = (participant + k) % m_Participants;
+        if (k == 0 ? PopFront(victim, job) : StealBack(victim, job))
+        {
+            m_Fn(m_User, job);
+            if (k > 0)
+                m_Stolen.fetch_add(1, std::memory_order_relaxed);
+            m_Remaining.fetch_sub(1, std::memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
+
+void JobPool::Run(int jobs, JobFn fn, void* user, bool flushDenormals)
+{
+    if (jobs <= 0)
+        return;
+
+    // Everything a claim reads is in place before the ranges are
+    m_Fn = fn;
+    m_User = user;
+    m_Flush.store(flushDenormals, std::memory_order_relaxed);
+    m_Remaining.store(jobs, std::memory_order_relaxed);
+    for (int p = 0; p < m_Participants; ++p)
+        m_Ranges[p].bounds.store(PackRange(jobs * p / m_Participants, jobs * (p + 1) / m_Participants), std::memory_order_release);
+
+    if (m_Participants > 1)
+    {
+        // Sequentially consistent with m_Parked, so a helper on its way to
+        // sleep either sees the new generation or is counted here. Helpers
+        // still polling need no system call.
+        m_Generation.fetch_add(1);
+        if (m_Parked.load() > 0)
+            m_Wake.notify_all();    // Without the lock; a missed wakeup costs one sleep timeout
+    }
+
+    while (RunOne(0))
+        ;
+    // Only jobs a helper is in the middle of remain, each on a core of its
+    // own since the helpers never outnumber the other cores, so they are
+    // waited for on the core; yielding is for a helper preempted mid-job
+    for (int pauses = 0; m_Remaining.load(std::memory_order_acquire) != 0; ++pauses)
+    {
+        if (pauses < WAIT_PAUSES)
+            CpuRelax();
+        else
+            std::this_thread::yield();
+    }
+}
+
+void JobPool::HelperLoop(int participant)
+{
+    typedef std::chrono::steady_clock Clock;
+    PromoteCurrentThread(ThreadRole::Worker, (m_Name + " " + std::to_string(participant)).c_str());
+
+    unsigned seen = m_Generation.load(std::memory_order_acquire);
+    bool spin = false;
+    while (!m_Quit.load())
+    {
+        Clock::time_point idle = Clock::now();
+        unsigned generation;
+        while ((generation = m_Generation.load(std::memory_order_acquire)) == seen && !m_Quit.load(std::memory_order_relaxed))
+        {
+            // Polling yields, so it never keeps a thread with work off a core
+            if (spin && std::chrono::duration<double>(Clock::now() - idle).count() < HELPER_SPIN_SECONDS)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            m_Parked.fetch_add(1);
+            {
+                std::unique_lock<std::mutex> lock(m_Mutex);
+                m_Wake.wait_for(lock, std::chrono::milliseconds(1), [&] {
+                    return m_Generation.load() != seen || m_Quit.load(std::memory_order_relaxed);
+                });
+            }
+            m_Parked.fetch_sub(1, std::memory_order_relaxed);
+        }
+        spin = std::chrono::duration<double>(Clock::now() - idle).count() < HELPER_SPIN_SECONDS;
+        seen = generation;
+
+        RealtimeScope realtime;
+        ScopedFlushDenormals flush(m_Flush.load(std::memory_order_relaxed));
+        while (RunOne(participant))
+            ;
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef void (*JobFn)(void* user, int job);
+
+const int MAX_POOL_HELPERS = 31;
+
+// Runs one block's jobs on the calling audio thread and a set of helper
+// threads. The jobs are dealt out in contiguous ranges, one per thread;
+// each takes from the front of its own range and, once that is empty,
+// steals from the back of the others'. The caller never waits for a helper
+// that has not started: it steals whatever is left, so a sleeping or
+// preempted helper costs parallelism but not the deadline. The exception
+// is a job a helper has already claimed: the caller waits for it to end,
+// so a helper preempted in the middle of a job holds the block up until it
+// runs again.
+class JobPool
+{
+public:
+    ~JobPool() { Stop(); }
+
+    // Not while Run() may be called. Starts at most GetHelperLimit()
+    // helpers: one more thread than there are cores only takes time from
+    // the audio thread.
+    void Start(int helpers, const char* name);
+    void Stop();
+    int GetHelperCount() const { return (int)m_Threads.size(); }
+    static int GetHelperLimit();
+
+    // Audio thread. Returns once every job has completed. Helpers run the
+    // jobs with the same denormal mode as the caller.
+    void Run(int jobs, JobFn fn, void* user, bool flushDenormals);
+
+    // Jobs run by a thread they were not dealt to
+    unsigned long long GetStolen() const { return m_Stolen.load(std::memory_order_relaxed); }
+
+private:
+    // Begin in the low half, end in the high half, so the owner and the
+    // thieves claim with one compare-exchange on the same word
+    struct alignas(64) Range
+    {
+        std::atomic<unsigned long long> bounds{ 0 };
+    };
+
+    bool PopFront(int owner, int& job);
+    bool StealBack(int victim, int& job);
+    bool RunOne(int participant);
+    void HelperLoop(int participant);
+
+    Range m_Ranges[MAX_POOL_HELPERS + 1];
+    int m_Participants = 1;
+    JobFn m_Fn = nullptr;
+    void* m_User = nullptr;
+    std::atomic<bool> m_Flush{ true };
+    alignas(64) std::atomic<int> m_Remaining{ 0 };
+    alignas(64) std::atomic<unsigned> m_Generation{ 0 };
+    std::atomic<int> m_Parked{ 0 };     // Helpers asleep on m_Wake, or about to be
+    std::atomic<unsigned long long> m_Stolen{ 0 };
+
+    std::vector<std::thread> m_Threads;
+    std::string m_Name;
+    std::atomic<bool> m_Quit{ false };
+    std::mutex m_Mutex;                 // Helpers only, to sleep between blocks
+    std::condition_variable m_Wake;
+};
@@ -0,0 +1,255 @@
+#include "key_input.hpp"
+#include "latency_monitor.hpp"
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <functional>
+#else
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+bool KeyInput::Fail(const std::string& error)
+{
+    m_Error = error;
+    return false;
+}
+
+// Transitions only: a repeat of a held key, or a release of one pressed
+// before the capture started or outside the focus window, is dropped
+void KeyInput::Deliver(int key, bool down, long long stamp)
+{
+    if (key < 0 || key >= KEY_CODE_COUNT || m_Down[key] == down)
+        return;
+    m_Down[key] = down;
+    m_Handler(m_User, { key, down, stamp });
+}
+
+// On the way out, so no note is left hanging
+void KeyInput::ReleaseAll()
+{
+    long long now = LatencyMonitor::Now();
+    for (int key = 0; key < KEY_CODE_COUNT; ++key)
+        Deliver(key, false, now);
+}
+
+#ifdef _WIN32
+
+bool KeyInput::Start(const KeyInputSettings& settings, KeyEventFn handler, void* user)
+{
+    if (m_Thread.joinable())
+        return Fail("Key input is already running");
+    m_Settings = settings;
+    m_Handler = handler;
+    m_User = user;
+    memset(m_Down, 0, sizeof(m_Down));
+
+    // Raw input goes to the thread that owns the receiving window, so the
+    // window is made there
+    std::promise<bool> started;
+    std::future<bool> result = started.get_future();
+    m_Thread = std::thread(&KeyInput::ThreadLoop, this, std::ref(started));
+    if (!result.get())
+    {
+        m_Thread.join();
+        return false;
+    }
+    m_Running.store(true);
+    return true;
+}
+
+void KeyInput::Stop()
+{
+    if (!m_Thread.joinable())
+        return;
+    PostThreadMessageW(m_ThreadId, WM_QUIT, 0, 0);
+    m_Thread.join();
+    m_Running.store(false);
+}
+
+void KeyInput::ThreadLoop(std::promise<bool>& started)
+{
+    HINSTANCE instance = GetModuleHandleW(nullptr);
+    WNDCLASSEXW windowClass = { sizeof(windowClass) };
+    windowClass.lpfnWndProc = DefWindowProcW;
+    windowClass.hInstance = instance;
+    windowClass.lpszClassName = L"SyntezatorKeyInput";
+    RegisterClassExW(&windowClass);     // Fails harmlessly when already registered by an earlier Start()
+
+    HWND window = CreateWindowExW(0, windowClass.lpszClassName, L"", 0, 0, 0, 0, 0, HWND_MESSAGE, nullptr, instance, nullptr);
+    if (!window)
+    {
+        Fail("CreateWindowEx failed, error " + std::to_string(GetLastError()));
+        started.set_value(false);
+        return;
+    }
+
+    // Generic desktop keyboards, delivered whichever window has the focus;
+    // the focus check is ours. Legacy key messages to the UI are untouched.
+    RAWINPUTDEVICE keyboard = { 0x01, 0x06, RIDEV_INPUTSINK, window };
+    if (!RegisterRawInputDevices(&keyboard, 1, sizeof(keyboard)))
+    {
+        Fail("RegisterRawInputDevices failed, error " + std::to_string(GetLastError()));
+        DestroyWindow(window);
+        started.set_value(false);
+        return;
+    }
+    m_ThreadId = GetCurrentThreadId();
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+    started.set_value(true);
+
+    // No hardware time reaches user mode, so the stamp is taken the moment
+    // the message is picked up
+    MSG message;
+    while (GetMessageW(&message, nullptr, 0, 0) > 0)
+    {
+        if (message.message == WM_INPUT)
+        {
+            long long stamp = LatencyMonitor::Now();
+            RAWINPUT input;
+            UINT size = sizeof(input);
+            if (GetRawInputData((HRAWINPUT)message.lParam, RID_INPUT, &input, &size, sizeof(RAWINPUTHEADER)) != (UINT)-1 &&
+                input.header.dwType == RIM_TYPEKEYBOARD)
+            {
+                const RAWKEYBOARD& key = input.data.keyboard;
+                bool down = !(key.Flags & RI_KEY_BREAK);
+                HWND focus = (HWND)m_Settings.focusWindow;
+                if (!down || !focus || GetForegroundWindow() == focus)
+                    Deliver(key.VKey, down, stamp);
+            }
+        }
+        DispatchMessageW(&message);     // WM_INPUT needs DefWindowProc to free its data
+    }
+
+    ReleaseAll();
+    RAWINPUTDEVICE remove = { 0x01, 0x06, RIDEV_REMOVE, nullptr };
+    RegisterRawInputDevices(&remove, 1, sizeof(remove));
+    DestroyWindow(window);
+}
+
+#else
+
+// evdev key codes to the virtual-key codes of the same keys, -1 for keys
+// nothing is bound to
+static int TranslateKey(int code)
+{
+    static const char DIGITS[] = "1234567890";
+    static const char TOP_ROW[] = "QWERTYUIOP";
+    static const char MIDDLE_ROW[] = "ASDFGHJKL";
+    static const char BOTTOM_ROW[] = "ZXCVBNM";
+    if (code >= KEY_1 && code <= KEY_0)
+        return DIGITS[code - KEY_1];
+    if (code >= KEY_Q && code <= KEY_P)
+        return TOP_ROW[code - KEY_Q];
+    if (code >= KEY_A && code <= KEY_L)
+        return MIDDLE_ROW[code - KEY_A];
+    if (code >= KEY_Z && code <= KEY_M)
+        return BOTTOM_ROW[code - KEY_Z];
+    if (code == KEY_SPACE)
+        return ' ';
+    if (code == KEY_LEFTSHIFT || code == KEY_RIGHTSHIFT)
+        return KEY_CODE_SHIFT;
+    return -1;
+}
+
+bool KeyInput::Start(const KeyInputSettings& settings, KeyEventFn handler, void* user)
+{
+    if (m_Thread.joinable())
+        return Fail("Key input is already running");
+    if (settings.device.empty())
+        return Fail("No input device given");
+    m_Device = open(settings.device.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_Device < 0)
+        return Fail(settings.device + ": " + strerror(errno));
+    if (pipe(m_Wake) != 0)
+    {
+        Fail(std::string("pipe: ") + strerror(errno));
+        close(m_Device);
+        m_Device = -1;
+        return false;
+    }
+
+    // Event times on the clock LatencyMonitor::Now() reads. Without this
+    // the kernel stamps wall-clock time, so the stamp is taken on arrival.
+    int clock = CLOCK_MONOTONIC;
+    m_KernelStamps = ioctl(m_Device, EVIOCSCLOCKID, &clock) == 0;
+
+    m_Settings = settings;
+    m_Handler = handler;
+    m_User = user;
+    memset(m_Down, 0, sizeof(m_Down));
+    m_Running.store(true);
+    m_Thread = std::thread(&KeyInput::ThreadLoop, this);
+    return true;
+}
+
+void KeyInput::Stop()
+{
+    if (m_Thread.joinable())
+    {
+        char wake = 0;
+        ssize_t written = write(m_Wake[1], &wake, 1);
+        (void)written;
+        m_Thread.join();
+    }
+    for (int& fd : m_Wake)
+    {
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+    if (m_Device >= 0)
+        close(m_Device);
+    m_Device = -1;
+    m_Running.store(false);
+}
+
+void KeyInput::ThreadLoop()
+{
+    input_event events[64];
+    pollfd waits[2] = { { m_Device, POLLIN, 0 }, { m_Wake[0], POLLIN, 0 } };
+    for (;;)
+    {
+        if (poll(waits, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            m_Error = std::string("poll: ") + strerror(errno);
+            break;
+        }
+        if (waits[1].revents)
+            break;
+
+        long long arrival = LatencyMonitor::Now();
+        ssize_t bytes = read(m_Device, events, sizeof(events));
+        if (bytes < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+        if (bytes <= 0)
+        {
+            // Unplugged, or the end of a recorded stream
+            m_Error = bytes < 0 ? m_Settings.device + ": " + strerror(errno) : m_Settings.device + ": end of input";
+            break;
+        }
+
+        // Value 2 is the keyboard's own auto-repeat
+        for (size_t i = 0; i < (size_t)bytes / sizeof(input_event); ++i)
+        {
+            const input_event& event = events[i];
+            if (event.type != EV_KEY || event.value == 2)
+                continue;
+            long long stamp = m_KernelStamps ? event.input_event_sec * 1000000000LL + event.input_event_usec * 1000LL : arrival;
+            Deliver(TranslateKey(event.code), event.value != 0, stamp);
+        }
+    }
+
+    ReleaseAll();
+    m_Running.store(false, std::memory_order_release);
+}
+
+#endif
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#ifdef _WIN32
+#include <future>
+#endif
+
+// Key codes are Windows virtual-key codes on every platform: 'A'..'Z' and
+// '0'..'9' for the letter and digit keys, and these
+const int KEY_CODE_SHIFT = 0x10;        // Either shift key
+const int KEY_CODE_COUNT = 256;
+
+// A key going down or up, stamped when it was captured
+struct KeyEvent
+{
+    int key;
+    bool down;
+    long long stamp;        // LatencyMonitor::Now() clock, nanoseconds
+};
+
+// Called on the capture thread for every transition, in order. Repeats of
+// a held key are not passed on.
+typedef void (*KeyEventFn)(void* user, const KeyEvent& event);
+
+struct KeyInputSettings
+{
+    // Linux: evdev node to read, e.g. /dev/input/event3 or a uinput
+    // device; needs read access. Keys are read whichever window has focus.
+    std::string device;
+    // Windows: key presses are passed on only while this window (an HWND)
+    // is in the foreground; releases always are, so no note hangs.
+    // nullptr = always.
+    void* focusWindow = nullptr;
+};
+
+// Captures key transitions on a thread of its own, so they no longer wait
+// for the next frame to be polled: a press and release within one frame
+// both arrive, and each carries the time it happened. Windows reads raw
+// keyboard input and stamps it on arrival; Linux reads evdev events, which
+// the kernel stamps with the monotonic clock when the key changed.
+class KeyInput
+{
+public:
+    ~KeyInput() { Stop(); }
+
+    // False, with the reason in GetError(), if the keyboard cannot be read.
+    // Stop() returns once the handler has been called for the last time;
+    // keys still down are released first.
+    bool Start(const KeyInputSettings& settings, KeyEventFn handler, void* user);
+    void Stop();
+
+    // False once the device is gone; GetError() then says why
+    bool IsRunning() const { return m_Running.load(std::memory_order_acquire); }
+    const std::string& GetError() const { return m_Error; }
+
+private:
+#ifdef _WIN32
+    void ThreadLoop(std::promise<bool>& started);
+#else
+    void ThreadLoop();
+#endif
+    void Deliver(int key, bool down, long long stamp);
+    void ReleaseAll();
+    bool Fail(const std::string& error);
+
+    KeyInputSettings m_Settings;
+    KeyEventFn m_Handler = nullptr;
+    void* m_User = nullptr;
+    std::thread m_Thread;
+    std::atomic<bool> m_Running{ false };
+    std::string m_Error;
+    bool m_Down[KEY_CODE_COUNT] = {};       // Capture thread
+
+#ifdef _WIN32
+    unsigned long m_ThreadId = 0;           // Owns the message-only window receiving raw input
+#else
+    int m_Device = -1;
+    int m_Wake[2] = { -1, -1 };             // Pipe that ends the read loop
+    bool m_KernelStamps = false;            // The device reports monotonic times
+#endif
+};
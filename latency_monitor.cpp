@@ -0,0 +1,117 @@
+#include "latency_monitor.hpp"
+#include <algorithm>
+#include <chrono>
+
+void LatencyHistogram::Add(double seconds)
+{
+    int bin = std::min(LATENCY_BINS - 1, std::max(0, (int)(seconds / LATENCY_BIN_SECONDS)));
+    m_Bins[bin].fetch_add(1, std::memory_order_relaxed);
+    m_Count.fetch_add(1, std::memory_order_relaxed);
+    if (seconds > m_Max.load(std::memory_order_relaxed))
+        m_Max.store(seconds, std::memory_order_relaxed);      // One writer
+}
+
+void LatencyHistogram::Reset()
+{
+    for (auto& bin : m_Bins)
+        bin.store(0, std::memory_order_relaxed);
+    m_Count.store(0, std::memory_order_relaxed);
+    m_Max.store(0.0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::GetPercentile(double p) const
+{
+    // Counted from the bins so a concurrent Add() cannot push the rank past
+    // the end
+    unsigned long long total = 0;
+    for (const auto& bin : m_Bins)
+        total += bin.load(std::memory_order_relaxed);
+    if (total == 0)
+        return 0.0;
+
+    unsigned long long rank = (unsigned long long)(p * (total - 1));
+    unsigned long long seen = 0;
+    for (int i = 0; i < LATENCY_BINS; ++i)
+    {
+        seen += m_Bins[i].load(std::memory_order_relaxed);
+        if (seen > rank)
+            return i == LATENCY_BINS - 1 ? GetMax() : std::min(GetMax(), (i + 1) * LATENCY_BIN_SECONDS);
+    }
+    return GetMax();
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+
+long long LatencyMonitor::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void LatencyMonitor::Reset()
+{
+    for (auto& histogram : m_Histograms)
+        histogram.Reset();
+}
+
+void LatencyMonitor::BeginRender()
+{
+    m_RenderStart = Now();
+    m_PendingCount = 0;
+}
+
+void LatencyMonitor::EventArrived(long long inputStamp, int frameOffset)
+{
+    // More note-ons in one call than this are a burst from a sequencer,
+    // not players; the first ones are representative
+    if (m_PendingCount < MAX_PENDING)
+        m_Pending[m_PendingCount++] = { inputStamp, frameOffset };
+}
+
+void LatencyMonitor::EndRender(int sampleRate, int delayFrames)
+{
+    if (m_PendingCount == 0)
+        return;
+
+    const long long end = Now();
+    const double render = (end - m_RenderStart) * 1e-9;
+    const double delay = (double)delayFrames / sampleRate;
+    const double output = delay + m_OutputLatency.load(std::memory_order_relaxed);
+    for (int i = 0; i < m_PendingCount; ++i)
+    {
+        // A stamp taken after the call started means the event was posted
+        // while this call was rendering; it waited for nothing
+        double queue = std::max(0.0, (m_RenderStart - m_Pending[i].inputStamp) * 1e-9);
+        double block = (double)m_Pending[i].frameOffset / sampleRate;
+        m_Histograms[(int)LatencyStage::Queue].Add(queue);
+        m_Histograms[(int)LatencyStage::Render].Add(render);
+        m_Histograms[(int)LatencyStage::Block].Add(block);
+        m_Histograms[(int)LatencyStage::Output].Add(output);
+        m_Histograms[(int)LatencyStage::Total].Add(queue + render + block + output);
+    }
+    m_PendingCount = 0;
+}
+
+const char* LatencyMonitor::GetStageName(LatencyStage stage)
+{
+    switch (stage)
+    {
+    case LatencyStage::Queue: return "Queue";
+    case LatencyStage::Render: return "Render";
+    case LatencyStage::Block: return "Block";
+    case LatencyStage::Output: return "Output";
+    case LatencyStage::Total: return "Total";
+    default: return "?";
+    }
+}
+
+void LatencyMonitor::PrintReport(FILE* file) const
+{
+    fprintf(file, "Key to sound latency, %llu notes (ms)\n", GetHistogram(LatencyStage::Total).GetCount());
+    fprintf(file, "  %-8s %8s %8s %8s\n", "", "p50", "p99", "max");
+    for (int s = 0; s < (int)LatencyStage::Count; ++s)
+    {
+        const LatencyHistogram& histogram = m_Histograms[s];
+        fprintf(file, "  %-8s %8.2f %8.2f %8.2f\n", GetStageName((LatencyStage)s), histogram.GetPercentile(0.5) * 1000.0,
+                histogram.GetPercentile(0.99) * 1000.0, histogram.GetMax() * 1000.0);
+    }
+}
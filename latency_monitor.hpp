@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+
+// Parts of the time from a key going down to its first sample reaching the
+// speaker. Queue and Render are measured, Block and Output are derived from
+// frame positions and the reported latencies.
+enum class LatencyStage
+{
+    Queue,      // Input stamp to the render call that picks the event up
+    Render,     // That render call, start to finish
+    Block,      // Event's offset into the rendered block
+    Output,     // Limiter lookahead plus the backend's buffer
+    Total,
+    Count
+};
+
+const int LATENCY_BINS = 2000;
+const double LATENCY_BIN_SECONDS = 0.00005;     // 50 us bins up to 100 ms
+
+// Fixed-bin histogram, filled by the audio thread without locks and read
+// by any thread. Anything past the last bin lands in it; the maximum is
+// kept exactly.
+class LatencyHistogram
+{
+public:
+    void Add(double seconds);
+    void Reset();
+
+    unsigned long long GetCount() const { return m_Count.load(std::memory_order_relaxed); }
+    double GetMax() const { return m_Max.load(std::memory_order_relaxed); }
+
+    // Upper edge of the bin holding the fraction p of the samples, at most
+    // the maximum
+    double GetPercentile(double p) const;
+
+private:
+    std::atomic<unsigned int> m_Bins[LATENCY_BINS] = {};
+    std::atomic<unsigned long long> m_Count{ 0 };
+    std::atomic<double> m_Max{ 0.0 };
+};
+
+// Follows every note-on posted for immediate playback from its input stamp
+// through the render call that starts it.
+class LatencyMonitor
+{
+public:
+    // Steady clock in nanoseconds, the unit of input stamps
+    static long long Now();
+
+    // UI thread. The backend's latency is not visible to the engine.
+    void SetOutputLatency(double seconds) { m_OutputLatency.store(seconds, std::memory_order_relaxed); }
+    void Reset();
+
+    // Audio thread, once per render call: the call's start, each stamped
+    // note-on with its frame offset in the call, and the call's end with
+    // any delay the master bus adds
+    void BeginRender();
+    void EventArrived(long long inputStamp, int frameOffset);
+    void EndRender(int sampleRate, int delayFrames);
+
+    const LatencyHistogram& GetHistogram(LatencyStage stage) const { return m_Histograms[(int)stage]; }
+    static const char* GetStageName(LatencyStage stage);
+
+    // p50, p99 and max of each stage in milliseconds
+    void PrintReport(FILE* file) const;
+
+private:
+    static const int MAX_PENDING = 64;
+
+    struct Pending
+    {
+        long long inputStamp;
+        int frameOffset;
+    };
+
+    Pending m_Pending[MAX_PENDING];
+    int m_PendingCount = 0;
+    long long m_RenderStart = 0;
+    std::atomic<double> m_OutputLatency{ 0.0 };
+    LatencyHistogram m_Histograms[(int)LatencyStage::Count];
+};
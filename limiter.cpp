@@ -0,0 +1,175 @@
+#include "limiter.hpp"
+#include <algorithm>
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+static const float GAIN_SMOOTHING_SECONDS = 0.01f;     // Master gain time constant
+
+static float DecibelsToGain(float db)
+{
+    return std::exp2(db * (1.0f / 6.0206f));
+}
+
+void Limiter::Prepare(int sampleRate)
+{
+    m_SampleRate = sampleRate;
+    int longest = (int)(MAX_LIMITER_LOOKAHEAD * sampleRate) + 1;
+
+    int size = 1;
+    while (size < longest + 2)
+        size <<= 1;
+    m_QueueFrame.assign(size, 0);
+    m_QueuePeak.assign(size, 0.0f);
+    m_QueueMask = size - 1;
+    m_Average.assign(longest, 1.0f);
+
+    size = 1;
+    while (size < longest + TRUE_PEAK_TAPS)
+        size <<= 1;
+    m_DelayL.assign(size, 0.0f);
+    m_DelayR.assign(size, 0.0f);
+    m_DelayMask = size - 1;
+
+    // Windowed sinc for the three positions between samples; the phase on
+    // the sample itself is the sample
+    for (int p = 1; p < TRUE_PEAK_PHASES; ++p)
+    {
+        for (int k = 0; k < TRUE_PEAK_TAPS; ++k)
+        {
+            double t = k - (TRUE_PEAK_TAPS / 2 - 1) - (double)p / TRUE_PEAK_PHASES;
+            double sinc = std::sin(PI * t) / (PI * t);
+            double window = 0.5 + 0.5 * std::cos(PI * t / (TRUE_PEAK_TAPS / 2));
+            m_Phases[p - 1][k] = (float)(sinc * window);
+        }
+    }
+
+    m_Gain.Prepare(GAIN_SMOOTHING_SECONDS, sampleRate);
+    Update(LimiterSettings());
+    Reset();
+}
+
+void Limiter::Update(const LimiterSettings& settings)
+{
+    int lookahead = (int)(std::max(0.0f, std::min(settings.lookahead, MAX_LIMITER_LOOKAHEAD)) * m_SampleRate);
+    bool restart = lookahead != m_Lookahead || settings.enabled != m_Enabled;
+    m_Enabled = settings.enabled;
+    m_Lookahead = lookahead;
+    m_Gain.SetTarget(DecibelsToGain(settings.gain));
+    m_Ceiling = DecibelsToGain(std::min(settings.ceiling, 0.0f));
+    m_ReleaseCoef = 1.0f - std::exp(-1.0f / (std::max(settings.release, 0.001f) * m_SampleRate));
+
+    // A different delay cannot be reached smoothly; start over
+    if (restart)
+        Reset();
+}
+
+void Limiter::Reset()
+{
+    m_Gain.Reset(m_Gain.GetTarget());
+    std::fill(std::begin(m_HistoryL), std::end(m_HistoryL), 0.0f);
+    std::fill(std::begin(m_HistoryR), std::end(m_HistoryR), 0.0f);
+    m_HistoryPos = 0;
+    m_QueueFront = m_QueueBack = 0;
+    m_Frame = 0;
+    m_Hold = 1.0f;
+    std::fill(m_Average.begin(), m_Average.end(), 1.0f);
+    m_AverageSum = m_Lookahead;
+    m_AveragePos = 0;
+    std::fill(m_DelayL.begin(), m_DelayL.end(), 0.0f);
+    std::fill(m_DelayR.begin(), m_DelayR.end(), 0.0f);
+    m_DelayPos = 0;
+    m_Reduction.store(0.0f, std::memory_order_relaxed);
+}
+
+// Largest magnitude of either channel at the sample TRUE_PEAK_TAPS / 2
+// frames back and at three points after it
+float Limiter::DetectPeak(float left, float right)
+{
+    m_HistoryL[m_HistoryPos] = m_HistoryL[m_HistoryPos + TRUE_PEAK_TAPS] = left;
+    m_HistoryR[m_HistoryPos] = m_HistoryR[m_HistoryPos + TRUE_PEAK_TAPS] = right;
+    m_HistoryPos = m_HistoryPos + 1 == TRUE_PEAK_TAPS ? 0 : m_HistoryPos + 1;
+    const float* l = m_HistoryL + m_HistoryPos;     // Oldest first
+    const float* r = m_HistoryR + m_HistoryPos;
+
+    float peak = std::max(std::fabs(l[TRUE_PEAK_TAPS / 2 - 1]), std::fabs(r[TRUE_PEAK_TAPS / 2 - 1]));
+    for (int p = 0; p < TRUE_PEAK_PHASES - 1; ++p)
+    {
+        float sumL = 0.0f, sumR = 0.0f;
+        for (int k = 0; k < TRUE_PEAK_TAPS; ++k)
+        {
+            sumL += l[k] * m_Phases[p][k];
+            sumR += r[k] * m_Phases[p][k];
+        }
+        peak = std::max(peak, std::max(std::fabs(sumL), std::fabs(sumR)));
+    }
+    return peak;
+}
+
+// Maximum of the peaks of the last m_Lookahead + 1 frames. A new peak
+// removes every smaller one from the back, since it outlives them; the
+// front is the maximum once entries older than the window are dropped.
+float Limiter::HoldPeak(float peak)
+{
+    while (m_QueueBack != m_QueueFront && m_QueuePeak[(m_QueueBack - 1) & m_QueueMask] <= peak)
+        m_QueueBack = (m_QueueBack - 1) & m_QueueMask;
+    m_QueueFrame[m_QueueBack] = m_Frame;
+    m_QueuePeak[m_QueueBack] = peak;
+    m_QueueBack = (m_QueueBack + 1) & m_QueueMask;
+
+    while (m_QueueFrame[m_QueueFront] < m_Frame - m_Lookahead)
+        m_QueueFront = (m_QueueFront + 1) & m_QueueMask;
+    ++m_Frame;
+    return m_QueuePeak[m_QueueFront];
+}
+
+void Limiter::Process(float* left, float* right, int frames)
+{
+    if (frames <= 0)
+        return;
+
+    // Master gain changes glide sample by sample, across blocks if need be
+    if (!m_Enabled)
+    {
+        for (int i = 0; i < frames; ++i)
+        {
+            float gain = m_Gain.Next();
+            left[i] *= gain;
+            right[i] *= gain;
+        }
+        return;
+    }
+
+    const int delay = m_Lookahead + TRUE_PEAK_TAPS / 2;
+    const float window = 1.0f / std::max(1, m_Lookahead);
+    float minGain = 1.0f;
+    for (int i = 0; i < frames; ++i)
+    {
+        float gain = m_Gain.Next();
+        float l = left[i] * gain;
+        float r = right[i] * gain;
+
+        float peak = HoldPeak(DetectPeak(l, r));
+        float needed = peak > m_Ceiling ? m_Ceiling / peak : 1.0f;
+        m_Hold = needed < m_Hold ? needed : m_Hold + (needed - m_Hold) * m_ReleaseCoef;
+
+        // Every held gain in the average already covers the peak leaving
+        // the delay now, so the average does too
+        float smoothed = m_Hold;
+        if (m_Lookahead > 0)
+        {
+            m_AverageSum += m_Hold - m_Average[m_AveragePos];
+            m_Average[m_AveragePos] = m_Hold;
+            m_AveragePos = m_AveragePos + 1 == m_Lookahead ? 0 : m_AveragePos + 1;
+            smoothed = (float)m_AverageSum * window;
+        }
+        minGain = std::min(minGain, smoothed);
+
+        m_DelayL[m_DelayPos] = l;
+        m_DelayR[m_DelayPos] = r;
+        int read = (m_DelayPos - delay) & m_DelayMask;
+        left[i] = m_DelayL[read] * smoothed;
+        right[i] = m_DelayR[read] * smoothed;
+        m_DelayPos = (m_DelayPos + 1) & m_DelayMask;
+    }
+    m_Reduction.store(-6.0206f * std::log2(minGain), std::memory_order_relaxed);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "parameter_store.hpp"
+#include <atomic>
+#include <vector>
+
+const float MAX_LIMITER_LOOKAHEAD = 0.02f;     // Seconds
+
+struct LimiterSettings
+{
+    bool enabled = true;
+    float gain = -6.0f;         // dB, master gain in front of the limiter
+    float ceiling = -1.0f;      // dB true peak
+    float lookahead = 0.005f;   // Seconds, up to MAX_LIMITER_LOOKAHEAD
+    float release = 0.1f;       // Seconds
+};
+
+// Taps per phase of the 4x oversampling filter that estimates the peaks
+// between samples, as in ITU-R BS.1770; it delays the detector by
+// TRUE_PEAK_TAPS / 2 frames
+const int TRUE_PEAK_TAPS = 12;
+const int TRUE_PEAK_PHASES = 4;
+
+// Brick-wall lookahead limiter on the master bus, stereo linked. The audio
+// is delayed by the lookahead so the gain is already down when a peak
+// arrives: the gain needed for the loudest true peak in the lookahead
+// window is held, released exponentially and smoothed with a moving
+// average as long as the window. The window maximum comes from a monotonic
+// deque, O(1) per frame whatever the lookahead. Audio thread only, except
+// GetGainReduction().
+class Limiter
+{
+public:
+    // Allocates for the longest lookahead
+    void Prepare(int sampleRate);
+    void Update(const LimiterSettings& settings);
+    void Reset();
+
+    // In place; the output lags by GetLatency() frames while enabled
+    void Process(float* left, float* right, int frames);
+
+    int GetLatency() const { return m_Enabled ? m_Lookahead + TRUE_PEAK_TAPS / 2 : 0; }
+    float GetGainReduction() const { return m_Reduction.load(std::memory_order_relaxed); }    // dB
+
+private:
+    float DetectPeak(float left, float right);
+    float HoldPeak(float peak);
+
+    int m_SampleRate = 44100;
+    bool m_Enabled = false;
+    int m_Lookahead = 0;            // Frames
+    ExponentialSmoother m_Gain;     // Master gain, glides to a new setting
+    float m_Ceiling = 1.0f;
+    float m_ReleaseCoef = 0.0f;
+
+    // Oversampling filter history, written twice so a window is contiguous
+    float m_HistoryL[2 * TRUE_PEAK_TAPS] = {};
+    float m_HistoryR[2 * TRUE_PEAK_TAPS] = {};
+    int m_HistoryPos = 0;
+    float m_Phases[TRUE_PEAK_PHASES - 1][TRUE_PEAK_TAPS] = {};
+
+    // Monotonic deque of (frame, peak), peaks decreasing from front to back
+    std::vector<long long> m_QueueFrame;
+    std::vector<float> m_QueuePeak;
+    int m_QueueMask = 0;
+    int m_QueueFront = 0;
+    int m_QueueBack = 0;
+    long long m_Frame = 0;
+
+    float m_Hold = 1.0f;            // Held gain after release smoothing
+    std::vector<float> m_Average;   // Last m_Lookahead held gains
+    double m_AverageSum = 0.0;
+    int m_AveragePos = 0;
+
+    std::vector<float> m_DelayL;
+    std::vector<float> m_DelayR;
+    int m_DelayMask = 0;
+    int m_DelayPos = 0;
+
+    std::atomic<float> m_Reduction{ 0.0f };     // dB, deepest in the last block
+};
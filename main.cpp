@@ -6,14 +6,56 @@
 #include <vector>
 #include <irrKlang.h>
 #include <unordered_map>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include "audio_output.hpp"
+#include "benchmark.hpp"
+#include "key_input.hpp"
+#include "midi.hpp"
+#include "midi_file.hpp"
+#include "parameter_store.hpp"
+#include "sample_bank.hpp"
+#include "synth_engine.hpp"
+#include "thread_scheduling.hpp"
 
 using namespace irrklang;
 ISoundEngine* soundEngine = nullptr;
 
 std::unordered_map<char, const char*> keySounds;    // Key-to-sound file association
 std::unordered_map<char, char> keyMappings;         // User-defined key mappings
+SampleBank sampleBank;                              // Note samples converted to the output rate
+SynthEngine synthEngine;                            // Voices rendered on the audio thread
 
-bool isKeyMappingActive = false;
+std::atomic<bool> sustainLatch{ false };            // Sustain pedal held down from the menu
+std::atomic<bool> sustainShift{ false };            // Shift held, the keyboard's sustain pedal
+
+// What each keyboard key plays, resolved once per remap instead of on every
+// press; the thread playing the keys always reads one whole table
+struct KeyBinding
+{
+    bool bound = false;
+    int sample = -1;        // Sample bank index, -1 if not loaded
+    float pitch = -1.0f;    // MIDI note number
+};
+
+struct KeyBindings
+{
+    KeyBinding keys[256];
+};
+
+SnapshotBuffer<KeyBindings> keyBindings;            // UI thread to whichever thread plays the keys
+void RebuildKeyBindings();
+
+// Key transitions are captured and played on their own thread, and passed
+// on here only to be drawn
+KeyInput keyInput;
+SpscQueue<KeyEvent, 256> keyEchoes;
+
+std::atomic<bool> isKeyMappingActive{ false };      // Keys do not play while they are being remapped
 
 struct Note
 {
@@ -147,6 +189,7 @@ void ShowKeyMappingWindow(bool* p_open)
         {
             keyMappings[selectedNote] = newKey; 
             UpdateKeySounds(); 
+            RebuildKeyBindings();
             ImGui::CloseCurrentPopup();  
         }
 
@@ -334,14 +377,93 @@ void DrawPianoKeys()
     }
 }
 
-void UpdatePianoKeys(float deltaTime)
+// MIDI note number of a note file such as "notes/C4.ogg", -1 if unknown
+float NotePitchFromFile(const char* path)
 {
-    ImGuiIO& io = ImGui::GetIO();
-    for (auto& key : keys)
+    static const int semitones[] = { 9, 11, 0, 2, 4, 5, 7 };   // A..G
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    if (name[0] < 'A' || name[0] > 'G')
+        return -1.0f;
+
+    int note = semitones[name[0] - 'A'];
+    const char* octave = name + 1;
+    if (*octave == '#')
+    {
+        ++note;
+        ++octave;
+    }
+    if (*octave < '0' || *octave > '9')
+        return -1.0f;
+    return (float)((*octave - '0' + 1) * 12 + note);
+}
+
+void RebuildKeyBindings()
+{
+    KeyBindings bindings;
+    for (const auto& entry : keySounds)
     {
-        bool keyPressed = io.KeysDown[(int)key.key];
+        if (!entry.second)
+            continue;
+        KeyBinding& binding = bindings.keys[(unsigned char)entry.first];
+        binding.bound = true;
+        binding.sample = sampleBank.FindIndex(entry.second);
+        binding.pitch = NotePitchFromFile(entry.second);
+    }
+    keyBindings.Write(bindings);
+}
 
-        if (keyPressed && !key.pressed)
+// Releases always reach the engine, so a key remapped or locked while down
+// does not hang
+void PlayKeyEvent(const KeyEvent& event, EventPort port)
+{
+    if (event.key == KEY_CODE_SHIFT)
+    {
+        sustainShift.store(event.down);
+        synthEngine.SetSustainPedal(event.down || sustainLatch.load(), 0, port);
+        return;
+    }
+    if (!event.down)
+    {
+        synthEngine.NoteOff(event.key, 0, port);
+        return;
+    }
+    keyBindings.Update();
+    const KeyBinding& binding = keyBindings.Read().keys[event.key & 0xff];
+    if (binding.bound && !isKeyMappingActive.load())
+        synthEngine.NoteOn(event.key, binding.sample, binding.pitch, 1.0f, 0, event.stamp, port);
+}
+
+// Key input thread. Each transition is played the moment it is captured,
+// stamped with the time it happened, then drawn by the next frame.
+// Releases are drawn only for the presses that were.
+void OnKeyEvent(void* user, const KeyEvent& event)
+{
+    static bool drawn[KEY_CODE_COUNT] = {};
+    (void)user;
+    PlayKeyEvent(event, EventPort::Keys);
+    if (event.down && isKeyMappingActive.load())
+        return;
+    if (event.down || drawn[event.key])
+        drawn[event.key] = keyEchoes.Push(event) && event.down;
+}
+
+// MIDI input thread: played the moment it arrives, stamped with when the
+// sequencer received it
+void OnMidiMessage(void* user, const MidiMessage& message, long long stamp)
+{
+    PlayMidiMessage(synthEngine, *(const MidiNoteMap*)user, message, 0, stamp, EventPort::Midi);
+}
+
+// Starts a note on the piano roll when the key goes down and stops it
+// growing when the key comes up
+void ShowKeyTransition(int code, bool down)
+{
+    for (auto& key : keys)
+    {
+        if ((unsigned char)key.key != code || key.pressed == down)
+            continue;
+        if (down)
         {
             // Generate a new note starting at the top of the key
             Note new_note;
@@ -350,25 +472,8 @@ void UpdatePianoKeys(float deltaTime)
             new_note.color = IM_COL32(255, 0, 0, 255);              // Color of the note
             new_note.locked = false;                                // Note is not locked initially
             active_notes.push_back(new_note);
-
-            // Play the sound corresponding to this key
-            soundEngine->play2D(keySounds[key.key], false);
-
-            // Set the key's pressed state
-            key.pressed = true;
-        }
-        else if (keyPressed && key.pressed)
-        {
-            // Elongate the note while the key is pressed
-            for (auto& note : active_notes)
-            {
-                if (!note.locked && note.pos.x == key.pos.x)
-                {
-                    note.size.y += 100.0f * deltaTime;  // Increase the height of the note
-                }
-            }
         }
-        else if (!keyPressed && key.pressed)
+        else
         {
             // Lock the note's size when the key is released
             for (auto& note : active_notes)
@@ -378,9 +483,49 @@ void UpdatePianoKeys(float deltaTime)
                     note.locked = true;
                 }
             }
+        }
+        key.pressed = down;
+    }
+}
 
-            // The key was just released
-            key.pressed = false;
+// Fallback when the key input thread could not start: the keys are
+// sampled once a frame, so presses shorter than a frame are missed
+void PollPianoKeys()
+{
+    ImGuiIO& io = ImGui::GetIO();
+    long long now = LatencyMonitor::Now();
+    for (auto& key : keys)
+    {
+        bool down = io.KeysDown[(int)key.key];
+        if (down != key.pressed)
+        {
+            PlayKeyEvent({ (unsigned char)key.key, down, now }, EventPort::Ui);
+            ShowKeyTransition((unsigned char)key.key, down);
+        }
+    }
+    if (io.KeyShift != sustainShift.load())
+        PlayKeyEvent({ KEY_CODE_SHIFT, io.KeyShift, now }, EventPort::Ui);
+}
+
+void UpdatePianoKeys(float deltaTime)
+{
+    KeyEvent event;
+    while (keyEchoes.Pop(event))
+        ShowKeyTransition(event.key, event.down);
+    if (!keyInput.IsRunning())
+        PollPianoKeys();
+
+    // Elongate the notes while their keys are pressed
+    for (auto& key : keys)
+    {
+        if (!key.pressed)
+            continue;
+        for (auto& note : active_notes)
+        {
+            if (!note.locked && note.pos.x == key.pos.x)
+            {
+                note.size.y += 100.0f * deltaTime;  // Increase the height of the note
+            }
         }
     }
 
@@ -404,17 +549,178 @@ LRESULT WINAPI WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
 // Add these two variables to manage the key mapping window
 bool showKeyMappingWindow = false;
 
+static void RenderSynth(void* user, float* left, float* right, int frames)
+{
+    ((SynthEngine*)user)->Render(left, right, frames);
+}
+
+// Stops the output and releases irrKlang on every way out of main(). The
+// irrKlang backend plays through soundEngine, so it goes first.
+struct AudioShutdown
+{
+    std::unique_ptr<AudioBackend>& backend;
+
+    ~AudioShutdown()
+    {
+        if (backend)
+            backend->Stop();
+        backend.reset();
+        if (soundEngine)
+        {
+            soundEngine->drop();
+            soundEngine = nullptr;
+        }
+    }
+};
+
 // Main code
-int main(int, char**)
+int main(int argc, char** argv)
 {
-    // Initialize sound engine
-    soundEngine = createIrrKlangDevice();
+    // Headless benchmark mode, no window or sound device needed
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+        return RunBenchmarks();
+
+    // Scripted session with the real-time checker, exit code 1 on violations
+    if (argc > 1 && strcmp(argv[1], "--rt-check") == 0)
+    {
+        soundEngine = createIrrKlangDevice(ESOD_NULL);
+        if (!soundEngine)
+            return 1;
+        LoadKeySounds();
+        std::vector<std::string> noteFiles;
+        for (const auto& entry : keySounds)
+            noteFiles.push_back(entry.second);
+        std::sort(noteFiles.begin(), noteFiles.end());
+        sampleBank.Load(soundEngine, noteFiles, 48000);
+        int result = RunRealtimeCheck(&sampleBank);
+        soundEngine->drop();
+        return result;
+    }
+
+    AudioBackendSettings audioSettings;
+    if (!ParseAudioArguments(argc, argv, audioSettings))
+        return 1;
+    ThreadSchedulingSettings scheduling;
+    if (!ParseSchedulingArguments(argc, argv, scheduling))
+        return 1;
+    SetThreadScheduling(scheduling);       // Before any audio or worker thread starts
+    MidiSettings midiSettings;
+    if (!ParseMidiArguments(argc, argv, midiSettings))
+        return 1;
+    MidiFile midiFile;
+    if (!midiSettings.file.empty() && !midiFile.Load(midiSettings.file))
+    {
+        fprintf(stderr, "Cannot read MIDI file %s\n", midiFile.GetError().c_str());
+        return 1;
+    }
+
+    // --stats=<path>: DSP load and xrun summary as JSON, rewritten every second
+    // --voice-threads=<n>: helpers for parallel voice rendering
+    const char* statsPath = nullptr;
+    int voiceThreads = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* value;
+        if ((value = GetOptionValue(argv[i], "--stats")) && *value)
+            statsPath = value;
+        else if ((value = GetOptionValue(argv[i], "--voice-threads")) && !ParseCount(value, 0, MAX_POOL_HELPERS, voiceThreads))
+        {
+            fprintf(stderr, "Bad option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    // irrKlang decodes the samples whichever backend plays the output
+    bool irrKlangOutput = audioSettings.type == AudioBackendType::IrrKlang;
+    soundEngine = createIrrKlangDevice(irrKlangOutput ? ESOD_AUTO_DETECT : ESOD_NULL);
     if (!soundEngine)
-        return 0;       // Error starting up the sound engine
+        return 1;       // Error starting up the sound engine
+
+    std::unique_ptr<AudioBackend> audioBackend = irrKlangOutput ? CreateIrrKlangBackend(soundEngine) : CreateAudioBackend(audioSettings.type);
+    AudioShutdown audioShutdown = { audioBackend };
+    if (!audioBackend)
+    {
+        fprintf(stderr, "Audio backend %s is not available in this build\n", GetAudioBackendName(audioSettings.type));
+        return 1;
+    }
+    if (!audioBackend->Open(audioSettings))
+    {
+        fprintf(stderr, "Cannot open %s output: %s\n", GetAudioBackendName(audioSettings.type), audioBackend->GetError().c_str());
+        return 1;
+    }
 
     LoadKeySounds();            // Load key sounds
     InitializeKeyMappings();    // Initialize key mappings
     UpdateKeySounds();          // Load initial key sounds
+
+    // Convert every note to the device rate once, so irrKlang plays them at
+    // unity rate instead of resampling each voice while it plays
+    std::vector<std::string> noteFiles;
+    for (const auto& entry : keySounds)
+        noteFiles.push_back(entry.second);
+    std::sort(noteFiles.begin(), noteFiles.end());
+    sampleBank.Load(soundEngine, noteFiles, audioBackend->GetInfo().sampleRate);
+    LockSampleMemory(sampleBank);
+    RebuildKeyBindings();       // Now that the notes have sample indices
+
+    // Drawbar-style organ as an example of a custom wavetable
+    synthEngine.GetWavetables().Build();
+    synthEngine.GetWavetables().AddFromHarmonics("Organ", { 1.0f, 0.8f, 0.6f, 0.5f, 0.0f, 0.3f, 0.0f, 0.25f });
+
+    // Notes are rendered by our own voices, the backend only plays the result
+    synthEngine.SetVoiceThreads(voiceThreads);
+    synthEngine.SetParallelVoices(voiceThreads > 0);
+    synthEngine.Prepare(&sampleBank, sampleBank.GetSampleRate());
+    synthEngine.GetLatencyMonitor().SetOutputLatency(audioBackend->GetInfo().latency);
+    synthEngine.GetTelemetry().SetXrunSource(audioBackend.get());
+    if (!audioBackend->Start(RenderSynth, &synthEngine))
+    {
+        fprintf(stderr, "Cannot start %s output: %s\n", GetAudioBackendName(audioSettings.type), audioBackend->GetError().c_str());
+        return 1;
+    }
+
+    // MIDI notes play the sample of the same pitch where there is one. Out
+    // first, so it sends the file from its first note; in last.
+    MidiNoteMap midiNotes;
+    for (const auto& entry : keySounds)
+    {
+        int note = (int)NotePitchFromFile(entry.second);
+        if (note >= 0 && note < MIDI_NOTES)
+            midiNotes.samples[note] = sampleBank.FindIndex(entry.second);
+    }
+    std::unique_ptr<MidiOutput> midiOutput = midiSettings.output ? CreateMidiOutput() : nullptr;
+    MidiEcho midiEcho;
+    if (midiSettings.output)
+    {
+        if (!midiOutput)
+        {
+            fprintf(stderr, "MIDI output is not available in this build\n");
+            return 1;
+        }
+        if (!midiOutput->Open(midiSettings.destination))
+        {
+            fprintf(stderr, "Cannot open MIDI output: %s\n", midiOutput->GetError().c_str());
+            return 1;
+        }
+        midiEcho.Start(synthEngine, *midiOutput);
+    }
+    MidiFilePlayer midiPlayer;
+    if (!midiSettings.file.empty())
+        midiPlayer.Start(midiFile, synthEngine, midiNotes, midiSettings.loop);
+    std::unique_ptr<MidiInput> midiInput = midiSettings.input ? CreateMidiInput() : nullptr;
+    if (midiSettings.input)
+    {
+        if (!midiInput)
+        {
+            fprintf(stderr, "MIDI input is not available in this build\n");
+            return 1;
+        }
+        if (!midiInput->Open(midiSettings.source) || !midiInput->Start(OnMidiMessage, &midiNotes))
+        {
+            fprintf(stderr, "Cannot open MIDI input: %s\n", midiInput->GetError().c_str());
+            return 1;
+        }
+    }
     
     // Create application window
     //ImGui_ImplWin32_EnableDpiAwareness();
@@ -434,6 +740,12 @@ int main(int, char**)
     ::ShowWindow(hwnd, SW_SHOWDEFAULT);
     ::UpdateWindow(hwnd);
 
+    // Keys play from their own thread while this window has the focus
+    KeyInputSettings keySettings;
+    keySettings.focusWindow = hwnd;
+    if (!keyInput.Start(keySettings, OnKeyEvent, nullptr))
+        fprintf(stderr, "Key input: %s; polling the keyboard once a frame instead\n", keyInput.GetError().c_str());
+
     // Setup Dear ImGui context
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -455,6 +767,7 @@ int main(int, char**)
     ImVec4 clear_color = ImVec4(0, 0, 0, 1.00f);
 
     InitPianoKeys();
+    ULONGLONG statsWritten = 0;
 
     // Main loop
     bool done = false;
@@ -495,6 +808,15 @@ int main(int, char**)
             ResetDevice();
         }
 
+        // Drain the render loop's block records once per frame
+        DspTelemetry& telemetry = synthEngine.GetTelemetry();
+        telemetry.Update();
+        if (statsPath && GetTickCount64() - statsWritten >= 1000)
+        {
+            telemetry.WriteStatsFile(statsPath);
+            statsWritten = GetTickCount64();
+        }
+
         // Start the Dear ImGui frame
         ImGui_ImplDX9_NewFrame();
         ImGui_ImplWin32_NewFrame();
@@ -539,8 +861,304 @@ int main(int, char**)
                         showKeyMappingWindow = true;
                     }
 
+                    if (ImGui::BeginMenu("Interpolation"))
+                    {
+                        for (int i = 0; i < (int)InterpolationKind::Count; ++i)
+                        {
+                            InterpolationKind kind = (InterpolationKind)i;
+                            if (ImGui::MenuItem(GetInterpolationName(kind), nullptr, GetGlobalInterpolation() == kind))
+                                SetGlobalInterpolation(kind);
+                        }
+                        ImGui::EndMenu();
+                    }
+
+                    if (ImGui::BeginMenu("Envelope"))
+                    {
+                        AdsrSettings envelope = synthEngine.GetEnvelope();
+                        bool changed = false;
+                        changed |= ImGui::SliderFloat("Attack", &envelope.attack, 0.0f, 1.0f, "%.3f s");
+                        changed |= ImGui::SliderFloat("Decay", &envelope.decay, 0.01f, 10.0f, "%.2f s");
+                        changed |= ImGui::SliderFloat("Sustain", &envelope.sustain, 0.0f, 1.0f);
+                        changed |= ImGui::SliderFloat("Release", &envelope.release, 0.01f, 5.0f, "%.2f s");
+                        if (changed)
+                            synthEngine.SetEnvelope(envelope);
+                        ImGui::EndMenu();
+                    }
+
+                    if (ImGui::BeginMenu("Sound"))
+                    {
+                        if (ImGui::MenuItem("Piano samples", nullptr, synthEngine.GetSoundSource() == SoundSource::Samples))
+                            synthEngine.SetSoundSource(SoundSource::Samples);
+                        if (ImGui::MenuItem("Physical piano", nullptr, synthEngine.GetSoundSource() == SoundSource::Physical))
+                            synthEngine.SetSoundSource(SoundSource::Physical);
+                        if (ImGui::BeginMenu("Physical piano quality"))
+                        {
+                            for (int i = 0; i < (int)PhysicalQuality::Count; ++i)
+                            {
+                                if (ImGui::MenuItem(GetPhysicalQualityName((PhysicalQuality)i), nullptr, synthEngine.GetPhysicalQuality() == (PhysicalQuality)i))
+                                    synthEngine.SetPhysicalQuality((PhysicalQuality)i);
+                            }
+                            ImGui::EndMenu();
+                        }
+                        ImGui::Separator();
+                        for (int i = 0; i < GetFmPresetCount(); ++i)
+                        {
+                            bool selected = synthEngine.GetSoundSource() == SoundSource::Fm && synthEngine.GetFmPreset() == i;
+                            if (ImGui::MenuItem(GetFmPreset(i).name, nullptr, selected))
+                            {
+                                synthEngine.SetFmPreset(i);
+                                synthEngine.SetSoundSource(SoundSource::Fm);
+                            }
+                        }
+                        ImGui::Separator();
+                        WavetableSet& tables = synthEngine.GetWavetables();
+                        for (int i = 0; i < tables.GetCount(); ++i)
+                        {
+                            bool selected = synthEngine.GetSoundSource() == SoundSource::Oscillators && synthEngine.GetWaveform() == i;
+                            if (ImGui::MenuItem(tables.GetName(i), nullptr, selected))
+                            {
+                                synthEngine.SetWaveform(i);
+                                synthEngine.SetSoundSource(SoundSource::Oscillators);
+                            }
+                        }
+                        ImGui::Separator();
+                        if (ImGui::BeginMenu("Layers"))
+                        {
+                            for (int i = 0; i < (int)SoundSource::Count; ++i)
+                            {
+                                bool enabled = synthEngine.IsLayerEnabled((SoundSource)i);
+                                if (ImGui::MenuItem(SynthEngine::GetLayerName((SoundSource)i), nullptr, &enabled))
+                                    synthEngine.SetLayerEnabled((SoundSource)i, enabled);
+                            }
+                            const GraphShape& shape = synthEngine.GetGraphShape();
+                            ImGui::TextDisabled("%d nodes, %d levels, %d buffers", shape.nodes, shape.levels, shape.buffers);
+                            ImGui::EndMenu();
+                        }
+                        ImGui::EndMenu();
+                    }
+
+                    if (ImGui::BeginMenu("Filter"))
+                    {
+                        FilterSettings filter = synthEngine.GetFilter();
+                        bool changed = false;
+                        for (int i = 0; i < (int)FilterMode::Count; ++i)
+                        {
+                            if (ImGui::MenuItem(GetFilterModeName((FilterMode)i), nullptr, filter.mode == (FilterMode)i))
+                            {
+                                filter.mode = (FilterMode)i;
+                                changed = true;
+                            }
+                        }
+                        changed |= ImGui::SliderFloat("Cutoff", &filter.cutoff, 20.0f, 16000.0f, "%.0f Hz", ImGuiSliderFlags_Logarithmic);
+                        changed |= ImGui::SliderFloat("Resonance", &filter.resonance, 0.0f, 1.0f);
+                        changed |= ImGui::SliderFloat("Key tracking", &filter.keyTracking, 0.0f, 1.0f);
+                        changed |= ImGui::SliderFloat("Envelope", &filter.envelopeAmount, -4.0f, 4.0f, "%.1f oct");
+                        if (changed)
+                            synthEngine.SetFilter(filter);
+                        ImGui::EndMenu();
+                    }
+
+                    if (ImGui::BeginMenu("Effects"))
+                    {
+                        EffectSettings effects = synthEngine.GetEffects().GetSettings();
+                        bool changed = false;
+                        if (ImGui::BeginMenu("EQ"))
+                        {
+                            changed |= ImGui::MenuItem("Enabled", nullptr, &effects.eq.enabled);
+                            changed |= ImGui::SliderFloat("Low", &effects.eq.lowGain, -12.0f, 12.0f, "%.1f dB");
+                            changed |= ImGui::SliderFloat("Low frequency", &effects.eq.lowFrequency, 40.0f, 800.0f, "%.0f Hz", ImGuiSliderFlags_Logarithmic);
+                            changed |= ImGui::SliderFloat("Mid", &effects.eq.midGain, -12.0f, 12.0f, "%.1f dB");
+                            changed |= ImGui::SliderFloat("Mid frequency", &effects.eq.midFrequency, 200.0f, 8000.0f, "%.0f Hz", ImGuiSliderFlags_Logarithmic);
+                            changed |= ImGui::SliderFloat("Mid Q", &effects.eq.midQ, 0.3f, 8.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+                            changed |= ImGui::SliderFloat("High", &effects.eq.highGain, -12.0f, 12.0f, "%.1f dB");
+                            changed |= ImGui::SliderFloat("High frequency", &effects.eq.highFrequency, 1000.0f, 16000.0f, "%.0f Hz", ImGuiSliderFlags_Logarithmic);
+                            ImGui::EndMenu();
+                        }
+                        if (ImGui::BeginMenu("Compressor"))
+                        {
+                            changed |= ImGui::MenuItem("Enabled", nullptr, &effects.compressor.enabled);
+                            changed |= ImGui::SliderFloat("Threshold", &effects.compressor.threshold, -48.0f, 0.0f, "%.1f dB");
+                            changed |= ImGui::SliderFloat("Ratio", &effects.compressor.ratio, 1.0f, 20.0f, "%.1f:1", ImGuiSliderFlags_Logarithmic);
+                            changed |= ImGui::SliderFloat("Knee", &effects.compressor.knee, 0.0f, 24.0f, "%.1f dB");
+                            changed |= ImGui::SliderFloat("Attack", &effects.compressor.attack, 0.0005f, 0.1f, "%.4f s", ImGuiSliderFlags_Logarithmic);
+                            changed |= ImGui::SliderFloat("Release", &effects.compressor.release, 0.01f, 1.0f, "%.3f s", ImGuiSliderFlags_Logarithmic);
+                            changed |= ImGui::SliderFloat("Makeup", &effects.compressor.makeup, 0.0f, 24.0f, "%.1f dB");
+                            ImGui::EndMenu();
+                        }
+                        if (ImGui::BeginMenu("Chorus"))
+                        {
+                            changed |= ImGui::MenuItem("Enabled", nullptr, &effects.chorus.enabled);
+                            changed |= ImGui::SliderFloat("Rate", &effects.chorus.rate, 0.05f, 5.0f, "%.2f Hz", ImGuiSliderFlags_Logarithmic);
+                            changed |= ImGui::SliderFloat("Depth", &effects.chorus.depth, 0.0f, 10.0f, "%.1f ms");
+                            changed |= ImGui::SliderFloat("Mix", &effects.chorus.mix, 0.0f, 1.0f);
+                            ImGui::EndMenu();
+                        }
+                        if (ImGui::BeginMenu("Delay"))
+                        {
+                            changed |= ImGui::MenuItem("Enabled", nullptr, &effects.delay.enabled);
+                            changed |= ImGui::SliderFloat("Time", &effects.delay.time, 0.01f, MAX_DELAY_SECONDS, "%.3f s", ImGuiSliderFlags_Logarithmic);
+                            changed |= ImGui::SliderFloat("Feedback", &effects.delay.feedback, 0.0f, 0.95f);
+                            changed |= ImGui::SliderFloat("Damping", &effects.delay.damping, 0.0f, 0.95f);
+                            changed |= ImGui::SliderFloat("Mix", &effects.delay.mix, 0.0f, 1.0f);
+                            ImGui::EndMenu();
+                        }
+                        if (ImGui::BeginMenu("Reverb"))
+                        {
+                            changed |= ImGui::MenuItem("Enabled", nullptr, &effects.reverb.enabled);
+                            changed |= ImGui::SliderFloat("Size", &effects.reverb.size, 0.0f, 1.0f);
+                            changed |= ImGui::SliderFloat("Damping", &effects.reverb.damping, 0.0f, 1.0f);
+                            changed |= ImGui::SliderFloat("Mix", &effects.reverb.mix, 0.0f, 1.0f);
+                            ImGui::EndMenu();
+                        }
+                        if (ImGui::BeginMenu("Convolution"))
+                        {
+                            changed |= ImGui::MenuItem("Enabled", nullptr, &effects.convolution.enabled);
+                            changed |= ImGui::SliderFloat("Mix", &effects.convolution.mix, 0.0f, 1.0f);
+                            ImGui::EndMenu();
+                        }
+                        if (changed)
+                            synthEngine.GetEffects().SetSettings(effects);
+                        ImGui::EndMenu();
+                    }
+
+                    if (ImGui::BeginMenu("Limiter"))
+                    {
+                        LimiterSettings limiter = synthEngine.GetLimiter();
+                        float lookahead = limiter.lookahead * 1000.0f;
+                        bool changed = ImGui::MenuItem("Enabled", nullptr, &limiter.enabled);
+                        changed |= ImGui::SliderFloat("Gain", &limiter.gain, -24.0f, 12.0f, "%.1f dB");
+                        changed |= ImGui::SliderFloat("Ceiling", &limiter.ceiling, -12.0f, 0.0f, "%.1f dBTP");
+                        if (ImGui::SliderFloat("Lookahead", &lookahead, 0.0f, MAX_LIMITER_LOOKAHEAD * 1000.0f, "%.1f ms"))
+                        {
+                            limiter.lookahead = lookahead * 0.001f;
+                            changed = true;
+                        }
+                        changed |= ImGui::SliderFloat("Release", &limiter.release, 0.01f, 1.0f, "%.2f s", ImGuiSliderFlags_Logarithmic);
+                        if (changed)
+                            synthEngine.SetLimiter(limiter);
+                        ImGui::EndMenu();
+                    }
+
+                    bool latch = sustainLatch.load();
+                    if (ImGui::MenuItem("Sustain pedal (Shift)", nullptr, &latch))
+                    {
+                        sustainLatch.store(latch);
+                        synthEngine.SetSustainPedal(latch || sustainShift.load());
+                    }
+
+                    // Helpers are fixed at startup; without any the audio thread runs every job
+                    bool parallelVoices = synthEngine.GetParallelVoices();
+                    char parallelLabel[64];
+                    snprintf(parallelLabel, sizeof(parallelLabel), "Parallel voices (%d helpers)", synthEngine.GetVoiceThreads());
+                    if (ImGui::MenuItem(parallelLabel, nullptr, &parallelVoices))
+                        synthEngine.SetParallelVoices(parallelVoices);
+
+                    bool governorEnabled = synthEngine.GetGovernor().IsEnabled();
+                    if (ImGui::MenuItem("Degrade quality under load", nullptr, &governorEnabled))
+                        synthEngine.GetGovernor().SetEnabled(governorEnabled);
+
+                    DenormalMonitor& denormals = synthEngine.GetDenormals();
+                    bool flushDenormals = denormals.IsFlushEnabled();
+                    if (ImGui::MenuItem("Flush denormals", nullptr, &flushDenormals))
+                        denormals.SetFlushEnabled(flushDenormals);
+                    bool countDenormals = denormals.IsCountingEnabled();
+                    if (ImGui::MenuItem("Count denormals (debug)", nullptr, &countDenormals))
+                        denormals.SetCountingEnabled(countDenormals);
+
                     ImGui::EndMenu();
                 }
+
+                ImGui::Separator();
+                const AudioBackendInfo& audio = audioBackend->GetInfo();
+                ImGui::TextWrapped("Output: %s, %s", GetAudioBackendName(audioSettings.type), audio.device.c_str());
+                if (audio.periods > 0)
+                    ImGui::Text("%d Hz, %d x %d frames", audio.sampleRate, audio.periods, audio.periodFrames);
+                else if (audio.periodFrames > 0)
+                    ImGui::Text("%d Hz, %d-frame periods", audio.sampleRate, audio.periodFrames);
+                else
+                    ImGui::Text("%d Hz, driver buffering", audio.sampleRate);
+                if (audio.latency > 0.0)
+                    ImGui::Text("Output latency: %.1f ms", audio.latency * 1000.0);
+                if (midiInput)
+                    ImGui::Text("MIDI in: %s", midiInput->GetName().c_str());
+                if (midiOutput)
+                    ImGui::Text("MIDI out: %s", midiOutput->GetName().c_str());
+                if (!midiSettings.file.empty())
+                {
+                    ImGui::TextWrapped("MIDI file: %s%s", midiSettings.file.c_str(), midiPlayer.IsPlaying() ? "" : " (done)");
+                    if (midiPlayer.GetRefusedPosts() > 0)
+                        ImGui::Text("  Queue full %llu times", midiPlayer.GetRefusedPosts());
+                }
+
+                // Rolling health of the render loop
+                const TelemetrySummary& health = telemetry.GetSummary();
+                ImGui::Text("Load %.0f / %.0f / %.0f%%", health.minLoad * 100.0f, health.avgLoad * 100.0f, health.maxLoad * 100.0f);
+                ImGui::Text("  min / avg / max, last %.0f s", TELEMETRY_WINDOW_SECONDS);
+                ImGui::Text("Xruns: %llu (%llu recent)", health.xruns, health.windowXruns);
+                if (synthEngine.GetRefusedEvents() > 0)
+                    ImGui::Text("Events refused, queue full: %llu", synthEngine.GetRefusedEvents());
+                if (health.blocks > 0)
+                    ImGui::Text("Worst block: %.0f%% of %.1f ms", health.worst.Load() * 100.0f, health.worst.deadline * 1000.0f);
+                if (ImGui::SmallButton("Reset health"))
+                    telemetry.Reset();
+
+                // What the audio and worker threads were granted, and why not more
+                if (ImGui::TreeNode("Threads"))
+                {
+                    for (const ThreadSchedulingResult& thread : GetSchedulingResults())
+                    {
+                        ImGui::TextWrapped("%s: %s, %s", thread.name.c_str(), thread.scheduling.c_str(), thread.affinity.c_str());
+                        if (!thread.error.empty())
+                            ImGui::TextWrapped("  %s", thread.error.c_str());
+                    }
+                    ImGui::TextWrapped("Memory: %s", GetMemoryLockResult().c_str());
+                    ImGui::TreePop();
+                }
+
+                // Output latency is only part of the total when the backend reports it
+                const LatencyHistogram& latency = synthEngine.GetLatencyMonitor().GetHistogram(LatencyStage::Total);
+                if (latency.GetCount() > 0)
+                {
+                    ImGui::Text("Key latency p50 %.1f ms", latency.GetPercentile(0.5) * 1000.0);
+                    ImGui::Text("  p99 %.1f, max %.1f ms", latency.GetPercentile(0.99) * 1000.0, latency.GetMax() * 1000.0);
+                    if (ImGui::SmallButton("Reset latency"))
+                        synthEngine.GetLatencyMonitor().Reset();
+                }
+                ImGui::Text("Voices: %d", synthEngine.GetActiveVoiceCount());
+
+                const GovernorCounters& counters = synthEngine.GetGovernor().GetCounters();
+                unsigned long long blocks = counters.blocks.load();
+                ImGui::Text("DSP load: %.0f%% (peak %.0f%%)", counters.load.load() * 100.0f, counters.peakLoad.load() * 100.0f);
+                ImGui::TextWrapped("Quality: %s", CpuGovernor::GetLevelName((DegradeLevel)counters.level.load()));
+                ImGui::Text("Overruns: %llu", counters.overruns.load());
+                ImGui::Text("Degraded: %.1f%%", blocks ? 100.0 * counters.degradedBlocks.load() / blocks : 0.0);
+                ImGui::Text("Voices stolen: %llu", counters.voicesStolen.load());
+
+                const EffectTimings& timings = synthEngine.GetEffects().GetTimings();
+                for (int i = 0; i < (int)EffectType::Count; ++i)
+                {
+                    float load = timings.load[i].load();
+                    if (load > 0.0f)
+                        ImGui::Text("%s: %.1f%%", GetEffectName((EffectType)i), load * 100.0f);
+                }
+                if (synthEngine.GetEffects().GetSettings().compressor.enabled)
+                    ImGui::Text("Gain reduction: %.1f dB", timings.gainReduction.load());
+                if (synthEngine.GetEffects().GetSettings().convolution.enabled)
+                    ImGui::Text("Convolution workers: %.1f%%", synthEngine.GetEffects().GetConvolution().GetBackgroundLoad() * 100.0f);
+                if (synthEngine.GetLimiter().enabled)
+                    ImGui::Text("Limiter: %.1f dB", synthEngine.GetLimiterReduction());
+
+                const DenormalMonitor& denormals = synthEngine.GetDenormals();
+                if (denormals.IsCountingEnabled())
+                {
+                    ImGui::Text("Denormal blocks of %llu:", denormals.GetBlocks());
+                    for (int n = 0; n < (int)DspNode::Count; ++n)
+                    {
+                        unsigned long long count = denormals.GetCount((DspNode)n);
+                        if (count > 0)
+                            ImGui::Text("  %s: %llu", DenormalMonitor::GetNodeName((DspNode)n), count);
+                    }
+                }
             }
             ImGui::End();
 
@@ -575,6 +1193,18 @@ int main(int, char**)
     }
 
     // Cleanup
+    keyInput.Stop();
+    if (midiInput)
+        midiInput->Stop();
+    midiPlayer.Stop();
+    midiEcho.Stop();
+    audioBackend->Stop();
+    synthEngine.GetLatencyMonitor().PrintReport(stdout);
+    PrintSchedulingReport(stdout);
+    synthEngine.GetTelemetry().Update();
+    if (statsPath)
+        synthEngine.GetTelemetry().WriteStatsFile(statsPath);
+
     ImGui_ImplDX9_Shutdown();
     ImGui_ImplWin32_Shutdown();
     ImGui::DestroyContext();
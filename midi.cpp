@@ -0,0 +1,180 @@
+#include "midi.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+std::unique_ptr<MidiInput> CreateMidiInput()
+{
+#if SYNTH_ALSA
+    return CreateAlsaMidiInput();
+#else
+    return nullptr;
+#endif
+}
+
+std::unique_ptr<MidiOutput> CreateMidiOutput()
+{
+#if SYNTH_ALSA
+    return CreateAlsaMidiOutput();
+#else
+    return nullptr;
+#endif
+}
+
+bool ParseMidiArguments(int argc, char** argv, MidiSettings& settings)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* value;
+        bool valid = true;
+        if (strcmp(argv[i], "--midi-in") == 0)
+            settings.input = true;
+        else if ((value = GetOptionValue(argv[i], "--midi-in")))
+        {
+            settings.input = true;
+            settings.source = value;
+        }
+        else if (strcmp(argv[i], "--midi-out") == 0)
+            settings.output = true;
+        else if ((value = GetOptionValue(argv[i], "--midi-out")))
+        {
+            settings.output = true;
+            settings.destination = value;
+        }
+        else if ((value = GetOptionValue(argv[i], "--midi-file")))
+        {
+            settings.file = value;
+            valid = !settings.file.empty();
+        }
+        else if (strcmp(argv[i], "--midi-loop") == 0)
+            settings.loop = true;
+        if (!valid)
+        {
+            fprintf(stderr, "Bad MIDI option %s\n", argv[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PlayMidiMessage(SynthEngine& engine, const MidiNoteMap& notes, const MidiMessage& message, long long time,
+    long long inputStamp, EventPort port)
+{
+    int channel = message.status & 0x0F;
+    int note = message.data1 & 0x7F;
+    switch (message.status & 0xF0)
+    {
+    case MIDI_NOTE_ON:
+        // Velocity 0 is a note-off, so running status can carry both
+        if (message.data2 != 0)
+        {
+            return engine.NoteOn(GetMidiKey(channel, note), notes.samples[note], (float)note, message.data2 / 127.0f, time,
+                inputStamp, port);
+        }
+        // Fall through
+    case MIDI_NOTE_OFF:
+        return engine.NoteOff(GetMidiKey(channel, note), time, port);
+    case MIDI_CONTROLLER:
+        if (message.data1 == MIDI_SUSTAIN)
+            return engine.SetSustainPedal(message.data2 >= 64, time, port, channel);
+        if (message.data1 == MIDI_ALL_SOUND_OFF || message.data1 == MIDI_ALL_NOTES_OFF)
+            return engine.AllNotesOff(time, port);
+        return true;
+    default:
+        return true;
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// MIDI out
+
+void MidiEcho::Start(SynthEngine& engine, MidiOutput& output)
+{
+    Stop();
+    m_Engine = &engine;
+    m_Output = &output;
+    m_SoundingCount = 0;
+    m_Quit.store(false);
+
+    // Whatever was played before the output was there is not sent late
+    NoteEvent stale;
+    while (engine.PopPlayedEvent(stale))
+        ;
+    engine.SetPlayedEventsEnabled(true);
+    m_Thread = std::thread(&MidiEcho::ThreadLoop, this);
+}
+
+void MidiEcho::Stop()
+{
+    if (!m_Thread.joinable())
+        return;
+    m_Engine->SetPlayedEventsEnabled(false);
+    m_Quit.store(true);
+    m_Thread.join();
+    while (m_SoundingCount > 0)
+        Release(m_SoundingCount - 1);
+}
+
+void MidiEcho::Send(int status, int data1, int data2)
+{
+    MidiMessage message = { (unsigned char)status, (unsigned char)data1, (unsigned char)data2 };
+    m_Output->Send(message);
+}
+
+void MidiEcho::Release(int slot)
+{
+    const Sounding& sounding = m_Sounding[slot];
+    Send(MIDI_NOTE_OFF | sounding.channel, sounding.note, 0);
+    m_Sounding[slot] = m_Sounding[--m_SoundingCount];
+}
+
+// The audio thread cannot wake anyone, so the queue is polled; a
+// millisecond is well under a period
+void MidiEcho::ThreadLoop()
+{
+    while (!m_Quit.load(std::memory_order_relaxed))
+    {
+        NoteEvent event;
+        if (!m_Engine->PopPlayedEvent(event))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        int slot = 0;
+        while (slot < m_SoundingCount && m_Sounding[slot].key != event.key)
+            ++slot;
+        switch (event.type)
+        {
+        case NoteEventType::NoteOn:
+        {
+            if (slot < m_SoundingCount)
+                Release(slot);      // Retrigger
+            int note = (int)std::lround(event.pitch);
+            if (note < 0 || note >= MIDI_NOTES || m_SoundingCount == MAX_SOUNDING)
+                break;
+            int channel = event.key >= MIDI_KEY_BASE ? (event.key - MIDI_KEY_BASE) / MIDI_NOTES % MIDI_CHANNELS : 0;
+            int velocity = std::min(std::max((int)std::lround(event.velocity * 127.0f), 1), 127);
+            m_Sounding[m_SoundingCount++] = { event.key, (unsigned char)channel, (unsigned char)note };
+            Send(MIDI_NOTE_ON | channel, note, velocity);
+            break;
+        }
+        case NoteEventType::NoteOff:
+            if (slot < m_SoundingCount)
+                Release(slot);
+            break;
+        case NoteEventType::SustainOn:
+        case NoteEventType::SustainOff:
+            Send(MIDI_CONTROLLER | (event.key & 0x0F), MIDI_SUSTAIN, event.type == NoteEventType::SustainOn ? 127 : 0);
+            break;
+        case NoteEventType::AllNotesOff:
+            while (m_SoundingCount > 0)
+                Release(m_SoundingCount - 1);
+            break;
+        default:
+            break;
+        }
+    }
+}
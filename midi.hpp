@@ -0,0 +1,152 @@
+#pragma once
+
+#include "audio_backend.hpp"
+#include "synth_engine.hpp"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+// A channel message as it goes over the wire. System messages are not
+// passed on.
+struct MidiMessage
+{
+    unsigned char status;       // Message type in the high nibble, channel in the low
+    unsigned char data1;        // Note or controller number
+    unsigned char data2;        // Velocity or controller value
+};
+
+const int MIDI_NOTE_OFF = 0x80;
+const int MIDI_NOTE_ON = 0x90;
+const int MIDI_CONTROLLER = 0xB0;
+const int MIDI_PROGRAM = 0xC0;
+const int MIDI_PITCH_BEND = 0xE0;
+const int MIDI_SUSTAIN = 64;            // Controller numbers
+const int MIDI_ALL_SOUND_OFF = 120;
+const int MIDI_ALL_NOTES_OFF = 123;
+const int MIDI_CHANNELS = 16;
+const int MIDI_NOTES = 128;
+
+// Engine key of a MIDI note, clear of the computer keyboard's key codes
+const int MIDI_KEY_BASE = 0x10000;
+inline int GetMidiKey(int channel, int note) { return MIDI_KEY_BASE + channel * MIDI_NOTES + note; }
+
+// Called on the input's thread for each message, in order, stamped with
+// when it arrived on the LatencyMonitor::Now() clock
+typedef void (*MidiInputFn)(void* user, const MidiMessage& message, long long stamp);
+
+// Empty source or destination: the port is only opened, for others to
+// connect (aconnect, a DAW)
+struct MidiSettings
+{
+    bool input = false;
+    std::string source;         // Sequencer address to read from, e.g. "20:0" or a client name
+    bool output = false;
+    std::string destination;    // Sequencer address to send what was played to
+    std::string file;           // Standard MIDI File to replay
+    bool loop = false;          // Replay the file until stopped
+};
+
+class MidiInput
+{
+public:
+    virtual ~MidiInput() {}
+
+    virtual bool Open(const std::string& source) = 0;
+    // Stop() returns once the handler has been called for the last time
+    virtual bool Start(MidiInputFn handler, void* user) = 0;
+    virtual void Stop() = 0;
+
+    // Address others connect to, valid after Open()
+    const std::string& GetName() const { return m_Name; }
+    const std::string& GetError() const { return m_Error; }
+
+protected:
+    std::string m_Name;
+    std::string m_Error;
+};
+
+class MidiOutput
+{
+public:
+    virtual ~MidiOutput() {}
+
+    virtual bool Open(const std::string& destination) = 0;
+    // Sent at once, without allocating; from one thread at a time
+    virtual bool Send(const MidiMessage& message) = 0;
+
+    const std::string& GetName() const { return m_Name; }
+    const std::string& GetError() const { return m_Error; }
+
+protected:
+    std::string m_Name;
+    std::string m_Error;
+};
+
+// Return nullptr when no MIDI support is compiled in
+std::unique_ptr<MidiInput> CreateMidiInput();
+std::unique_ptr<MidiOutput> CreateMidiOutput();
+
+// Reads --midi-in[=source], --midi-out[=destination], --midi-file= and
+// --midi-loop from the command line; other arguments are left alone
+bool ParseMidiArguments(int argc, char** argv, MidiSettings& settings);
+
+// The sample each note plays, -1 for notes that sound only on the
+// synthesised layers
+struct MidiNoteMap
+{
+    MidiNoteMap()
+    {
+        for (int& sample : samples)
+            sample = -1;
+    }
+    int samples[MIDI_NOTES];
+};
+
+// Posts one message to the engine on the given port: note on and off, the
+// sustain pedal, and all notes off. Anything else is ignored. False, with
+// nothing posted, while the port's queue is full.
+bool PlayMidiMessage(SynthEngine& engine, const MidiNoteMap& notes, const MidiMessage& message, long long time,
+    long long inputStamp, EventPort port);
+
+// Sends what the engine played to a MIDI output from a thread of its own:
+// notes and the pedal on the channel they came in on, the computer
+// keyboard's on the first. The audio thread hands the events over through
+// a queue, so it never touches the output. Messages go out as soon as the
+// block that applied them is rendered, not at their frame: up to a block
+// early against the audio, plus up to a millisecond of polling.
+class MidiEcho
+{
+public:
+    ~MidiEcho() { Stop(); }
+
+    void Start(SynthEngine& engine, MidiOutput& output);
+    // Notes still sounding are ended on the output
+    void Stop();
+
+private:
+    void ThreadLoop();
+    void Send(int status, int data1, int data2);
+    void Release(int slot);
+
+    // A note the output was sent, so its note-off can follow
+    struct Sounding
+    {
+        int key;
+        unsigned char channel;
+        unsigned char note;
+    };
+    static const int MAX_SOUNDING = 256;
+
+    SynthEngine* m_Engine = nullptr;
+    MidiOutput* m_Output = nullptr;
+    std::thread m_Thread;
+    std::atomic<bool> m_Quit{ false };
+    Sounding m_Sounding[MAX_SOUNDING];
+    int m_SoundingCount = 0;
+};
+
+#if SYNTH_ALSA
+std::unique_ptr<MidiInput> CreateAlsaMidiInput();
+std::unique_ptr<MidiOutput> CreateAlsaMidiOutput();
+#endif
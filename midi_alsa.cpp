@@ -0,0 +1,289 @@
+#include "midi.hpp"
+
+#if SYNTH_ALSA
+#include "latency_monitor.hpp"
+#include <alsa/asoundlib.h>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+
+// As others see it in aconnect -l
+static const char* CLIENT_NAME = "Syntezator";
+
+static std::string GetAddress(snd_seq_t* seq, int port)
+{
+    return std::to_string(snd_seq_client_id(seq)) + ":" + std::to_string(port);
+}
+
+// Reads from a sequencer port that others connect to, or that connects
+// itself to the source given. The kernel stamps each event with the real
+// time of a queue started with the input as it is delivered to the port,
+// so the stamp is when the event arrived rather than when this thread got
+// round to it; the queue's start time puts it on the LatencyMonitor::Now()
+// clock. Test with a virtual client: aconnect, or snd-virmidi and amidi.
+class AlsaMidiInput : public MidiInput
+{
+public:
+    ~AlsaMidiInput() override
+    {
+        Stop();
+        if (m_Seq)
+            snd_seq_close(m_Seq);
+    }
+
+    bool Open(const std::string& source) override
+    {
+        int error = snd_seq_open(&m_Seq, "default", SND_SEQ_OPEN_INPUT, SND_SEQ_NONBLOCK);
+        if (error < 0)
+            return Fail("snd_seq_open", error);
+        snd_seq_set_client_name(m_Seq, CLIENT_NAME);
+        if ((m_Queue = snd_seq_alloc_named_queue(m_Seq, "Syntezator input")) < 0)
+            return Fail("snd_seq_alloc_named_queue", m_Queue);
+
+        snd_seq_port_info_t* info;
+        snd_seq_port_info_alloca(&info);
+        snd_seq_port_info_set_name(info, "MIDI in");
+        snd_seq_port_info_set_capability(info, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+        snd_seq_port_info_set_type(info, SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+        snd_seq_port_info_set_timestamping(info, 1);
+        snd_seq_port_info_set_timestamp_real(info, 1);
+        snd_seq_port_info_set_timestamp_queue(info, m_Queue);
+        if ((error = snd_seq_create_port(m_Seq, info)) < 0)
+            return Fail("snd_seq_create_port", error);
+        m_Port = snd_seq_port_info_get_port(info);
+        m_Name = GetAddress(m_Seq, m_Port);
+
+        if (!source.empty())
+        {
+            snd_seq_addr_t address;
+            if ((error = snd_seq_parse_address(m_Seq, &address, source.c_str())) < 0)
+                return Fail(source.c_str(), error);
+            if ((error = snd_seq_connect_from(m_Seq, m_Port, address.client, address.port)) < 0)
+                return Fail("snd_seq_connect_from", error);
+        }
+        return true;
+    }
+
+    bool Start(MidiInputFn handler, void* user) override
+    {
+        if (!m_Seq || m_Thread.joinable() || !handler)
+            return false;
+        if (pipe(m_Wake) != 0)
+        {
+            m_Error = std::string("pipe: ") + strerror(errno);
+            return false;
+        }
+        int error = snd_seq_start_queue(m_Seq, m_Queue, nullptr);
+        if (error >= 0)
+            error = snd_seq_drain_output(m_Seq);
+        if (error < 0)
+        {
+            m_Error = std::string("snd_seq_start_queue: ") + snd_strerror(error);
+            CloseWake();
+            return false;
+        }
+        m_QueueStart = LatencyMonitor::Now();
+        m_Handler = handler;
+        m_User = user;
+        m_Thread = std::thread(&AlsaMidiInput::ThreadLoop, this);
+        return true;
+    }
+
+    void Stop() override
+    {
+        if (!m_Thread.joinable())
+            return;
+        char wake = 0;
+        ssize_t written = write(m_Wake[1], &wake, 1);
+        (void)written;
+        m_Thread.join();
+        CloseWake();
+        snd_seq_stop_queue(m_Seq, m_Queue, nullptr);
+        snd_seq_drain_output(m_Seq);
+    }
+
+private:
+    static const int MAX_DESCRIPTORS = 4;
+
+    void ThreadLoop()
+    {
+        pollfd waits[MAX_DESCRIPTORS + 1];
+        int count = snd_seq_poll_descriptors(m_Seq, waits, MAX_DESCRIPTORS, POLLIN);
+        waits[count] = { m_Wake[0], POLLIN, 0 };
+        for (;;)
+        {
+            if (poll(waits, count + 1, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                m_Error = std::string("poll: ") + strerror(errno);
+                break;
+            }
+            if (waits[count].revents)
+                break;
+
+            // -ENOSPC means the kernel's buffer overran and events were
+            // lost; what is left is still read
+            snd_seq_event_t* event;
+            int result;
+            while ((result = snd_seq_event_input(m_Seq, &event)) >= 0 || result == -ENOSPC)
+            {
+                if (result < 0)
+                    continue;
+                MidiMessage message;
+                if (!Translate(*event, message))
+                    continue;
+                long long stamp = LatencyMonitor::Now();
+                if ((event->flags & SND_SEQ_TIME_STAMP_MASK) == SND_SEQ_TIME_STAMP_REAL)
+                    stamp = m_QueueStart + event->time.time.tv_sec * 1000000000LL + event->time.time.tv_nsec;
+                m_Handler(m_User, message, stamp);
+            }
+        }
+    }
+
+    static bool Translate(const snd_seq_event_t& event, MidiMessage& message)
+    {
+        const snd_seq_ev_note_t& note = event.data.note;
+        const snd_seq_ev_ctrl_t& control = event.data.control;
+        switch (event.type)
+        {
+        case SND_SEQ_EVENT_NOTEON:
+            message = { (unsigned char)(MIDI_NOTE_ON | (note.channel & 0x0F)), note.note, note.velocity };
+            return true;
+        case SND_SEQ_EVENT_NOTEOFF:
+            message = { (unsigned char)(MIDI_NOTE_OFF | (note.channel & 0x0F)), note.note, note.velocity };
+            return true;
+        case SND_SEQ_EVENT_CONTROLLER:
+            message = { (unsigned char)(MIDI_CONTROLLER | (control.channel & 0x0F)), (unsigned char)(control.param & 0x7F),
+                (unsigned char)(control.value & 0x7F) };
+            return true;
+        case SND_SEQ_EVENT_PGMCHANGE:
+            message = { (unsigned char)(MIDI_PROGRAM | (control.channel & 0x0F)), (unsigned char)(control.value & 0x7F), 0 };
+            return true;
+        case SND_SEQ_EVENT_PITCHBEND:
+        {
+            int bend = control.value + 8192;
+            message = { (unsigned char)(MIDI_PITCH_BEND | (control.channel & 0x0F)), (unsigned char)(bend & 0x7F),
+                (unsigned char)(bend >> 7 & 0x7F) };
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    void CloseWake()
+    {
+        for (int& fd : m_Wake)
+        {
+            if (fd >= 0)
+                close(fd);
+            fd = -1;
+        }
+    }
+
+    bool Fail(const char* what, int error)
+    {
+        m_Error = std::string(what) + ": " + snd_strerror(error);
+        if (m_Seq)
+        {
+            snd_seq_close(m_Seq);
+            m_Seq = nullptr;
+        }
+        return false;
+    }
+
+    snd_seq_t* m_Seq = nullptr;
+    int m_Port = -1;
+    int m_Queue = -1;
+    long long m_QueueStart = 0;     // LatencyMonitor::Now() when the queue started
+    MidiInputFn m_Handler = nullptr;
+    void* m_User = nullptr;
+    std::thread m_Thread;
+    int m_Wake[2] = { -1, -1 };     // Pipe that ends the read loop
+};
+
+// Sends through a port others can subscribe to, or connected to the
+// destination given. Events go out directly, bypassing the client's output
+// buffer and any queue, so Send() neither allocates nor waits on a drain.
+class AlsaMidiOutput : public MidiOutput
+{
+public:
+    ~AlsaMidiOutput() override
+    {
+        if (m_Seq)
+            snd_seq_close(m_Seq);
+    }
+
+    bool Open(const std::string& destination) override
+    {
+        int error = snd_seq_open(&m_Seq, "default", SND_SEQ_OPEN_OUTPUT, 0);
+        if (error < 0)
+            return Fail("snd_seq_open", error);
+        snd_seq_set_client_name(m_Seq, CLIENT_NAME);
+        if ((m_Port = snd_seq_create_simple_port(m_Seq, "MIDI out", SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+            SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION)) < 0)
+            return Fail("snd_seq_create_simple_port", m_Port);
+        m_Name = GetAddress(m_Seq, m_Port);
+
+        if (!destination.empty())
+        {
+            snd_seq_addr_t address;
+            if ((error = snd_seq_parse_address(m_Seq, &address, destination.c_str())) < 0)
+                return Fail(destination.c_str(), error);
+            if ((error = snd_seq_connect_to(m_Seq, m_Port, address.client, address.port)) < 0)
+                return Fail("snd_seq_connect_to", error);
+        }
+        return true;
+    }
+
+    bool Send(const MidiMessage& message) override
+    {
+        if (!m_Seq)
+            return false;
+        snd_seq_event_t event;
+        snd_seq_ev_clear(&event);
+        snd_seq_ev_set_source(&event, m_Port);
+        snd_seq_ev_set_subs(&event);
+        snd_seq_ev_set_direct(&event);
+        int channel = message.status & 0x0F;
+        switch (message.status & 0xF0)
+        {
+        case MIDI_NOTE_ON: snd_seq_ev_set_noteon(&event, channel, message.data1, message.data2); break;
+        case MIDI_NOTE_OFF: snd_seq_ev_set_noteoff(&event, channel, message.data1, message.data2); break;
+        case MIDI_CONTROLLER: snd_seq_ev_set_controller(&event, channel, message.data1, message.data2); break;
+        case MIDI_PROGRAM: snd_seq_ev_set_pgmchange(&event, channel, message.data1); break;
+        case MIDI_PITCH_BEND: snd_seq_ev_set_pitchbend(&event, channel, (message.data2 << 7 | message.data1) - 8192); break;
+        default: return false;
+        }
+        return snd_seq_event_output_direct(m_Seq, &event) >= 0;
+    }
+
+private:
+    bool Fail(const char* what, int error)
+    {
+        m_Error = std::string(what) + ": " + snd_strerror(error);
+        if (m_Seq)
+        {
+            snd_seq_close(m_Seq);
+            m_Seq = nullptr;
+        }
+        return false;
+    }
+
+    snd_seq_t* m_Seq = nullptr;
+    int m_Port = -1;
+};
+
+std::unique_ptr<MidiInput> CreateAlsaMidiInput()
+{
+    return std::unique_ptr<MidiInput>(new AlsaMidiInput());
+}
+
+std::unique_ptr<MidiOutput> CreateAlsaMidiOutput()
+{
+    return std::unique_ptr<MidiOutput>(new AlsaMidiOutput());
+}
+
+#endif
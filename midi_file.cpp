@@ -0,0 +1,314 @@
+#include "midi_file.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+static const unsigned DEFAULT_TEMPO = 500000;       // Microseconds per quarter note, 120 bpm
+
+static unsigned ReadBigEndian(const unsigned char* data, int bytes)
+{
+    unsigned value = 0;
+    for (int i = 0; i < bytes; ++i)
+        value = value << 8 | data[i];
+    return value;
+}
+
+// Variable-length quantity: seven bits a byte, at most four bytes
+static bool ReadVariable(const unsigned char*& data, const unsigned char* end, unsigned& value)
+{
+    value = 0;
+    for (int i = 0; i < 4 && data < end; ++i)
+    {
+        unsigned char byte = *data++;
+        value = value << 7 | (byte & 0x7F);
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+namespace
+{
+struct TickEvent
+{
+    unsigned long long tick;
+    MidiMessage message;
+};
+
+struct TempoChange
+{
+    unsigned long long tick;
+    unsigned microseconds;      // Per quarter note
+};
+}
+
+// Appends the track's channel messages and tempo changes. Returns the
+// problem, or nullptr.
+static const char* ParseTrack(const unsigned char* data, const unsigned char* end, std::vector<TickEvent>& events,
+    std::vector<TempoChange>& tempos)
+{
+    unsigned long long tick = 0;
+    int running = 0;
+    while (data < end)
+    {
+        unsigned delta;
+        if (!ReadVariable(data, end, delta))
+            return "bad delta time";
+        tick += delta;
+        if (data >= end)
+            return "cut short";
+
+        int status = *data;
+        if (status & 0x80)
+            ++data;
+        else if (running)
+            status = running;
+        else
+            return "data byte without a status";
+
+        if (status == 0xFF)
+        {
+            // Meta event; running status does not carry across one
+            unsigned length;
+            if (data >= end)
+                return "cut short";
+            int type = *data++;
+            if (!ReadVariable(data, end, length) || length > (size_t)(end - data))
+                return "cut short";
+            if (type == 0x51 && length == 3)
+                tempos.push_back({ tick, ReadBigEndian(data, 3) });
+            data += length;
+            running = 0;
+            if (type == 0x2F)
+                break;      // End of track
+        }
+        else if (status == 0xF0 || status == 0xF7)
+        {
+            unsigned length;
+            if (!ReadVariable(data, end, length) || length > (size_t)(end - data))
+                return "cut short";
+            data += length;
+            running = 0;
+        }
+        else if (status > 0xF0)
+            return "system message in a track";
+        else
+        {
+            // Program change and channel pressure carry one data byte
+            int bytes = (status & 0xE0) == 0xC0 ? 1 : 2;
+            if (end - data < bytes)
+                return "cut short";
+            MidiMessage message = { (unsigned char)status, (unsigned char)(data[0] & 0x7F),
+                (unsigned char)(bytes == 2 ? data[1] & 0x7F : 0) };
+            events.push_back({ tick, message });
+            data += bytes;
+            running = status;
+        }
+    }
+    return nullptr;
+}
+
+bool MidiFile::Fail(const std::string& error)
+{
+    m_Events.clear();
+    m_Error = error;
+    return false;
+}
+
+bool MidiFile::Load(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return Fail(path + ": " + strerror(errno));
+    std::vector<unsigned char> data;
+    unsigned char buffer[65536];
+    size_t bytes;
+    while ((bytes = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + bytes);
+    fclose(file);
+    if (!Parse(data.data(), data.size()))
+        return Fail(path + ": " + m_Error);
+    return true;
+}
+
+bool MidiFile::Parse(const unsigned char* data, size_t size)
+{
+    m_Events.clear();
+    if (size < 14 || memcmp(data, "MThd", 4) != 0)
+        return Fail("not a MIDI file");
+    size_t headerLength = ReadBigEndian(data + 4, 4);
+    if (headerLength < 6 || headerLength > size - 8)
+        return Fail("bad header");
+    unsigned format = ReadBigEndian(data + 8, 2);
+    unsigned trackCount = ReadBigEndian(data + 10, 2);
+    unsigned division = ReadBigEndian(data + 12, 2);
+    if (format > 1)
+        return Fail("format " + std::to_string(format) + " files are not supported");
+
+    // Ticks are either a fraction of a quarter note, and so follow the
+    // tempo, or a fraction of an SMPTE frame, fixed
+    double secondsPerTick = 0.0;
+    if (division & 0x8000)
+    {
+        int framesPerSecond = -(signed char)(division >> 8);
+        int ticksPerFrame = division & 0xFF;
+        if (framesPerSecond <= 0 || ticksPerFrame == 0)
+            return Fail("bad time division");
+        secondsPerTick = 1.0 / ((framesPerSecond == 29 ? 29.97 : framesPerSecond) * ticksPerFrame);
+    }
+    else if (division == 0)
+        return Fail("bad time division");
+
+    // Events are gathered track by track and sorted stably, so at equal
+    // ticks the earlier track and then the file order go first
+    std::vector<TickEvent> events;
+    std::vector<TempoChange> tempos;
+    size_t position = 8 + headerLength;
+    unsigned track = 0;
+    while (track < trackCount && size - position >= 8)
+    {
+        size_t length = ReadBigEndian(data + position + 4, 4);
+        if (length > size - position - 8)
+            return Fail("track " + std::to_string(track + 1) + " cut short");
+        const unsigned char* chunk = data + position + 8;
+        bool isTrack = memcmp(data + position, "MTrk", 4) == 0;
+        position += 8 + length;
+        if (!isTrack)
+            continue;       // Unknown chunks are skipped
+        if (const char* error = ParseTrack(chunk, chunk + length, events, tempos))
+            return Fail("track " + std::to_string(track + 1) + ": " + error);
+        ++track;
+    }
+    if (track < trackCount)
+        return Fail("only " + std::to_string(track) + " of " + std::to_string(trackCount) + " tracks");
+
+    std::stable_sort(events.begin(), events.end(), [](const TickEvent& a, const TickEvent& b) { return a.tick < b.tick; });
+    std::stable_sort(tempos.begin(), tempos.end(), [](const TempoChange& a, const TempoChange& b) { return a.tick < b.tick; });
+
+    m_Events.reserve(events.size());
+    size_t nextTempo = 0;
+    unsigned long long tempoTick = 0;
+    double tempoSeconds = 0.0;
+    double tickSeconds = secondsPerTick > 0.0 ? secondsPerTick : DEFAULT_TEMPO * 1e-6 / division;
+    for (const TickEvent& event : events)
+    {
+        if (secondsPerTick == 0.0)
+        {
+            for (; nextTempo < tempos.size() && tempos[nextTempo].tick <= event.tick; ++nextTempo)
+            {
+                tempoSeconds += (tempos[nextTempo].tick - tempoTick) * tickSeconds;
+                tempoTick = tempos[nextTempo].tick;
+                tickSeconds = tempos[nextTempo].microseconds * 1e-6 / division;
+            }
+        }
+        m_Events.push_back({ tempoSeconds + (event.tick - tempoTick) * tickSeconds, event.message });
+    }
+    m_Error.clear();
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Player
+
+void MidiFilePlayer::Start(const MidiFile& file, SynthEngine& engine, const MidiNoteMap& notes, bool loop)
+{
+    Stop();
+    m_File = &file;
+    m_Engine = &engine;
+    m_Notes = &notes;
+    m_Loop = loop;
+    memset(m_Sounding, 0, sizeof(m_Sounding));
+    m_PedalDown = false;
+    m_PedalChannel = 0;
+    m_Quit.store(false);
+    m_Playing.store(true);
+    m_Thread = std::thread(&MidiFilePlayer::ThreadLoop, this);
+}
+
+void MidiFilePlayer::Stop()
+{
+    if (!m_Thread.joinable())
+        return;
+    m_Quit.store(true);
+    m_Thread.join();
+}
+
+// The queue may still be full of the lookahead, so each release waits for
+// room; not for ever, in case the output has stopped
+void MidiFilePlayer::ReleaseAll()
+{
+    int retries = RELEASE_RETRIES;
+    for (int channel = 0; channel < MIDI_CHANNELS; ++channel)
+    {
+        for (int note = 0; note < MIDI_NOTES; ++note)
+        {
+            while (m_Sounding[channel][note] && !m_Engine->NoteOff(GetMidiKey(channel, note), 0, EventPort::Player)
+                && retries-- > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(WAKE_MILLISECONDS));
+            m_Sounding[channel][note] = false;
+        }
+    }
+    while (m_PedalDown && !m_Engine->SetSustainPedal(false, 0, EventPort::Player, m_PedalChannel) && retries-- > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(WAKE_MILLISECONDS));
+    m_PedalDown = false;
+}
+
+void MidiFilePlayer::ThreadLoop()
+{
+    const std::vector<MidiFileEvent>& events = m_File->GetEvents();
+    const double sampleRate = m_Engine->GetSampleRate();
+    const long long lookahead = (long long)(LOOKAHEAD_SECONDS * sampleRate);
+    const long long length = std::llround(m_File->GetLength() * sampleRate);
+    long long start = m_Engine->GetFrameTime() + (long long)(LEAD_SECONDS * sampleRate);
+    size_t next = 0;
+
+    while (!m_Quit.load(std::memory_order_relaxed))
+    {
+        long long horizon = m_Engine->GetFrameTime() + lookahead;
+        for (; next < events.size(); ++next)
+        {
+            long long time = start + std::llround(events[next].seconds * sampleRate);
+            if (time > horizon)
+                break;
+
+            // A full queue holds the rest back until the next wake, so
+            // nothing is lost however dense the file
+            const MidiMessage& message = events[next].message;
+            if (!PlayMidiMessage(*m_Engine, *m_Notes, message, time, 0, EventPort::Player))
+            {
+                m_Refused.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            int type = message.status & 0xF0;
+            int channel = message.status & 0x0F;
+            if (type == MIDI_NOTE_ON || type == MIDI_NOTE_OFF)
+                m_Sounding[channel][message.data1] = type == MIDI_NOTE_ON && message.data2 != 0;
+            else if (type == MIDI_CONTROLLER && message.data1 == MIDI_SUSTAIN)
+            {
+                m_PedalDown = message.data2 >= 64;
+                m_PedalChannel = channel;
+            }
+            else if (type == MIDI_CONTROLLER && (message.data1 == MIDI_ALL_SOUND_OFF || message.data1 == MIDI_ALL_NOTES_OFF))
+                memset(m_Sounding, 0, sizeof(m_Sounding));
+        }
+
+        if (next == events.size())
+        {
+            if (m_Loop && length > 0)
+            {
+                start += length;
+                next = 0;
+                continue;
+            }
+            if (m_Engine->GetFrameTime() >= start + length)
+                break;      // Played out
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(WAKE_MILLISECONDS));
+    }
+
+    ReleaseAll();
+    m_Playing.store(false, std::memory_order_release);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "midi.hpp"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct MidiFileEvent
+{
+    double seconds;             // From the start of the file
+    MidiMessage message;
+};
+
+// A Standard MIDI File, format 0 or 1, read whole: the channel messages of
+// every track merged in time order, with the tempo map applied. Meta events
+// and system exclusives are skipped.
+class MidiFile
+{
+public:
+    bool Load(const std::string& path);
+    bool Parse(const unsigned char* data, size_t size);
+
+    const std::vector<MidiFileEvent>& GetEvents() const { return m_Events; }
+    double GetLength() const { return m_Events.empty() ? 0.0 : m_Events.back().seconds; }
+    const std::string& GetError() const { return m_Error; }
+
+private:
+    bool Fail(const std::string& error);
+
+    std::vector<MidiFileEvent> m_Events;
+    std::string m_Error;
+};
+
+// Replays a file into the engine in real time from a thread of its own.
+// Each event is posted up to LOOKAHEAD_SECONDS ahead with the output frame
+// it falls on, counted from the frame playback started at, so it lands
+// sample-exactly however late the thread wakes: the same file renders the
+// same way every time, which makes it a repeatable load. Needs an output
+// clocked in real time; one rendering faster (the file sink) can overtake
+// the lookahead.
+class MidiFilePlayer
+{
+public:
+    ~MidiFilePlayer() { Stop(); }
+
+    // The file must outlive the playback
+    void Start(const MidiFile& file, SynthEngine& engine, const MidiNoteMap& notes, bool loop);
+    // Ends the notes the file left sounding, after the lookahead already
+    // posted has played
+    void Stop();
+
+    // False once a file played without looping has played out
+    bool IsPlaying() const { return m_Playing.load(std::memory_order_acquire); }
+    // Times the engine's queue was full and posting waited for the next
+    // wake. Events that were late as a result land at the next block.
+    unsigned long long GetRefusedPosts() const { return m_Refused.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr double LOOKAHEAD_SECONDS = 0.1;
+    static constexpr double LEAD_SECONDS = 0.05;       // Time for the first events to be posted
+    static constexpr int WAKE_MILLISECONDS = 10;
+    static constexpr int RELEASE_RETRIES = 100;
+
+    void ThreadLoop();
+    void ReleaseAll();
+
+    const MidiFile* m_File = nullptr;
+    SynthEngine* m_Engine = nullptr;
+    const MidiNoteMap* m_Notes = nullptr;
+    bool m_Loop = false;
+    std::thread m_Thread;
+    std::atomic<bool> m_Quit{ false };
+    std::atomic<bool> m_Playing{ false };
+    std::atomic<unsigned long long> m_Refused{ 0 };
+    bool m_Sounding[MIDI_CHANNELS][MIDI_NOTES] = {};   // Player thread until joined
+    bool m_PedalDown = false;
+    int m_PedalChannel = 0;
+};
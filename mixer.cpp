@@ -0,0 +1,214 @@
+#include "mixer.hpp"
+#include <cmath>
+
+// Square-root law: left^2 + right^2 stays constant like the sin/cos law,
+// without two transcendental calls per voice and block
+void PanGains(float gain, float pan, float& left, float& right)
+{
+    left = gain * std::sqrt(0.5f * (1.0f - pan));
+    right = gain * std::sqrt(0.5f * (1.0f + pan));
+}
+
+// Per-channel gain ramp of one voice over a block
+struct ChannelRamps
+{
+    float left, leftStep;
+    float right, rightStep;
+};
+
+static ChannelRamps MakeRamps(const MixVoice& voice, int frames)
+{
+    float l0, r0, l1, r1;
+    PanGains(voice.gainStart, voice.panStart, l0, r0);
+    PanGains(voice.gainEnd, voice.panEnd, l1, r1);
+
+    ChannelRamps ramps;
+    float inv = 1.0f / (float)frames;
+    ramps.left = l0;
+    ramps.leftStep = (l1 - l0) * inv;
+    ramps.right = r0;
+    ramps.rightStep = (r1 - r0) * inv;
+    return ramps;
+}
+
+// Kernels are instantiated per layout so the frame loops carry no branches
+
+template<VoiceLayout Layout>
+static inline void LoadFrame(const MixVoice& voice, int i, float& l, float& r)
+{
+    if (Layout == VoiceLayout::Mono)
+    {
+        l = r = voice.left[i];
+    }
+    else if (Layout == VoiceLayout::StereoPlanar)
+    {
+        l = voice.left[i];
+        r = voice.right[i];
+    }
+    else
+    {
+        l = voice.left[2 * i];
+        r = voice.left[2 * i + 1];
+    }
+}
+
+// Scalar tail shared by the SIMD kernels, from frame 'start' onwards
+template<VoiceLayout Layout>
+static void MixTail(const MixVoice& voice, const ChannelRamps& ramps, int start, float* outL, float* outR, int frames)
+{
+    for (int i = start; i < frames; ++i)
+    {
+        float l, r;
+        LoadFrame<Layout>(voice, i, l, r);
+        outL[i] += l * (ramps.left + ramps.leftStep * i);
+        outR[i] += r * (ramps.right + ramps.rightStep * i);
+    }
+}
+
+template<VoiceLayout Layout>
+static void MixOneScalar(const MixVoice& voice, float* outL, float* outR, int frames)
+{
+    MixTail<Layout>(voice, MakeRamps(voice, frames), 0, outL, outR, frames);
+}
+
+#if SYNTH_X86
+template<VoiceLayout Layout>
+SYNTH_TARGET_SSE2 static void MixOneSSE2(const MixVoice& voice, float* outL, float* outR, int frames)
+{
+    const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    ChannelRamps ramps = MakeRamps(voice, frames);
+
+    __m128 gl = _mm_add_ps(_mm_set1_ps(ramps.left), _mm_mul_ps(lanes, _mm_set1_ps(ramps.leftStep)));
+    __m128 gr = _mm_add_ps(_mm_set1_ps(ramps.right), _mm_mul_ps(lanes, _mm_set1_ps(ramps.rightStep)));
+    const __m128 dl = _mm_set1_ps(ramps.leftStep * 4.0f);
+    const __m128 dr = _mm_set1_ps(ramps.rightStep * 4.0f);
+
+    int i = 0;
+    for (; i + 4 <= frames; i += 4)
+    {
+        __m128 l, r;
+        if (Layout == VoiceLayout::Mono)
+        {
+            l = r = _mm_loadu_ps(voice.left + i);
+        }
+        else if (Layout == VoiceLayout::StereoPlanar)
+        {
+            l = _mm_loadu_ps(voice.left + i);
+            r = _mm_loadu_ps(voice.right + i);
+        }
+        else
+        {
+            __m128 a = _mm_loadu_ps(voice.left + 2 * i);
+            __m128 b = _mm_loadu_ps(voice.left + 2 * i + 4);
+            l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        }
+        _mm_storeu_ps(outL + i, _mm_add_ps(_mm_loadu_ps(outL + i), _mm_mul_ps(l, gl)));
+        _mm_storeu_ps(outR + i, _mm_add_ps(_mm_loadu_ps(outR + i), _mm_mul_ps(r, gr)));
+        gl = _mm_add_ps(gl, dl);
+        gr = _mm_add_ps(gr, dr);
+    }
+    MixTail<Layout>(voice, ramps, i, outL, outR, frames);
+}
+
+template<VoiceLayout Layout>
+SYNTH_TARGET_AVX2 static void MixOneAVX2(const MixVoice& voice, float* outL, float* outR, int frames)
+{
+    const __m256 lanes = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    ChannelRamps ramps = MakeRamps(voice, frames);
+
+    __m256 gl = _mm256_add_ps(_mm256_set1_ps(ramps.left), _mm256_mul_ps(lanes, _mm256_set1_ps(ramps.leftStep)));
+    __m256 gr = _mm256_add_ps(_mm256_set1_ps(ramps.right), _mm256_mul_ps(lanes, _mm256_set1_ps(ramps.rightStep)));
+    const __m256 dl = _mm256_set1_ps(ramps.leftStep * 8.0f);
+    const __m256 dr = _mm256_set1_ps(ramps.rightStep * 8.0f);
+
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m256 l, r;
+        if (Layout == VoiceLayout::Mono)
+        {
+            l = r = _mm256_loadu_ps(voice.left + i);
+        }
+        else if (Layout == VoiceLayout::StereoPlanar)
+        {
+            l = _mm256_loadu_ps(voice.left + i);
+            r = _mm256_loadu_ps(voice.right + i);
+        }
+        else
+        {
+            // Shuffling within 128-bit lanes leaves frames in 0 1 4 5 2 3 6 7
+            // order, the 64-bit permute puts them back in sequence
+            __m256 a = _mm256_loadu_ps(voice.left + 2 * i);
+            __m256 b = _mm256_loadu_ps(voice.left + 2 * i + 8);
+            __m256 even = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            __m256 odd = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+            l = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(even), _MM_SHUFFLE(3, 1, 2, 0)));
+            r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(odd), _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+        _mm256_storeu_ps(outL + i, _mm256_add_ps(_mm256_loadu_ps(outL + i), _mm256_mul_ps(l, gl)));
+        _mm256_storeu_ps(outR + i, _mm256_add_ps(_mm256_loadu_ps(outR + i), _mm256_mul_ps(r, gr)));
+        gl = _mm256_add_ps(gl, dl);
+        gr = _mm256_add_ps(gr, dr);
+    }
+
+    // Avoid AVX-SSE transition stalls in the scalar code that follows
+    _mm256_zeroupper();
+    MixTail<Layout>(voice, ramps, i, outL, outR, frames);
+}
+#endif
+
+template<VoiceLayout Layout>
+static MixVoiceFn SelectMixVoiceFunction(SimdLevel level)
+{
+#if SYNTH_X86
+    if (level == SimdLevel::AVX2)
+        return &MixOneAVX2<Layout>;
+    if (level == SimdLevel::SSE2)
+        return &MixOneSSE2<Layout>;
+#endif
+    (void)level;
+    return &MixOneScalar<Layout>;
+}
+
+MixVoiceFn GetMixVoiceFunction(VoiceLayout layout, SimdLevel level)
+{
+    switch (layout)
+    {
+    case VoiceLayout::Mono: return SelectMixVoiceFunction<VoiceLayout::Mono>(level);
+    case VoiceLayout::StereoPlanar: return SelectMixVoiceFunction<VoiceLayout::StereoPlanar>(level);
+    default: return SelectMixVoiceFunction<VoiceLayout::StereoInterleaved>(level);
+    }
+}
+
+// Batch kernels pick the layout kernel once per voice
+template<SimdLevel Level>
+static void MixBatch(const MixVoice* voices, int count, float* outL, float* outR, int frames)
+{
+    static const MixVoiceFn kernels[3] = {
+        GetMixVoiceFunction(VoiceLayout::Mono, Level),
+        GetMixVoiceFunction(VoiceLayout::StereoPlanar, Level),
+        GetMixVoiceFunction(VoiceLayout::StereoInterleaved, Level)
+    };
+    for (int v = 0; v < count; ++v)
+        kernels[(int)voices[v].layout](voices[v], outL, outR, frames);
+}
+
+MixFn GetMixFunction(SimdLevel level)
+{
+#if SYNTH_X86
+    if (level == SimdLevel::AVX2)
+        return &MixBatch<SimdLevel::AVX2>;
+    if (level == SimdLevel::SSE2)
+        return &MixBatch<SimdLevel::SSE2>;
+#endif
+    (void)level;
+    return &MixBatch<SimdLevel::Scalar>;
+}
+
+void MixVoices(const MixVoice* voices, int count, float* outL, float* outR, int frames)
+{
+    static const MixFn mix = GetMixFunction(GetSimdLevel());
+    if (frames > 0)
+        mix(voices, count, outL, outR, frames);
+}
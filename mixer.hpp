@@ -0,0 +1,38 @@
+#pragma once
+
+#include "cpu_features.hpp"
+
+// Sums voice buffers into the planar stereo master buffer, applying each
+// voice's gain and pan as linear ramps across the block in the same pass.
+
+enum class VoiceLayout
+{
+    Mono,               // left only
+    StereoPlanar,       // left and right
+    StereoInterleaved   // left holds L R L R ...
+};
+
+struct MixVoice
+{
+    const float* left;
+    const float* right;
+    VoiceLayout layout;
+    float gainStart;    // Linear gain at the first frame of the block
+    float gainEnd;      // ... and at the frame after the last one
+    float panStart;     // -1 (left) .. 1 (right), equal power
+    float panEnd;
+};
+
+typedef void (*MixFn)(const MixVoice* voices, int count, float* outL, float* outR, int frames);
+typedef void (*MixVoiceFn)(const MixVoice& voice, float* outL, float* outR, int frames);
+
+// Adds the voices to outL/outR using the fastest kernel for this CPU
+void MixVoices(const MixVoice* voices, int count, float* outL, float* outR, int frames);
+MixFn GetMixFunction(SimdLevel level);
+
+// Kernel for a single voice of a known layout, for callers that pick it once
+// per note instead of once per block
+MixVoiceFn GetMixVoiceFunction(VoiceLayout layout, SimdLevel level);
+
+// Equal-power pan law shared by everything that positions a voice
+void PanGains(float gain, float pan, float& left, float& right);
@@ -0,0 +1,214 @@
+#include "oscillator.hpp"
+#include "mixer.hpp"
+#include <cmath>
+
+// Raw waveforms are full scale; keep a chord of them near the level of the
+// piano samples
+static const float OSCILLATOR_LEVEL = 0.25f;
+
+// Slots kept free for stolen voices to fade out in
+static const int STEAL_RESERVE = 16;
+
+void OscillatorEngine::Prepare(const WavetableSet* tables, int sampleRate)
+{
+    m_Tables = tables;
+    m_SampleRate = sampleRate;
+    m_ActiveCount = 0;
+    m_FilterSmoothing = SvfSmoothing(sampleRate);
+    for (int v = 0; v < MAX_OSCILLATOR_VOICES; ++v)
+    {
+        m_Voices[v] = OscillatorVoice();
+        m_Gain[v] = m_GainStep[v] = 0.0f;
+    }
+}
+
+int OscillatorEngine::FindVoice(int key) const
+{
+    for (int v = 0; v < MAX_OSCILLATOR_VOICES; ++v)
+    {
+        if (m_Voices[v].active && m_Voices[v].key == key)
+            return v;
+    }
+    return -1;
+}
+
+float OscillatorEngine::GetLoudness(int v) const
+{
+    return m_Voices[v].envelope.GetLevel() * m_Voices[v].velocity;
+}
+
+int OscillatorEngine::FindQuietest(bool playingOnly) const
+{
+    int quietest = -1;
+    for (int v = 0; v < MAX_OSCILLATOR_VOICES; ++v)
+    {
+        const OscillatorVoice& voice = m_Voices[v];
+        if (voice.active && !(playingOnly && voice.stolen) && (quietest < 0 || GetLoudness(v) < GetLoudness(quietest)))
+            quietest = v;
+    }
+    return quietest;
+}
+
+int OscillatorEngine::GetPlayingCount() const
+{
+    int playing = 0;
+    for (const auto& voice : m_Voices)
+        playing += (voice.active && !voice.stolen) ? 1 : 0;
+    return playing;
+}
+
+bool OscillatorEngine::StealQuietest()
+{
+    int v = FindQuietest(true);
+    if (v < 0)
+        return false;
+    m_Voices[v].stolen = true;
+    m_Voices[v].envelope.FastRelease(m_SampleRate);
+    return true;
+}
+
+// Lowest free slot keeps the used lanes packed at the front. Once no more
+// than STEAL_RESERVE are free, the quietest playing voice fades out to make
+// room; a voice is only cut when a burst of notes has used every slot.
+int OscillatorEngine::AllocateVoice()
+{
+    int idle = -1, idleCount = 0;
+    for (int v = 0; v < MAX_OSCILLATOR_VOICES; ++v)
+    {
+        if (!m_Voices[v].active)
+        {
+            idle = idle < 0 ? v : idle;
+            ++idleCount;
+        }
+    }
+    if (idleCount <= STEAL_RESERVE)
+        StealQuietest();
+    return idle >= 0 ? idle : FindQuietest(false);
+}
+
+void OscillatorEngine::StartNote(int key, float pitch, float velocity, int table, const AdsrSettings& envelope)
+{
+    if (!m_Tables || table < 0 || table >= m_Tables->GetCount())
+        return;
+
+    double frequency = 440.0 * std::pow(2.0, (pitch - 69.0) / 12.0);
+    double increment = frequency / m_SampleRate;
+    if (increment <= 0.0 || increment >= 0.5)
+        return;
+
+    // A retriggered key keeps its phase so the waveform does not jump
+    int v = FindVoice(key);
+    if (v < 0)
+    {
+        v = AllocateVoice();
+        m_Voices[v].envelope.Reset();
+        m_Voices[v].filterReset = true;
+        m_Phase[v] = 0;
+    }
+
+    OscillatorVoice& voice = m_Voices[v];
+    voice.active = true;
+    voice.held = true;
+    voice.sustained = false;
+    voice.stolen = false;
+    voice.key = key;
+    voice.pitch = pitch;
+    voice.velocity = velocity;
+    voice.pan = std::fmax(-0.3f, std::fmin(0.3f, (pitch - 60.0f) / 80.0f));
+    voice.envelope.Start(envelope, m_SampleRate);
+
+    m_Increment[v] = (uint32_t)(increment * 4294967296.0);
+    m_Offset[v] = m_Tables->GetOffset(table, increment);
+    PanGains(1.0f, voice.pan, m_PanLeft[v], m_PanRight[v]);
+}
+
+void OscillatorEngine::ReleaseNote(int key, bool sustainPedal)
+{
+    int v = FindVoice(key);
+    if (v < 0)
+        return;
+    m_Voices[v].held = false;
+    if (sustainPedal)
+        m_Voices[v].sustained = true;
+    else
+        m_Voices[v].envelope.Release();
+}
+
+void OscillatorEngine::ReleaseSustained()
+{
+    for (auto& voice : m_Voices)
+    {
+        if (voice.active && voice.sustained && !voice.held)
+        {
+            voice.sustained = false;
+            voice.envelope.Release();
+        }
+    }
+}
+
+void OscillatorEngine::ReleaseAll()
+{
+    for (auto& voice : m_Voices)
+    {
+        voice.held = voice.sustained = false;
+        voice.envelope.Release();
+    }
+}
+
+void OscillatorEngine::Render(float* outL, float* outR, int frames, const FilterSettings& filter)
+{
+    if (!m_Tables || frames <= 0)
+        return;
+
+    // Switching the filter on starts every voice from a clean state
+    bool filterChanged = filter.mode != m_FilterMode;
+    m_FilterMode = filter.mode;
+    float damping = SvfDampingCoefficient(filter.resonance);
+
+    // Envelopes run at block rate and become per-lane gain ramps and filter
+    // targets; the kernel smooths the coefficients towards them every sample
+    int lanes = 0;
+    for (int v = 0; v < MAX_OSCILLATOR_VOICES; ++v)
+    {
+        OscillatorVoice& voice = m_Voices[v];
+        if (!voice.active)
+            continue;
+        float start = voice.envelope.GetLevel();
+        float end = voice.envelope.Advance(frames);
+        float scale = voice.velocity * OSCILLATOR_LEVEL;
+        m_Gain[v] = start * scale;
+        m_GainStep[v] = (end - start) * scale / frames;
+        lanes = v + 1;
+
+        if (filter.mode != FilterMode::Off)
+        {
+            float octaves = filter.keyTracking * (voice.pitch - 60.0f) / 12.0f + filter.envelopeAmount * end;
+            m_FilterGTarget[v] = SvfCutoffCoefficient(filter.cutoff * std::exp2(octaves), m_SampleRate);
+            m_FilterKTarget[v] = damping;
+            if (voice.filterReset || filterChanged)
+            {
+                m_FilterIc1[v] = m_FilterIc2[v] = 0.0f;
+                m_FilterG[v] = m_FilterGTarget[v];
+                m_FilterK[v] = m_FilterKTarget[v];
+                voice.filterReset = false;
+            }
+        }
+    }
+
+    OscillatorLanes args = { m_Phase, m_Increment, m_Offset, m_Gain, m_GainStep, m_PanLeft, m_PanRight,
+                             (lanes + 7) & ~7, m_Tables->GetData(), filter.mode,
+                             { m_FilterIc1, m_FilterIc2, m_FilterG, m_FilterK, m_FilterGTarget, m_FilterKTarget, m_FilterSmoothing } };
+    RenderOscillators(args, outL, outR, frames);
+
+    // Reclaim voices whose release became inaudible; silent lanes are skipped
+    m_ActiveCount = 0;
+    for (int v = 0; v < lanes; ++v)
+    {
+        OscillatorVoice& voice = m_Voices[v];
+        if (voice.active && voice.envelope.IsIdle())
+            voice.active = false;
+        if (!voice.active)
+            m_Gain[v] = m_GainStep[v] = 0.0f;
+        m_ActiveCount += voice.active ? 1 : 0;
+    }
+}
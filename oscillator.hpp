@@ -0,0 +1,73 @@
+#pragma once
+
+#include "envelope.hpp"
+#include "wavetable.hpp"
+
+const int MAX_OSCILLATOR_VOICES = 256;
+
+// Note bookkeeping of an oscillator voice; the per-sample state lives in
+// the engine's lane arrays at the same index
+struct OscillatorVoice
+{
+    bool active = false;
+    bool held = false;
+    bool sustained = false;
+    bool stolen = false;        // Fading out to make room for other voices
+    bool filterReset = false;   // Snap the filter to its target on the next block
+    int key = 0;
+    float pitch = 60.0f;
+    float velocity = 1.0f;
+    float pan = 0.0f;
+    AdsrEnvelope envelope;
+};
+
+// Wavetable synthesiser voices, each with its own filter, rendered by SIMD
+// kernels that run one voice per lane. Needs no sample memory beyond the
+// shared tables. Audio thread only; SynthEngine forwards its events here.
+class OscillatorEngine
+{
+public:
+    void Prepare(const WavetableSet* tables, int sampleRate);
+
+    // pitch in MIDI note numbers, may be fractional
+    void StartNote(int key, float pitch, float velocity, int table, const AdsrSettings& envelope);
+    void ReleaseNote(int key, bool sustainPedal);
+    void ReleaseSustained();
+    void ReleaseAll();
+
+    // Adds the voices to outL/outR
+    void Render(float* outL, float* outR, int frames, const FilterSettings& filter);
+    int GetActiveCount() const { return m_ActiveCount; }
+    // For the governor's voice limit: voices playing, not counting those
+    // fading out after being stolen, and a fade-out of the quietest one;
+    // false if none is playing
+    int GetPlayingCount() const;
+    bool StealQuietest();
+
+private:
+    int FindVoice(int key) const;
+    int AllocateVoice();
+    int FindQuietest(bool playingOnly) const;
+    float GetLoudness(int v) const;
+
+    const WavetableSet* m_Tables = nullptr;
+    int m_SampleRate = 44100;
+    int m_ActiveCount = 0;
+    FilterMode m_FilterMode = FilterMode::Off;
+    float m_FilterSmoothing = 0.0f;
+    OscillatorVoice m_Voices[MAX_OSCILLATOR_VOICES];
+
+    alignas(32) uint32_t m_Phase[MAX_OSCILLATOR_VOICES] = {};
+    alignas(32) uint32_t m_Increment[MAX_OSCILLATOR_VOICES] = {};
+    alignas(32) int32_t m_Offset[MAX_OSCILLATOR_VOICES] = {};
+    alignas(32) float m_Gain[MAX_OSCILLATOR_VOICES] = {};
+    alignas(32) float m_GainStep[MAX_OSCILLATOR_VOICES] = {};
+    alignas(32) float m_PanLeft[MAX_OSCILLATOR_VOICES] = {};
+    alignas(32) float m_PanRight[MAX_OSCILLATOR_VOICES] = {};
+    alignas(32) float m_FilterIc1[MAX_OSCILLATOR_VOICES] = {};
+    alignas(32) float m_FilterIc2[MAX_OSCILLATOR_VOICES] = {};
+    alignas(32) float m_FilterG[MAX_OSCILLATOR_VOICES] = {};
+    alignas(32) float m_FilterK[MAX_OSCILLATOR_VOICES] = {};
+    alignas(32) float m_FilterGTarget[MAX_OSCILLATOR_VOICES] = {};
+    alignas(32) float m_FilterKTarget[MAX_OSCILLATOR_VOICES] = {};
+};
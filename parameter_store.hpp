@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+// Latest settings from one writer thread to one reader thread, whole. Three
+// copies: the writer fills its own and swaps it with the shared one, the
+// reader swaps the shared one for its own when it holds something newer.
+// Neither side waits or allocates, the reader never sees half a write, and
+// the newest write is never dropped, however many came before it.
+template<typename T>
+class SnapshotBuffer
+{
+public:
+    explicit SnapshotBuffer(const T& initial = T())
+    {
+        for (T& slot : m_Slots)
+            slot = initial;
+    }
+
+    // Writer
+    void Write(const T& value)
+    {
+        m_Slots[m_Back] = value;
+        m_Back = m_Shared.exchange(m_Back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    // Reader: takes the newest write, if there is one since the last call.
+    // Read() stays the same between calls.
+    bool Update()
+    {
+        if (!(m_Shared.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        m_Front = m_Shared.exchange(m_Front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const T& Read() const { return m_Slots[m_Front]; }
+
+private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;         // The shared copy is newer than the reader's
+
+    T m_Slots[3];
+    int m_Back = 0;                     // Writer's
+    alignas(64) std::atomic<int> m_Shared{ 1 };
+    alignas(64) int m_Front = 2;        // Reader's
+};
+
+// Per-sample glides towards a target set once a block, so a setting that
+// jumps does not click or step. Audio thread.
+
+// Reaches the target in a fixed time along a straight line, then holds it
+// exactly. For mix levels, where a glide should take as long whatever the
+// distance.
+class LinearSmoother
+{
+public:
+    void Prepare(float seconds, int sampleRate) { m_Length = std::max(1, (int)(seconds * sampleRate)); }
+    void Reset(float value)
+    {
+        m_Value = m_Target = value;
+        m_Remaining = 0;
+    }
+    void SetTarget(float target)
+    {
+        if (target == m_Target)
+            return;
+        m_Target = target;
+        m_Remaining = m_Length;
+        m_Step = (target - m_Value) / m_Length;
+    }
+
+    float Next()
+    {
+        if (m_Remaining == 0)
+            return m_Value;
+        m_Value = --m_Remaining == 0 ? m_Target : m_Value + m_Step;
+        return m_Value;
+    }
+    // As many Next() calls at once, for settings applied once per chunk
+    float Advance(int frames)
+    {
+        if (frames >= m_Remaining)
+        {
+            m_Value = m_Target;
+            m_Remaining = 0;
+        }
+        else
+        {
+            m_Value += m_Step * frames;
+            m_Remaining -= frames;
+        }
+        return m_Value;
+    }
+    bool IsSmoothing() const { return m_Remaining > 0; }
+    float GetValue() const { return m_Value; }
+    float GetTarget() const { return m_Target; }
+
+private:
+    float m_Value = 0.0f;
+    float m_Target = 0.0f;
+    float m_Step = 0.0f;
+    int m_Length = 1;
+    int m_Remaining = 0;
+};
+
+// One-pole glide: fast at first, then easing in, which sounds even for
+// gains. Snaps to the target once within SNAP of it, so it settles to the
+// exact value and the steady state costs nothing.
+class ExponentialSmoother
+{
+public:
+    void Prepare(float seconds, int sampleRate) { m_Coef = 1.0f - std::exp(-1.0f / (std::max(seconds, 1e-4f) * sampleRate)); }
+    void Reset(float value) { m_Value = m_Target = value; }
+    void SetTarget(float target) { m_Target = target; }
+
+    float Next()
+    {
+        if (m_Value == m_Target)
+            return m_Value;
+        m_Value += (m_Target - m_Value) * m_Coef;
+        if (std::fabs(m_Target - m_Value) < SNAP)
+            m_Value = m_Target;
+        return m_Value;
+    }
+    bool IsSmoothing() const { return m_Value != m_Target; }
+    float GetValue() const { return m_Value; }
+    float GetTarget() const { return m_Target; }
+
+private:
+    static constexpr float SNAP = 1e-5f;    // -100 dB of full scale
+
+    float m_Value = 0.0f;
+    float m_Target = 0.0f;
+    float m_Coef = 1.0f;
+};
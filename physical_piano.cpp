@@ -0,0 +1,673 @@
+#include "physical_piano.hpp"
+#include "mixer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstring>
+
+static const double PI = 3.14159265358979323846;
+static const uint32_t DELAY_MASK = STRING_DELAY_SIZE - 1;
+
+// Hammer pulses peak at the velocity; keep a chord near the sample level
+static const float PHYSICAL_LEVEL = 0.35f;
+static const float SOUNDBOARD_LEVEL = 0.5f;
+
+// Voices are reclaimed once a block peaks below this
+static const float SILENCE = 1e-4f;
+
+// Decay time of a damped string and first key without a damper (F6)
+static const double DAMPED_T60 = 0.12;
+static const int FIRST_UNDAMPED_KEY = 89;
+
+// Slots kept free for stolen strings to fade out in, and the fade time;
+// the string keeps ringing under the fade, so it is not choked
+static const int STEAL_RESERVE = 8;
+static const float STEAL_FADE_SECONDS = 0.005f;
+
+const char* GetPhysicalQualityName(PhysicalQuality quality)
+{
+    switch (quality)
+    {
+    case PhysicalQuality::Draft: return "Draft";
+    case PhysicalQuality::Low: return "Low";
+    case PhysicalQuality::Medium: return "Medium";
+    case PhysicalQuality::High: return "High";
+    default: return "?";
+    }
+}
+
+int GetDispersionStages(PhysicalQuality quality)
+{
+    static const int stages[(int)PhysicalQuality::Count] = { 0, 2, 4, MAX_DISPERSION_STAGES };
+    return stages[(int)quality];
+}
+
+int GetSoundboardModes(PhysicalQuality quality)
+{
+    static const int modes[(int)PhysicalQuality::Count] = { 0, 8, 16, MAX_SOUNDBOARD_MODES };
+    return modes[(int)quality];
+}
+
+//---------------------------------------------------------------------------
+// String kernels
+
+template<int Stages>
+static void StringScalar(const StringLanes& lanes, float* outL, float* outR, float* board, int frames)
+{
+    for (int v = 0; v < lanes.count; ++v)
+    {
+        float g = lanes.loopGain[v];
+        if (g == 0.0f)
+            continue;
+
+        float* line = lanes.delay + v * STRING_DELAY_SIZE;
+        uint32_t length = (uint32_t)lanes.length[v];
+        float eta = lanes.tuning[v];
+        float ts = lanes.tuningState[v];
+        float c = lanes.dispersion[v];
+        float ds[Stages > 0 ? Stages : 1];
+        for (int s = 0; s < Stages; ++s)
+            ds[s] = lanes.dispersionState[s * MAX_PHYSICAL_VOICES + v];
+        float a = lanes.loss[v];
+        float lp = lanes.lossState[v];
+        float left = lanes.panLeft[v];
+        float right = lanes.panRight[v];
+        float send = 0.5f * (left + right);
+        float fade = lanes.fade[v];
+        float fadeStep = lanes.fadeStep[v];
+        float peak = lanes.peak[v];
+
+        for (int i = 0; i < frames; ++i)
+        {
+            uint32_t w = (lanes.writePos + i) & DELAY_MASK;
+            float x = line[(w - length) & DELAY_MASK];
+            float y = eta * x + ts;
+            ts = x - eta * y;
+            for (int s = 0; s < Stages; ++s)
+            {
+                float z = c * y + ds[s];
+                ds[s] = y - c * z;
+                y = z;
+            }
+            lp += a * (y - lp);
+            y = lp * g;
+            line[w] = y;
+            peak = std::fmax(peak, std::fabs(y));
+            y *= fade;
+            fade += fadeStep;
+            outL[i] += y * left;
+            outR[i] += y * right;
+            board[i] += y * send;
+        }
+
+        lanes.tuningState[v] = ts;
+        for (int s = 0; s < Stages; ++s)
+            lanes.dispersionState[s * MAX_PHYSICAL_VOICES + v] = ds[s];
+        lanes.lossState[v] = lp;
+        lanes.peak[v] = peak;
+    }
+}
+
+#if SYNTH_X86
+
+static bool LanesUnused(const StringLanes& lanes, int first, int width)
+{
+    for (int v = first; v < first + width; ++v)
+    {
+        if (lanes.loopGain[v] != 0.0f)
+            return false;
+    }
+    return true;
+}
+
+// Lanes hold one string each: reads are gathered from each lane's line,
+// writes all go to the same position of every line
+template<int Stages>
+SYNTH_TARGET_SSE2 static void StringSSE2(const StringLanes& lanes, float* outL, float* outR, float* board, int frames)
+{
+    alignas(16) float accL[STRING_CHUNK_FRAMES * 4] = {};
+    alignas(16) float accR[STRING_CHUNK_FRAMES * 4] = {};
+    alignas(16) float accB[STRING_CHUNK_FRAMES * 4] = {};
+    alignas(16) int32_t index[4];
+    alignas(16) float written[4];
+    const __m128i mask = _mm_set1_epi32((int)DELAY_MASK);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    for (int v = 0; v < lanes.count; v += 4)
+    {
+        if (LanesUnused(lanes, v, 4))
+            continue;
+
+        float* line = lanes.delay + v * STRING_DELAY_SIZE;
+        __m128i length = _mm_loadu_si128((const __m128i*)(lanes.length + v));
+        __m128i base = _mm_setr_epi32(0, STRING_DELAY_SIZE, 2 * STRING_DELAY_SIZE, 3 * STRING_DELAY_SIZE);
+        __m128 eta = _mm_loadu_ps(lanes.tuning + v);
+        __m128 ts = _mm_loadu_ps(lanes.tuningState + v);
+        __m128 c = _mm_loadu_ps(lanes.dispersion + v);
+        __m128 ds[Stages > 0 ? Stages : 1];
+        for (int s = 0; s < Stages; ++s)
+            ds[s] = _mm_loadu_ps(lanes.dispersionState + s * MAX_PHYSICAL_VOICES + v);
+        __m128 a = _mm_loadu_ps(lanes.loss + v);
+        __m128 lp = _mm_loadu_ps(lanes.lossState + v);
+        __m128 g = _mm_loadu_ps(lanes.loopGain + v);
+        __m128 left = _mm_loadu_ps(lanes.panLeft + v);
+        __m128 right = _mm_loadu_ps(lanes.panRight + v);
+        __m128 send = _mm_mul_ps(half, _mm_add_ps(left, right));
+        __m128 fade = _mm_loadu_ps(lanes.fade + v);
+        __m128 fadeStep = _mm_loadu_ps(lanes.fadeStep + v);
+        __m128 peak = _mm_loadu_ps(lanes.peak + v);
+
+        for (int i = 0; i < frames; ++i)
+        {
+            uint32_t w = (lanes.writePos + i) & DELAY_MASK;
+            __m128i read = _mm_and_si128(_mm_sub_epi32(_mm_set1_epi32((int)w), length), mask);
+            _mm_store_si128((__m128i*)index, _mm_add_epi32(read, base));
+            __m128 x = _mm_setr_ps(line[index[0]], line[index[1]], line[index[2]], line[index[3]]);
+            __m128 y = _mm_add_ps(_mm_mul_ps(eta, x), ts);
+            ts = _mm_sub_ps(x, _mm_mul_ps(eta, y));
+            for (int s = 0; s < Stages; ++s)
+            {
+                __m128 z = _mm_add_ps(_mm_mul_ps(c, y), ds[s]);
+                ds[s] = _mm_sub_ps(y, _mm_mul_ps(c, z));
+                y = z;
+            }
+            lp = _mm_add_ps(lp, _mm_mul_ps(a, _mm_sub_ps(y, lp)));
+            y = _mm_mul_ps(lp, g);
+            _mm_store_ps(written, y);
+            for (int l = 0; l < 4; ++l)
+                line[l * STRING_DELAY_SIZE + w] = written[l];
+            peak = _mm_max_ps(peak, _mm_andnot_ps(sign, y));
+            y = _mm_mul_ps(y, fade);
+            fade = _mm_add_ps(fade, fadeStep);
+            _mm_store_ps(accL + 4 * i, _mm_add_ps(_mm_load_ps(accL + 4 * i), _mm_mul_ps(y, left)));
+            _mm_store_ps(accR + 4 * i, _mm_add_ps(_mm_load_ps(accR + 4 * i), _mm_mul_ps(y, right)));
+            _mm_store_ps(accB + 4 * i, _mm_add_ps(_mm_load_ps(accB + 4 * i), _mm_mul_ps(y, send)));
+        }
+
+        _mm_storeu_ps(lanes.tuningState + v, ts);
+        for (int s = 0; s < Stages; ++s)
+            _mm_storeu_ps(lanes.dispersionState + s * MAX_PHYSICAL_VOICES + v, ds[s]);
+        _mm_storeu_ps(lanes.lossState + v, lp);
+        _mm_storeu_ps(lanes.peak + v, peak);
+    }
+
+    FoldLanes(accL, outL, frames);
+    FoldLanes(accR, outR, frames);
+    FoldLanes(accB, board, frames);
+}
+
+template<int Stages>
+SYNTH_TARGET_AVX2 static void StringAVX2(const StringLanes& lanes, float* outL, float* outR, float* board, int frames)
+{
+    alignas(32) float accL[STRING_CHUNK_FRAMES * 8] = {};
+    alignas(32) float accR[STRING_CHUNK_FRAMES * 8] = {};
+    alignas(32) float accB[STRING_CHUNK_FRAMES * 8] = {};
+    alignas(16) float fold[STRING_CHUNK_FRAMES * 4];
+    alignas(32) float written[8];
+    const __m256i mask = _mm256_set1_epi32((int)DELAY_MASK);
+    const __m256i base = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(STRING_DELAY_SIZE));
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+
+    for (int v = 0; v < lanes.count; v += 8)
+    {
+        if (LanesUnused(lanes, v, 8))
+            continue;
+
+        float* line = lanes.delay + v * STRING_DELAY_SIZE;
+        __m256i length = _mm256_loadu_si256((const __m256i*)(lanes.length + v));
+        __m256 eta = _mm256_loadu_ps(lanes.tuning + v);
+        __m256 ts = _mm256_loadu_ps(lanes.tuningState + v);
+        __m256 c = _mm256_loadu_ps(lanes.dispersion + v);
+        __m256 ds[Stages > 0 ? Stages : 1];
+        for (int s = 0; s < Stages; ++s)
+            ds[s] = _mm256_loadu_ps(lanes.dispersionState + s * MAX_PHYSICAL_VOICES + v);
+        __m256 a = _mm256_loadu_ps(lanes.loss + v);
+        __m256 lp = _mm256_loadu_ps(lanes.lossState + v);
+        __m256 g = _mm256_loadu_ps(lanes.loopGain + v);
+        __m256 left = _mm256_loadu_ps(lanes.panLeft + v);
+        __m256 right = _mm256_loadu_ps(lanes.panRight + v);
+        __m256 send = _mm256_mul_ps(half, _mm256_add_ps(left, right));
+        __m256 fade = _mm256_loadu_ps(lanes.fade + v);
+        __m256 fadeStep = _mm256_loadu_ps(lanes.fadeStep + v);
+        __m256 peak = _mm256_loadu_ps(lanes.peak + v);
+
+        for (int i = 0; i < frames; ++i)
+        {
+            uint32_t w = (lanes.writePos + i) & DELAY_MASK;
+            __m256i read = _mm256_and_si256(_mm256_sub_epi32(_mm256_set1_epi32((int)w), length), mask);
+            __m256 x = _mm256_i32gather_ps(line, _mm256_add_epi32(read, base), 4);
+            __m256 y = _mm256_add_ps(_mm256_mul_ps(eta, x), ts);
+            ts = _mm256_sub_ps(x, _mm256_mul_ps(eta, y));
+            for (int s = 0; s < Stages; ++s)
+            {
+                __m256 z = _mm256_add_ps(_mm256_mul_ps(c, y), ds[s]);
+                ds[s] = _mm256_sub_ps(y, _mm256_mul_ps(c, z));
+                y = z;
+            }
+            lp = _mm256_add_ps(lp, _mm256_mul_ps(a, _mm256_sub_ps(y, lp)));
+            y = _mm256_mul_ps(lp, g);
+            _mm256_store_ps(written, y);
+            for (int l = 0; l < 8; ++l)
+                line[l * STRING_DELAY_SIZE + w] = written[l];
+            peak = _mm256_max_ps(peak, _mm256_andnot_ps(sign, y));
+            y = _mm256_mul_ps(y, fade);
+            fade = _mm256_add_ps(fade, fadeStep);
+            _mm256_store_ps(accL + 8 * i, _mm256_add_ps(_mm256_load_ps(accL + 8 * i), _mm256_mul_ps(y, left)));
+            _mm256_store_ps(accR + 8 * i, _mm256_add_ps(_mm256_load_ps(accR + 8 * i), _mm256_mul_ps(y, right)));
+            _mm256_store_ps(accB + 8 * i, _mm256_add_ps(_mm256_load_ps(accB + 8 * i), _mm256_mul_ps(y, send)));
+        }
+
+        _mm256_storeu_ps(lanes.tuningState + v, ts);
+        for (int s = 0; s < Stages; ++s)
+            _mm256_storeu_ps(lanes.dispersionState + s * MAX_PHYSICAL_VOICES + v, ds[s]);
+        _mm256_storeu_ps(lanes.lossState + v, lp);
+        _mm256_storeu_ps(lanes.peak + v, peak);
+    }
+
+    FoldLanes8(accL, fold, outL, frames);
+    FoldLanes8(accR, fold, outR, frames);
+    FoldLanes8(accB, fold, board, frames);
+}
+
+#endif
+
+template<int Stages>
+static StringFn SelectStringFunction(SimdLevel level)
+{
+#if SYNTH_X86
+    if (level == SimdLevel::AVX2)
+        return &StringAVX2<Stages>;
+    if (level == SimdLevel::SSE2)
+        return &StringSSE2<Stages>;
+#endif
+    (void)level;
+    return &StringScalar<Stages>;
+}
+
+StringFn GetStringFunction(SimdLevel level, PhysicalQuality quality)
+{
+    switch (quality)
+    {
+    case PhysicalQuality::Draft: return SelectStringFunction<0>(level);
+    case PhysicalQuality::Low: return SelectStringFunction<2>(level);
+    case PhysicalQuality::Medium: return SelectStringFunction<4>(level);
+    default: return SelectStringFunction<MAX_DISPERSION_STAGES>(level);
+    }
+}
+
+//---------------------------------------------------------------------------
+// Engine
+
+// Phase delay in samples of a filter at w radians per sample
+static double PhaseDelay(std::complex<double> response, double w)
+{
+    return -std::arg(response) / w;
+}
+
+// First-order allpass (c + z^-1) / (1 + c z^-1)
+static std::complex<double> AllpassResponse(double c, double w)
+{
+    std::complex<double> z1 = std::polar(1.0, -w);
+    return (c + z1) / (1.0 + c * z1);
+}
+
+// One-pole lowpass a / (1 - (1 - a) z^-1)
+static std::complex<double> LossResponse(double a, double w)
+{
+    return a / (1.0 - (1.0 - a) * std::polar(1.0, -w));
+}
+
+void PhysicalPianoEngine::Prepare(int sampleRate)
+{
+    m_SampleRate = sampleRate;
+    m_ActiveCount = 0;
+    m_WritePos = 0;
+    m_Delay.assign((size_t)MAX_PHYSICAL_VOICES * STRING_DELAY_SIZE, 0.0f);
+    for (int v = 0; v < MAX_PHYSICAL_VOICES; ++v)
+    {
+        m_Voices[v] = PhysicalVoice();
+        m_LoopGain[v] = m_PanLeft[v] = m_PanRight[v] = m_Fade[v] = m_FadeStep[v] = 0.0f;
+    }
+    m_Render = GetStringFunction(GetSimdLevel(), m_Quality);
+    BuildSoundboard();
+}
+
+int PhysicalPianoEngine::FindVoice(int key) const
+{
+    for (int v = 0; v < MAX_PHYSICAL_VOICES; ++v)
+    {
+        if (m_Voices[v].active && m_Voices[v].key == key)
+            return v;
+    }
+    return -1;
+}
+
+// Loudness is the string's recent peak under its fade
+int PhysicalPianoEngine::FindQuietest(bool playingOnly) const
+{
+    int quietest = -1;
+    for (int v = 0; v < MAX_PHYSICAL_VOICES; ++v)
+    {
+        const PhysicalVoice& voice = m_Voices[v];
+        if (voice.active && !(playingOnly && voice.stolen)
+            && (quietest < 0 || m_Peak[v] * m_Fade[v] < m_Peak[quietest] * m_Fade[quietest]))
+            quietest = v;
+    }
+    return quietest;
+}
+
+int PhysicalPianoEngine::GetPlayingCount() const
+{
+    int playing = 0;
+    for (const auto& voice : m_Voices)
+        playing += (voice.active && !voice.stolen) ? 1 : 0;
+    return playing;
+}
+
+// The string fades out in Render()
+bool PhysicalPianoEngine::StealQuietest()
+{
+    int v = FindQuietest(true);
+    if (v < 0)
+        return false;
+    m_Voices[v].stolen = true;
+    return true;
+}
+
+// Lowest free slot keeps the used lanes packed at the front. Once no more
+// than STEAL_RESERVE are free, the quietest playing string fades out to
+// make room; a string is only cut when a burst of notes has used every slot.
+int PhysicalPianoEngine::AllocateVoice()
+{
+    int idle = -1, idleCount = 0;
+    for (int v = 0; v < MAX_PHYSICAL_VOICES; ++v)
+    {
+        if (!m_Voices[v].active)
+        {
+            idle = idle < 0 ? v : idle;
+            ++idleCount;
+        }
+    }
+    if (idleCount <= STEAL_RESERVE)
+        StealQuietest();
+    return idle >= 0 ? idle : FindQuietest(false);
+}
+
+// Splits the period at the voice pitch between the filters in the loop and
+// the delay line. Higher strings are stiffer and brighter and ring shorter.
+bool PhysicalPianoEngine::TuneString(int v)
+{
+    const PhysicalVoice& voice = m_Voices[v];
+    double frequency = 440.0 * std::pow(2.0, (voice.pitch - 69.0) / 12.0);
+    double period = m_SampleRate / frequency;
+    if (period < 4.0 || period > STRING_DELAY_SIZE - 4)
+        return false;
+
+    double w = 2.0 * PI / period;
+    double t = std::fmax(0.0, std::fmin(1.0, (voice.pitch - 21.0) / 87.0));
+    double a = 0.3 + 0.65 * t;
+    double remaining = period - PhaseDelay(LossResponse(a, w), w);
+
+    // Dispersion stretches the partials; its share of the period bounds the
+    // stretch of the short top strings, which relax towards plain delays
+    int stages = GetDispersionStages(m_Quality);
+    double c = -0.6 + 0.3 * t;
+    for (int i = 0; i < 40 && stages * PhaseDelay(AllpassResponse(c, w), w) > 0.06 * period; ++i)
+        c *= 0.8;
+    remaining -= stages * PhaseDelay(AllpassResponse(c, w), w);
+
+    // Fractional part in [0.5, 1.5) keeps the tuning allpass well inside
+    // its stable range; two corrections for its phase delay away from DC
+    int length = std::max(1, (int)std::floor(remaining - 0.5));
+    double fraction = remaining - length;
+    double target = fraction;
+    for (int i = 0; i < 2; ++i)
+    {
+        double eta = (1.0 - fraction) / (1.0 + fraction);
+        fraction += target - PhaseDelay(AllpassResponse(eta, w), w);
+    }
+
+    // Loop gain sets the decay of the fundamental, net of the loss filter
+    double t60 = 12.0 * std::pow(2.0, -(voice.pitch - 21.0) / 24.0);
+    double loss = std::abs(LossResponse(a, w));
+    m_Undamped[v] = (float)std::fmin(0.99995, std::exp(-6.9078 / (frequency * t60)) / loss);
+    m_Damped[v] = voice.key >= FIRST_UNDAMPED_KEY ? m_Undamped[v]
+                  : (float)std::fmin(0.99995, std::exp(-6.9078 / (frequency * DAMPED_T60)) / loss);
+
+    m_Length[v] = length;
+    m_Tuning[v] = (float)((1.0 - fraction) / (1.0 + fraction));
+    m_Dispersion[v] = (float)c;
+    m_Loss[v] = (float)a;
+    return true;
+}
+
+void PhysicalPianoEngine::SetDamper(int v, bool down)
+{
+    m_LoopGain[v] = down ? m_Damped[v] : m_Undamped[v];
+}
+
+// Writes the hammer pulse into the part of the line read over the next
+// period. A raised cosine narrowing with velocity, with the comb of the
+// strike position and a little felt noise.
+void PhysicalPianoEngine::Strike(int v, bool retrigger)
+{
+    float* line = &m_Delay[(size_t)v * STRING_DELAY_SIZE];
+    const PhysicalVoice& voice = m_Voices[v];
+    int length = m_Length[v];
+    if (!retrigger)
+        std::memset(line, 0, STRING_DELAY_SIZE * sizeof(float));
+
+    int width = std::max(2, std::min(length / 2, (int)(m_SampleRate * (0.0025f - 0.0017f * voice.velocity))));
+    int strike = std::max(1, (int)(0.12f * length + 0.5f));
+    float sum = 0.0f;
+    for (int n = 0; n < length; ++n)
+    {
+        float pulse = 0.0f;
+        if (n < width)
+            pulse += 0.5f - 0.5f * std::cos(2.0f * (float)PI * n / width);
+        if (n >= strike && n - strike < width)
+            pulse -= 0.5f - 0.5f * std::cos(2.0f * (float)PI * (n - strike) / width);
+        m_Noise = m_Noise * 1664525u + 1013904223u;
+        float noise = ((int32_t)m_Noise * (1.0f / 2147483648.0f)) * 0.05f * std::fabs(pulse);
+        float excitation = voice.velocity * (pulse + noise);
+        line[(m_WritePos - length + n) & DELAY_MASK] += excitation;
+        sum += excitation;
+    }
+    float dc = sum / length;
+    for (int n = 0; n < length; ++n)
+        line[(m_WritePos - length + n) & DELAY_MASK] -= dc;
+}
+
+void PhysicalPianoEngine::StartNote(int key, float pitch, float velocity)
+{
+    // A retriggered string is struck again while it rings
+    int v = FindVoice(key);
+    bool retrigger = v >= 0;
+    if (!retrigger)
+        v = AllocateVoice();
+
+    PhysicalVoice& voice = m_Voices[v];
+    PhysicalVoice previous = voice;
+    voice.key = key;
+    voice.pitch = pitch;
+    voice.velocity = velocity;
+    if (!TuneString(v))
+    {
+        voice = previous;
+        return;
+    }
+
+    if (!retrigger)
+    {
+        m_TuningState[v] = m_LossState[v] = m_Peak[v] = 0.0f;
+        m_Fade[v] = 1.0f;
+        m_PeakFrames[v] = 0;
+        for (int s = 0; s < MAX_DISPERSION_STAGES; ++s)
+            m_DispersionState[s * MAX_PHYSICAL_VOICES + v] = 0.0f;
+    }
+    voice.active = true;
+    voice.held = true;
+    voice.sustained = false;
+    voice.stolen = false;
+    float pan = std::fmax(-0.3f, std::fmin(0.3f, (pitch - 60.0f) / 80.0f));
+    PanGains(PHYSICAL_LEVEL, pan, m_PanLeft[v], m_PanRight[v]);
+    SetDamper(v, false);
+    Strike(v, retrigger);
+}
+
+void PhysicalPianoEngine::ReleaseNote(int key, bool sustainPedal)
+{
+    int v = FindVoice(key);
+    if (v < 0)
+        return;
+    m_Voices[v].held = false;
+    if (sustainPedal)
+        m_Voices[v].sustained = true;
+    else
+        SetDamper(v, true);
+}
+
+void PhysicalPianoEngine::ReleaseSustained()
+{
+    for (int v = 0; v < MAX_PHYSICAL_VOICES; ++v)
+    {
+        PhysicalVoice& voice = m_Voices[v];
+        if (voice.active && voice.sustained && !voice.held)
+        {
+            voice.sustained = false;
+            SetDamper(v, true);
+        }
+    }
+}
+
+void PhysicalPianoEngine::ReleaseAll()
+{
+    for (int v = 0; v < MAX_PHYSICAL_VOICES; ++v)
+    {
+        PhysicalVoice& voice = m_Voices[v];
+        voice.held = voice.sustained = false;
+        if (voice.active)
+            SetDamper(v, true);
+    }
+}
+
+// Modes spread log-uniformly from 95 Hz to 3.5 kHz with a slight jitter;
+// low modes ring longest. Signs alternate so the bank sums to a flat-ish
+// response rather than one big peak.
+void PhysicalPianoEngine::BuildSoundboard()
+{
+    m_ModeCount = GetSoundboardModes(m_Quality);
+    for (int m = 0; m < m_ModeCount; ++m)
+    {
+        double position = m_ModeCount > 1 ? (double)m / (m_ModeCount - 1) : 0.0;
+        double frequency = 95.0 * std::pow(3500.0 / 95.0, position) * (1.0 + 0.03 * std::sin(m * 2.7));
+        double t60 = 0.35 - 0.27 * position;
+        double r = std::exp(-6.9078 / (t60 * m_SampleRate));
+        double theta = 2.0 * PI * frequency / m_SampleRate;
+        m_ModeA1[m] = (float)(2.0 * r * std::cos(theta));
+        m_ModeA2[m] = (float)(-r * r);
+        // Unity gain at resonance before the level
+        m_ModeGain[m] = (float)((m & 1 ? -1.0 : 1.0) * 2.0 * (1.0 - r) * std::sin(theta) * SOUNDBOARD_LEVEL);
+        m_ModeY1[m] = m_ModeY2[m] = 0.0f;
+    }
+}
+
+// Moves fade by at most step towards target, landing on it exactly
+static float FadeTowards(float fade, float target, float step)
+{
+    return fade < target ? std::min(target, fade + step) : std::max(target, fade - step);
+}
+
+void PhysicalPianoEngine::Render(float* outL, float* outR, int frames, PhysicalQuality quality)
+{
+    if (m_Delay.empty() || frames <= 0)
+        return;
+
+    // A quality change moves the loop delay between the filters and the
+    // line, so ringing strings are retuned to stay in pitch
+    if (quality != m_Quality)
+    {
+        m_Quality = quality;
+        m_Render = GetStringFunction(GetSimdLevel(), quality);
+        BuildSoundboard();
+        for (int v = 0; v < MAX_PHYSICAL_VOICES; ++v)
+        {
+            if (m_Voices[v].active && TuneString(v))
+                SetDamper(v, !m_Voices[v].held && !m_Voices[v].sustained);
+        }
+    }
+
+    int lanes = 0;
+    for (int v = 0; v < MAX_PHYSICAL_VOICES; ++v)
+    {
+        if (m_Voices[v].active)
+            lanes = v + 1;
+    }
+    if (lanes == 0)
+        return;
+
+    StringLanes args = { m_Delay.data(), 0, m_Length, m_Tuning, m_TuningState, m_Dispersion, m_DispersionState,
+                         m_Loss, m_LossState, m_LoopGain, m_PanLeft, m_PanRight, m_Fade, m_FadeStep, m_Peak, (lanes + 7) & ~7 };
+    float fadeFrames = std::max(1.0f, STEAL_FADE_SECONDS * m_SampleRate);
+    for (int start = 0; start < frames; start += STRING_CHUNK_FRAMES)
+    {
+        int chunk = std::min(STRING_CHUNK_FRAMES, frames - start);
+        float board[STRING_CHUNK_FRAMES] = {};
+        float fadeEnd[MAX_PHYSICAL_VOICES];
+        for (int v = 0; v < lanes; ++v)
+        {
+            fadeEnd[v] = FadeTowards(m_Fade[v], m_Voices[v].stolen ? 0.0f : 1.0f, chunk / fadeFrames);
+            m_FadeStep[v] = (fadeEnd[v] - m_Fade[v]) / chunk;
+        }
+        args.writePos = m_WritePos;
+        m_Render(args, outL + start, outR + start, board, chunk);
+        m_WritePos += chunk;
+        for (int v = 0; v < lanes; ++v)
+            m_Fade[v] = fadeEnd[v];
+
+        // Each mode only depends on its own past, so the inner loop runs
+        // across modes
+        for (int i = 0; i < chunk && m_ModeCount > 0; ++i)
+        {
+            float x = board[i];
+            float sum = 0.0f;
+            for (int m = 0; m < m_ModeCount; ++m)
+            {
+                float y = m_ModeA1[m] * m_ModeY1[m] + m_ModeA2[m] * m_ModeY2[m] + m_ModeGain[m] * x;
+                m_ModeY2[m] = m_ModeY1[m];
+                m_ModeY1[m] = y;
+                sum += y;
+            }
+            outL[start + i] += sum;
+            outR[start + i] += sum;
+        }
+    }
+
+    // Reclaim strings that have decayed to silence. The peak has to cover a
+    // whole period, since a bass string can be silent for a block between
+    // passes of the pulse.
+    m_ActiveCount = 0;
+    for (int v = 0; v < lanes; ++v)
+    {
+        PhysicalVoice& voice = m_Voices[v];
+        m_PeakFrames[v] += frames;
+        if (voice.active && voice.stolen && m_Fade[v] == 0.0f)
+        {
+            voice.active = false;
+            m_LoopGain[v] = m_PanLeft[v] = m_PanRight[v] = 0.0f;
+        }
+        if (voice.active && m_PeakFrames[v] >= m_Length[v])
+        {
+            if (m_Peak[v] < SILENCE)
+            {
+                voice.active = false;
+                m_LoopGain[v] = m_PanLeft[v] = m_PanRight[v] = 0.0f;
+            }
+            m_Peak[v] = 0.0f;
+            m_PeakFrames[v] = 0;
+        }
+        m_ActiveCount += voice.active ? 1 : 0;
+    }
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "cpu_features.hpp"
+#include <stdint.h>
+#include <vector>
+
+const int MAX_PHYSICAL_VOICES = 64;
+const int STRING_DELAY_BITS = 12;
+const int STRING_DELAY_SIZE = 1 << STRING_DELAY_BITS;  // Frames per voice, a power of two
+const int MAX_DISPERSION_STAGES = 8;
+const int MAX_SOUNDBOARD_MODES = 32;
+const int STRING_CHUNK_FRAMES = 64;
+
+// Cost/realism trade-off of the string model: allpass stages giving the
+// stiff-string inharmonicity and resonant modes of the soundboard
+enum class PhysicalQuality
+{
+    Draft,      // Plain Karplus-Strong loop, no soundboard
+    Low,
+    Medium,
+    High,
+    Count
+};
+
+const char* GetPhysicalQualityName(PhysicalQuality quality);
+int GetDispersionStages(PhysicalQuality quality);
+int GetSoundboardModes(PhysicalQuality quality);
+
+// Digital waveguide strings, one per lane. Each loop is a delay line, a
+// first-order allpass for the fractional part of the period, a cascade of
+// dispersion allpasses and a one-pole loss filter with the loop gain.
+struct StringLanes
+{
+    float* delay;               // STRING_DELAY_SIZE frames per lane
+    uint32_t writePos;          // Shared by all lanes, advanced by the caller
+    const int32_t* length;      // Integer part of the loop delay
+    const float* tuning;        // Fractional delay allpass coefficient
+    float* tuningState;
+    const float* dispersion;    // Coefficient shared by the stages of a lane
+    float* dispersionState;     // [stage * MAX_PHYSICAL_VOICES + lane]
+    const float* loss;          // One-pole lowpass coefficient
+    float* lossState;
+    const float* loopGain;      // 0 = lane unused
+    const float* panLeft;
+    const float* panRight;
+    const float* fade;          // Output gain at the first frame, leaves the loop alone
+    const float* fadeStep;      // Added to it every frame
+    float* peak;                // Largest output magnitude, updated by the kernel
+    int count;
+};
+
+// Adds the strings to outL/outR and their mono sum to board, at most
+// STRING_CHUNK_FRAMES per call
+typedef void (*StringFn)(const StringLanes& lanes, float* outL, float* outR, float* board, int frames);
+
+StringFn GetStringFunction(SimdLevel level, PhysicalQuality quality);
+
+struct PhysicalVoice
+{
+    bool active = false;
+    bool held = false;
+    bool sustained = false;
+    bool stolen = false;        // Fading out to make room for other voices
+    int key = 0;
+    float pitch = 60.0f;
+    float velocity = 1.0f;
+};
+
+// Modelled piano: no sample memory, a few kB of state per voice. Audio
+// thread only; SynthEngine forwards its events here.
+class PhysicalPianoEngine
+{
+public:
+    // Allocates the delay lines; call before rendering starts
+    void Prepare(int sampleRate);
+
+    // pitch in MIDI note numbers, may be fractional
+    void StartNote(int key, float pitch, float velocity);
+    void ReleaseNote(int key, bool sustainPedal);
+    void ReleaseSustained();
+    void ReleaseAll();
+
+    // Adds the voices to outL/outR
+    void Render(float* outL, float* outR, int frames, PhysicalQuality quality);
+    int GetActiveCount() const { return m_ActiveCount; }
+    // For the governor's voice limit: voices playing, not counting those
+    // fading out after being stolen, and a fade-out of the quietest one;
+    // false if none is playing
+    int GetPlayingCount() const;
+    bool StealQuietest();
+
+private:
+    int FindVoice(int key) const;
+    int AllocateVoice();
+    int FindQuietest(bool playingOnly) const;
+    bool TuneString(int v);
+    void SetDamper(int v, bool down);
+    void Strike(int v, bool retrigger);
+    void BuildSoundboard();
+
+    int m_SampleRate = 44100;
+    int m_ActiveCount = 0;
+    uint32_t m_WritePos = 0;
+    uint32_t m_Noise = 1;
+    PhysicalQuality m_Quality = PhysicalQuality::Medium;
+    StringFn m_Render = nullptr;
+    PhysicalVoice m_Voices[MAX_PHYSICAL_VOICES];
+    std::vector<float> m_Delay;
+
+    alignas(32) int32_t m_Length[MAX_PHYSICAL_VOICES] = {};
+    alignas(32) float m_Tuning[MAX_PHYSICAL_VOICES] = {};
+    alignas(32) float m_TuningState[MAX_PHYSICAL_VOICES] = {};
+    alignas(32) float m_Dispersion[MAX_PHYSICAL_VOICES] = {};
+    alignas(32) float m_DispersionState[MAX_DISPERSION_STAGES * MAX_PHYSICAL_VOICES] = {};
+    alignas(32) float m_Loss[MAX_PHYSICAL_VOICES] = {};
+    alignas(32) float m_LossState[MAX_PHYSICAL_VOICES] = {};
+    alignas(32) float m_LoopGain[MAX_PHYSICAL_VOICES] = {};
+    alignas(32) float m_PanLeft[MAX_PHYSICAL_VOICES] = {};
+    alignas(32) float m_PanRight[MAX_PHYSICAL_VOICES] = {};
+    alignas(32) float m_Fade[MAX_PHYSICAL_VOICES] = {};
+    alignas(32) float m_FadeStep[MAX_PHYSICAL_VOICES] = {};
+    alignas(32) float m_Peak[MAX_PHYSICAL_VOICES] = {};
+    int m_PeakFrames[MAX_PHYSICAL_VOICES] = {};     // Frames covered by m_Peak
+    float m_Undamped[MAX_PHYSICAL_VOICES] = {};     // Loop gain with the damper off
+    float m_Damped[MAX_PHYSICAL_VOICES] = {};
+
+    // Soundboard: two-pole resonators driven by the mono string sum
+    int m_ModeCount = 0;
+    alignas(32) float m_ModeA1[MAX_SOUNDBOARD_MODES] = {};
+    alignas(32) float m_ModeA2[MAX_SOUNDBOARD_MODES] = {};
+    alignas(32) float m_ModeGain[MAX_SOUNDBOARD_MODES] = {};
+    alignas(32) float m_ModeY1[MAX_SOUNDBOARD_MODES] = {};
+    alignas(32) float m_ModeY2[MAX_SOUNDBOARD_MODES] = {};
+};
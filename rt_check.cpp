@@ -0,0 +1,454 @@
+// The fortified inline wrappers of read(), fread() and friends would clash
+// with the interposed definitions below
+#undef _FORTIFY_SOURCE
+
+#include "rt_check.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if SYNTH_RT_CHECK && defined(__GLIBC__)
+#define RT_INTERPOSE 1
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#define RT_INTERPOSE 0
+#endif
+
+#if SYNTH_RT_CHECK && defined(_WIN32)
+#include <windows.h>
+#if defined(_MSC_VER) && defined(_DEBUG)
+#include <crtdbg.h>
+#endif
+#endif
+
+static const int MAX_STACK_DEPTH = 24;
+static const int MAX_RECORDS = 256;
+
+struct ViolationRecord
+{
+    RealtimeViolation kind;
+    int depth;
+    void* stack[MAX_STACK_DEPTH];
+};
+
+static std::atomic<bool> g_Enabled{ false };
+static std::atomic<unsigned long long> g_ViolationCount{ 0 };
+static std::atomic<int> g_RecordCount{ 0 };
+static ViolationRecord g_Records[MAX_RECORDS];
+
+static thread_local int t_RealtimeDepth = 0;
+static thread_local bool t_Recording = false;      // Inside Record(), or a hook calling the real function
+
+static int CaptureStack(void** stack, int size)
+{
+#if RT_INTERPOSE
+    return backtrace(stack, size);
+#elif SYNTH_RT_CHECK && defined(_WIN32)
+    return CaptureStackBackTrace(0, (DWORD)size, stack, nullptr);
+#else
+    (void)stack;
+    (void)size;
+    return 0;
+#endif
+}
+
+static void Record(RealtimeViolation kind)
+{
+    if (t_RealtimeDepth == 0 || t_Recording || !g_Enabled.load(std::memory_order_relaxed))
+        return;
+
+    // Capturing the stack may allocate; that must not record again
+    t_Recording = true;
+    g_ViolationCount.fetch_add(1, std::memory_order_relaxed);
+    int slot = g_RecordCount.fetch_add(1, std::memory_order_relaxed);
+    if (slot < MAX_RECORDS)
+    {
+        g_Records[slot].kind = kind;
+        g_Records[slot].depth = CaptureStack(g_Records[slot].stack, MAX_STACK_DEPTH);
+    }
+    t_Recording = false;
+}
+
+RealtimeScope::RealtimeScope()
+{
+    ++t_RealtimeDepth;
+}
+
+RealtimeScope::~RealtimeScope()
+{
+    --t_RealtimeDepth;
+}
+
+#if SYNTH_RT_CHECK && defined(_MSC_VER) && defined(_DEBUG)
+static int __cdecl CrtAllocHook(int type, void*, size_t, int, long, const unsigned char*, int)
+{
+    Record(type == _HOOK_FREE ? RealtimeViolation::Free : RealtimeViolation::Allocation);
+    return TRUE;
+}
+#endif
+
+void EnableRealtimeCheck(bool enabled)
+{
+    if (enabled)
+    {
+        // The first stack capture loads the unwinder, which allocates
+        void* stack[4];
+        CaptureStack(stack, 4);
+        g_ViolationCount.store(0);
+        g_RecordCount.store(0);
+#if SYNTH_RT_CHECK && defined(_MSC_VER) && defined(_DEBUG)
+        _CrtSetAllocHook(CrtAllocHook);
+#endif
+    }
+    g_Enabled.store(enabled);
+}
+
+bool IsRealtimeCheckEnabled()
+{
+    return g_Enabled.load();
+}
+
+unsigned long long GetRealtimeViolationCount()
+{
+    return g_ViolationCount.load();
+}
+
+const char* GetRealtimeViolationName(RealtimeViolation kind)
+{
+    switch (kind)
+    {
+    case RealtimeViolation::Allocation: return "Allocation";
+    case RealtimeViolation::Free: return "Free";
+    case RealtimeViolation::Lock: return "Mutex lock";
+    case RealtimeViolation::FileIo: return "File I/O";
+    case RealtimeViolation::Sleep: return "Sleep";
+    default: return "?";
+    }
+}
+
+static bool SameStack(const ViolationRecord& a, const ViolationRecord& b)
+{
+    return a.kind == b.kind && a.depth == b.depth && memcmp(a.stack, b.stack, a.depth * sizeof(void*)) == 0;
+}
+
+void PrintRealtimeViolations(FILE* file)
+{
+    unsigned long long total = g_ViolationCount.load();
+    int records = std::min(g_RecordCount.load(), MAX_RECORDS);
+    fprintf(file, "Real-time violations: %llu\n", total);
+    if (records < (long long)total)
+        fprintf(file, "(stacks of the first %d)\n", records);
+
+    for (int i = 0; i < records; ++i)
+    {
+        bool seen = false;
+        for (int j = 0; j < i && !seen; ++j)
+            seen = SameStack(g_Records[i], g_Records[j]);
+        if (seen)
+            continue;
+
+        int hits = 1;
+        for (int j = i + 1; j < records; ++j)
+            hits += SameStack(g_Records[i], g_Records[j]) ? 1 : 0;
+        fprintf(file, "\n%s, %d times:\n", GetRealtimeViolationName(g_Records[i].kind), hits);
+#if RT_INTERPOSE
+        // Writes straight to the descriptor, past the stdio buffer
+        fflush(file);
+        backtrace_symbols_fd(g_Records[i].stack, g_Records[i].depth, fileno(file));
+#else
+        for (int f = 0; f < g_Records[i].depth; ++f)
+            fprintf(file, "  %p\n", g_Records[i].stack[f]);
+#endif
+    }
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Hooks
+
+#if SYNTH_RT_CHECK
+
+#if RT_INTERPOSE
+extern "C" void* __libc_malloc(size_t size) noexcept;
+extern "C" void* __libc_calloc(size_t count, size_t size) noexcept;
+extern "C" void* __libc_realloc(void* pointer, size_t size) noexcept;
+extern "C" void __libc_free(void* pointer) noexcept;
+
+static void* RawMalloc(size_t size)
+{
+    return __libc_malloc(size);
+}
+
+static void RawFree(void* pointer)
+{
+    __libc_free(pointer);
+}
+#else
+// The CRT hook sees these; it must not count them twice
+static void* RawMalloc(size_t size)
+{
+    bool recording = t_Recording;
+    t_Recording = true;
+    void* pointer = malloc(size);
+    t_Recording = recording;
+    return pointer;
+}
+
+static void RawFree(void* pointer)
+{
+    bool recording = t_Recording;
+    t_Recording = true;
+    free(pointer);
+    t_Recording = recording;
+}
+#endif
+
+static void* AlignedAllocate(size_t size, size_t alignment)
+{
+    bool recording = t_Recording;
+    t_Recording = true;
+#ifdef _MSC_VER
+    void* pointer = _aligned_malloc(size ? size : 1, alignment);
+#else
+    void* pointer = nullptr;
+    if (posix_memalign(&pointer, alignment < sizeof(void*) ? sizeof(void*) : alignment, size ? size : 1) != 0)
+        pointer = nullptr;
+#endif
+    t_Recording = recording;
+    return pointer;
+}
+
+static void AlignedFree(void* pointer)
+{
+#ifdef _MSC_VER
+    bool recording = t_Recording;
+    t_Recording = true;
+    _aligned_free(pointer);
+    t_Recording = recording;
+#else
+    RawFree(pointer);
+#endif
+}
+
+void* operator new(std::size_t size)
+{
+    Record(RealtimeViolation::Allocation);
+    if (void* pointer = RawMalloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    Record(RealtimeViolation::Allocation);
+    return RawMalloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    Record(RealtimeViolation::Allocation);
+    if (void* pointer = AlignedAllocate(size, (size_t)alignment))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return operator new(size, alignment);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    Record(RealtimeViolation::Allocation);
+    return AlignedAllocate(size, (size_t)alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t& tag) noexcept
+{
+    return operator new(size, alignment, tag);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    if (!pointer)
+        return;
+    Record(RealtimeViolation::Free);
+    RawFree(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, std::align_val_t) noexcept
+{
+    if (!pointer)
+        return;
+    Record(RealtimeViolation::Free);
+    AlignedFree(pointer);
+}
+
+void operator delete[](void* pointer, std::align_val_t alignment) noexcept
+{
+    operator delete(pointer, alignment);
+}
+
+void operator delete(void* pointer, std::size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(pointer, alignment);
+}
+
+void operator delete[](void* pointer, std::size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(pointer, alignment);
+}
+
+void operator delete(void* pointer, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    operator delete(pointer, alignment);
+}
+
+void operator delete[](void* pointer, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    operator delete(pointer, alignment);
+}
+
+#endif
+
+#if RT_INTERPOSE
+// The executable's definitions take precedence over libc's for every
+// caller, shared libraries included. The originals come from dlsym() on
+// first use.
+template<typename Fn>
+static Fn Original(Fn& cache, const char* name)
+{
+    if (!cache)
+        cache = (Fn)dlsym(RTLD_NEXT, name);
+    return cache;
+}
+
+extern "C" void* malloc(size_t size) noexcept
+{
+    Record(RealtimeViolation::Allocation);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) noexcept
+{
+    Record(RealtimeViolation::Allocation);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size) noexcept
+{
+    Record(RealtimeViolation::Allocation);
+    return __libc_realloc(pointer, size);
+}
+
+extern "C" void free(void* pointer) noexcept
+{
+    if (pointer)
+        Record(RealtimeViolation::Free);
+    __libc_free(pointer);
+}
+
+extern "C" int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept
+{
+    static int (*original)(pthread_mutex_t*) = nullptr;
+    Record(RealtimeViolation::Lock);
+    return Original(original, "pthread_mutex_lock")(mutex);
+}
+
+extern "C" ssize_t read(int descriptor, void* buffer, size_t bytes)
+{
+    static ssize_t (*original)(int, void*, size_t) = nullptr;
+    Record(RealtimeViolation::FileIo);
+    return Original(original, "read")(descriptor, buffer, bytes);
+}
+
+extern "C" ssize_t write(int descriptor, const void* buffer, size_t bytes)
+{
+    static ssize_t (*original)(int, const void*, size_t) = nullptr;
+    Record(RealtimeViolation::FileIo);
+    return Original(original, "write")(descriptor, buffer, bytes);
+}
+
+extern "C" FILE* fopen(const char* path, const char* mode)
+{
+    static FILE* (*original)(const char*, const char*) = nullptr;
+    Record(RealtimeViolation::FileIo);
+    return Original(original, "fopen")(path, mode);
+}
+
+extern "C" size_t fread(void* buffer, size_t size, size_t count, FILE* file)
+{
+    static size_t (*original)(void*, size_t, size_t, FILE*) = nullptr;
+    Record(RealtimeViolation::FileIo);
+    return Original(original, "fread")(buffer, size, count, file);
+}
+
+extern "C" size_t fwrite(const void* buffer, size_t size, size_t count, FILE* file)
+{
+    static size_t (*original)(const void*, size_t, size_t, FILE*) = nullptr;
+    Record(RealtimeViolation::FileIo);
+    return Original(original, "fwrite")(buffer, size, count, file);
+}
+
+extern "C" int nanosleep(const struct timespec* duration, struct timespec* remaining)
+{
+    static int (*original)(const struct timespec*, struct timespec*) = nullptr;
+    Record(RealtimeViolation::Sleep);
+    return Original(original, "nanosleep")(duration, remaining);
+}
+
+extern "C" int clock_nanosleep(clockid_t clock, int flags, const struct timespec* duration, struct timespec* remaining)
+{
+    static int (*original)(clockid_t, int, const struct timespec*, struct timespec*) = nullptr;
+    Record(RealtimeViolation::Sleep);
+    return Original(original, "clock_nanosleep")(clock, flags, duration, remaining);
+}
+
+extern "C" int usleep(useconds_t microseconds)
+{
+    static int (*original)(useconds_t) = nullptr;
+    Record(RealtimeViolation::Sleep);
+    return Original(original, "usleep")(microseconds);
+}
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdio>
+
+// Real-time safety checker. While enabled, every heap allocation, mutex
+// lock, file access or sleep made by a thread inside a RealtimeScope is
+// recorded with its call stack. Hooked through global operator new/delete
+// everywhere; malloc/free, pthread_mutex_lock, file I/O and sleeps are
+// interposed on glibc, and malloc/free through the CRT hook in MSVC debug
+// builds. Compiled out with SYNTH_RT_CHECK=0.
+#ifndef SYNTH_RT_CHECK
+#define SYNTH_RT_CHECK 1
+#endif
+
+enum class RealtimeViolation
+{
+    Allocation,
+    Free,
+    Lock,
+    FileIo,
+    Sleep,
+    Count
+};
+
+// Marks the current thread as rendering audio until the end of the scope
+class RealtimeScope
+{
+public:
+    RealtimeScope();
+    ~RealtimeScope();
+
+    RealtimeScope(const RealtimeScope&) = delete;
+    RealtimeScope& operator=(const RealtimeScope&) = delete;
+};
+
+// Not while rendering: enabling clears earlier records
+void EnableRealtimeCheck(bool enabled);
+bool IsRealtimeCheckEnabled();
+
+unsigned long long GetRealtimeViolationCount();
+
+// Each distinct call stack once, with how often it was hit
+void PrintRealtimeViolations(FILE* file);
+
+const char* GetRealtimeViolationName(RealtimeViolation kind);
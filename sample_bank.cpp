@@ -0,0 +1,317 @@
+#include "sample_bank.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+using namespace irrklang;
+namespace fs = std::filesystem;
+
+static const int CACHE_VERSION = 1;
+
+// Header of a cached, converted sample. The source size and time stamp
+// invalidate the cache entry when the original file changes.
+struct SampleCacheHeader
+{
+    char magic[4];
+    int version;
+    int sampleRate;
+    int sourceRate;
+    int channels;
+    int frames;
+    long long sourceSize;
+    long long sourceTime;
+};
+
+struct SourceStamp
+{
+    long long size = -1;
+    long long time = 0;
+};
+
+static SourceStamp GetSourceStamp(const std::string& name)
+{
+    SourceStamp stamp;
+    std::error_code ec;
+    uintmax_t size = fs::file_size(name, ec);
+    if (ec)
+        return stamp;
+    stamp.size = (long long)size;
+    stamp.time = (long long)fs::last_write_time(name, ec).time_since_epoch().count();
+    return stamp;
+}
+
+void ResampleOffline(const float* src, int frames, int srcRate, int dstRate, std::vector<float>& dst)
+{
+    // Tables for the conversions in use are built once; the cutoff follows
+    // the lower of the two rates so downsampling does not alias
+    static std::list<std::pair<long long, SincTable>> tables;
+    static std::mutex tables_mutex;
+
+    double ratio = (double)dstRate / srcRate;
+    long long key = (long long)srcRate * 1000000 + dstRate;
+    const SincTable* table = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(tables_mutex);
+        for (auto& entry : tables)
+            if (entry.first == key)
+                table = &entry.second;
+        if (!table)
+        {
+            tables.emplace_back(key, SincTable());
+            tables.back().second.Build(32, 1024, 0.92 * std::min(1.0, ratio), 8.0);
+            table = &tables.back().second;
+        }
+    }
+
+    std::vector<float> padded(frames + 2 * INTERPOLATION_PADDING, 0.0f);
+    std::copy(src, src + frames, padded.begin() + INTERPOLATION_PADDING);
+
+    int out_frames = (int)std::ceil(frames * ratio);
+    dst.assign(out_frames, 0.0f);
+
+    double position = 0.0;
+    ResampleArgs args = { &padded[INTERPOLATION_PADDING], frames, &position, (double)srcRate / dstRate, dst.data(), out_frames, table };
+    int written = GetResampleFunction(InterpolationKind::Sinc32)(args);
+    dst.resize(written);
+}
+
+// Decodes a file with irrKlang into unpadded planar float
+static bool DecodeSample(ISoundEngine* engine, const std::string& name, SampleData& sample, std::vector<float>& planar)
+{
+    engine->removeSoundSource(name.c_str());
+    // Not preloaded: the file is first opened by getAudioFormat() below
+    ISoundSource* source = engine->addSoundSourceFromFile(name.c_str(), ESM_NO_STREAMING, false);
+    if (!source)
+        return false;
+
+    // irrKlang streams anything over about a megabyte decoded, whatever
+    // the mode asked for, and a streamed source has no sample data. The
+    // threshold is per source, so it is lifted before the file is opened,
+    // and a reload makes sure nothing read under the old one is kept.
+    source->setForcedStreamingThreshold(0);
+    source->setStreamMode(ESM_NO_STREAMING);
+    source->forceReloadAtNextUse();
+    SAudioStreamFormat format = source->getAudioFormat();
+    const void* pcm = source->getSampleData();
+    if (!pcm || format.FrameCount <= 0 || format.ChannelCount <= 0)
+    {
+        engine->removeSoundSource(source);
+        return false;
+    }
+
+    sample.sourceRate = format.SampleRate;
+    sample.channels = format.ChannelCount;
+    sample.frames = format.FrameCount;
+    planar.resize((size_t)format.ChannelCount * format.FrameCount);
+
+    for (int c = 0; c < format.ChannelCount; ++c)
+    {
+        float* dst = &planar[(size_t)c * format.FrameCount];
+        if (format.SampleFormat == ESF_S16)
+        {
+            const short* in = (const short*)pcm + c;
+            for (int i = 0; i < format.FrameCount; ++i)
+                dst[i] = in[(size_t)i * format.ChannelCount] * (1.0f / 32768.0f);
+        }
+        else
+        {
+            const unsigned char* in = (const unsigned char*)pcm + c;
+            for (int i = 0; i < format.FrameCount; ++i)
+                dst[i] = (in[(size_t)i * format.ChannelCount] - 128) * (1.0f / 128.0f);
+        }
+    }
+
+    engine->removeSoundSource(source);
+    return true;
+}
+
+// Resamples (or copies) the decoded channels into the padded layout
+static void ConvertSample(SampleData& sample, const std::vector<float>& planar, int sampleRate)
+{
+    std::vector<std::vector<float>> channels(sample.channels);
+    for (int c = 0; c < sample.channels; ++c)
+    {
+        const float* src = &planar[(size_t)c * sample.frames];
+        if (sample.sourceRate == sampleRate)
+            channels[c].assign(src, src + sample.frames);
+        else
+            ResampleOffline(src, sample.frames, sample.sourceRate, sampleRate, channels[c]);
+    }
+
+    sample.frames = (int)channels[0].size();
+    sample.data.assign((size_t)sample.channels * sample.Stride(), 0.0f);
+    for (int c = 0; c < sample.channels; ++c)
+        std::copy(channels[c].begin(), channels[c].end(), sample.data.begin() + (size_t)c * sample.Stride() + INTERPOLATION_PADDING);
+}
+
+bool SampleBank::Load(ISoundEngine* engine, const std::vector<std::string>& files, int sampleRate, int threads)
+{
+    Clear();
+    m_SampleRate = sampleRate;
+    m_Samples.resize(files.size());
+
+    // Cached conversions are used as they are, everything else is decoded
+    // here (irrKlang is not used from several threads) and converted below
+    std::vector<std::vector<float>> decoded(files.size());
+    std::vector<int> pending;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        SampleData& sample = m_Samples[i];
+        sample.name = files[i];
+
+        if (ReadCache(sample, CachePath(files[i])))
+            continue;
+
+        if (!DecodeSample(engine, files[i], sample, decoded[i]))
+        {
+            printf("SampleBank: cannot decode %s\n", files[i].c_str());
+            continue;
+        }
+        pending.push_back((int)i);
+    }
+
+    if (threads <= 0)
+        threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, (int)pending.size());
+
+    std::atomic<int> next(0);
+    auto worker = [&]()
+    {
+        for (int job = next++; job < (int)pending.size(); job = next++)
+        {
+            int i = pending[job];
+            ConvertSample(m_Samples[i], decoded[i], sampleRate);
+            decoded[i].clear();
+            decoded[i].shrink_to_fit();
+            WriteCache(m_Samples[i], CachePath(files[i]));
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t)
+        pool.emplace_back(worker);
+    worker();
+    for (auto& thread : pool)
+        thread.join();
+
+    bool all_loaded = true;
+    for (auto& sample : m_Samples)
+        all_loaded = all_loaded && sample.frames > 0;
+    return all_loaded;
+}
+
+void SampleBank::Clear()
+{
+    m_Samples.clear();
+    m_SampleRate = 0;
+}
+
+int SampleBank::Add(SampleData sample, int sampleRate)
+{
+    m_SampleRate = sampleRate;
+    m_Samples.push_back(std::move(sample));
+    return (int)m_Samples.size() - 1;
+}
+
+int SampleBank::FindIndex(const char* name) const
+{
+    for (size_t i = 0; i < m_Samples.size(); ++i)
+    {
+        if (m_Samples[i].name == name)
+            return (int)i;
+    }
+    return -1;
+}
+
+const SampleData* SampleBank::Find(const char* name) const
+{
+    int index = FindIndex(name);
+    return index >= 0 ? &m_Samples[index] : nullptr;
+}
+
+size_t SampleBank::GetMemoryBytes() const
+{
+    size_t bytes = 0;
+    for (auto& sample : m_Samples)
+        bytes += sample.data.size() * sizeof(float);
+    return bytes;
+}
+
+std::string SampleBank::CachePath(const std::string& name) const
+{
+    return m_CacheDir + "/" + std::to_string(m_SampleRate) + "/" + fs::path(name).stem().string() + ".f32";
+}
+
+bool SampleBank::ReadCache(SampleData& sample, const std::string& path) const
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+
+    SourceStamp stamp = GetSourceStamp(sample.name);
+    SampleCacheHeader header;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, "SZSB", 4) == 0
+        && header.version == CACHE_VERSION
+        && header.sampleRate == m_SampleRate
+        && header.sourceSize == stamp.size
+        && header.sourceTime == stamp.time
+        && header.channels > 0 && header.frames > 0;
+
+    if (valid)
+    {
+        sample.sourceRate = header.sourceRate;
+        sample.channels = header.channels;
+        sample.frames = header.frames;
+        sample.data.assign((size_t)sample.channels * sample.Stride(), 0.0f);
+        for (int c = 0; c < sample.channels && valid; ++c)
+        {
+            float* dst = &sample.data[(size_t)c * sample.Stride() + INTERPOLATION_PADDING];
+            valid = fread(dst, sizeof(float), sample.frames, file) == (size_t)sample.frames;
+        }
+        if (!valid)
+        {
+            sample.data.clear();
+            sample.frames = 0;
+        }
+    }
+
+    fclose(file);
+    return valid;
+}
+
+void SampleBank::WriteCache(const SampleData& sample, const std::string& path) const
+{
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+        return;
+
+    SourceStamp stamp = GetSourceStamp(sample.name);
+    SampleCacheHeader header;
+    memcpy(header.magic, "SZSB", 4);
+    header.version = CACHE_VERSION;
+    header.sampleRate = m_SampleRate;
+    header.sourceRate = sample.sourceRate;
+    header.channels = sample.channels;
+    header.frames = sample.frames;
+    header.sourceSize = stamp.size;
+    header.sourceTime = stamp.time;
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int c = 0; c < sample.channels && ok; ++c)
+        ok = fwrite(sample.Channel(c), sizeof(float), sample.frames, file) == (size_t)sample.frames;
+    fclose(file);
+
+    if (!ok)
+        fs::remove(path, ec);
+}
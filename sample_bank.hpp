@@ -0,0 +1,57 @@
+#pragma once
+
+#include "interpolation.hpp"
+#include <irrKlang.h>
+#include <string>
+#include <vector>
+
+// One decoded note, stored as planar float at the bank rate
+struct SampleData
+{
+    std::string name;                       // File name, e.g. "notes/C3.ogg"
+    int sourceRate = 0;                     // Rate of the original file
+    int channels = 0;
+    int frames = 0;
+    std::vector<float> data;                // Planar, each channel padded with INTERPOLATION_PADDING zeros
+
+    int Stride() const { return frames + 2 * INTERPOLATION_PADDING; }
+    const float* Channel(int c) const { return &data[(size_t)c * Stride() + INTERPOLATION_PADDING]; }
+};
+
+// All note samples, converted once at load time to the output device rate so
+// playback at the original pitch needs no resampling.
+class SampleBank
+{
+public:
+    // Decodes the files (or reads them from the per-rate cache) and converts
+    // them to sampleRate. threads == 0 uses one thread per core.
+    bool Load(irrklang::ISoundEngine* engine, const std::vector<std::string>& files, int sampleRate, int threads = 0);
+    void Clear();
+
+    // Generated sample, already at sampleRate and padded; the bank must be
+    // empty or at that rate. Returns its index.
+    int Add(SampleData sample, int sampleRate);
+
+    int GetSampleRate() const { return m_SampleRate; }
+    int GetCount() const { return (int)m_Samples.size(); }
+    const SampleData& Get(int index) const { return m_Samples[index]; }
+    int FindIndex(const char* name) const;          // -1 if not loaded
+    const SampleData* Find(const char* name) const;
+    size_t GetMemoryBytes() const;
+
+    // Converted banks are cached as raw float files under cacheDir/<rate>/
+    void SetCacheDirectory(const std::string& dir) { m_CacheDir = dir; }
+
+private:
+    bool ReadCache(SampleData& sample, const std::string& path) const;
+    void WriteCache(const SampleData& sample, const std::string& path) const;
+    std::string CachePath(const std::string& name) const;
+
+    std::vector<SampleData> m_Samples;
+    std::string m_CacheDir = "notes/cache";
+    int m_SampleRate = 0;
+};
+
+// High quality conversion of one planar channel. dst receives the converted
+// frames; both buffers are unpadded.
+void ResampleOffline(const float* src, int frames, int srcRate, int dstRate, std::vector<float>& dst);
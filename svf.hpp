@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cmath>
+
+// Trapezoidal state-variable filter (Simper's formulation). Stays stable
+// under fast cutoff and resonance modulation, which lets the voice kernels
+// move the coefficients every sample.
+
+enum class FilterMode
+{
+    Off,
+    LowPass,
+    BandPass,
+    HighPass,
+    Count
+};
+
+struct FilterSettings
+{
+    FilterMode mode = FilterMode::Off;
+    float cutoff = 2000.0f;         // Hz at middle C
+    float resonance = 0.2f;         // 0..1, self-oscillation just above 1
+    float keyTracking = 0.5f;       // 1 = cutoff follows the pitch exactly
+    float envelopeAmount = 2.0f;    // Octaves added at full envelope level
+};
+
+// Per-voice filter state in structure-of-arrays form. g and k glide towards
+// their targets by 'smoothing' every sample, so block-rate target updates
+// never step.
+struct SvfLanes
+{
+    float* ic1;
+    float* ic2;
+    float* g;
+    float* k;
+    const float* gTarget;
+    const float* kTarget;
+    float smoothing;
+};
+
+// Frequency warping coefficient, cutoff clamped below Nyquist
+inline float SvfCutoffCoefficient(float cutoff, int sampleRate)
+{
+    float limit = 0.45f * sampleRate;
+    cutoff = cutoff < 10.0f ? 10.0f : (cutoff > limit ? limit : cutoff);
+    return std::tan(3.14159265f * cutoff / sampleRate);
+}
+
+// Damping (1/Q) from a 0..1 resonance
+inline float SvfDampingCoefficient(float resonance)
+{
+    resonance = resonance < 0.0f ? 0.0f : (resonance > 1.0f ? 1.0f : resonance);
+    return 2.0f - 1.98f * resonance;
+}
+
+// Per-sample glide for a time constant of about 5 ms
+inline float SvfSmoothing(int sampleRate)
+{
+    return 1.0f - std::exp(-1.0f / (0.005f * sampleRate));
+}
+
+// One sample of one lane, the reference the SIMD kernels follow
+template<FilterMode Mode>
+inline float SvfTick(float v0, float& ic1, float& ic2, float g, float k)
+{
+    float a1 = 1.0f / (1.0f + g * (g + k));
+    float a2 = g * a1;
+    float a3 = g * a2;
+    float v3 = v0 - ic2;
+    float v1 = a1 * ic1 + a2 * v3;
+    float v2 = ic2 + a2 * ic1 + a3 * v3;
+    ic1 = 2.0f * v1 - ic1;
+    ic2 = 2.0f * v2 - ic2;
+    if (Mode == FilterMode::LowPass)
+        return v2;
+    if (Mode == FilterMode::BandPass)
+        return v1;
+    return v0 - k * v1 - v2;
+}
+
+inline const char* GetFilterModeName(FilterMode mode)
+{
+    switch (mode)
+    {
+    case FilterMode::Off: return "Off";
+    case FilterMode::LowPass: return "Low-pass";
+    case FilterMode::BandPass: return "Band-pass";
+    case FilterMode::HighPass: return "High-pass";
+    default: return "?";
+    }
+}
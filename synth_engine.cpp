@@ -0,0 +1,530 @@
+#include "synth_engine.hpp"
+#include "rt_check.hpp"
+#include <algorithm>
+#include <cstring>
+
+static_assert(MAX_BLOCK_FRAMES <= MAX_GRAPH_FRAMES, "Blocks must fit the graph's buffers");
+
+// Voices kept free for stolen voices to fade out in
+static const int STEAL_RESERVE = 16;
+
+void SynthEngine::Prepare(const SampleBank* bank, int sampleRate)
+{
+    m_Bank = bank;
+    m_SampleRate = sampleRate;
+    m_Governor.Prepare(sampleRate);
+    if (m_Wavetables.GetCount() == 0)
+        m_Wavetables.Build();
+    m_Oscillators.Prepare(&m_Wavetables, sampleRate);
+    m_Physical.Prepare(sampleRate);
+    m_Fm.Prepare(sampleRate);
+    m_Effects.Prepare(sampleRate);
+    m_Limiter.Prepare(sampleRate);
+    m_Limiter.Update(m_UiParameters.limiter);
+    m_Limiter.Reset();
+    for (auto& voice : m_Voices)
+    {
+        voice.active = false;
+        voice.envelope.Reset();
+    }
+    m_JobMix.assign((size_t)VOICE_JOBS * 2 * MAX_BLOCK_FRAMES, 0.0f);
+    m_VoicePool.Start(m_VoiceHelpers, "voices");
+    m_LayerPool.Start(std::min(m_VoiceHelpers, (int)SoundSource::Count - 1), "layers");
+    RebuildGraph();
+}
+
+// Enabled layers into the mix, in a fixed order so the sum does not depend
+// on which were switched on last
+void SynthEngine::RebuildGraph()
+{
+    DspGraph graph;
+    int mix = graph.AddNode(&m_LayerMix);
+    for (int layer = 0; layer < (int)SoundSource::Count; ++layer)
+    {
+        if (m_LayerEnabled[layer])
+            graph.Connect(graph.AddNode(&m_Layers[layer]), 0, mix, layer);
+    }
+    graph.SetOutput(mix, 0);
+
+    std::unique_ptr<CompiledGraph> schedule = graph.Compile();
+    m_GraphShape = schedule->GetShape();
+    m_Schedule.CollectRetired();
+    m_Schedule.Publish(std::move(schedule));
+}
+
+void SynthEngine::SetLayerEnabled(SoundSource layer, bool enabled)
+{
+    if (m_LayerEnabled[(int)layer] == enabled)
+        return;
+    m_LayerEnabled[(int)layer] = enabled;
+    RebuildGraph();
+}
+
+const char* SynthEngine::GetLayerName(SoundSource layer)
+{
+    switch (layer)
+    {
+    case SoundSource::Samples: return "Piano samples";
+    case SoundSource::Oscillators: return "Oscillators";
+    case SoundSource::Physical: return "Physical piano";
+    case SoundSource::Fm: return "FM";
+    default: return "?";
+    }
+}
+
+bool SynthEngine::PostEvent(EventPort port, const NoteEvent& event)
+{
+    // A full queue means the audio thread is not running or the poster is
+    // far ahead of it; refusing is the only option that cannot block
+    if (m_Events[(int)port].Push(event))
+        return true;
+    m_RefusedEvents.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+// The earliest event waiting on any port; the lowest port first on a tie
+const NoteEvent* SynthEngine::PeekEvent(int& port) const
+{
+    const NoteEvent* first = nullptr;
+    for (int p = 0; p < (int)EventPort::Count; ++p)
+    {
+        const NoteEvent* event = m_Events[p].Peek();
+        if (event && (!first || event->time < first->time))
+        {
+            first = event;
+            port = p;
+        }
+    }
+    return first;
+}
+
+bool SynthEngine::NoteOn(int key, int sample, float pitch, float velocity, long long time, long long inputStamp, EventPort port)
+{
+    if (time == 0 && inputStamp == 0)
+        inputStamp = LatencyMonitor::Now();
+    return PostEvent(port, { NoteEventType::NoteOn, key, sample, pitch, velocity, time, time == 0 ? inputStamp : 0 });
+}
+
+bool SynthEngine::NoteOff(int key, long long time, EventPort port)
+{
+    return PostEvent(port, { NoteEventType::NoteOff, key, -1, 0.0f, 0.0f, time, 0 });
+}
+
+bool SynthEngine::SetSustainPedal(bool down, long long time, EventPort port, int channel)
+{
+    return PostEvent(port, { down ? NoteEventType::SustainOn : NoteEventType::SustainOff, channel, -1, 0.0f, 0.0f, time, 0 });
+}
+
+bool SynthEngine::AllNotesOff(long long time, EventPort port)
+{
+    return PostEvent(port, { NoteEventType::AllNotesOff, 0, -1, 0.0f, 0.0f, time, 0 });
+}
+
+void SynthEngine::SetEnvelope(const AdsrSettings& settings)
+{
+    m_UiParameters.envelope = settings;
+    m_Parameters.Write(m_UiParameters);
+}
+
+void SynthEngine::SetFilter(const FilterSettings& settings)
+{
+    m_UiParameters.filter = settings;
+    m_Parameters.Write(m_UiParameters);
+}
+
+void SynthEngine::SetLimiter(const LimiterSettings& settings)
+{
+    m_UiParameters.limiter = settings;
+    m_Parameters.Write(m_UiParameters);
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Audio thread
+
+// The key's sounding voice; one fading out after a steal or a retrigger no
+// longer answers to the key
+Voice* SynthEngine::FindVoice(int key)
+{
+    for (auto& voice : m_Voices)
+    {
+        if (voice.active && !voice.stolen && voice.key == key)
+            return &voice;
+    }
+    return nullptr;
+}
+
+Voice* SynthEngine::FindQuietest(bool playingOnly)
+{
+    Voice* quietest = nullptr;
+    for (auto& voice : m_Voices)
+    {
+        if (voice.active && !(playingOnly && voice.stolen)
+            && (!quietest || voice.envelope.GetLevel() * voice.velocity < quietest->envelope.GetLevel() * quietest->velocity))
+            quietest = &voice;
+    }
+    return quietest;
+}
+
+bool SynthEngine::StealQuietest()
+{
+    Voice* quietest = FindQuietest(true);
+    if (!quietest)
+        return false;
+    quietest->stolen = true;
+    quietest->envelope.FastRelease(m_SampleRate);
+    return true;
+}
+
+// Takes the lowest free voice. Once no more than STEAL_RESERVE are free,
+// each new note fades out the quietest playing voice with FastRelease, so
+// the fading voices have somewhere to finish. Only when a burst of notes
+// inside the fade has used every voice is the quietest one cut outright.
+Voice* SynthEngine::AllocateVoice()
+{
+    Voice* idle = nullptr;
+    int idleCount = 0;
+    for (auto& voice : m_Voices)
+    {
+        if (!voice.active)
+        {
+            idle = idle ? idle : &voice;
+            ++idleCount;
+        }
+    }
+    if (idleCount <= STEAL_RESERVE)
+        StealQuietest();
+    return idle ? idle : FindQuietest(false);
+}
+
+void SynthEngine::StartVoice(const NoteEvent& event)
+{
+    if (!m_Bank || event.sample < 0 || event.sample >= m_Bank->GetCount())
+        return;
+
+    // Retriggering a key fades its sounding voice out like a stolen one and
+    // starts the note on another, so the sample never jumps back to its
+    // start at full level
+    if (Voice* previous = FindVoice(event.key))
+    {
+        previous->stolen = true;
+        previous->envelope.FastRelease(m_SampleRate);
+    }
+    Voice* voice = AllocateVoice();
+    voice->envelope.Reset();
+
+    voice->active = true;
+    voice->held = true;
+    voice->sustained = false;
+    voice->stolen = false;
+    voice->key = event.key;
+    voice->sample = event.sample;
+    voice->position = 0.0;
+    voice->step = (double)m_Bank->GetSampleRate() / m_SampleRate;
+    voice->velocity = event.velocity;
+    voice->interpolation = GetGlobalInterpolation();
+
+    // Spread the keyboard slightly across the stereo field, low notes left
+    int count = m_Bank->GetCount();
+    voice->pan = count > 1 ? 0.6f * event.sample / (count - 1) - 0.3f : 0.0f;
+
+    voice->envelope.Start(m_Parameters.Read().envelope, m_SampleRate);
+    SelectKernel(*voice);
+}
+
+void SynthEngine::HandleEvent(const NoteEvent& event)
+{
+    switch (event.type)
+    {
+    case NoteEventType::NoteOn:
+        if (GetSoundSource() == SoundSource::Oscillators)
+            m_Oscillators.StartNote(event.key, event.pitch, event.velocity, GetWaveform(), m_Parameters.Read().envelope);
+        else if (GetSoundSource() == SoundSource::Physical)
+            m_Physical.StartNote(event.key, event.pitch, event.velocity);
+        else if (GetSoundSource() == SoundSource::Fm)
+            m_Fm.StartNote(event.key, event.pitch, event.velocity, GetFmPreset());
+        else
+            StartVoice(event);
+        break;
+    case NoteEventType::NoteOff:
+        if (Voice* voice = FindVoice(event.key))
+        {
+            voice->held = false;
+            if (m_SustainPedal)
+                voice->sustained = true;
+            else
+                voice->envelope.Release();
+        }
+        m_Oscillators.ReleaseNote(event.key, m_SustainPedal);
+        m_Physical.ReleaseNote(event.key, m_SustainPedal);
+        m_Fm.ReleaseNote(event.key, m_SustainPedal);
+        break;
+    case NoteEventType::SustainOn:
+        m_SustainPedal = true;
+        break;
+    case NoteEventType::SustainOff:
+        m_SustainPedal = false;
+        for (auto& voice : m_Voices)
+        {
+            if (voice.active && voice.sustained && !voice.held)
+            {
+                voice.sustained = false;
+                voice.envelope.Release();
+            }
+        }
+        m_Oscillators.ReleaseSustained();
+        m_Physical.ReleaseSustained();
+        m_Fm.ReleaseSustained();
+        break;
+    case NoteEventType::AllNotesOff:
+        for (auto& voice : m_Voices)
+        {
+            voice.held = voice.sustained = false;
+            voice.envelope.Release();
+        }
+        m_Oscillators.ReleaseAll();
+        m_Physical.ReleaseAll();
+        m_Fm.ReleaseAll();
+        break;
+    }
+}
+
+// Picks the render kernels for the voice's configuration; they stay fixed
+// until the note ends or the governor changes the interpolation limit
+void SynthEngine::SelectKernel(Voice& voice)
+{
+    const SampleData& sample = m_Bank->Get(voice.sample);
+    bool unity = voice.step == 1.0 && voice.position == (double)(int)voice.position;
+    voice.kernel = SelectVoiceKernel(m_Governor.LimitInterpolation(voice.interpolation), sample.channels, unity, GetSimdLevel());
+}
+
+// Fades out an engine's quietest voices while it plays more than limit
+template<typename Engine>
+static void LimitVoices(Engine& engine, int limit, CpuGovernor& governor)
+{
+    for (int playing = engine.GetPlayingCount(); playing > limit && engine.StealQuietest(); --playing)
+        governor.CountStolenVoice();
+}
+
+// Fades out the quietest voices of every engine while more are playing
+// than the governor allows
+void SynthEngine::EnforceVoiceLimit()
+{
+    int playing = 0;
+    for (auto& voice : m_Voices)
+        playing += (voice.active && !voice.stolen) ? 1 : 0;
+    for (int limit = m_Governor.GetVoiceLimit(MAX_VOICES); playing > limit && StealQuietest(); --playing)
+        m_Governor.CountStolenVoice();
+
+    LimitVoices(m_Oscillators, m_Governor.GetVoiceLimit(MAX_OSCILLATOR_VOICES), m_Governor);
+    LimitVoices(m_Physical, m_Governor.GetVoiceLimit(MAX_PHYSICAL_VOICES), m_Governor);
+    LimitVoices(m_Fm, m_Governor.GetVoiceLimit(MAX_FM_VOICES), m_Governor);
+}
+
+// Mixes the voice into the output; touches nothing but the voice, so
+// different voices may render on different threads
+void SynthEngine::RenderVoice(Voice& voice, float* outL, float* outR, int frames, bool reselect)
+{
+    if (reselect)
+        SelectKernel(voice);
+
+    float level_start = voice.envelope.GetLevel();
+    float level_end = voice.envelope.Advance(frames);
+    VoiceBlock block = { &m_Bank->Get(voice.sample), &voice.position, voice.step,
+                         level_start * voice.velocity, level_end * voice.velocity, voice.pan, outL, outR, frames };
+    int written = RenderVoiceBlock(voice.kernel, block);
+
+    // Reclaim voices whose sample ended or whose release became inaudible
+    if (written < frames || voice.envelope.IsIdle())
+    {
+        voice.active = false;
+        voice.envelope.Reset();
+    }
+}
+
+// One group of voices into its own buffer, left untouched if none plays
+void SynthEngine::RenderVoiceJob(void* user, int job)
+{
+    SynthEngine* engine = (SynthEngine*)user;
+    const int frames = engine->m_JobFrames;
+    float* left = &engine->m_JobMix[(size_t)job * 2 * MAX_BLOCK_FRAMES];
+    float* right = left + MAX_BLOCK_FRAMES;
+    bool used = false;
+    for (int v = job * VOICES_PER_JOB; v < (job + 1) * VOICES_PER_JOB; ++v)
+    {
+        Voice& voice = engine->m_Voices[v];
+        if (!voice.active)
+            continue;
+        if (!used)
+        {
+            memset(left, 0, frames * sizeof(float));
+            memset(right, 0, frames * sizeof(float));
+            used = true;
+        }
+        engine->RenderVoice(voice, left, right, frames, engine->m_JobReselect);
+    }
+    engine->m_JobUsed[job] = used;
+}
+
+// Layers run on the audio thread or a layer pool helper; each touches only
+// its own engine, and the sample layer only the voices
+
+void SynthEngine::RenderSampleLayer(void* user, float* outL, float* outR, int frames)
+{
+    SynthEngine* engine = (SynthEngine*)user;
+    // Denormals raised on the voice helpers are not counted
+    engine->m_Denormals.Begin();
+    if (engine->m_ParallelVoices.load(std::memory_order_relaxed))
+    {
+        // The layer helpers already fill the cores
+        if (engine->m_LayersParallel)
+        {
+            for (int job = 0; job < VOICE_JOBS; ++job)
+                RenderVoiceJob(engine, job);
+        }
+        else
+            engine->m_VoicePool.Run(VOICE_JOBS, RenderVoiceJob, engine, engine->m_Denormals.IsFlushEnabled());
+
+        // Fixed order, whichever thread finished first
+        for (int job = 0; job < VOICE_JOBS; ++job)
+        {
+            if (!engine->m_JobUsed[job])
+                continue;
+            const float* left = &engine->m_JobMix[(size_t)job * 2 * MAX_BLOCK_FRAMES];
+            const float* right = left + MAX_BLOCK_FRAMES;
+            for (int i = 0; i < frames; ++i)
+            {
+                outL[i] += left[i];
+                outR[i] += right[i];
+            }
+        }
+    }
+    else
+    {
+        for (auto& voice : engine->m_Voices)
+        {
+            if (voice.active)
+                engine->RenderVoice(voice, outL, outR, frames, engine->m_JobReselect);
+        }
+    }
+    engine->m_Denormals.End(DspNode::SampleVoices);
+}
+
+void SynthEngine::RenderOscillatorLayer(void* user, float* outL, float* outR, int frames)
+{
+    SynthEngine* engine = (SynthEngine*)user;
+    engine->m_Denormals.Begin();
+    engine->m_Oscillators.Render(outL, outR, frames, engine->m_Parameters.Read().filter);
+    engine->m_Denormals.End(DspNode::Oscillators);
+}
+
+void SynthEngine::RenderPhysicalLayer(void* user, float* outL, float* outR, int frames)
+{
+    SynthEngine* engine = (SynthEngine*)user;
+    engine->m_Denormals.Begin();
+    engine->m_Physical.Render(outL, outR, frames, engine->m_Governor.LimitPhysicalQuality(engine->GetPhysicalQuality()));
+    engine->m_Denormals.End(DspNode::PhysicalPiano);
+}
+
+void SynthEngine::RenderFmLayer(void* user, float* outL, float* outR, int frames)
+{
+    SynthEngine* engine = (SynthEngine*)user;
+    engine->m_Denormals.Begin();
+    engine->m_Fm.Render(outL, outR, frames);
+    engine->m_Denormals.End(DspNode::Fm);
+}
+
+void SynthEngine::RenderBlock(float* outL, float* outR, int frames)
+{
+    EnforceVoiceLimit();
+
+    m_JobFrames = frames;
+    m_JobReselect = m_Governor.GetLevel() != m_KernelLevel;
+    m_KernelLevel = m_Governor.GetLevel();
+
+    // A schedule published since the last block takes over here, between
+    // sub-blocks, never inside one
+    if (CompiledGraph* graph = m_Schedule.Acquire())
+    {
+        // One sounding layer gains nothing from the layer helpers, and the
+        // sample voices would lose theirs
+        int sounding = (m_Oscillators.GetActiveCount() > 0) + (m_Physical.GetActiveCount() > 0) + (m_Fm.GetActiveCount() > 0);
+        for (const auto& voice : m_Voices)
+        {
+            if (voice.active)
+            {
+                ++sounding;
+                break;
+            }
+        }
+        m_LayersParallel = m_ParallelVoices.load(std::memory_order_relaxed) && sounding > 1;
+        graph->Process(outL, outR, frames, m_LayersParallel ? &m_LayerPool : nullptr, m_Denormals.IsFlushEnabled());
+    }
+}
+
+void SynthEngine::Render(float* outL, float* outR, int frames)
+{
+    RealtimeScope realtime;
+
+    // The audio thread belongs to the output driver; flush only while
+    // rendering and leave its mode as it was
+    ScopedFlushDenormals flush(m_Denormals.IsFlushEnabled());
+    m_Governor.BeginBlock();
+    m_Denormals.BeginBlock();
+    m_Latency.BeginRender();
+
+    // One set of settings for the whole call, however the UI moves them
+    if (m_Parameters.Update())
+        m_Limiter.Update(m_Parameters.Read().limiter);
+
+    memset(outL, 0, frames * sizeof(float));
+    memset(outR, 0, frames * sizeof(float));
+    // Blocks are split at event times so every event lands on its exact frame
+    int offset = 0;
+    while (offset < frames)
+    {
+        long long now = m_FrameTime + offset;
+        const NoteEvent* next;
+        int port = 0;
+        while ((next = PeekEvent(port)) && next->time <= now)
+        {
+            NoteEvent event;
+            m_Events[port].Pop(event);
+            if (event.type == NoteEventType::NoteOn && event.inputStamp != 0)
+                m_Latency.EventArrived(event.inputStamp, offset);
+            HandleEvent(event);
+            if (m_KeepPlayed.load(std::memory_order_relaxed))
+            {
+                event.time = now;
+                m_Played.Push(event);
+            }
+        }
+
+        int block = std::min(MAX_BLOCK_FRAMES, frames - offset);
+        if (next && next->time < now + block)
+            block = (int)(next->time - now);
+        RenderBlock(outL + offset, outR + offset, block);
+        offset += block;
+    }
+
+    // Inside the timed block so the governor sees the effects' cost. Offline
+    // renders that must match bit for bit should disable the governor.
+    m_Effects.Process(outL, outR, frames, m_Governor.OptionalEffectsEnabled(), &m_Denormals);
+
+    // Master gain and limiter last, never shed by the governor
+    m_Denormals.Begin();
+    m_Limiter.Process(outL, outR, frames);
+    m_Denormals.End(DspNode::Limiter);
+    m_Denormals.EndBlock();
+    m_Latency.EndRender(m_SampleRate, m_Limiter.GetLatency());
+
+    m_FrameTime += frames;
+    m_PublishedTime.store(m_FrameTime, std::memory_order_relaxed);
+
+    int active = m_Oscillators.GetActiveCount() + m_Physical.GetActiveCount() + m_Fm.GetActiveCount();
+    for (auto& voice : m_Voices)
+        active += voice.active ? 1 : 0;
+    m_ActiveVoices.store(active, std::memory_order_relaxed);
+
+    m_Governor.EndBlock(frames);
+    m_Telemetry.RecordBlock(m_Governor.GetLastRenderSeconds(), frames, m_SampleRate);
+}
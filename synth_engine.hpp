@@ -0,0 +1,250 @@
+#pragma once
+
+#include "denormals.hpp"
+#include "dsp_graph.hpp"
+#include "dsp_telemetry.hpp"
+#include "effects.hpp"
+#include "envelope.hpp"
+#include "event_queue.hpp"
+#include "fm_synth.hpp"
+#include "governor.hpp"
+#include "interpolation.hpp"
+#include "job_pool.hpp"
+#include "latency_monitor.hpp"
+#include "limiter.hpp"
+#include "mixer.hpp"
+#include "oscillator.hpp"
+#include "parameter_store.hpp"
+#include "physical_piano.hpp"
+#include "sample_bank.hpp"
+#include "voice_kernels.hpp"
+#include <atomic>
+#include <vector>
+
+const int MAX_VOICES = 256;
+const int VOICES_PER_JOB = 8;           // Parallel mode renders voices in fixed groups of this many
+const int VOICE_JOBS = MAX_VOICES / VOICES_PER_JOB;
+const int MAX_BLOCK_FRAMES = 256;
+
+enum class NoteEventType
+{
+    NoteOn,
+    NoteOff,
+    SustainOn,
+    SustainOff,
+    AllNotesOff
+};
+
+// Each thread that posts events has a queue of its own, so no producer
+// waits on another; the audio thread takes them in time order
+enum class EventPort
+{
+    Ui,
+    Keys,       // Key input thread
+    Midi,       // MIDI input thread
+    Player,     // MIDI file player
+    Count
+};
+
+struct NoteEvent
+{
+    NoteEventType type;
+    int key;            // Identifies the note for note-off and retrigger; the pedal's MIDI channel
+    int sample;         // Sample bank index, note-on only
+    float pitch;        // MIDI note number for the oscillators, note-on only
+    float velocity;     // 0..1, note-on only
+    long long time;     // Output frame to apply the event at, 0 = as soon as possible
+    long long inputStamp;   // LatencyMonitor::Now() of the input, 0 = not measured
+};
+
+enum class SoundSource
+{
+    Samples,
+    Oscillators,
+    Physical,
+    Fm,
+    Count
+};
+
+struct Voice
+{
+    bool active = false;
+    bool held = false;          // Key is down
+    bool sustained = false;     // Key is up but the pedal keeps the note
+    bool stolen = false;        // Fading out to make room for other voices
+    int key = 0;
+    int sample = -1;
+    double position = 0.0;      // Read position in sample frames
+    double step = 1.0;          // Sample frames per output frame
+    float velocity = 1.0f;
+    float pan = 0.0f;
+    AdsrEnvelope envelope;
+    InterpolationKind interpolation = InterpolationKind::Cubic;
+    VoiceKernel kernel;
+};
+
+// Settings the UI changes a group at a time; the audio thread takes a whole
+// copy once per render call
+struct EngineParameters
+{
+    AdsrSettings envelope;
+    FilterSettings filter;
+    LimiterSettings limiter;
+};
+
+// Polyphonic sample player, wavetable and FM synthesisers and modelled
+// piano rendered on the audio thread. The UI and input threads only post
+// events; voices are started, released and reclaimed by Render().
+class SynthEngine
+{
+public:
+    void Prepare(const SampleBank* bank, int sampleRate);
+    int GetSampleRate() const { return m_SampleRate; }
+
+    // One thread per port. Timed events must be posted in time order on
+    // their port; anything in the past is applied at the start of the next
+    // block. Untimed note-ons are followed by the latency monitor from
+    // inputStamp, or from the call if no stamp is given. False, with
+    // nothing posted, while the port's queue is full.
+    bool NoteOn(int key, int sample, float pitch, float velocity = 1.0f, long long time = 0, long long inputStamp = 0,
+                EventPort port = EventPort::Ui);
+    bool NoteOff(int key, long long time = 0, EventPort port = EventPort::Ui);
+    bool SetSustainPedal(bool down, long long time = 0, EventPort port = EventPort::Ui, int channel = 0);
+    bool AllNotesOff(long long time = 0, EventPort port = EventPort::Ui);
+    // Posts refused for a full queue: lost, unless the poster retries
+    unsigned long long GetRefusedEvents() const { return m_RefusedEvents.load(std::memory_order_relaxed); }
+
+    // The events as the audio thread applied them, in order, each with the
+    // frame it took effect at as its time; for MIDI out. One reader thread.
+    // Kept only while enabled; when the reader falls behind by a full
+    // queue, later events are dropped.
+    void SetPlayedEventsEnabled(bool enabled) { m_KeepPlayed.store(enabled, std::memory_order_relaxed); }
+    bool PopPlayedEvent(NoteEvent& event) { return m_Played.Pop(event); }
+
+    // UI thread
+    void SetEnvelope(const AdsrSettings& settings);
+    const AdsrSettings& GetEnvelope() const { return m_UiParameters.envelope; }
+    void SetFilter(const FilterSettings& settings);    // Oscillator voices only
+    const FilterSettings& GetFilter() const { return m_UiParameters.filter; }
+    void SetLimiter(const LimiterSettings& settings);  // The master gain glides to a new setting
+    const LimiterSettings& GetLimiter() const { return m_UiParameters.limiter; }
+    float GetLimiterReduction() const { return m_Limiter.GetGainReduction(); }    // dB
+    int GetActiveVoiceCount() const { return m_ActiveVoices.load(std::memory_order_relaxed); }
+    long long GetFrameTime() const { return m_PublishedTime.load(std::memory_order_relaxed); }
+    void SetSoundSource(SoundSource source) { m_Source.store(source, std::memory_order_relaxed); }
+    SoundSource GetSoundSource() const { return m_Source.load(std::memory_order_relaxed); }
+    void SetWaveform(int table) { m_Waveform.store(table, std::memory_order_relaxed); }
+    int GetWaveform() const { return m_Waveform.load(std::memory_order_relaxed); }
+    void SetPhysicalQuality(PhysicalQuality quality) { m_PhysicalQuality.store(quality, std::memory_order_relaxed); }
+    PhysicalQuality GetPhysicalQuality() const { return m_PhysicalQuality.load(std::memory_order_relaxed); }
+    void SetFmPreset(int preset) { m_FmPreset.store(preset, std::memory_order_relaxed); }
+    int GetFmPreset() const { return m_FmPreset.load(std::memory_order_relaxed); }
+
+    // Sample voices in parallel: each group of VOICES_PER_JOB is mixed on
+    // its own and the groups are summed in order, so the output is the
+    // same bit for bit whatever the number of threads, none included. It
+    // differs from the serial mix only in rounding. Helper threads are
+    // started by Prepare(); setting the count takes effect there.
+    void SetVoiceThreads(int helpers) { m_VoiceHelpers = helpers; }
+    int GetVoiceThreads() const { return m_VoicePool.GetHelperCount(); }
+    void SetParallelVoices(bool enabled) { m_ParallelVoices.store(enabled, std::memory_order_relaxed); }
+    bool GetParallelVoices() const { return m_ParallelVoices.load(std::memory_order_relaxed); }
+    unsigned long long GetStolenVoiceJobs() const { return m_VoicePool.GetStolen(); }
+
+    // Each sound source is a layer: a node of the source graph, mixed with
+    // the others before the effects. When parallel voices are on and more
+    // than one layer is sounding, the layers render in parallel on a second
+    // pool, one helper per layer at most; the sample voices then run their
+    // jobs inline, so only one pool is ever busy. UI thread; a switched-off
+    // layer is left out of the schedule, costs nothing and holds its notes
+    // until it is switched back on. Takes effect at the next block.
+    void SetLayerEnabled(SoundSource layer, bool enabled);
+    bool IsLayerEnabled(SoundSource layer) const { return m_LayerEnabled[(int)layer]; }
+    const GraphShape& GetGraphShape() const { return m_GraphShape; }
+    static const char* GetLayerName(SoundSource layer);
+
+    // Custom tables may be added before Prepare(), which builds the
+    // standard ones if that has not happened yet
+    WavetableSet& GetWavetables() { return m_Wavetables; }
+    CpuGovernor& GetGovernor() { return m_Governor; }
+    EffectsChain& GetEffects() { return m_Effects; }
+    DenormalMonitor& GetDenormals() { return m_Denormals; }
+    LatencyMonitor& GetLatencyMonitor() { return m_Latency; }
+    DspTelemetry& GetTelemetry() { return m_Telemetry; }
+
+    // Audio thread, frames may be any size
+    void Render(float* outL, float* outR, int frames);
+
+private:
+    bool PostEvent(EventPort port, const NoteEvent& event);
+    const NoteEvent* PeekEvent(int& port) const;
+    void HandleEvent(const NoteEvent& event);
+    void StartVoice(const NoteEvent& event);
+    Voice* FindVoice(int key);
+    Voice* AllocateVoice();
+    Voice* FindQuietest(bool playingOnly);
+    bool StealQuietest();
+    void EnforceVoiceLimit();
+    void SelectKernel(Voice& voice);
+    void RenderVoice(Voice& voice, float* outL, float* outR, int frames, bool reselect);
+    static void RenderVoiceJob(void* user, int job);
+    static void RenderSampleLayer(void* user, float* outL, float* outR, int frames);
+    static void RenderOscillatorLayer(void* user, float* outL, float* outR, int frames);
+    static void RenderPhysicalLayer(void* user, float* outL, float* outR, int frames);
+    static void RenderFmLayer(void* user, float* outL, float* outR, int frames);
+    void RenderBlock(float* outL, float* outR, int frames);
+    void RebuildGraph();
+
+    const SampleBank* m_Bank = nullptr;
+    int m_SampleRate = 44100;
+    Voice m_Voices[MAX_VOICES];
+    bool m_SustainPedal = false;
+
+    SpscQueue<NoteEvent, 1024> m_Events[(int)EventPort::Count];    // A full chord of every voice, and then some
+    SpscQueue<NoteEvent, 1024> m_Played;
+    std::atomic<bool> m_KeepPlayed{ false };
+    std::atomic<unsigned long long> m_RefusedEvents{ 0 };
+    std::atomic<int> m_ActiveVoices{ 0 };
+    CpuGovernor m_Governor;
+    DenormalMonitor m_Denormals;
+    LatencyMonitor m_Latency;
+    DspTelemetry m_Telemetry;
+    DegradeLevel m_KernelLevel = DegradeLevel::Normal;     // Governor level the voice kernels were picked for
+
+    int m_VoiceHelpers = 0;
+    std::atomic<bool> m_ParallelVoices{ false };
+    JobPool m_VoicePool;
+    std::vector<float> m_JobMix;                // VOICE_JOBS stereo blocks, left then right
+    bool m_JobUsed[VOICE_JOBS] = {};
+    int m_JobFrames = 0;
+    bool m_JobReselect = false;
+
+    SourceNode m_Layers[(int)SoundSource::Count] = {
+        { "Sample voices", RenderSampleLayer, this },
+        { "Oscillators", RenderOscillatorLayer, this },
+        { "Physical piano", RenderPhysicalLayer, this },
+        { "FM", RenderFmLayer, this }
+    };
+    MixNode m_LayerMix{ "Layer mix", PortType::Stereo, (int)SoundSource::Count };
+    bool m_LayerEnabled[(int)SoundSource::Count] = { true, true, true, true };     // UI thread
+    GraphShape m_GraphShape;                    // UI thread, of the last schedule published
+    GraphSchedule m_Schedule;
+    JobPool m_LayerPool;
+    bool m_LayersParallel = false;              // This block's layers run on m_LayerPool
+
+    long long m_FrameTime = 0;      // Output frames rendered so far
+    std::atomic<long long> m_PublishedTime{ 0 };
+    std::atomic<SoundSource> m_Source{ SoundSource::Samples };
+    std::atomic<int> m_Waveform{ (int)Waveform::Saw };
+    WavetableSet m_Wavetables;
+    OscillatorEngine m_Oscillators;
+    std::atomic<PhysicalQuality> m_PhysicalQuality{ PhysicalQuality::Medium };
+    PhysicalPianoEngine m_Physical;
+    std::atomic<int> m_FmPreset{ 0 };
+    FmEngine m_Fm;
+    EffectsChain m_Effects;
+    Limiter m_Limiter;
+
+    EngineParameters m_UiParameters;                // UI thread
+    SnapshotBuffer<EngineParameters> m_Parameters;
+};
@@ -0,0 +1,334 @@
+#include "thread_scheduling.hpp"
+#include "audio_backend.hpp"
+#include "sample_bank.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <avrt.h>
+#pragma comment(lib, "avrt.lib")
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+// Taken when threads start and by the UI, never on the render path
+static std::mutex g_Mutex;
+static ThreadSchedulingSettings g_Settings;
+static std::vector<ThreadSchedulingResult> g_Results;
+static std::string g_MemoryLock = "not attempted";
+
+const char* GetSchedulingPolicyName(SchedulingPolicy policy)
+{
+    switch (policy)
+    {
+    case SchedulingPolicy::Normal: return "off";
+    case SchedulingPolicy::Fifo: return "fifo";
+    case SchedulingPolicy::RoundRobin: return "rr";
+    default: return "?";
+    }
+}
+
+void SetThreadScheduling(const ThreadSchedulingSettings& settings)
+{
+    std::lock_guard<std::mutex> lock(g_Mutex);
+    g_Settings = settings;
+}
+
+ThreadSchedulingSettings GetThreadScheduling()
+{
+    std::lock_guard<std::mutex> lock(g_Mutex);
+    return g_Settings;
+}
+
+static void AddError(std::string& errors, const std::string& error)
+{
+    if (!errors.empty())
+        errors += "; ";
+    errors += error;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Platform parts, each true if everything asked for was granted
+
+#ifdef _WIN32
+static bool ApplyPolicy(ThreadRole role, int, ThreadSchedulingResult& result)
+{
+    // MMCSS raises the thread above normal applications without admin
+    // rights and keeps it there while the process is in the foreground
+    DWORD index = 0;
+    HANDLE task = AvSetMmThreadCharacteristicsW(L"Pro Audio", &index);
+    if (task)
+    {
+        bool audio = role == ThreadRole::Audio;
+        AvSetMmThreadPriority(task, audio ? AVRT_PRIORITY_CRITICAL : AVRT_PRIORITY_HIGH);
+        result.scheduling = audio ? "MMCSS Pro Audio, critical" : "MMCSS Pro Audio, high";
+        return true;
+    }
+
+    // The Multimedia Class Scheduler service is disabled on some servers
+    DWORD error = GetLastError();
+    bool raised = SetThreadPriority(GetCurrentThread(), role == ThreadRole::Audio ? THREAD_PRIORITY_TIME_CRITICAL : THREAD_PRIORITY_HIGHEST) != 0;
+    result.scheduling = !raised ? "normal" : role == ThreadRole::Audio ? "time critical" : "highest";
+    AddError(result.error, "MMCSS refused, error " + std::to_string(error));
+    return false;
+}
+#else
+static bool ApplyPolicy(ThreadRole, int priority, ThreadSchedulingResult& result)
+{
+    const SchedulingPolicy requested = g_Settings.policy;
+    const int policy = requested == SchedulingPolicy::RoundRobin ? SCHED_RR : SCHED_FIFO;
+    const char* name = requested == SchedulingPolicy::RoundRobin ? "SCHED_RR" : "SCHED_FIFO";
+
+    sched_param param = {};
+    param.sched_priority = std::min(sched_get_priority_max(policy), std::max(sched_get_priority_min(policy), priority));
+    int error = pthread_setschedparam(pthread_self(), policy, &param);
+
+    // Without CAP_SYS_NICE the rtprio limit is the ceiling; take what it allows
+    struct rlimit limit;
+    if (error == EPERM && getrlimit(RLIMIT_RTPRIO, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur > 0 &&
+        (rlim_t)param.sched_priority > limit.rlim_cur)
+    {
+        param.sched_priority = (int)limit.rlim_cur;
+        error = pthread_setschedparam(pthread_self(), policy, &param);
+        if (error == 0)
+            AddError(result.error, "priority capped at " + std::to_string(param.sched_priority) + " by RLIMIT_RTPRIO");
+    }
+
+    if (error != 0)
+    {
+        result.scheduling = "normal";
+        std::string reason = std::string(name) + " refused: " + strerror(error);
+        if (error == EPERM)
+            reason += " (needs CAP_SYS_NICE or an rtprio limit, e.g. \"@audio - rtprio 95\" in limits.conf)";
+        AddError(result.error, reason);
+        return false;
+    }
+    result.scheduling = std::string(name) + " " + std::to_string(param.sched_priority);
+    return result.error.empty();
+}
+#endif
+
+static bool ApplyAffinity(int cpu, ThreadSchedulingResult& result)
+{
+    result.affinity = "any";
+    if (cpu < 0)
+        return true;
+
+#if defined(_WIN32)
+    bool pinned = cpu < (int)(sizeof(DWORD_PTR) * 8) && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+    bool pinned = false;
+    if (cpu < CPU_SETSIZE)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+    }
+#else
+    bool pinned = false;
+#endif
+    if (!pinned)
+    {
+        AddError(result.error, "cannot pin to cpu " + std::to_string(cpu));
+        return false;
+    }
+    result.affinity = "cpu " + std::to_string(cpu);
+    return true;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+
+bool PromoteCurrentThread(ThreadRole role, const char* name)
+{
+    std::lock_guard<std::mutex> lock(g_Mutex);
+    const ThreadSchedulingSettings& settings = g_Settings;
+
+    // A restarted thread keeps its record, and with it its worker CPU
+    int slot = (int)g_Results.size();
+    int workerIndex = 0;
+    for (int i = 0; i < (int)g_Results.size(); ++i)
+    {
+        if (g_Results[i].name == name)
+        {
+            slot = i;
+            break;
+        }
+        if (g_Results[i].role == ThreadRole::Worker)
+            ++workerIndex;
+    }
+    if (slot == (int)g_Results.size())
+        g_Results.emplace_back();
+
+    ThreadSchedulingResult result;
+    result.name = name;
+    result.role = role;
+    bool granted = true;
+    if (settings.policy == SchedulingPolicy::Normal)
+        result.scheduling = "normal";
+    else
+    {
+        int priority = role == ThreadRole::Worker && settings.workerPriority > 0 ? settings.workerPriority : settings.priority;
+        granted = ApplyPolicy(role, priority, result);
+    }
+
+    int cpu = settings.audioCpu;
+    if (role == ThreadRole::Worker)
+        cpu = settings.workerCpus.empty() ? -1 : settings.workerCpus[workerIndex % settings.workerCpus.size()];
+    granted = ApplyAffinity(cpu, result) && granted;
+
+    g_Results[slot] = result;
+    return granted;
+}
+
+bool LockSampleMemory(const SampleBank& bank)
+{
+    std::lock_guard<std::mutex> lock(g_Mutex);
+    if (!g_Settings.lockMemory)
+    {
+        g_MemoryLock = "not requested";
+        return true;
+    }
+
+    const size_t bytes = bank.GetMemoryBytes();
+    const double megabytes = bytes / (1024.0 * 1024.0);
+    int locked = 0;
+#ifdef _WIN32
+    // VirtualLock() is bounded by the working set minimum; grow it by the bank
+    SIZE_T minimum = 0, maximum = 0;
+    if (GetProcessWorkingSetSize(GetCurrentProcess(), &minimum, &maximum))
+        SetProcessWorkingSetSize(GetCurrentProcess(), minimum + bytes, std::max(maximum, minimum + bytes));
+    DWORD error = 0;
+    for (int i = 0; i < bank.GetCount(); ++i)
+    {
+        const std::vector<float>& data = bank.Get(i).data;
+        if (data.empty() || VirtualLock((void*)data.data(), data.size() * sizeof(float)))
+            ++locked;
+        else
+            error = GetLastError();
+    }
+    if (locked == bank.GetCount())
+    {
+        g_MemoryLock = "sample bank locked (" + std::to_string((int)(megabytes + 0.5)) + " MB)";
+        return true;
+    }
+    g_MemoryLock = "VirtualLock refused, error " + std::to_string(error);
+#else
+    // Everything mapped now: the bank, the code and the stacks. MCL_FUTURE
+    // is left out, under a memlock limit it would turn later allocations
+    // into failures.
+    if (mlockall(MCL_CURRENT) == 0)
+    {
+        g_MemoryLock = "all memory locked, " + std::to_string((int)(megabytes + 0.5)) + " MB of samples";
+        return true;
+    }
+    g_MemoryLock = std::string("mlockall refused: ") + strerror(errno);
+
+    // A limit too small for the process may still hold the bank
+    for (int i = 0; i < bank.GetCount(); ++i)
+    {
+        const std::vector<float>& data = bank.Get(i).data;
+        if (data.empty() || mlock(data.data(), data.size() * sizeof(float)) == 0)
+            ++locked;
+    }
+    if (locked == bank.GetCount())
+    {
+        g_MemoryLock += "; sample bank locked on its own";
+        return true;
+    }
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        g_MemoryLock += " (RLIMIT_MEMLOCK " + std::to_string((unsigned long long)limit.rlim_cur / 1024) + " kB)";
+#endif
+    g_MemoryLock += "; " + std::to_string(locked) + " of " + std::to_string(bank.GetCount()) + " samples locked";
+    return false;
+}
+
+std::vector<ThreadSchedulingResult> GetSchedulingResults()
+{
+    std::lock_guard<std::mutex> lock(g_Mutex);
+    return g_Results;
+}
+
+std::string GetMemoryLockResult()
+{
+    std::lock_guard<std::mutex> lock(g_Mutex);
+    return g_MemoryLock;
+}
+
+void PrintSchedulingReport(FILE* file)
+{
+    fprintf(file, "Thread scheduling (%s requested)\n", GetSchedulingPolicyName(GetThreadScheduling().policy));
+    for (const ThreadSchedulingResult& result : GetSchedulingResults())
+    {
+        fprintf(file, "  %-20s %s, %s\n", result.name.c_str(), result.scheduling.c_str(), result.affinity.c_str());
+        if (!result.error.empty())
+            fprintf(file, "  %-20s %s\n", "", result.error.c_str());
+    }
+    fprintf(file, "  %-20s %s\n", "memory", GetMemoryLockResult().c_str());
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+
+static bool ParsePolicy(const char* name, SchedulingPolicy& policy)
+{
+    for (int p = 0; p < (int)SchedulingPolicy::Count; ++p)
+    {
+        if (strcmp(name, GetSchedulingPolicyName((SchedulingPolicy)p)) == 0)
+        {
+            policy = (SchedulingPolicy)p;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Comma separated CPU numbers
+static bool ParseCpuList(const char* text, std::vector<int>& cpus)
+{
+    cpus.clear();
+    while (*text)
+    {
+        char* end;
+        long cpu = strtol(text, &end, 10);
+        if (end == text || cpu < 0 || cpu > 1023 || (*end != ',' && *end != 0))
+            return false;
+        cpus.push_back((int)cpu);
+        text = *end ? end + 1 : end;
+    }
+    return !cpus.empty();
+}
+
+bool ParseSchedulingArguments(int argc, char** argv, ThreadSchedulingSettings& settings)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* value;
+        bool valid = true;
+        if ((value = GetOptionValue(argv[i], "--rt")))
+            valid = ParsePolicy(value, settings.policy);
+        else if ((value = GetOptionValue(argv[i], "--rt-priority")))
+            valid = ParseCount(value, 1, 99, settings.priority);
+        else if ((value = GetOptionValue(argv[i], "--rt-worker-priority")))
+            valid = ParseCount(value, 1, 99, settings.workerPriority);
+        else if ((value = GetOptionValue(argv[i], "--audio-cpu")))
+            valid = ParseCount(value, 0, 1023, settings.audioCpu);
+        else if ((value = GetOptionValue(argv[i], "--worker-cpus")))
+            valid = ParseCpuList(value, settings.workerCpus);
+        else if (strcmp(argv[i], "--no-mlock") == 0)
+            settings.lockMemory = false;
+        if (!valid)
+        {
+            fprintf(stderr, "Bad scheduling option %s\n", argv[i]);
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+class SampleBank;
+
+// Linux scheduling classes; on Windows anything but Normal joins the MMCSS
+// "Pro Audio" task, which has no FIFO/RR distinction
+enum class SchedulingPolicy
+{
+    Normal,
+    Fifo,
+    RoundRobin,
+    Count
+};
+
+enum class ThreadRole
+{
+    Audio,      // Drives the render callback
+    Worker      // Helps the audio thread meet the same deadline
+};
+
+struct ThreadSchedulingSettings
+{
+    SchedulingPolicy policy = SchedulingPolicy::Fifo;
+    int priority = 70;                  // Audio threads, 1..99
+    int workerPriority = 0;             // 0 = same as the audio threads, see PromoteCurrentThread()
+    int audioCpu = -1;                  // -1 = not pinned
+    std::vector<int> workerCpus;        // Workers pinned round robin in start order; empty = not pinned
+    bool lockMemory = true;             // Keep the sample bank resident
+};
+
+// What one thread asked for and what it got
+struct ThreadSchedulingResult
+{
+    std::string name;
+    ThreadRole role = ThreadRole::Audio;
+    std::string scheduling;             // e.g. "SCHED_FIFO 70", "MMCSS Pro Audio", "normal"
+    std::string affinity;               // e.g. "cpu 2", "any"
+    std::string error;                  // Why less was granted than asked, empty if nothing
+};
+
+// Process-wide, set before the backend and the effects start their threads
+void SetThreadScheduling(const ThreadSchedulingSettings& settings);
+ThreadSchedulingSettings GetThreadScheduling();
+
+// Called by each audio and worker thread when it starts, outside the
+// render path. Whatever is not permitted falls back to normal scheduling
+// and is recorded; false if anything was refused. Workers run at the
+// audio priority by default because the audio thread yields to them when
+// they fall behind, and yielding only reaches threads of equal priority.
+bool PromoteCurrentThread(ThreadRole role, const char* name);
+
+// Pins the bank's pages in memory so a note never waits for a page fault.
+// False, with the reason in the report, if the lock was refused.
+bool LockSampleMemory(const SampleBank& bank);
+
+// Latest result per thread name, and of the memory lock
+std::vector<ThreadSchedulingResult> GetSchedulingResults();
+std::string GetMemoryLockResult();
+void PrintSchedulingReport(FILE* file);
+
+// Reads --rt=fifo|rr|off, --rt-priority=, --rt-worker-priority=,
+// --audio-cpu=, --worker-cpus=a,b,... and --no-mlock; other arguments are
+// left alone. False on a bad value.
+bool ParseSchedulingArguments(int argc, char** argv, ThreadSchedulingSettings& settings);
+const char* GetSchedulingPolicyName(SchedulingPolicy policy);
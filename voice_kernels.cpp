@@ -0,0 +1,115 @@
+#include "voice_kernels.hpp"
+#include <algorithm>
+
+// Interpolated frames are produced in chunks this size between source read
+// and mix
+static const int VOICE_CHUNK_FRAMES = 64;
+
+VoiceKernel SelectVoiceKernel(InterpolationKind kind, int channels, bool unityStep, SimdLevel level)
+{
+    VoiceKernel kernel;
+    kernel.resample = unityStep ? nullptr : GetResampleFunction(kind, level);
+    kernel.layout = channels >= 2 ? VoiceLayout::StereoPlanar : VoiceLayout::Mono;
+    kernel.mix = GetMixVoiceFunction(kernel.layout, level);
+    return kernel;
+}
+
+int RenderVoiceBlock(const VoiceKernel& kernel, const VoiceBlock& block)
+{
+    const SampleData& sample = *block.sample;
+    const int channels = std::min(sample.channels, 2);
+
+    if (!kernel.resample)
+    {
+        // Unity step: mix straight from the sample memory
+        int start = (int)*block.position;
+        int frames = std::max(0, std::min(block.frames, sample.frames - start));
+        if (frames > 0)
+        {
+            float gainEnd = block.gainStart + (block.gainEnd - block.gainStart) * frames / block.frames;
+            MixVoice voice = { sample.Channel(0) + start, channels > 1 ? sample.Channel(1) + start : nullptr,
+                               kernel.layout, block.gainStart, gainEnd, block.pan, block.pan };
+            kernel.mix(voice, block.outL, block.outR, frames);
+        }
+        *block.position += frames;
+        return frames;
+    }
+
+    alignas(32) float chunk[2][VOICE_CHUNK_FRAMES];
+    const float slope = (block.gainEnd - block.gainStart) / block.frames;
+    int rendered = 0;
+    while (rendered < block.frames)
+    {
+        int wanted = std::min(VOICE_CHUNK_FRAMES, block.frames - rendered);
+        int frames = 0;
+        double position = *block.position;
+        for (int c = 0; c < channels; ++c)
+        {
+            position = *block.position;
+            ResampleArgs args = { sample.Channel(c), sample.frames, &position, block.step, chunk[c], wanted, nullptr };
+            frames = kernel.resample(args);
+        }
+        *block.position = position;
+
+        if (frames > 0)
+        {
+            MixVoice voice = { chunk[0], chunk[1], kernel.layout,
+                               block.gainStart + slope * rendered, block.gainStart + slope * (rendered + frames),
+                               block.pan, block.pan };
+            kernel.mix(voice, block.outL + rendered, block.outR + rendered, frames);
+        }
+        rendered += frames;
+        if (frames < wanted)
+            break;
+    }
+    return rendered;
+}
+
+int RenderVoiceGeneric(const VoiceBlock& block, InterpolationKind kind)
+{
+    const SampleData& sample = *block.sample;
+    float panLeft, panRight;
+    PanGains(1.0f, block.pan, panLeft, panRight);
+
+    int i = 0;
+    for (; i < block.frames; ++i)
+    {
+        // Every decision the specialised kernels make at note-on is made here
+        // for every frame: source kind, interpolation kernel, channel layout
+        float frame[2] = { 0.0f, 0.0f };
+        int read = 0;
+        double position = *block.position;
+        for (int c = 0; c < std::min(sample.channels, 2); ++c)
+        {
+            position = *block.position;
+            if (block.step == 1.0 && position == (double)(int)position)
+            {
+                read = (int)position < sample.frames ? 1 : 0;
+                frame[c] = read ? sample.Channel(c)[(int)position] : 0.0f;
+                position += read;
+            }
+            else
+            {
+                ResampleArgs args = { sample.Channel(c), sample.frames, &position, block.step, &frame[c], 1, nullptr };
+                read = GetResampleFunction(kind, SimdLevel::Scalar)(args);
+            }
+        }
+        if (!read)
+            break;
+        *block.position = position;
+
+        float gain = block.gainStart + (block.gainEnd - block.gainStart) * i / block.frames;
+        switch (sample.channels)
+        {
+        case 1:
+            block.outL[i] += frame[0] * gain * panLeft;
+            block.outR[i] += frame[0] * gain * panRight;
+            break;
+        default:
+            block.outL[i] += frame[0] * gain * panLeft;
+            block.outR[i] += frame[1] * gain * panRight;
+            break;
+        }
+    }
+    return i;
+}
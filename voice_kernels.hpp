@@ -0,0 +1,41 @@
+#pragma once
+
+#include "interpolation.hpp"
+#include "mixer.hpp"
+#include "sample_bank.hpp"
+
+// Render path of one sample voice: source read (plain copy or interpolation)
+// followed by the gain/pan mix, both template instantiations picked once at
+// note-on. Rendering goes through a small chunk buffer that stays in L1, so
+// no per-voice block buffers are needed.
+
+struct VoiceKernel
+{
+    ResampleFn resample = nullptr;      // nullptr = plain copy at unity step
+    MixVoiceFn mix = nullptr;
+    VoiceLayout layout = VoiceLayout::Mono;
+};
+
+struct VoiceBlock
+{
+    const SampleData* sample;
+    double* position;       // Sample frames, advanced by the render
+    double step;
+    float gainStart;        // Envelope x velocity at the first frame
+    float gainEnd;          // ... and at the frame after the last one
+    float pan;
+    float* outL;
+    float* outR;
+    int frames;
+};
+
+// unityStep: the voice reads at the output rate from an integral position
+VoiceKernel SelectVoiceKernel(InterpolationKind kind, int channels, bool unityStep, SimdLevel level);
+
+// Adds the voice to the output, returns the frames rendered before the
+// sample ended
+int RenderVoiceBlock(const VoiceKernel& kernel, const VoiceBlock& block);
+
+// Same output with every choice made per sample; the baseline the
+// specialised kernels are benchmarked against
+int RenderVoiceGeneric(const VoiceBlock& block, InterpolationKind kind);
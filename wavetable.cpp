@@ -0,0 +1,451 @@
+#include "wavetable.hpp"
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+
+// Phase layout: the top WAVETABLE_SIZE_BITS select the sample, the rest is
+// the interpolation fraction
+static const int FRAC_BITS = 32 - WAVETABLE_SIZE_BITS;
+static const uint32_t FRAC_MASK = (1u << FRAC_BITS) - 1;
+static const float FRAC_SCALE = 1.0f / (float)(1u << FRAC_BITS);
+
+// Highest harmonic stored in a mip level
+static int LevelHarmonics(int level)
+{
+    int harmonics = (WAVETABLE_SIZE / 2) >> level;
+    return harmonics < WAVETABLE_SIZE / 2 ? harmonics : WAVETABLE_SIZE / 2 - 1;
+}
+
+void WavetableSet::Build()
+{
+    m_Data.clear();
+    m_Names.clear();
+
+    const int harmonics = LevelHarmonics(0);
+    std::vector<float> sine(1, 1.0f);
+    std::vector<float> saw(harmonics), square(harmonics, 0.0f), triangle(harmonics, 0.0f);
+    for (int k = 1; k <= harmonics; ++k)
+    {
+        saw[k - 1] = (k & 1 ? 1.0f : -1.0f) / k;
+        if (k & 1)
+        {
+            square[k - 1] = 1.0f / k;
+            triangle[k - 1] = ((k / 2) & 1 ? -1.0f : 1.0f) / ((float)k * k);
+        }
+    }
+
+    AddFromHarmonics("Sine", sine);
+    AddFromHarmonics("Saw", saw);
+    AddFromHarmonics("Square", square);
+    AddFromHarmonics("Triangle", triangle);
+}
+
+int WavetableSet::AddFromHarmonics(const std::string& name, const std::vector<float>& amplitudes)
+{
+    std::vector<float> coefficients(2 * amplitudes.size(), 0.0f);
+    for (size_t k = 0; k < amplitudes.size(); ++k)
+        coefficients[2 * k] = amplitudes[k];
+    AddTable(name, coefficients);
+    return GetCount() - 1;
+}
+
+int WavetableSet::AddFromCycle(const std::string& name, const float* cycle, int length)
+{
+    // Plain DFT; tables are built once at startup
+    int harmonics = length / 2 - 1;
+    if (harmonics > LevelHarmonics(0))
+        harmonics = LevelHarmonics(0);
+
+    std::vector<float> coefficients(2 * (harmonics > 0 ? harmonics : 0), 0.0f);
+    for (int k = 1; k <= harmonics; ++k)
+    {
+        double s = 0.0, c = 0.0;
+        for (int n = 0; n < length; ++n)
+        {
+            double angle = 2.0 * PI * k * n / length;
+            s += cycle[n] * std::sin(angle);
+            c += cycle[n] * std::cos(angle);
+        }
+        coefficients[2 * (k - 1)] = (float)(2.0 * s / length);
+        coefficients[2 * (k - 1) + 1] = (float)(2.0 * c / length);
+    }
+    AddTable(name, coefficients);
+    return GetCount() - 1;
+}
+
+// coefficients holds sine, cosine pairs per harmonic
+void WavetableSet::AddTable(const std::string& name, std::vector<float> coefficients)
+{
+    // Index arithmetic on one period of sine keeps the synthesis exact and
+    // avoids millions of sin() calls
+    static std::vector<double> s_Sine;
+    if (s_Sine.empty())
+    {
+        s_Sine.resize(WAVETABLE_SIZE);
+        for (int i = 0; i < WAVETABLE_SIZE; ++i)
+            s_Sine[i] = std::sin(2.0 * PI * i / WAVETABLE_SIZE);
+    }
+
+    size_t base = m_Data.size();
+    m_Data.resize(base + (size_t)WAVETABLE_LEVELS * WAVETABLE_STRIDE, 0.0f);
+    const int mask = WAVETABLE_SIZE - 1;
+    const int count = (int)coefficients.size() / 2;
+
+    std::vector<double> cycle(WAVETABLE_SIZE);
+    double peak = 0.0;
+    for (int level = 0; level < WAVETABLE_LEVELS; ++level)
+    {
+        int harmonics = LevelHarmonics(level) < count ? LevelHarmonics(level) : count;
+        for (int n = 0; n < WAVETABLE_SIZE; ++n)
+        {
+            double value = 0.0;
+            for (int k = 1; k <= harmonics; ++k)
+            {
+                int index = k * n;
+                value += coefficients[2 * (k - 1)] * s_Sine[index & mask]
+                    + coefficients[2 * (k - 1) + 1] * s_Sine[(index + WAVETABLE_SIZE / 4) & mask];
+            }
+            cycle[n] = value;
+        }
+
+        // Level 0 has the most harmonics and the largest overshoot; scaling
+        // every level by it keeps the loudness equal across the keyboard
+        if (level == 0)
+        {
+            for (double value : cycle)
+                peak = std::fabs(value) > peak ? std::fabs(value) : peak;
+            if (peak == 0.0)
+                peak = 1.0;
+        }
+
+        float* dst = &m_Data[base + (size_t)level * WAVETABLE_STRIDE];
+        for (int n = 0; n < WAVETABLE_STRIDE; ++n)
+            dst[n] = (float)(cycle[n & mask] / peak);
+    }
+    m_Names.push_back(name);
+}
+
+int WavetableSet::GetOffset(int table, double increment) const
+{
+    // Lowest level whose top harmonic still fits below Nyquist
+    int level = 0;
+    while (level + 1 < WAVETABLE_LEVELS && LevelHarmonics(level) * increment > 0.5)
+        ++level;
+    return (table * WAVETABLE_LEVELS + level) * WAVETABLE_STRIDE;
+}
+
+//-------------------------------------------------------------------------------------------------------------------------------------
+// Kernels, instantiated per filter mode so the unfiltered path pays nothing
+
+template<FilterMode Mode>
+static void OscillatorScalar(const OscillatorLanes& lanes, float* outL, float* outR, int frames)
+{
+    const SvfLanes& filter = lanes.filter;
+    for (int v = 0; v < lanes.count; ++v)
+    {
+        float gain = lanes.gain[v];
+        float step = lanes.gainStep[v];
+        if (gain == 0.0f && step == 0.0f)
+            continue;
+
+        const float* table = lanes.tables + lanes.offset[v];
+        uint32_t phase = lanes.phase[v];
+        uint32_t increment = lanes.increment[v];
+        float left = lanes.panLeft[v];
+        float right = lanes.panRight[v];
+        float ic1 = 0.0f, ic2 = 0.0f, g = 0.0f, k = 0.0f, gTarget = 0.0f, kTarget = 0.0f;
+        if (Mode != FilterMode::Off)
+        {
+            ic1 = filter.ic1[v];
+            ic2 = filter.ic2[v];
+            g = filter.g[v];
+            k = filter.k[v];
+            gTarget = filter.gTarget[v];
+            kTarget = filter.kTarget[v];
+        }
+
+        for (int i = 0; i < frames; ++i)
+        {
+            uint32_t index = phase >> FRAC_BITS;
+            float frac = (float)(phase & FRAC_MASK) * FRAC_SCALE;
+            float a = table[index];
+            float s = a + (table[index + 1] - a) * frac;
+            if (Mode != FilterMode::Off)
+            {
+                g += (gTarget - g) * filter.smoothing;
+                k += (kTarget - k) * filter.smoothing;
+                s = SvfTick<Mode>(s, ic1, ic2, g, k);
+            }
+            s *= gain;
+            outL[i] += s * left;
+            outR[i] += s * right;
+            gain += step;
+            phase += increment;
+        }
+        lanes.phase[v] = phase;
+        lanes.gain[v] = gain;
+        if (Mode != FilterMode::Off)
+        {
+            filter.ic1[v] = ic1;
+            filter.ic2[v] = ic2;
+            filter.g[v] = g;
+            filter.k[v] = k;
+        }
+    }
+}
+
+#if SYNTH_X86
+
+// Lanes hold one voice each, so the kernels accumulate per-lane sums for a
+// chunk of frames and fold the lanes into the output once per frame at the end
+static const int CHUNK_FRAMES = 64;
+
+static bool LanesSilent(const OscillatorLanes& lanes, int first, int width)
+{
+    for (int v = first; v < first + width; ++v)
+    {
+        if (lanes.gain[v] != 0.0f || lanes.gainStep[v] != 0.0f)
+            return false;
+    }
+    return true;
+}
+
+// SvfTick for 4 lanes
+template<FilterMode Mode>
+SYNTH_TARGET_SSE2 static inline __m128 SvfTickSSE2(__m128 v0, __m128& ic1, __m128& ic2, __m128 g, __m128 k)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 a1 = _mm_div_ps(one, _mm_add_ps(one, _mm_mul_ps(g, _mm_add_ps(g, k))));
+    __m128 a2 = _mm_mul_ps(g, a1);
+    __m128 a3 = _mm_mul_ps(g, a2);
+    __m128 v3 = _mm_sub_ps(v0, ic2);
+    __m128 v1 = _mm_add_ps(_mm_mul_ps(a1, ic1), _mm_mul_ps(a2, v3));
+    __m128 v2 = _mm_add_ps(ic2, _mm_add_ps(_mm_mul_ps(a2, ic1), _mm_mul_ps(a3, v3)));
+    ic1 = _mm_sub_ps(_mm_add_ps(v1, v1), ic1);
+    ic2 = _mm_sub_ps(_mm_add_ps(v2, v2), ic2);
+    if (Mode == FilterMode::LowPass)
+        return v2;
+    if (Mode == FilterMode::BandPass)
+        return v1;
+    return _mm_sub_ps(_mm_sub_ps(v0, _mm_mul_ps(k, v1)), v2);
+}
+
+// SvfTick for 8 lanes
+template<FilterMode Mode>
+SYNTH_TARGET_AVX2 static inline __m256 SvfTickAVX2(__m256 v0, __m256& ic1, __m256& ic2, __m256 g, __m256 k)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    __m256 a1 = _mm256_div_ps(one, _mm256_add_ps(one, _mm256_mul_ps(g, _mm256_add_ps(g, k))));
+    __m256 a2 = _mm256_mul_ps(g, a1);
+    __m256 a3 = _mm256_mul_ps(g, a2);
+    __m256 v3 = _mm256_sub_ps(v0, ic2);
+    __m256 v1 = _mm256_add_ps(_mm256_mul_ps(a1, ic1), _mm256_mul_ps(a2, v3));
+    __m256 v2 = _mm256_add_ps(ic2, _mm256_add_ps(_mm256_mul_ps(a2, ic1), _mm256_mul_ps(a3, v3)));
+    ic1 = _mm256_sub_ps(_mm256_add_ps(v1, v1), ic1);
+    ic2 = _mm256_sub_ps(_mm256_add_ps(v2, v2), ic2);
+    if (Mode == FilterMode::LowPass)
+        return v2;
+    if (Mode == FilterMode::BandPass)
+        return v1;
+    return _mm256_sub_ps(_mm256_sub_ps(v0, _mm256_mul_ps(k, v1)), v2);
+}
+
+template<FilterMode Mode>
+SYNTH_TARGET_SSE2 static void OscillatorSSE2(const OscillatorLanes& lanes, float* outL, float* outR, int frames)
+{
+    alignas(16) float accL[CHUNK_FRAMES * 4];
+    alignas(16) float accR[CHUNK_FRAMES * 4];
+    alignas(16) int32_t index[4];
+    const __m128i fracMask = _mm_set1_epi32((int)FRAC_MASK);
+    const __m128 fracScale = _mm_set1_ps(FRAC_SCALE);
+    const SvfLanes& filter = lanes.filter;
+    const __m128 smoothing = _mm_set1_ps(filter.smoothing);
+
+    for (int start = 0; start < frames; start += CHUNK_FRAMES)
+    {
+        int chunk = frames - start < CHUNK_FRAMES ? frames - start : CHUNK_FRAMES;
+        for (int i = 0; i < chunk * 4; i += 4)
+        {
+            _mm_store_ps(accL + i, _mm_setzero_ps());
+            _mm_store_ps(accR + i, _mm_setzero_ps());
+        }
+
+        for (int v = 0; v < lanes.count; v += 4)
+        {
+            if (LanesSilent(lanes, v, 4))
+                continue;
+
+            __m128i phase = _mm_loadu_si128((const __m128i*)(lanes.phase + v));
+            __m128i increment = _mm_loadu_si128((const __m128i*)(lanes.increment + v));
+            __m128i offset = _mm_loadu_si128((const __m128i*)(lanes.offset + v));
+            __m128 gain = _mm_loadu_ps(lanes.gain + v);
+            __m128 step = _mm_loadu_ps(lanes.gainStep + v);
+            __m128 left = _mm_loadu_ps(lanes.panLeft + v);
+            __m128 right = _mm_loadu_ps(lanes.panRight + v);
+            __m128 ic1 = _mm_setzero_ps(), ic2 = _mm_setzero_ps(), g = _mm_setzero_ps(), k = _mm_setzero_ps();
+            __m128 gTarget = _mm_setzero_ps(), kTarget = _mm_setzero_ps();
+            if (Mode != FilterMode::Off)
+            {
+                ic1 = _mm_loadu_ps(filter.ic1 + v);
+                ic2 = _mm_loadu_ps(filter.ic2 + v);
+                g = _mm_loadu_ps(filter.g + v);
+                k = _mm_loadu_ps(filter.k + v);
+                gTarget = _mm_loadu_ps(filter.gTarget + v);
+                kTarget = _mm_loadu_ps(filter.kTarget + v);
+            }
+            const float* t = lanes.tables;
+
+            for (int i = 0; i < chunk; ++i)
+            {
+                _mm_store_si128((__m128i*)index, _mm_add_epi32(_mm_srli_epi32(phase, FRAC_BITS), offset));
+                __m128 a = _mm_setr_ps(t[index[0]], t[index[1]], t[index[2]], t[index[3]]);
+                __m128 b = _mm_setr_ps(t[index[0] + 1], t[index[1] + 1], t[index[2] + 1], t[index[3] + 1]);
+                __m128 frac = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(phase, fracMask)), fracScale);
+                __m128 s = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), frac));
+                if (Mode != FilterMode::Off)
+                {
+                    g = _mm_add_ps(g, _mm_mul_ps(_mm_sub_ps(gTarget, g), smoothing));
+                    k = _mm_add_ps(k, _mm_mul_ps(_mm_sub_ps(kTarget, k), smoothing));
+                    s = SvfTickSSE2<Mode>(s, ic1, ic2, g, k);
+                }
+                s = _mm_mul_ps(s, gain);
+                _mm_store_ps(accL + 4 * i, _mm_add_ps(_mm_load_ps(accL + 4 * i), _mm_mul_ps(s, left)));
+                _mm_store_ps(accR + 4 * i, _mm_add_ps(_mm_load_ps(accR + 4 * i), _mm_mul_ps(s, right)));
+                gain = _mm_add_ps(gain, step);
+                phase = _mm_add_epi32(phase, increment);
+            }
+
+            _mm_storeu_si128((__m128i*)(lanes.phase + v), phase);
+            _mm_storeu_ps(lanes.gain + v, gain);
+            if (Mode != FilterMode::Off)
+            {
+                _mm_storeu_ps(filter.ic1 + v, ic1);
+                _mm_storeu_ps(filter.ic2 + v, ic2);
+                _mm_storeu_ps(filter.g + v, g);
+                _mm_storeu_ps(filter.k + v, k);
+            }
+        }
+
+        FoldLanes(accL, outL + start, chunk);
+        FoldLanes(accR, outR + start, chunk);
+    }
+}
+
+template<FilterMode Mode>
+SYNTH_TARGET_AVX2 static void OscillatorAVX2(const OscillatorLanes& lanes, float* outL, float* outR, int frames)
+{
+    alignas(32) float accL[CHUNK_FRAMES * 8];
+    alignas(32) float accR[CHUNK_FRAMES * 8];
+    alignas(16) float fold[CHUNK_FRAMES * 4];
+    const __m256i fracMask = _mm256_set1_epi32((int)FRAC_MASK);
+    const __m256 fracScale = _mm256_set1_ps(FRAC_SCALE);
+    const __m256i one = _mm256_set1_epi32(1);
+    const SvfLanes& filter = lanes.filter;
+    const __m256 smoothing = _mm256_set1_ps(filter.smoothing);
+
+    for (int start = 0; start < frames; start += CHUNK_FRAMES)
+    {
+        int chunk = frames - start < CHUNK_FRAMES ? frames - start : CHUNK_FRAMES;
+        for (int i = 0; i < chunk * 8; i += 8)
+        {
+            _mm256_store_ps(accL + i, _mm256_setzero_ps());
+            _mm256_store_ps(accR + i, _mm256_setzero_ps());
+        }
+
+        for (int v = 0; v < lanes.count; v += 8)
+        {
+            if (LanesSilent(lanes, v, 8))
+                continue;
+
+            __m256i phase = _mm256_loadu_si256((const __m256i*)(lanes.phase + v));
+            __m256i increment = _mm256_loadu_si256((const __m256i*)(lanes.increment + v));
+            __m256i offset = _mm256_loadu_si256((const __m256i*)(lanes.offset + v));
+            __m256 gain = _mm256_loadu_ps(lanes.gain + v);
+            __m256 step = _mm256_loadu_ps(lanes.gainStep + v);
+            __m256 left = _mm256_loadu_ps(lanes.panLeft + v);
+            __m256 right = _mm256_loadu_ps(lanes.panRight + v);
+            __m256 ic1 = _mm256_setzero_ps(), ic2 = _mm256_setzero_ps(), g = _mm256_setzero_ps(), k = _mm256_setzero_ps();
+            __m256 gTarget = _mm256_setzero_ps(), kTarget = _mm256_setzero_ps();
+            if (Mode != FilterMode::Off)
+            {
+                ic1 = _mm256_loadu_ps(filter.ic1 + v);
+                ic2 = _mm256_loadu_ps(filter.ic2 + v);
+                g = _mm256_loadu_ps(filter.g + v);
+                k = _mm256_loadu_ps(filter.k + v);
+                gTarget = _mm256_loadu_ps(filter.gTarget + v);
+                kTarget = _mm256_loadu_ps(filter.kTarget + v);
+            }
+
+            for (int i = 0; i < chunk; ++i)
+            {
+                __m256i index = _mm256_add_epi32(_mm256_srli_epi32(phase, FRAC_BITS), offset);
+                __m256 a = _mm256_i32gather_ps(lanes.tables, index, 4);
+                __m256 b = _mm256_i32gather_ps(lanes.tables, _mm256_add_epi32(index, one), 4);
+                __m256 frac = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(phase, fracMask)), fracScale);
+                __m256 s = _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), frac));
+                if (Mode != FilterMode::Off)
+                {
+                    g = _mm256_add_ps(g, _mm256_mul_ps(_mm256_sub_ps(gTarget, g), smoothing));
+                    k = _mm256_add_ps(k, _mm256_mul_ps(_mm256_sub_ps(kTarget, k), smoothing));
+                    s = SvfTickAVX2<Mode>(s, ic1, ic2, g, k);
+                }
+                s = _mm256_mul_ps(s, gain);
+                _mm256_store_ps(accL + 8 * i, _mm256_add_ps(_mm256_load_ps(accL + 8 * i), _mm256_mul_ps(s, left)));
+                _mm256_store_ps(accR + 8 * i, _mm256_add_ps(_mm256_load_ps(accR + 8 * i), _mm256_mul_ps(s, right)));
+                gain = _mm256_add_ps(gain, step);
+                phase = _mm256_add_epi32(phase, increment);
+            }
+
+            _mm256_storeu_si256((__m256i*)(lanes.phase + v), phase);
+            _mm256_storeu_ps(lanes.gain + v, gain);
+            if (Mode != FilterMode::Off)
+            {
+                _mm256_storeu_ps(filter.ic1 + v, ic1);
+                _mm256_storeu_ps(filter.ic2 + v, ic2);
+                _mm256_storeu_ps(filter.g + v, g);
+                _mm256_storeu_ps(filter.k + v, k);
+            }
+        }
+
+        FoldLanes8(accL, fold, outL + start, chunk);
+        FoldLanes8(accR, fold, outR + start, chunk);
+    }
+}
+
+#endif
+
+template<FilterMode Mode>
+static OscillatorFn SelectOscillatorFunction(SimdLevel level)
+{
+#if SYNTH_X86
+    if (level == SimdLevel::AVX2)
+        return &OscillatorAVX2<Mode>;
+    if (level == SimdLevel::SSE2)
+        return &OscillatorSSE2<Mode>;
+#endif
+    (void)level;
+    return &OscillatorScalar<Mode>;
+}
+
+OscillatorFn GetOscillatorFunction(SimdLevel level, FilterMode mode)
+{
+    switch (mode)
+    {
+    case FilterMode::LowPass: return SelectOscillatorFunction<FilterMode::LowPass>(level);
+    case FilterMode::BandPass: return SelectOscillatorFunction<FilterMode::BandPass>(level);
+    case FilterMode::HighPass: return SelectOscillatorFunction<FilterMode::HighPass>(level);
+    default: return SelectOscillatorFunction<FilterMode::Off>(level);
+    }
+}
+
+void RenderOscillators(const OscillatorLanes& lanes, float* outL, float* outR, int frames)
+{
+    static const OscillatorFn render[(int)FilterMode::Count] = {
+        GetOscillatorFunction(GetSimdLevel(), FilterMode::Off),
+        GetOscillatorFunction(GetSimdLevel(), FilterMode::LowPass),
+        GetOscillatorFunction(GetSimdLevel(), FilterMode::BandPass),
+        GetOscillatorFunction(GetSimdLevel(), FilterMode::HighPass)
+    };
+    if (frames > 0)
+        render[(int)lanes.filterMode](lanes, outL, outR, frames);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "cpu_features.hpp"
+#include "svf.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Band-limited single-cycle wavetables. Every waveform is stored as a chain
+// of mip levels, one per octave, each holding only the harmonics that stay
+// below Nyquist for the pitches it is used at, so oscillators never alias.
+
+const int WAVETABLE_SIZE_BITS = 11;
+const int WAVETABLE_SIZE = 1 << WAVETABLE_SIZE_BITS;    // Samples per cycle
+const int WAVETABLE_LEVELS = WAVETABLE_SIZE_BITS;       // 1024 harmonics down to 1
+const int WAVETABLE_STRIDE = WAVETABLE_SIZE + 8;        // Guard samples for interpolation
+
+enum class Waveform
+{
+    Sine,
+    Saw,
+    Square,
+    Triangle,
+    Count       // Custom tables are numbered from here
+};
+
+class WavetableSet
+{
+public:
+    // Builds the standard waveforms; custom ones can be added afterwards,
+    // but not while an oscillator engine is using the set
+    void Build();
+
+    // amplitudes[k] is the sine amplitude of harmonic k + 1
+    int AddFromHarmonics(const std::string& name, const std::vector<float>& amplitudes);
+    // Analyses one cycle of any length
+    int AddFromCycle(const std::string& name, const float* cycle, int length);
+
+    int GetCount() const { return (int)m_Names.size(); }
+    const char* GetName(int table) const { return m_Names[table].c_str(); }
+
+    // Offset into GetData() of the mip level to use for a phase increment in
+    // cycles per sample
+    int GetOffset(int table, double increment) const;
+    const float* GetData() const { return m_Data.data(); }
+
+private:
+    void AddTable(const std::string& name, std::vector<float> amplitudes);
+
+    std::vector<float> m_Data;
+    std::vector<std::string> m_Names;
+};
+
+// One oscillator per lane, structure-of-arrays so the kernels can run 4 or 8
+// voices per instruction. Arrays hold a multiple of 8 lanes; unused lanes
+// have zero gain. Each lane runs through its own filter before gain and pan.
+struct OscillatorLanes
+{
+    uint32_t* phase;            // Position in the cycle, full range = one cycle
+    const uint32_t* increment;
+    const int32_t* offset;      // Mip level start in the table data
+    float* gain;                // Advanced by gainStep every frame
+    const float* gainStep;
+    const float* panLeft;
+    const float* panRight;
+    int count;
+    const float* tables;
+    FilterMode filterMode;
+    SvfLanes filter;            // Unused when filterMode is Off
+};
+
+typedef void (*OscillatorFn)(const OscillatorLanes& lanes, float* outL, float* outR, int frames);
+
+// Adds all lanes to outL/outR using the fastest kernel for this CPU
+void RenderOscillators(const OscillatorLanes& lanes, float* outL, float* outR, int frames);
+OscillatorFn GetOscillatorFunction(SimdLevel level, FilterMode mode);